@@ -0,0 +1,84 @@
+#!/usr/bin/python3
+
+# Measures the requests per second served by the SURE boutique when the async
+# services (frontend, checkout, recommendation) run on an increasing number of
+# cores. Services must be built with the multi-core runtime enabled
+# (CONFIG_APP<SERVICE>_MULTICORE). After every run the stats tool reports how
+# many upstream connections each core of the services reachable over RPC
+# (checkout, recommendation) holds and how many it stole from loaded cores.
+
+import csv
+import os
+import re
+import subprocess
+import time
+
+curdir = os.path.dirname(os.path.abspath(__file__))
+
+CORES		= [1, 2, 3, 4, 5, 6, 7, 8]
+RUNS		= 5
+CLIENTS		= 256
+DURATION	= '30s'
+FRONTEND_URL	= 'http://10.0.0.10:5010'
+RES_FILENAME	= 'res-cores.csv'
+TESTS_GAP	= 5 # Seconds of gap between two tests
+BOOT_TIME	= 10 # Seconds to wait for all services to be up
+STATS_SERVICES	= ['checkout', 'recommendation']
+# First sidecar after those of the services and of their replicas
+STATS_SIDECAR	= 10 + 10 * 3 + 1
+
+def stop_services():
+	subprocess.run(['sudo', 'pkill', 'qemu-system-x86'],
+		       stderr=subprocess.DEVNULL)
+	time.sleep(1)
+
+# Connections and stolen connections of every core of @service, e.g. '4/0 3/2'
+# for two cores, the second one serving 3 connections, 2 of which it stole
+def core_stats(service):
+	res = subprocess.run(['sudo', './stats/run.sh', str(STATS_SIDECAR),
+			      '-s', service], cwd=curdir + '/sure',
+			     capture_output=True, text=True, timeout=30)
+	cores = re.findall(r'core \d+: (\d+) connections, (\d+) stolen',
+			   res.stdout)
+	return ' '.join(f'{conns}/{stolen}' for conns, stolen in cores)
+
+out = open(RES_FILENAME, 'w')
+out.write('run,cores,rps,p50,p99,' + ','.join(STATS_SERVICES) + '\n')
+
+for cores in CORES:
+	for run in range(RUNS):
+		print(f'Run {run}: running {CLIENTS} clients on {cores} cores...')
+
+		env = dict(os.environ, NCORES=str(cores))
+		subprocess.run(['sudo', '-E', './run.sh'], cwd=curdir + '/sure',
+			       env=env, check=True, stdout=subprocess.DEVNULL)
+		time.sleep(BOOT_TIME)
+
+		subprocess.run(['./run_locust_workers.sh', FRONTEND_URL,
+				DURATION, str(CLIENTS)],
+			       cwd=curdir + '/loadgenerator',
+			       stdout=subprocess.DEVNULL,
+			       stderr=subprocess.DEVNULL)
+
+		rps = p50 = p99 = 0
+		with open(curdir + '/loadgenerator/res_stats.csv') as f:
+			for row in csv.DictReader(f):
+				if row['Name'] == 'Aggregated':
+					rps = float(row['Requests/s'])
+					p50 = row['50%']
+					p99 = row['99%']
+
+		print(f'rps={rps:.0f} p50={p50}ms p99={p99}ms')
+		stolen = [core_stats(service) for service in STATS_SERVICES]
+		for service, s in zip(STATS_SERVICES, stolen):
+			print(f'{service}: connections/stolen per core {s}')
+		print()
+
+		out.write(f'{run},{cores},{rps:.0f},{p50},{p99},'
+			  + ','.join(stolen) + '\n')
+		out.flush()
+
+		stop_services()
+		time.sleep(TESTS_GAP)
+
+out.close()
@@ -0,0 +1,104 @@
+#!/usr/bin/python3
+
+# Compares the SURE boutique with every service in its own unikernel (split)
+# and with the cheap stateless services fused into the images of their callers
+# (fused), which call them directly rather than over unimsg. Reports the
+# requests per second and the latency of the home, product and checkout pages
+# under the mix of the load generator. Each topology rebuilds the services
+# hosting fused ones (see FUSE in sure/Makefile).
+
+import csv
+import os
+import subprocess
+import time
+
+curdir = os.path.dirname(os.path.abspath(__file__))
+
+TOPOLOGIES	= {
+	'split': '',
+	'fused': 'frontend=currencyservice,adservice,productcatalogservice,'
+		 'shippingservice '
+		 'checkoutservice=currencyservice,productcatalogservice,'
+		 'shippingservice,paymentservice,emailservice '
+		 'recommendationservice=productcatalogservice',
+}
+HOSTS		= ['frontend', 'checkoutservice', 'recommendationservice']
+# Pages, matched on the name of the requests of the load generator
+PAGES		= {
+	'home': lambda name: name == '/',
+	'product': lambda name: name.startswith('/product/'),
+	'checkout': lambda name: name == '/cart/checkout',
+}
+RUNS		= 5
+CLIENTS		= 256
+DURATION	= '30s'
+FRONTEND_URL	= 'http://10.0.0.10:5010'
+RES_FILENAME	= 'res-fusion.csv'
+TESTS_GAP	= 5 # Seconds of gap between two tests
+BOOT_TIME	= 10 # Seconds to wait for all services to be up
+
+def stop_services():
+	subprocess.run(['sudo', 'pkill', 'qemu-system-x86'],
+		       stderr=subprocess.DEVNULL)
+	time.sleep(1)
+
+def build(fuse):
+	for host in HOSTS:
+		subprocess.run(['make', '-C', host, 'clean'], cwd=curdir + '/sure',
+			       check=True, stdout=subprocess.DEVNULL)
+	subprocess.run(['make', f'FUSE={fuse}'] + HOSTS, cwd=curdir + '/sure',
+		       check=True, stdout=subprocess.DEVNULL)
+
+# Requests per second and latency percentiles of each page. Pages made of
+# several request names, like the product pages, get the sum of the requests
+# per second and the percentiles averaged over the requests.
+def page_stats():
+	stats = {page: [0, 0, 0, 0] for page in PAGES}
+	with open(curdir + '/loadgenerator/res_stats.csv') as f:
+		for row in csv.DictReader(f):
+			for page, match in PAGES.items():
+				if not match(row['Name']):
+					continue
+				n = int(row['Request Count'])
+				s = stats[page]
+				s[0] += n
+				s[1] += float(row['Requests/s'])
+				s[2] += n * float(row['50%'])
+				s[3] += n * float(row['99%'])
+
+	return {page: (rps, p50 / n if n else 0, p99 / n if n else 0)
+		for page, (n, rps, p50, p99) in stats.items()}
+
+out = open(RES_FILENAME, 'w')
+out.write('run,topology,page,rps,p50,p99\n')
+
+for topology, fuse in TOPOLOGIES.items():
+	print(f'Building the {topology} topology...')
+	build(fuse)
+
+	for run in range(RUNS):
+		print(f'Run {run}: running {CLIENTS} clients on the {topology} '
+		      f'topology...')
+
+		subprocess.run(['sudo', './run.sh'], cwd=curdir + '/sure',
+			       check=True, stdout=subprocess.DEVNULL)
+		time.sleep(BOOT_TIME)
+
+		subprocess.run(['./run_locust_workers.sh', FRONTEND_URL,
+				DURATION, str(CLIENTS)],
+			       cwd=curdir + '/loadgenerator',
+			       stdout=subprocess.DEVNULL,
+			       stderr=subprocess.DEVNULL)
+
+		for page, (rps, p50, p99) in page_stats().items():
+			print(f'{page}: rps={rps:.0f} p50={p50:.0f}ms '
+			      f'p99={p99:.0f}ms')
+			out.write(f'{run},{topology},{page},{rps:.0f},{p50:.0f},'
+				  f'{p99:.0f}\n')
+		print()
+		out.flush()
+
+		stop_services()
+		time.sleep(TESTS_GAP)
+
+out.close()
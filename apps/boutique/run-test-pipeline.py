@@ -0,0 +1,70 @@
+#!/usr/bin/python3
+
+# Measures the requests per second served by a sync service (the currency
+# service) under pipelined load, with and without batching of the responses
+# of a received bulk. The load is generated by the rpcbench client, which
+# keeps a window of requests in flight on every connection.
+
+import os
+import subprocess
+import time
+
+curdir = os.path.dirname(os.path.abspath(__file__))
+
+MODES		= {'batch': [], 'no-batch': ['--no-batch']}
+DEPTHS		= [1, 2, 4, 8, 16, 32]
+CONNECTIONS	= 4
+RUNS		= 5
+DURATION	= 10
+SERVICE_ID	= 4 # Sidecar of the currency service
+CLIENT_ID	= 11 # First sidecar not used by the boutique
+RES_FILENAME	= 'res-pipeline.csv'
+TESTS_GAP	= 5 # Seconds of gap between two tests
+BOOT_TIME	= 2 # Seconds to wait for the service to be up
+
+def stop_services():
+	subprocess.run(['sudo', 'pkill', 'qemu-system-x86'],
+		       stderr=subprocess.DEVNULL)
+	time.sleep(1)
+
+out = open(RES_FILENAME, 'w')
+out.write('run,mode,depth,rps\n')
+
+for mode, opts in MODES.items():
+	for depth in DEPTHS:
+		for run in range(RUNS):
+			print(f'Run {run}: {mode}, {CONNECTIONS} connections '
+			      f'with {depth} requests in flight...')
+
+			service = subprocess.Popen(['sudo', 'taskset', '1',
+						    './currencyservice/run.sh',
+						    str(SERVICE_ID)] + opts,
+						   cwd=curdir + '/sure',
+						   stdout=subprocess.DEVNULL,
+						   stderr=subprocess.DEVNULL)
+			time.sleep(BOOT_TIME)
+
+			res = subprocess.run(['sudo', 'taskset', '2',
+					      './rpcbench/run.sh',
+					      str(CLIENT_ID),
+					      '-c', str(CONNECTIONS),
+					      '-p', str(depth),
+					      '-d', str(DURATION)],
+					     cwd=curdir + '/sure',
+					     capture_output=True, text=True)
+
+			rps = 0
+			for line in res.stdout.splitlines():
+				if line.split('=')[0] == 'rps':
+					rps = int(line.split('=')[1])
+
+			print(f'rps={rps}\n')
+
+			out.write(f'{run},{mode},{depth},{rps}\n')
+			out.flush()
+
+			stop_services()
+			service.wait()
+			time.sleep(TESTS_GAP)
+
+out.close()
@@ -122,20 +122,16 @@ static void GetAds(AdRR *rr) {
 	DEBUG("[GetAds] completed request\n");
 }
 
-static void handle_request(struct unimsg_shm_desc *desc)
-{
-	struct rpc *rpc = desc->addr;
-	AdRR *rr = (AdRR *)rpc->rr;
-
-	GetAds(rr);
-}
+static const struct ad_handlers handlers = {
+	.GetAds = GetAds,
+};
 
 int main(int argc, char **argv)
 {
-	(void)argc;
-	(void)argv;
+	parse_service_args(argc, argv);
 
-	run_service(AD_SERVICE, handle_request);
+	register_ad_service(&handlers);
+	run_service(AD_SERVICE);
 
 	return 0;
 }
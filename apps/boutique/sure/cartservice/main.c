@@ -16,11 +16,7 @@
 	ERR_CLOSE(s);							\
 })
 
-static int compare_e(void* left, void* right ) {
-    return strcmp((const char *)left, (const char *)right);
-}
-
-struct clib_map* LocalCartStore;
+struct clib_hashmap* LocalCartStore;
 
 static void PrintUserCart(Cart *cart) {
 	DEBUG("Cart for user %s: \n", cart->UserId);
@@ -49,15 +45,13 @@ static void AddItemAsync(char *userId, char *productId, int32_t quantity) {
 	strcpy(newCart.UserId, userId);
 	strcpy(newCart.Items[0].ProductId, productId);
 
-	void* cart;
-	if (!find_c_map(LocalCartStore, userId, &cart)) {
+	/* Carts are updated in place in the store */
+	void* cart = find_c_hashmap(LocalCartStore, userId);
+	if (!cart) {
 		DEBUG("Add new carts for user %s\n", userId);
-		char *key = clib_strdup(userId);
-		int key_length = (int)strlen(key) + 1;
 		newCart.num_items = 1;
-		DEBUG("Inserting [%s -> %s]\n", key, newCart.UserId);
-		insert_c_map(LocalCartStore, key, key_length, &newCart, sizeof(Cart));
-		free(key);
+		DEBUG("Inserting [%s -> %s]\n", userId, newCart.UserId);
+		insert_c_hashmap(LocalCartStore, userId, &newCart);
 	} else {
 		DEBUG("Found carts for user %s\n", userId);
 		int cnt = 0;
@@ -72,13 +66,15 @@ static void AddItemAsync(char *userId, char *productId, int32_t quantity) {
 		}
 
 		if (cnt == ((Cart*)cart)->num_items) { // The item doesn't exist, we update it into DB
+			if (((Cart*)cart)->num_items == sizeof(((Cart*)cart)->Items) / sizeof(((Cart*)cart)->Items[0])) {
+				DEBUG("Cart for user %s is full\n", userId);
+				return;
+			}
 			DEBUG("Update carts for user %s - The item doesn't exist, we update it into DB\n", userId);
-			((Cart*)cart)->num_items++;
 			strcpy(((Cart*)cart)->Items[((Cart*)cart)->num_items].ProductId, productId);
 			((Cart*)cart)->Items[((Cart*)cart)->num_items].Quantity = quantity;
+			((Cart*)cart)->num_items++;
 		}
-
-		free(cart);
 	}
 	return;
 }
@@ -95,14 +91,13 @@ static void GetCartAsync(GetCartRR *rr) {
 	Cart *out = &rr->res;
 	DEBUG("[GetCart] GetCartAsync called with userId=%s\n", in->UserId);
 
-	void *cart;
-	if (!find_c_map(LocalCartStore, in->UserId, &cart)) {
+	void *cart = find_c_hashmap(LocalCartStore, in->UserId);
+	if (!cart) {
 		DEBUG("No carts for user %s\n", in->UserId);
 		out->num_items = 0;
 		return;
 	} else {
 		*out = *(Cart*)cart;
-		free(cart);
 		return;
 	}
 }
@@ -115,8 +110,8 @@ static void GetCart(GetCartRR *rr){
 static void EmptyCartAsync(EmptyCartRequest *in) {
 	DEBUG("EmptyCartAsync called with userId=%s\n", in->UserId);
 
-	void *cart;
-	if (!find_c_map(LocalCartStore, in->UserId, &cart)) {
+	void *cart = find_c_hashmap(LocalCartStore, in->UserId);
+	if (!cart) {
 		DEBUG("No carts for user %s\n", in->UserId);
 		// out->num_items = -1;
 		return;
@@ -127,8 +122,8 @@ static void EmptyCartAsync(EmptyCartRequest *in) {
 			strcpy((*((Cart**)(&cart)))->Items[i].ProductId, "");
 			((*((Cart**)(&cart))))->Items[i].Quantity = 0;
 		}
+		((Cart*)cart)->num_items = 0;
 		PrintUserCart((Cart*)cart);
-		free(cart);
 		return;
 	}
 }
@@ -139,33 +134,25 @@ static void EmptyCart(EmptyCartRequest *in) {
 	return;
 }
 
-static void handle_request(struct unimsg_shm_desc *desc)
-{
-	struct rpc *rpc = desc->addr;
-
-	switch (rpc->command) {
-	case CART_ADD_ITEM:
-		AddItem((AddItemRequest *)rpc->rr);
-		break;
-	case CART_GET_CART:
-		GetCart((GetCartRR *)rpc->rr);
-		break;
-	case CART_EMPTY_CART:
-		EmptyCart((EmptyCartRequest *)rpc->rr);
-		break;
-	default:
-		fprintf(stderr, "Received unknown command\n");
-	}
-}
+static const struct cart_handlers handlers = {
+	.AddItem = AddItem,
+	.GetCart = GetCart,
+	.EmptyCart = EmptyCart,
+};
 
 int main(int argc, char **argv)
 {
-	(void)argc;
-	(void)argv;
+	parse_service_args(argc, argv);
 
-	LocalCartStore = new_c_map(compare_e, NULL, NULL);
+	LocalCartStore = new_c_hashmap(sizeof(((Cart *)0)->UserId), sizeof(Cart),
+				       0, NULL);
+	if (!LocalCartStore) {
+		fprintf(stderr, "Error creating cart store\n");
+		exit(1);
+	}
 
-	run_service(CART_SERVICE, handle_request);
+	register_cart_service(&handlers);
+	run_service(CART_SERVICE);
 
 	return 0;
 }
@@ -24,10 +24,7 @@ static int dependencies[] = {
 
 static Cart *getUserCart(struct unimsg_shm_desc *desc, PlaceOrderRR *rr)
 {
-	struct rpc *rpc = desc->addr;
-	rpc->command = CART_GET_CART;
-	desc->size = get_rpc_size(CART_GET_CART);
-	GetCartRR *get_cart_rr = (GetCartRR *)rpc->rr;
+	GetCartRR *get_cart_rr = rpc_cart_get_cart(desc);
 	memcpy(get_cart_rr->req.UserId, rr->req.UserId, sizeof(rr->req.UserId));
 
 	do_rpc(desc, CART_SERVICE);
@@ -35,77 +32,88 @@ static Cart *getUserCart(struct unimsg_shm_desc *desc, PlaceOrderRR *rr)
 	return &((GetCartRR *)((struct rpc *)desc->addr)->rr)->res;
 }
 
-static Product *getProduct(struct unimsg_shm_desc *desc, char *product_id)
+static void prepGetProduct(struct unimsg_shm_desc *desc, char *product_id)
 {
-	struct rpc *rpc = desc->addr;
-	rpc->command = PRODUCTCATALOG_GET_PRODUCT;
-	desc->size = get_rpc_size(PRODUCTCATALOG_GET_PRODUCT);
-	GetProductRR *rr = (GetProductRR *)rpc->rr;
+	unimsg_buffer_reset(desc);
+	GetProductRR *rr = rpc_product_catalog_get_product(desc);
 	strcpy(rr->req.Id, product_id);
-
-	do_rpc(desc, PRODUCTCATALOG_SERVICE);
-
-	return &((GetProductRR *)(((struct rpc *)desc->addr)->rr))->res;
 }
 
-static Money convertCurrency(struct unimsg_shm_desc *desc, Money price_usd,
-			     char *user_currency)
+static CurrencyConversionBatchRequest *
+prepConvertCurrencyBatch(struct unimsg_shm_desc *desc, char *user_currency)
 {
 	unimsg_buffer_reset(desc);
-	struct rpc *rpc = desc->addr;
-	rpc->command = CURRENCY_CONVERT;
-	desc->size = get_rpc_size(CURRENCY_CONVERT);
-	CurrencyConversionRR *rr = (CurrencyConversionRR *)rpc->rr;
-	rr->req.From = price_usd;
+	CurrencyConversionBatchRR *rr = rpc_currency_convert_batch(desc);
+	rr->req.num_amounts = 0;
 	strcpy(rr->req.ToCode, user_currency);
 
-	do_rpc(desc, CURRENCY_SERVICE);
+	return &rr->req;
+}
 
-	return ((CurrencyConversionRR *)((struct rpc *)desc->addr)->rr)->res;
+static void prepQuoteShipping(struct unimsg_shm_desc *desc, Address *address,
+			      Cart *cart)
+{
+	unimsg_buffer_reset(desc);
+	GetQuoteRR *rr = rpc_shipping_get_quote(desc);
+	rr->req.address = *address;
+	rr->req.num_items = cart->num_items;
+	memcpy(rr->req.Items, cart->Items, sizeof(CartItem) * cart->num_items);
 }
 
-static void prepOrderItems(Cart *cart, char *user_currency,
-			   OrderItem *order_items, unsigned *num_order_items)
+/* Look up all the products of the cart and quote shipping in parallel, then
+ * convert all the prices and the shipping cost with a single RPC
+ */
+static void prepOrderItems(Cart *cart, Address *address, char *user_currency,
+			   OrderItem *order_items, unsigned *num_order_items,
+			   Money *shipping_cost)
 {
 	int rc;
-	struct unimsg_shm_desc desc;
+	unsigned num_items = cart->num_items;
+	struct unimsg_shm_desc descs[num_items + 1];
+	struct rpc_call calls[num_items + 1];
 
-	rc = unimsg_buffer_get(&desc, 1);
+	rc = unimsg_buffer_get(descs, num_items + 1);
 	if (rc) {
 		fprintf(stderr, "Error getting shm buffer: %s\n",
 			strerror(-rc));
 		exit(1);
 	}
 
-	for (int i = 0; i < cart->num_items; i++) {
+	prepQuoteShipping(&descs[0], address, cart);
+	calls[0] = (struct rpc_call)RPC_CALL(&descs[0], SHIPPING_SERVICE);
+	for (unsigned i = 0; i < num_items; i++) {
 		order_items[i].Item = cart->Items[i];
-
-		Product *prod = getProduct(&desc, cart->Items[i].ProductId);
-
-		order_items[i].Cost = convertCurrency(&desc, prod->PriceUsd,
-						      user_currency);
+		prepGetProduct(&descs[i + 1], cart->Items[i].ProductId);
+		calls[i + 1] = (struct rpc_call)RPC_CALL(&descs[i + 1],
+							 PRODUCTCATALOG_SERVICE);
 	}
 
-	unimsg_buffer_put(&desc, 1);
+	do_rpc_many(calls, num_items + 1, RPC_WAIT_ALL);
+
+	/* The batch request overwrites the quote, copy the cost out first */
+	Money shipping_usd =
+		((GetQuoteRR *)((struct rpc *)descs[0].addr)->rr)->res.CostUsd;
+	CurrencyConversionBatchRequest *conv_req =
+		prepConvertCurrencyBatch(&descs[0], user_currency);
+	ConversionBatchAdd(conv_req, &shipping_usd);
+	for (unsigned i = 0; i < num_items; i++) {
+		Product *prod = &((GetProductRR *)
+				  ((struct rpc *)descs[i + 1].addr)->rr)->res;
+		ConversionBatchAdd(conv_req, &prod->PriceUsd);
+	}
 
-	*num_order_items = cart->num_items;
-}
+	do_rpc(&descs[0], CURRENCY_SERVICE);
 
-static Money quoteShipping(struct unimsg_shm_desc *desc, Address *address,
-			   Cart *cart)
-{
-	unimsg_buffer_reset(desc);
-	struct rpc *rpc = desc->addr;
-	rpc->command = SHIPPING_GET_QUOTE;
-	desc->size = get_rpc_size(SHIPPING_GET_QUOTE);
-	GetQuoteRR *rr = (GetQuoteRR *)rpc->rr;
-	rr->req.address = *address;
-	rr->req.num_items = cart->num_items;
-	memcpy(rr->req.Items, cart->Items, sizeof(CartItem) * cart->num_items);
+	CurrencyConversionBatchResponse *conv_res =
+		&((CurrencyConversionBatchRR *)
+		  ((struct rpc *)descs[0].addr)->rr)->res;
+	*shipping_cost = ConversionBatchGet(conv_res, 0);
+	for (unsigned i = 0; i < num_items; i++)
+		order_items[i].Cost = ConversionBatchGet(conv_res, i + 1);
 
-	do_rpc(desc, SHIPPING_SERVICE);
+	unimsg_buffer_put(descs, num_items + 1);
 
-	return ((GetQuoteRR *)((struct rpc *)desc->addr)->rr)->res.CostUsd;
+	*num_order_items = num_items;
 }
 
 void prepareOrderItemsAndShippingQuoteFromCart(PlaceOrderRR *rr,
@@ -125,23 +133,10 @@ void prepareOrderItemsAndShippingQuoteFromCart(PlaceOrderRR *rr,
 	}
 	Cart *cart = getUserCart(&cart_desc, rr);
 
-	prepOrderItems(cart, rr->req.UserCurrency, order_items,
-		       num_order_items);
-
-	struct unimsg_shm_desc ship_desc;
-	rc = unimsg_buffer_get(&ship_desc, 1);
-	if (rc) {
-		fprintf(stderr, "Error getting shm buffer: %s\n",
-			strerror(-rc));
-		exit(1);
-	}
-
-	DEBUG("Quoting shipping\n");
-	Money shipping_usd = quoteShipping(&ship_desc, &rr->req.address, cart);
-	*shipping_cost = convertCurrency(&ship_desc, shipping_usd,
-					 rr->req.UserCurrency);
+	DEBUG("Preparing order items and quoting shipping\n");
+	prepOrderItems(cart, &rr->req.address, rr->req.UserCurrency,
+		       order_items, num_order_items, shipping_cost);
 
-	unimsg_buffer_put(&ship_desc, 1);
 	unimsg_buffer_put(&cart_desc, 1);
 }
 
@@ -149,10 +144,7 @@ static void chargeCard(struct unimsg_shm_desc *desc, Money amount,
 		       CreditCardInfo paymentInfo, char *transaction_id)
 {
 	unimsg_buffer_reset(desc);
-	struct rpc *rpc = desc->addr;
-	rpc->command = PAYMENT_CHARGE;
-	desc->size = get_rpc_size(PAYMENT_CHARGE);
-	ChargeRR *rr = (ChargeRR *)rpc->rr;
+	ChargeRR *rr = rpc_payment_charge(desc);
 	rr->req.Amount = amount;
 	rr->req.CreditCard = paymentInfo;
 
@@ -167,17 +159,14 @@ static void shipOrder(struct unimsg_shm_desc *desc,
 		      char *tracking_id)
 {
 	unimsg_buffer_reset(desc);
-	struct rpc *rpc = desc->addr;
-	desc->size = get_rpc_size(SHIPPING_SHIP_ORDER);
-	rpc->command = SHIPPING_SHIP_ORDER;
-	ShipOrderRR *rr = (ShipOrderRR *)rpc->rr;
+	ShipOrderRR *rr = rpc_shipping_ship_order(desc);
 	rr->req.address = *address;
 	for (unsigned i = 0; i < num_items; i++)
 		rr->req.Items[i] = items[i].Item;
 
 	do_rpc(desc, SHIPPING_SERVICE);
 
-	rpc = desc->addr;
+	struct rpc *rpc = desc->addr;
 	rr = (ShipOrderRR *)rpc->rr;
 	strcpy(tracking_id, rr->res.TrackingId);
 }
@@ -185,10 +174,7 @@ static void shipOrder(struct unimsg_shm_desc *desc,
 static void emptyUserCart(struct unimsg_shm_desc *desc, char *user_id)
 {
 	unimsg_buffer_reset(desc);
-	struct rpc *rpc = desc->addr;
-	desc->size = get_rpc_size(CART_EMPTY_CART);
-	rpc->command = CART_EMPTY_CART;
-	EmptyCartRequest *req = (EmptyCartRequest *)rpc->rr;
+	EmptyCartRequest *req = rpc_cart_empty_cart(desc);
 	strcpy(req->UserId, user_id);
 
 	do_rpc(desc, CART_SERVICE);
@@ -199,12 +185,10 @@ static void sendOrderConfirmation(struct unimsg_shm_desc *desc, char *email,
 				  OrderResult *order)
 {
 	unimsg_buffer_reset(desc);
-	struct rpc *rpc = desc->addr;
-	desc->size = get_rpc_size(EMAIL_SEND_ORDER_CONFIRMATION);
-	rpc->command = EMAIL_SEND_ORDER_CONFIRMATION;
-	SendOrderConfirmationRR *rr = (SendOrderConfirmationRR *)rpc->rr;
-	strcpy(rr->req.Email , email);
-	rr->req.Order = *order;
+	SendOrderConfirmationRequest *req =
+		rpc_email_send_order_confirmation(desc);
+	strcpy(req->Email, email);
+	req->Order = *order;
 
 	do_rpc(desc, EMAIL_SERVICE);
 }
@@ -261,20 +245,16 @@ static void PlaceOrder(PlaceOrderRR *rr)
 	DEBUG("Order placed\n");
 }
 
-static void handle_request(struct unimsg_shm_desc *desc)
-{
-	struct rpc *rpc = desc->addr;
-	PlaceOrderRR *rr = (PlaceOrderRR *)rpc->rr;
-
-	PlaceOrder(rr);
-}
+static const struct checkout_handlers handlers = {
+	.PlaceOrder = PlaceOrder,
+};
 
 int main(int argc, char **argv)
 {
-	(void)argc;
-	(void)argv;
+	parse_service_args(argc, argv);
 
-	run_service(CHECKOUT_SERVICE, handle_request, dependencies,
+	register_checkout_service(&handlers);
+	run_service(CHECKOUT_SERVICE, NULL, dependencies,
 		    sizeof(dependencies) / sizeof(dependencies[0]));
 
 	return 0;
@@ -0,0 +1,103 @@
+/*
+ * Insert and lookup throughput of the open-addressing hash map against the
+ * red-black tree, with keys shaped like cart user IDs.
+ */
+
+#include "c_lib.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define KEY_SIZE 24
+#define LOOKUPS  2000000
+
+/* Allocation counting hook required by the bench link flags */
+extern void* __real_malloc(size_t size);
+
+void*
+__wrap_malloc(size_t size) {
+    return __real_malloc(size);
+}
+
+static int
+compare_e(void* left, void* right) {
+    return strcmp((const char*)left, (const char*)right);
+}
+
+static double
+now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static char*
+make_keys(unsigned n) {
+    char* keys = malloc((size_t)n * KEY_SIZE);
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        snprintf(keys + (size_t)i * KEY_SIZE, KEY_SIZE, "user-%08x",
+                 i * 2654435761u);
+    return keys;
+}
+
+/* Lookup order is scrambled so that the tree does not get warm paths */
+static unsigned
+lookup_index(unsigned i, unsigned n) {
+    return (unsigned)(((unsigned long long)i * 40503u) % n);
+}
+
+static void
+bench(unsigned n) {
+    char* keys = make_keys(n);
+    struct clib_rb* tree = new_c_rb(compare_e, NULL, NULL);
+    struct clib_hashmap* map = new_c_hashmap(KEY_SIZE, sizeof(unsigned), 0,
+                                             NULL);
+    double start, rb_insert, hm_insert, rb_find, hm_find;
+    unsigned long long sum = 0;
+    unsigned i;
+
+    start = now_ns();
+    for (i = 0; i < n; i++) {
+        char* key = keys + (size_t)i * KEY_SIZE;
+        insert_c_rb(tree, key, strlen(key) + 1, &i, sizeof(i));
+    }
+    rb_insert = (now_ns() - start) / n;
+
+    start = now_ns();
+    for (i = 0; i < n; i++)
+        insert_c_hashmap(map, keys + (size_t)i * KEY_SIZE, &i);
+    hm_insert = (now_ns() - start) / n;
+
+    start = now_ns();
+    for (i = 0; i < LOOKUPS; i++) {
+        struct clib_rb_node* node =
+            find_c_rb(tree, keys + (size_t)lookup_index(i, n) * KEY_SIZE);
+        sum += *(unsigned*)node->value.raw_data;
+    }
+    rb_find = (now_ns() - start) / LOOKUPS;
+
+    start = now_ns();
+    for (i = 0; i < LOOKUPS; i++)
+        sum -= *(unsigned*)find_c_hashmap(map, keys +
+            (size_t)lookup_index(i, n) * KEY_SIZE);
+    hm_find = (now_ns() - start) / LOOKUPS;
+
+    printf("%8u keys: insert rb %7.1f ns hashmap %7.1f ns | "
+           "find rb %7.1f ns hashmap %7.1f ns%s\n",
+           n, rb_insert, hm_insert, rb_find, hm_find,
+           sum ? " (checksum mismatch)" : "");
+
+    delete_c_hashmap(map);
+    delete_c_rb(tree);
+    free(keys);
+}
+
+int
+main(void) {
+    bench(10);
+    bench(10000);
+    bench(1000000);
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * Map lookup microbenchmark: copying lookups (find_c_map) against borrowed
+ * lookups (find_ref_c_map) on a currency table like the one used by the
+ * currency service. Allocations are counted by wrapping malloc at link time.
+ */
+
+#include "c_lib.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define LOOKUPS 10000000
+
+static unsigned long mallocs;
+
+extern void* __real_malloc(size_t size);
+
+void*
+__wrap_malloc(size_t size) {
+    mallocs++;
+    return __real_malloc(size);
+}
+
+static const char* currencies[] = {
+    "EUR", "USD", "JPY", "BGN", "CZK", "DKK", "GBP", "HUF", "PLN", "RON",
+    "SEK", "CHF", "ISK", "NOK", "HRK", "RUB", "TRY", "AUD", "BRL", "CAD",
+    "CNY", "HKD", "IDR", "ILS", "INR", "KRW", "MXN", "MYR", "NZD", "PHP",
+    "SGD", "THB", "ZAR"
+};
+#define NCURRENCIES (sizeof(currencies) / sizeof(currencies[0]))
+
+static int
+compare_e(void* left, void* right) {
+    return strcmp((const char*)left, (const char*)right);
+}
+
+static double
+now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+report(const char* name, double start, unsigned long start_mallocs,
+       double sum) {
+    double elapsed = now_ns() - start;
+    printf("%-16s %8.1f ns/lookup %6.2f mallocs/lookup (checksum %.0f)\n",
+           name, elapsed / LOOKUPS,
+           (double)(mallocs - start_mallocs) / LOOKUPS, sum);
+}
+
+int
+main(void) {
+    struct clib_map* map = new_c_map(compare_e, NULL, NULL);
+    unsigned long start_mallocs;
+    double start, sum;
+    unsigned i;
+
+    for (i = 0; i < NCURRENCIES; i++) {
+        double rate = 1.0 + i;
+        insert_c_map(map, (void*)currencies[i], strlen(currencies[i]) + 1,
+                     &rate, sizeof(rate));
+    }
+
+    sum = 0;
+    start_mallocs = mallocs;
+    start = now_ns();
+    for (i = 0; i < LOOKUPS; i++) {
+        void* rate;
+        find_c_map(map, (void*)currencies[i % NCURRENCIES], &rate);
+        sum += *(double*)rate;
+        free(rate);
+    }
+    report("find_c_map", start, start_mallocs, sum);
+
+    sum = 0;
+    start_mallocs = mallocs;
+    start = now_ns();
+    for (i = 0; i < LOOKUPS; i++) {
+        void* rate;
+        find_ref_c_map(map, (void*)currencies[i % NCURRENCIES], &rate);
+        sum += *(double*)rate;
+    }
+    report("find_ref_c_map", start, start_mallocs, sum);
+
+    delete_c_map(map);
+    return 0;
+}
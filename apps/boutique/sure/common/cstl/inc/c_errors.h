@@ -53,6 +53,11 @@
 
 #define CLIB_SLIST_INSERT_FAILED      601
 
+#define CLIB_HASHMAP_NOT_INITIALIZED  701
+#define CLIB_HASHMAP_INVALID_INPUT    702
+#define CLIB_HASHMAP_KEY_DUPLICATE    703
+#define CLIB_HASHMAP_KEY_NOT_FOUND    704
+
 
 
 #endif
\ No newline at end of file
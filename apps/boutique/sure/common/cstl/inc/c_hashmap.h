@@ -0,0 +1,61 @@
+/** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** **
+ *  This file is part of clib library
+ *  Copyright (C) 2011 Avinash Dongre ( dongre.avinash@gmail.com )
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ * 
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ * 
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** **/
+
+#ifndef _C_HASHMAP_H_
+#define _C_HASHMAP_H_
+
+/*
+ * Open-addressing hash map from NUL-terminated string keys of at most
+ * key_size - 1 characters to fixed-size values. Keys and values are stored
+ * inline in a flat slot array. Every slot has a control byte holding either
+ * 7 bits of the key hash or an empty/deleted marker. Control bytes are
+ * probed 16 at a time, with SSE2 where available.
+ *
+ * Value pointers returned by find_c_hashmap are valid until the next insert
+ * or remove. The value destructor is called on values in place and must not
+ * free them.
+ */
+
+#define CLIB_HASHMAP_GROUP_SIZE 16
+
+struct clib_hashmap {
+    signed char* ctrl;
+    char* slots;
+    size_t capacity;
+    size_t size;
+    size_t tombstones;
+    size_t key_size;
+    size_t value_size;
+    size_t slot_size;
+    clib_destroy destruct_v_fn;
+};
+
+extern struct clib_hashmap* new_c_hashmap ( size_t key_size, size_t value_size, size_t capacity, clib_destroy fn_v_d);
+extern clib_error   insert_c_hashmap ( struct clib_hashmap* pMap, const char* key, void* value);
+extern void*        find_c_hashmap   ( struct clib_hashmap* pMap, const char* key);
+extern clib_bool    exists_c_hashmap ( struct clib_hashmap* pMap, const char* key);
+extern clib_error   remove_c_hashmap ( struct clib_hashmap* pMap, const char* key);
+extern size_t       size_c_hashmap   ( struct clib_hashmap* pMap);
+extern clib_error   delete_c_hashmap ( struct clib_hashmap* pMap);
+
+#endif
@@ -67,6 +67,7 @@ struct clib_iterator {
 #include "c_rb.h"
 #include "c_set.h"
 #include "c_map.h"
+#include "c_hashmap.h"
 #include "c_slist.h"
 #include "c_map.h"
 #include "c_algorithms.h"
@@ -34,6 +34,8 @@ extern clib_error   insert_c_map ( struct clib_map* pMap, void* key, size_t key_
 extern clib_bool    exists_c_map ( struct clib_map* pMap, void* key);
 extern clib_error   remove_c_map ( struct clib_map* pMap, void* key);
 extern clib_bool    find_c_map   ( struct clib_map* pMap, void* key, void**value);
+extern clib_bool    find_ref_c_map ( struct clib_map* pMap, void* key, void**value);
+extern clib_error   replace_c_map  ( struct clib_map* pMap, void* key, void* value, size_t value_size);
 extern clib_error   delete_c_map ( struct clib_map* pMap);
 
 extern struct clib_iterator* new_iterator_c_map(struct clib_map* pMap);
@@ -24,27 +24,48 @@
 #ifndef _C_RB_H_
 #define _C_RB_H_
 
+/*
+ * Keys and values are stored inline, right after the node header, in a
+ * block carved out of the tree arena. key.raw_data and value.raw_data point
+ * into the block, except for a value replaced with one larger than the
+ * block can hold, which is moved to the heap. As before, destructors are
+ * passed a copy they own.
+ */
 struct clib_rb_node {
     struct clib_rb_node *left;
     struct clib_rb_node *right;
     struct clib_rb_node *parent;
     int color; 
-    struct clib_object* key;
-    struct clib_object* value; 
+    struct clib_object key;
+    struct clib_object value; 
+    size_t block_size;
 };
 
+/* Arena chunk nodes are carved from, never returned until the tree dies */
+struct clib_rb_chunk {
+    struct clib_rb_chunk *next;
+    size_t used;
+    size_t size;
+};
+
+#define CLIB_RB_CHUNK_SIZE 4096
+
 struct clib_rb {
     struct clib_rb_node* root;
     struct clib_rb_node sentinel;
     clib_destroy destruct_k_fn;
 	clib_destroy destruct_v_fn;
     clib_compare compare_fn;
+    struct clib_rb_chunk* chunks;
+    struct clib_rb_node* free_nodes;
 };
 
 extern struct clib_rb* new_c_rb(clib_compare fn_c,clib_destroy fn_ed, clib_destroy fn_vd );
 extern clib_error  insert_c_rb(struct clib_rb* pTree, void* key, size_t key_size, void* value, size_t value_size);
 extern struct clib_rb_node*   find_c_rb (struct clib_rb* pTree, void* key);
 extern struct clib_rb_node* remove_c_rb (struct clib_rb* pTree, void* key);
+extern void        delete_node_c_rb (struct clib_rb* pTree, struct clib_rb_node* x);
+extern clib_error  replace_value_c_rb (struct clib_rb* pTree, struct clib_rb_node* x, void* value, size_t value_size);
 extern clib_error  delete_c_rb (struct clib_rb* pTree);
 extern clib_bool   empty_c_rb  (struct clib_rb* pTree);
 
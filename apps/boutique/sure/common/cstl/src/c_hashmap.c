@@ -0,0 +1,338 @@
+/** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** **
+ *  This file is part of clib library
+ *  Copyright (C) 2011 Avinash Dongre ( dongre.avinash@gmail.com )
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ * 
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ * 
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** **/
+
+#include "c_lib.h"
+
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CTRL_EMPTY   ((signed char)-128)
+#define CTRL_DELETED ((signed char)-2)
+#define NOT_FOUND    ((size_t)-1)
+
+#define hm_align(x) (((x) + 7) & ~(size_t)7)
+
+/* FNV-1a with a final mix so that both the low (tag) and high (group) bits
+ * of the hash are usable
+ */
+static uint64_t
+__hash_key ( const char* key, size_t* len ) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    const char* p = key;
+
+    while ( *p ) {
+        h ^= (unsigned char)*p++;
+        h *= 0x100000001b3ULL;
+    }
+    *len = (size_t)(p - key);
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static signed char
+__tag ( uint64_t hash ) {
+    return (signed char)(hash & 0x7f);
+}
+
+/* Bitmask of the slots of a group whose control byte is tag */
+static unsigned
+__match_group ( const signed char* ctrl, signed char tag ) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128 ( (const __m128i*)ctrl );
+    return (unsigned)_mm_movemask_epi8 ( _mm_cmpeq_epi8 ( group, _mm_set1_epi8 ( tag ) ) );
+#else
+    unsigned mask = 0;
+    int i;
+    for ( i = 0; i < CLIB_HASHMAP_GROUP_SIZE; i++ ) {
+        if ( ctrl[i] == tag )
+            mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+static char*
+__slot_key ( struct clib_hashmap* pMap, size_t slot ) {
+    return pMap->slots + slot * pMap->slot_size;
+}
+
+static void*
+__slot_value ( struct clib_hashmap* pMap, size_t slot ) {
+    return pMap->slots + slot * pMap->slot_size + hm_align(pMap->key_size);
+}
+
+/*
+ * Groups are probed in triangular order, which visits every group once when
+ * their number is a power of two. A group with an empty slot ends the
+ * probe, as no key was ever pushed past it.
+ */
+static size_t
+__find_slot ( struct clib_hashmap* pMap, const char* key, size_t len, uint64_t hash ) {
+    size_t group_mask = pMap->capacity / CLIB_HASHMAP_GROUP_SIZE - 1;
+    size_t group = (size_t)(hash >> 7) & group_mask;
+    signed char tag = __tag ( hash );
+    size_t k;
+
+    for ( k = 0; k <= group_mask; k++ ) {
+        signed char* ctrl = pMap->ctrl + group * CLIB_HASHMAP_GROUP_SIZE;
+        unsigned match = __match_group ( ctrl, tag );
+        while ( match ) {
+            size_t slot = group * CLIB_HASHMAP_GROUP_SIZE + __builtin_ctz ( match );
+            if ( memcmp ( __slot_key ( pMap, slot ), key, len + 1 ) == 0 )
+                return slot;
+            match &= match - 1;
+        }
+        if ( __match_group ( ctrl, CTRL_EMPTY ) )
+            return NOT_FOUND;
+        group = (group + k + 1) & group_mask;
+    }
+    return NOT_FOUND;
+}
+
+static size_t
+__find_free_slot ( struct clib_hashmap* pMap, uint64_t hash ) {
+    size_t group_mask = pMap->capacity / CLIB_HASHMAP_GROUP_SIZE - 1;
+    size_t group = (size_t)(hash >> 7) & group_mask;
+    size_t k;
+
+    for ( k = 0; k <= group_mask; k++ ) {
+        signed char* ctrl = pMap->ctrl + group * CLIB_HASHMAP_GROUP_SIZE;
+        unsigned match = __match_group ( ctrl, CTRL_EMPTY ) | __match_group ( ctrl, CTRL_DELETED );
+        if ( match )
+            return group * CLIB_HASHMAP_GROUP_SIZE + __builtin_ctz ( match );
+        group = (group + k + 1) & group_mask;
+    }
+    return NOT_FOUND;
+}
+
+static void
+__put_slot ( struct clib_hashmap* pMap, size_t slot, uint64_t hash, const char* key, size_t len, void* value ) {
+    pMap->ctrl[slot] = __tag ( hash );
+    memcpy ( __slot_key ( pMap, slot ), key, len + 1 );
+    memcpy ( __slot_value ( pMap, slot ), value, pMap->value_size );
+}
+
+static clib_error
+__alloc_slots ( struct clib_hashmap* pMap, size_t capacity ) {
+    pMap->ctrl = (signed char*)malloc ( capacity );
+    if ( !pMap->ctrl )
+        return CLIB_ERROR_MEMORY;
+    pMap->slots = (char*)malloc ( capacity * pMap->slot_size );
+    if ( !pMap->slots ) {
+        free ( pMap->ctrl );
+        return CLIB_ERROR_MEMORY;
+    }
+    memset ( pMap->ctrl, CTRL_EMPTY, capacity );
+    pMap->capacity   = capacity;
+    pMap->tombstones = 0;
+    return CLIB_ERROR_SUCCESS;
+}
+
+static clib_error
+__rehash ( struct clib_hashmap* pMap, size_t capacity ) {
+    signed char* old_ctrl = pMap->ctrl;
+    char* old_slots = pMap->slots;
+    size_t old_capacity = pMap->capacity;
+    size_t i;
+
+    if ( __alloc_slots ( pMap, capacity ) != CLIB_ERROR_SUCCESS ) {
+        pMap->ctrl  = old_ctrl;
+        pMap->slots = old_slots;
+        return CLIB_ERROR_MEMORY;
+    }
+
+    for ( i = 0; i < old_capacity; i++ ) {
+        char* key;
+        size_t len;
+        uint64_t hash;
+        if ( old_ctrl[i] < 0 )
+            continue;
+        key  = old_slots + i * pMap->slot_size;
+        hash = __hash_key ( key, &len );
+        __put_slot ( pMap, __find_free_slot ( pMap, hash ), hash, key, len,
+                     key + hm_align(pMap->key_size) );
+    }
+
+    free ( old_ctrl );
+    free ( old_slots );
+    return CLIB_ERROR_SUCCESS;
+}
+
+/* Keep at most 7/8 of the slots used, tombstones included */
+static clib_bool
+__over_load ( size_t used, size_t capacity ) {
+    return used * 8 > capacity * 7;
+}
+
+struct clib_hashmap*
+new_c_hashmap ( size_t key_size, size_t value_size, size_t capacity, clib_destroy fn_v_d ) {
+    struct clib_hashmap* pMap;
+    size_t slots = CLIB_HASHMAP_GROUP_SIZE;
+
+    if ( key_size == 0 )
+        return (struct clib_hashmap*)0;
+
+    pMap = (struct clib_hashmap*)malloc ( sizeof(struct clib_hashmap) );
+    if ( pMap == (struct clib_hashmap*)0 )
+        return (struct clib_hashmap*)0;
+
+    while ( __over_load ( capacity, slots ) )
+        slots *= 2;
+
+    pMap->size          = 0;
+    pMap->key_size      = key_size;
+    pMap->value_size    = value_size;
+    pMap->slot_size     = hm_align ( hm_align(key_size) + value_size );
+    pMap->destruct_v_fn = fn_v_d;
+    if ( __alloc_slots ( pMap, slots ) != CLIB_ERROR_SUCCESS ) {
+        free ( pMap );
+        return (struct clib_hashmap*)0;
+    }
+    return pMap;
+}
+
+clib_error
+insert_c_hashmap ( struct clib_hashmap* pMap, const char* key, void* value ) {
+    size_t len;
+    size_t slot;
+    uint64_t hash;
+
+    if ( pMap == (struct clib_hashmap*)0 )
+        return CLIB_HASHMAP_NOT_INITIALIZED;
+
+    hash = __hash_key ( key, &len );
+    if ( len >= pMap->key_size )
+        return CLIB_HASHMAP_INVALID_INPUT;
+    if ( __find_slot ( pMap, key, len, hash ) != NOT_FOUND )
+        return CLIB_HASHMAP_KEY_DUPLICATE;
+
+    if ( __over_load ( pMap->size + pMap->tombstones + 1, pMap->capacity ) ) {
+        /* Grow if live keys fill half of the table, otherwise just purge
+         * the tombstones
+         */
+        size_t capacity = pMap->capacity;
+        if ( __over_load ( (pMap->size + 1) * 2, capacity ) )
+            capacity *= 2;
+        if ( __rehash ( pMap, capacity ) != CLIB_ERROR_SUCCESS )
+            return CLIB_ERROR_MEMORY;
+    }
+
+    slot = __find_free_slot ( pMap, hash );
+    if ( pMap->ctrl[slot] == CTRL_DELETED )
+        pMap->tombstones--;
+    __put_slot ( pMap, slot, hash, key, len, value );
+    pMap->size++;
+
+    return CLIB_ERROR_SUCCESS;
+}
+
+void*
+find_c_hashmap ( struct clib_hashmap* pMap, const char* key ) {
+    size_t len;
+    size_t slot;
+    uint64_t hash;
+
+    if ( pMap == (struct clib_hashmap*)0 )
+        return (void*)0;
+
+    hash = __hash_key ( key, &len );
+    if ( len >= pMap->key_size )
+        return (void*)0;
+    slot = __find_slot ( pMap, key, len, hash );
+    if ( slot == NOT_FOUND )
+        return (void*)0;
+
+    return __slot_value ( pMap, slot );
+}
+
+clib_bool
+exists_c_hashmap ( struct clib_hashmap* pMap, const char* key ) {
+    return find_c_hashmap ( pMap, key ) ? clib_true : clib_false;
+}
+
+clib_error
+remove_c_hashmap ( struct clib_hashmap* pMap, const char* key ) {
+    size_t len;
+    size_t slot;
+    uint64_t hash;
+    signed char* group;
+
+    if ( pMap == (struct clib_hashmap*)0 )
+        return CLIB_HASHMAP_NOT_INITIALIZED;
+
+    hash = __hash_key ( key, &len );
+    if ( len >= pMap->key_size )
+        return CLIB_HASHMAP_KEY_NOT_FOUND;
+    slot = __find_slot ( pMap, key, len, hash );
+    if ( slot == NOT_FOUND )
+        return CLIB_HASHMAP_KEY_NOT_FOUND;
+
+    if ( pMap->destruct_v_fn )
+        pMap->destruct_v_fn ( __slot_value ( pMap, slot ) );
+
+    /* A group that still has an empty slot never ended a probe early, so
+     * the slot can be freed outright. Otherwise leave a tombstone.
+     */
+    group = pMap->ctrl + slot - slot % CLIB_HASHMAP_GROUP_SIZE;
+    if ( __match_group ( group, CTRL_EMPTY ) ) {
+        pMap->ctrl[slot] = CTRL_EMPTY;
+    } else {
+        pMap->ctrl[slot] = CTRL_DELETED;
+        pMap->tombstones++;
+    }
+    pMap->size--;
+
+    return CLIB_ERROR_SUCCESS;
+}
+
+size_t
+size_c_hashmap ( struct clib_hashmap* pMap ) {
+    if ( pMap == (struct clib_hashmap*)0 )
+        return 0;
+    return pMap->size;
+}
+
+clib_error
+delete_c_hashmap ( struct clib_hashmap* pMap ) {
+    size_t i;
+
+    if ( pMap == (struct clib_hashmap*)0 )
+        return CLIB_HASHMAP_NOT_INITIALIZED;
+
+    if ( pMap->destruct_v_fn ) {
+        for ( i = 0; i < pMap->capacity; i++ ) {
+            if ( pMap->ctrl[i] >= 0 )
+                pMap->destruct_v_fn ( __slot_value ( pMap, i ) );
+        }
+    }
+    free ( pMap->ctrl );
+    free ( pMap->slots );
+    free ( pMap );
+    return CLIB_ERROR_SUCCESS;
+}
@@ -70,16 +70,7 @@ remove_c_map ( struct clib_map* pMap, void* key) {
 
     node = remove_c_rb ( pMap->root, key );
     if ( node != (struct clib_rb_node*)0  ) {
-        void* removed_node;
-        get_raw_clib_object ( node->key, &removed_node );
-        free ( removed_node);
-        delete_clib_object ( node->key );
-
-        get_raw_clib_object ( node->value, &removed_node );
-        free ( removed_node);
-        delete_clib_object ( node->value);
-
-        free ( node );
+        delete_node_c_rb ( pMap->root, node );
     }
     return rc;
 }
@@ -94,10 +85,44 @@ find_c_map ( struct clib_map* pMap, void* key, void**value) {
     if ( node == (struct clib_rb_node*)0  ) 
         return clib_false;
 
-    get_raw_clib_object ( node->value, value );
+    get_raw_clib_object ( &node->value, value );
+
+    return clib_true;
+
+}
+/*
+ * Like find_c_map, but *value points to the value stored in the map instead
+ * of a copy: it can be updated in place and must not be freed. It stays
+ * valid until the key is removed, replaced with a larger value or the map
+ * is deleted.
+ */
+clib_bool    
+find_ref_c_map ( struct clib_map* pMap, void* key, void**value) {
+    struct clib_rb_node* node;
+
+    if (pMap == (struct clib_map*)0)
+        return clib_false;
+
+    node = find_c_rb ( pMap->root, key);
+    if ( node == (struct clib_rb_node*)0  ) 
+        return clib_false;
+
+    *value = node->value.raw_data;
 
     return clib_true;
+}
+clib_error   
+replace_c_map ( struct clib_map* pMap, void* key, void* value,  size_t value_size) {
+    struct clib_rb_node* node;
 
+    if (pMap == (struct clib_map*)0)
+        return CLIB_MAP_NOT_INITIALIZED;
+
+    node = find_c_rb ( pMap->root, key);
+    if ( node == (struct clib_rb_node*)0  ) 
+        return CLIB_RBTREE_KEY_NOT_FOUND;
+
+    return replace_value_c_rb ( pMap->root, node, value, value_size);
 }
 
 clib_error    
@@ -126,7 +151,7 @@ get_next_c_map( struct clib_iterator* pIterator ) {
 	if ( ! pIterator->pCurrentElement)
 		return (struct clib_object*)0;
 
-	return ((struct clib_rb_node*)pIterator->pCurrentElement)->value;
+	return &((struct clib_rb_node*)pIterator->pCurrentElement)->value;
 }
 static void* 
 get_value_c_map( void* pObject) {
@@ -138,12 +163,7 @@ static void
 replace_value_c_map(struct clib_iterator *pIterator, void* elem, size_t elem_size) {
 	struct clib_map*  pMap = (struct clib_map*)pIterator->pContainer;
 	
-	if ( pMap->root->destruct_v_fn ) {
-		void* old_element;
-		get_raw_clib_object (((struct clib_rb_node*)pIterator->pCurrentElement)->value, &old_element );
-		pMap->root->destruct_v_fn(old_element);
-    }
-	replace_raw_clib_object(((struct clib_rb_node*)pIterator->pCurrentElement)->value, elem, elem_size);
+	replace_value_c_rb(pMap->root, (struct clib_rb_node*)pIterator->pCurrentElement, elem, elem_size);
 }
 
 
@@ -28,7 +28,14 @@
 #include <assert.h>
 
 #define rb_sentinel &pTree->sentinel
-
+#define rb_align(x) (((x) + 15) & ~(size_t)15)
+#define rb_node_header rb_align(sizeof(struct clib_rb_node))
+
+/*
+ * Checking the tree properties walks the whole tree on every insert and
+ * remove, so it is only built in when testing the library
+ */
+#ifdef CLIB_RB_VERIFY
 static void debug_verify_properties(struct clib_rb*);
 static void debug_verify_property_1(struct clib_rb*,struct clib_rb_node*);
 static void debug_verify_property_2(struct clib_rb*,struct clib_rb_node*);
@@ -36,6 +43,9 @@ static int debug_node_color(struct clib_rb*,struct clib_rb_node* n);
 static void debug_verify_property_4(struct clib_rb*,struct clib_rb_node*);
 static void debug_verify_property_5(struct clib_rb*,struct clib_rb_node*);
 static void debug_verify_property_5_helper(struct clib_rb*,struct clib_rb_node*,int,int*);
+#else
+#define debug_verify_properties(t) ((void)0)
+#endif
 
 
 static void
@@ -80,6 +90,58 @@ __right_rotate(struct clib_rb* pTree, struct clib_rb_node* x) {
         x->parent = y;
 }
 
+static void*
+__inline_key(struct clib_rb_node* x) {
+    return (char*)x + rb_node_header;
+}
+static void*
+__inline_value(struct clib_rb_node* x) {
+    return (char*)x + rb_node_header + rb_align(x->key.size);
+}
+static size_t
+__inline_value_capacity(struct clib_rb_node* x) {
+    return x->block_size - rb_node_header - rb_align(x->key.size);
+}
+
+/*
+ * Nodes are carved from the tree arena. Removed nodes are kept on a free
+ * list, linked through their right pointer, and reused by any later insert
+ * they are large enough for.
+ */
+static struct clib_rb_node*
+__alloc_node(struct clib_rb* pTree, size_t key_size, size_t value_size) {
+    size_t size = rb_node_header + rb_align(key_size) + rb_align(value_size);
+    size_t chunk_header = rb_align(sizeof(struct clib_rb_chunk));
+    struct clib_rb_node** prev = &pTree->free_nodes;
+    struct clib_rb_chunk* chunk = pTree->chunks;
+    struct clib_rb_node* x;
+
+    for (x = *prev; x; prev = &x->right, x = x->right) {
+        if (x->block_size >= size) {
+            *prev = x->right;
+            return x;
+        }
+    }
+
+    if (!chunk || chunk->size - chunk->used < size) {
+        size_t chunk_size = CLIB_RB_CHUNK_SIZE;
+        if (chunk_header + size > chunk_size)
+            chunk_size = chunk_header + size;
+        chunk = (struct clib_rb_chunk*)malloc(chunk_size);
+        if ( chunk == (struct clib_rb_chunk*)0 )
+            return (struct clib_rb_node*)0;
+        chunk->next  = pTree->chunks;
+        chunk->used  = chunk_header;
+        chunk->size  = chunk_size;
+        pTree->chunks = chunk;
+    }
+
+    x = (struct clib_rb_node*)((char*)chunk + chunk->used);
+    chunk->used  += size;
+    x->block_size = size;
+    return x;
+}
+
 struct clib_rb*
 new_c_rb(clib_compare fn_c,clib_destroy fn_ed, clib_destroy fn_vd ){
 
@@ -95,6 +157,8 @@ new_c_rb(clib_compare fn_c,clib_destroy fn_ed, clib_destroy fn_vd ){
     pTree->sentinel.right       = rb_sentinel;
     pTree->sentinel.parent      = (struct clib_rb_node*)0 ;
     pTree->sentinel.color       = clib_black;
+    pTree->chunks               = (struct clib_rb_chunk*)0;
+    pTree->free_nodes           = (struct clib_rb_node*)0;
 
     return pTree;
 }
@@ -142,11 +206,7 @@ find_c_rb (struct clib_rb* pTree, void* key) {
     struct clib_rb_node* x = pTree->root;
 
     while (x != rb_sentinel) {
-        int c = 0;
-        void* cur_key ;
-        get_raw_clib_object ( x->key, &cur_key );
-        c = pTree->compare_fn (key, cur_key);
-        free ( cur_key );
+        int c = pTree->compare_fn (key, x->key.raw_data);
         if (c == 0) {
             break;
         } else {
@@ -166,38 +226,14 @@ insert_c_rb(struct clib_rb* pTree, void* k, size_t key_size, void* v, size_t val
     struct clib_rb_node* x;
 	struct clib_rb_node* y;
 	struct clib_rb_node* z;
-
-    x = (struct clib_rb_node*)malloc (sizeof(struct clib_rb_node));
-    if ( x == (struct clib_rb_node*)0  ) 
-        return CLIB_ERROR_MEMORY;
-
-    x->left    = rb_sentinel;
-    x->right   = rb_sentinel;
-    x->color   = clib_red;
-
-    x->key     = new_clib_object ( k, key_size );
-    if ( v ) {
-        x->value   = new_clib_object ( v, value_size );
-    } else {
-        x->value =  (struct clib_object*)0;
-    }
+    int c = 0;
 
     y = pTree->root;
     z = (struct clib_rb_node*)0 ;
 
     while (y != rb_sentinel) {
-        int c = 0;
-        void* cur_key;
-		void* new_key;
-
-        get_raw_clib_object ( y->key, &cur_key );
-        get_raw_clib_object ( x->key, &new_key );
-
-        c = (pTree->compare_fn) ( new_key , cur_key);
-        free ( cur_key );
-        free ( new_key );
+        c = (pTree->compare_fn) ( k, y->key.raw_data);
         if (c == 0) {
-            /* TODO : Delete node here */
             return CLIB_RBTREE_KEY_DUPLICATE;
         }
         z = y;
@@ -206,17 +242,27 @@ insert_c_rb(struct clib_rb* pTree, void* k, size_t key_size, void* v, size_t val
         else
             y = y->right;
     }    
+
+    if ( !v )
+        value_size = 0;
+    x = __alloc_node ( pTree, key_size, value_size );
+    if ( x == (struct clib_rb_node*)0  ) 
+        return CLIB_ERROR_MEMORY;
+
+    x->left    = rb_sentinel;
+    x->right   = rb_sentinel;
+    x->color   = clib_red;
+
+    x->key.raw_data   = __inline_key ( x );
+    x->key.size       = key_size;
+    memcpy ( x->key.raw_data, k, key_size );
+    x->value.raw_data = __inline_value ( x );
+    x->value.size     = value_size;
+    if ( v )
+        memcpy ( x->value.raw_data, v, value_size );
+
     x->parent = z;
     if (z) {
-        int c = 0;
-        void* cur_key;
-		void* new_key;
-        get_raw_clib_object ( z->key, &cur_key );
-        get_raw_clib_object ( x->key, &new_key );
-
-        c = pTree->compare_fn( new_key, cur_key);
-        free ( cur_key );
-        free ( new_key );
         if (c < 0) {
             z->left = x;
         } else {
@@ -314,21 +360,33 @@ __remove_c_rb(struct clib_rb* pTree, struct clib_rb_node* z ) {
     }
     else
         pTree->root = x;
-    if (y != z) {
-        struct clib_object* tmp;
-        tmp    = z->key;
-        z->key = y->key;
-        y->key = tmp;
-
-        tmp      = z->value;
-        z->value = y->value;
-        y->value = tmp;
-    }
     if (y->color == clib_black)
         __rb_remove_fixup (pTree, x);
+    /*
+     * Move the successor node into the place of the removed one rather than
+     * swapping their payloads, so that pointers to values stay valid
+     */
+    if (y != z) {
+        y->left   = z->left;
+        y->right  = z->right;
+        y->parent = z->parent;
+        y->color  = z->color;
+        if (y->left != rb_sentinel)
+            y->left->parent = y;
+        if (y->right != rb_sentinel)
+            y->right->parent = y;
+        if (z->parent) {
+            if (z == z->parent->left)
+                z->parent->left = y;
+            else
+                z->parent->right = y;
+        }
+        else
+            pTree->root = y;
+    }
 
     debug_verify_properties ( pTree);
-    return y;
+    return z;
 }
 
 struct clib_rb_node*
@@ -337,11 +395,7 @@ remove_c_rb (struct clib_rb* pTree, void* key) {
 
     z = pTree->root;
     while (z != rb_sentinel) {
-        int c = 0;
-        void* cur_key;
-        get_raw_clib_object ( z->key, &cur_key );
-        c = pTree->compare_fn (key, cur_key);
-        free ( cur_key );
+        int c = pTree->compare_fn (key, z->key.raw_data);
         if ( c == 0) {
             break;
         }
@@ -360,18 +414,50 @@ __delete_c_rb_node (struct clib_rb* pTree, struct clib_rb_node* x ) {
 	void* value;
 
     if ( pTree->destruct_k_fn ) {
-        get_raw_clib_object ( x->key, &key );
+        get_raw_clib_object ( &x->key, &key );
         pTree->destruct_k_fn ( key );
     }
-    delete_clib_object( x->key );
 
-    if ( x->value ) {
+    if ( x->value.size ) {
         if ( pTree->destruct_v_fn ) {
-            get_raw_clib_object ( x->value, &value);
+            get_raw_clib_object ( &x->value, &value);
             pTree->destruct_v_fn ( value );
         }
-        delete_clib_object( x->value );
     }
+    if ( x->value.raw_data != __inline_value ( x ) )
+        free ( x->value.raw_data );
+}
+
+void
+delete_node_c_rb (struct clib_rb* pTree, struct clib_rb_node* x ) {
+    __delete_c_rb_node ( pTree, x );
+    x->right = pTree->free_nodes;
+    pTree->free_nodes = x;
+}
+
+clib_error
+replace_value_c_rb (struct clib_rb* pTree, struct clib_rb_node* x, void* v, size_t value_size) {
+    void* storage = __inline_value ( x );
+
+    if ( value_size > __inline_value_capacity ( x ) ) {
+        storage = malloc ( value_size );
+        if ( !storage )
+            return CLIB_ERROR_MEMORY;
+    }
+
+    if ( x->value.size && pTree->destruct_v_fn ) {
+        void* old_value;
+        get_raw_clib_object ( &x->value, &old_value );
+        pTree->destruct_v_fn ( old_value );
+    }
+    if ( x->value.raw_data != __inline_value ( x ) )
+        free ( x->value.raw_data );
+
+    x->value.raw_data = storage;
+    x->value.size     = value_size;
+    memcpy ( x->value.raw_data, v, value_size );
+
+    return CLIB_ERROR_SUCCESS;
 }
 
 clib_error  
@@ -379,6 +465,7 @@ delete_c_rb(struct clib_rb* pTree) {
 
     clib_error rc = CLIB_ERROR_SUCCESS;
     struct clib_rb_node* z = pTree->root;
+    struct clib_rb_chunk* chunk = pTree->chunks;
 
     while (z != rb_sentinel) {
         if (z->left != rb_sentinel)
@@ -389,19 +476,20 @@ delete_c_rb(struct clib_rb* pTree) {
             __delete_c_rb_node ( pTree, z );
             if (z->parent) {
                 z = z->parent;
-                if (z->left != rb_sentinel){
-                    free ( z->left );
+                if (z->left != rb_sentinel)
                     z->left = rb_sentinel;
-                }else if (z->right != rb_sentinel){
-                    free ( z->right );
+                else if (z->right != rb_sentinel)
                     z->right = rb_sentinel;
-                }
             } else {
-                free ( z );
                 z = rb_sentinel;
             }
         }
     }
+    while ( chunk ) {
+        struct clib_rb_chunk* next = chunk->next;
+        free ( chunk );
+        chunk = next;
+    }
     free ( pTree );
     return rc;
 }
@@ -468,6 +556,7 @@ get_next_c_rb(struct clib_rb* pTree, struct clib_rb_node**current, struct clib_r
     return (struct clib_rb_node*)0 ;
 }*/
 
+#ifdef CLIB_RB_VERIFY
 void debug_verify_properties(struct clib_rb* t) {
     debug_verify_property_1(t,t->root);
     debug_verify_property_2(t,t->root);
@@ -521,4 +610,4 @@ void debug_verify_property_5_helper(struct clib_rb* pTree,struct clib_rb_node* n
     debug_verify_property_5_helper(pTree,n->left,  black_count, path_black_count);
     debug_verify_property_5_helper(pTree,n->right, black_count, path_black_count);
 }
-
+#endif
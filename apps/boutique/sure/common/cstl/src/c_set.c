@@ -68,8 +68,7 @@ remove_c_set ( struct clib_set* pSet, void* key) {
 
     node = remove_c_rb ( pSet->root, key );
     if ( node != (struct clib_rb_node*)0  ) {
-        /*free ( node->raw_data.key);
-        free ( node );*/
+        delete_node_c_rb ( pSet->root, node );
     }
     return rc;
 }
@@ -84,7 +83,7 @@ find_c_set ( struct clib_set* pSet, void* key, void* outKey) {
     if ( node == (struct clib_rb_node*)0  ) 
         return clib_false;
 
-    get_raw_clib_object ( node->key, outKey );
+    get_raw_clib_object ( &node->key, outKey );
 
     return clib_true;
 
@@ -115,7 +114,7 @@ get_next_c_set( struct clib_iterator* pIterator ) {
 	if ( ! pIterator->pCurrentElement)
 		return (struct clib_object*)0;
 
-	return ((struct clib_rb_node*)pIterator->pCurrentElement)->key;
+	return &((struct clib_rb_node*)pIterator->pCurrentElement)->key;
 }
 static void* 
 get_value_c_set( void* pObject) {
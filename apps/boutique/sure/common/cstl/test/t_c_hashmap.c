@@ -0,0 +1,164 @@
+/** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** **
+ *  This file is part of clib library
+ *  Copyright (C) 2011 Avinash Dongre ( dongre.avinash@gmail.com )
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ * 
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ * 
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** ** **/
+
+#include "c_lib.h"
+#include <string.h>
+#include <assert.h>
+#include <stdio.h>
+
+static int destroyed;
+
+static void
+count_destroy ( void* value ) {
+    (void)value;
+    destroyed++;
+}
+
+static void
+key_of ( char* key, int i ) {
+    sprintf ( key, "key-%d", i );
+}
+
+static void
+test_basic() {
+    struct clib_hashmap* pMap = new_c_hashmap ( 8, sizeof(int), 0, NULL );
+    int one = 1, two = 2;
+    int* value;
+
+    assert ( pMap );
+    assert ( size_c_hashmap ( pMap ) == 0 );
+    assert ( clib_false == exists_c_hashmap ( pMap, "one" ) );
+    assert ( CLIB_ERROR_SUCCESS == insert_c_hashmap ( pMap, "one", &one ) );
+    assert ( CLIB_ERROR_SUCCESS == insert_c_hashmap ( pMap, "two", &two ) );
+    assert ( CLIB_HASHMAP_KEY_DUPLICATE == insert_c_hashmap ( pMap, "one", &two ) );
+    assert ( size_c_hashmap ( pMap ) == 2 );
+
+    /* Keys must leave room for the terminator */
+    assert ( CLIB_HASHMAP_INVALID_INPUT == insert_c_hashmap ( pMap, "12345678", &one ) );
+    assert ( CLIB_ERROR_SUCCESS == insert_c_hashmap ( pMap, "1234567", &one ) );
+    assert ( (void*)0 == find_c_hashmap ( pMap, "12345678" ) );
+
+    /* Prefixes of stored keys are different keys */
+    assert ( (void*)0 == find_c_hashmap ( pMap, "on" ) );
+    assert ( (void*)0 == find_c_hashmap ( pMap, "" ) );
+
+    value = (int*)find_c_hashmap ( pMap, "one" );
+    assert ( value && *value == 1 );
+    *value = 11;
+    assert ( *(int*)find_c_hashmap ( pMap, "one" ) == 11 );
+
+    assert ( CLIB_ERROR_SUCCESS == remove_c_hashmap ( pMap, "one" ) );
+    assert ( CLIB_HASHMAP_KEY_NOT_FOUND == remove_c_hashmap ( pMap, "one" ) );
+    assert ( clib_false == exists_c_hashmap ( pMap, "one" ) );
+    assert ( *(int*)find_c_hashmap ( pMap, "two" ) == 2 );
+    assert ( size_c_hashmap ( pMap ) == 2 );
+
+    delete_c_hashmap ( pMap );
+}
+
+static void
+test_growth() {
+    enum { N = 100000 };
+    struct clib_hashmap* pMap = new_c_hashmap ( 16, sizeof(int), 0, NULL );
+    char key[16];
+    int i;
+
+    for ( i = 0; i < N; i++ ) {
+        key_of ( key, i );
+        assert ( CLIB_ERROR_SUCCESS == insert_c_hashmap ( pMap, key, &i ) );
+    }
+    assert ( size_c_hashmap ( pMap ) == N );
+    for ( i = 0; i < N; i++ ) {
+        int* value;
+        key_of ( key, i );
+        value = (int*)find_c_hashmap ( pMap, key );
+        assert ( value && *value == i );
+    }
+    key_of ( key, N );
+    assert ( clib_false == exists_c_hashmap ( pMap, key ) );
+
+    delete_c_hashmap ( pMap );
+}
+
+/* Remove and insert over and over without growing, leaving tombstones
+ * behind that must be purged
+ */
+static void
+test_churn() {
+    enum { N = 64, ROUNDS = 100000 };
+    struct clib_hashmap* pMap = new_c_hashmap ( 16, sizeof(int), N, NULL );
+    size_t capacity = pMap->capacity;
+    int present[N * 4] = { 0 };
+    char key[16];
+    int i, k;
+
+    srand ( 1 );
+    for ( i = 0; i < ROUNDS; i++ ) {
+        k = rand() % (N * 4);
+        key_of ( key, k );
+        if ( present[k] ) {
+            assert ( CLIB_ERROR_SUCCESS == remove_c_hashmap ( pMap, key ) );
+            present[k] = 0;
+        } else if ( size_c_hashmap ( pMap ) < N ) {
+            assert ( CLIB_ERROR_SUCCESS == insert_c_hashmap ( pMap, key, &k ) );
+            present[k] = 1;
+        }
+    }
+    assert ( pMap->capacity == capacity );
+    for ( k = 0; k < N * 4; k++ ) {
+        int* value;
+        key_of ( key, k );
+        value = (int*)find_c_hashmap ( pMap, key );
+        if ( present[k] )
+            assert ( value && *value == k );
+        else
+            assert ( value == (int*)0 );
+    }
+
+    delete_c_hashmap ( pMap );
+}
+
+static void
+test_destructor() {
+    struct clib_hashmap* pMap = new_c_hashmap ( 8, sizeof(int), 0, count_destroy );
+    char key[16];
+    int i;
+
+    destroyed = 0;
+    for ( i = 0; i < 10; i++ ) {
+        key_of ( key, i );
+        insert_c_hashmap ( pMap, key, &i );
+    }
+    remove_c_hashmap ( pMap, "key-3" );
+    assert ( destroyed == 1 );
+    delete_c_hashmap ( pMap );
+    assert ( destroyed == 10 );
+}
+
+void
+test_c_hashmap() {
+    test_basic();
+    test_growth();
+    test_churn();
+    test_destructor();
+}
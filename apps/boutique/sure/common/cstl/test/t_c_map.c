@@ -147,6 +147,131 @@ test_with_iterators() {
 	delete_c_map(myMap);
 }
 
+static void
+check_refs_in_place(struct clib_map* myMap) {
+    int size = sizeof(char_value)/sizeof(char_value[0]);
+    int i = 0;
+    void* ref;
+    void* ref_again;
+    void* copy;
+    for ( i = 0; i < size; i++ ) {
+        assert ( clib_true == find_ref_c_map ( myMap, char_value[i], &ref));
+        assert ( *(int*)ref == int_value[i]);
+        /* Updates through the reference are visible to later lookups */
+        *(int*)ref += 100;
+        assert ( clib_true == find_ref_c_map ( myMap, char_value[i], &ref_again));
+        assert ( ref == ref_again );
+        assert ( clib_true == find_c_map ( myMap, char_value[i], &copy));
+        assert ( copy != ref );
+        assert ( *(int*)copy == int_value[i] + 100);
+        free ( copy );
+        *(int*)ref -= 100;
+    }
+    assert ( clib_false == find_ref_c_map ( myMap, "missing", &ref_again));
+}
+
+static void
+check_refs_survive_removal(struct clib_map* myMap) {
+    void* refs[26];
+    int size = sizeof(char_value)/sizeof(char_value[0]);
+    int i = 0;
+    for ( i = 0; i < size; i++ )
+        assert ( clib_true == find_ref_c_map ( myMap, char_value[i], &refs[i]));
+
+    /* Removing inner nodes relinks their successors, which must not move */
+    for ( i = 0; i < size; i += 3 )
+        assert ( CLIB_ERROR_SUCCESS == remove_c_map ( myMap, char_value[i]));
+    for ( i = 0; i < size; i++ ) {
+        void* ref;
+        if ( i % 3 == 0 ) {
+            assert ( clib_false == exists_c_map ( myMap, char_value[i]));
+            continue;
+        }
+        assert ( clib_true == find_ref_c_map ( myMap, char_value[i], &ref));
+        assert ( ref == refs[i] );
+        assert ( *(int*)ref == int_value[i]);
+    }
+    for ( i = 0; i < size; i += 3 ) {
+        char *key = clib_strdup( char_value[i]);
+        insert_c_map ( myMap, key, strlen(key) + 1, &int_value[i], sizeof(int));
+        free ( key );
+    }
+}
+
+static void
+check_replace(struct clib_map* myMap) {
+    void* ref;
+    int small = 42;
+    long long big[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+    assert ( CLIB_RBTREE_KEY_NOT_FOUND == replace_c_map ( myMap, "missing", &small, sizeof(small)));
+
+    assert ( CLIB_ERROR_SUCCESS == replace_c_map ( myMap, "B", &small, sizeof(small)));
+    assert ( clib_true == find_ref_c_map ( myMap, "B", &ref));
+    assert ( *(int*)ref == 42 );
+
+    /* A value larger than the node can hold moves out of line and back */
+    assert ( CLIB_ERROR_SUCCESS == replace_c_map ( myMap, "B", big, sizeof(big)));
+    assert ( clib_true == find_ref_c_map ( myMap, "B", &ref));
+    assert ( ((long long*)ref)[7] == 8 );
+    assert ( CLIB_ERROR_SUCCESS == replace_c_map ( myMap, "B", &int_value[1], sizeof(int)));
+    assert ( clib_true == find_ref_c_map ( myMap, "B", &ref));
+    assert ( *(int*)ref == int_value[1] );
+}
+
+static void
+test_refs() {
+	struct clib_map* myMap = new_c_map ( compare_e, NULL, NULL);
+	insert_all(myMap);
+	check_refs_in_place(myMap);
+	check_refs_survive_removal(myMap);
+	check_exists_all(myMap);
+	check_replace(myMap);
+	replace_values_using_iterators(myMap);
+	check_replace(myMap);
+	delete_c_map(myMap);
+}
+
+static int
+compare_int_e ( void* left, void* right ) {
+    int l = *(int*)left;
+    int r = *(int*)right;
+    return l < r ? -1 : l > r;
+}
+
+static void
+test_random_insert_remove() {
+    enum { N = 512, ROUNDS = 8192 };
+    int present[N] = { 0 };
+    void* refs[N];
+    struct clib_map* myMap = new_c_map ( compare_int_e, NULL, NULL);
+    int i, k;
+
+    srand ( 1 );
+    for ( i = 0; i < ROUNDS; i++ ) {
+        k = rand() % N;
+        if ( present[k] ) {
+            assert ( CLIB_ERROR_SUCCESS == remove_c_map ( myMap, &k));
+            present[k] = 0;
+        } else {
+            int v = k * 2;
+            assert ( CLIB_ERROR_SUCCESS == insert_c_map ( myMap, &k, sizeof(k), &v, sizeof(v)));
+            assert ( clib_true == find_ref_c_map ( myMap, &k, &refs[k]));
+            present[k] = 1;
+        }
+    }
+    for ( k = 0; k < N; k++ ) {
+        void* ref;
+        if ( !present[k] ) {
+            assert ( clib_false == exists_c_map ( myMap, &k));
+            continue;
+        }
+        assert ( clib_true == find_ref_c_map ( myMap, &k, &ref));
+        assert ( ref == refs[k] );
+        assert ( *(int*)ref == k * 2 );
+    }
+    delete_c_map(myMap);
+}
 
 void 
 test_c_map() {
@@ -157,4 +282,6 @@ test_c_map() {
     add_removed_check_all(myMap);
     delete_c_map(myMap);
 	test_with_iterators();
+	test_refs();
+	test_random_insert_remove();
 }
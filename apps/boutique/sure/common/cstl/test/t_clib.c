@@ -31,6 +31,7 @@ extern void test_c_map();
 extern void test_c_slist();
 extern void test_c_map();
 extern void test_c_algorithms();
+extern void test_c_hashmap();
 
 int main( int argc, char**argv ) {	
     printf ( "Performing test for dynamic array\n");
@@ -41,6 +42,8 @@ int main( int argc, char**argv ) {
     test_c_set();
     printf ( "Performing test for map\n");
     test_c_map();
+    printf ( "Performing test for hashmap\n");
+    test_c_hashmap();
     printf ( "Performing test for slist\n");
     test_c_slist();
     printf ( "Performing algorithms tests\n");
@@ -0,0 +1,178 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* Client-side load balancing among the replicas of a downstream service. The
+ * caller picks a replica for every RPC and keeps count of the RPCs
+ * outstanding on each one:
+ * - round-robin spreads RPCs evenly, whatever the replicas are doing;
+ * - least-outstanding picks the replica with the fewest RPCs in flight,
+ *   steering away from slow or stalled replicas;
+ * - power-of-two-choices compares two random replicas only, close to
+ *   least-outstanding with less herding when many callers share replicas.
+ *
+ * Counts are local to the caller (a core), other callers' load is not seen.
+ *
+ * Replicas also grant the caller credits, the RPCs it may have outstanding on
+ * them: only replicas with credits left are picked, and none is when all of
+ * them are exhausted, so that the caller holds back work the replicas could
+ * only queue.
+ */
+
+#ifndef __BALANCE__
+#define __BALANCE__
+
+#include <stdint.h>
+
+/* Replicas of a service */
+#define MAX_REPLICAS 4
+
+enum lb_policy {
+	LB_RR,
+	LB_LEAST,
+	LB_P2C,
+};
+
+struct balancer {
+	enum lb_policy policy;
+	unsigned nreplicas;
+	/* Next replica of round-robin, start of the scan of least-outstanding */
+	unsigned next;
+	uint64_t rand;
+	unsigned outstanding[MAX_REPLICAS];
+	/* Max RPCs outstanding on each replica, as last granted by it */
+	unsigned credits[MAX_REPLICAS];
+};
+
+/* Replicas start with @credits each, until they grant theirs */
+static inline void balancer_init(struct balancer *b, enum lb_policy policy,
+				 unsigned nreplicas, unsigned credits,
+				 uint64_t seed)
+{
+	*b = (struct balancer){
+		.policy = policy,
+		.nreplicas = nreplicas,
+		/* xorshift must not start from 0 */
+		.rand = seed | 1,
+	};
+	for (unsigned i = 0; i < nreplicas; i++)
+		b->credits[i] = credits;
+}
+
+static inline unsigned balancer_rand(struct balancer *b, unsigned n)
+{
+	b->rand ^= b->rand << 13;
+	b->rand ^= b->rand >> 7;
+	b->rand ^= b->rand << 17;
+
+	return (b->rand >> 32) % n;
+}
+
+static inline int balancer_has_credit(struct balancer *b, unsigned replica)
+{
+	return b->outstanding[replica] < b->credits[replica];
+}
+
+/* Replica with credits and the fewest RPCs outstanding, ties go to the
+ * replicas in turn. Returns -1 if all the replicas are out of credits.
+ */
+static inline int balancer_least(struct balancer *b)
+{
+	unsigned n = b->nreplicas;
+	int pick = -1;
+
+	for (unsigned i = 0; i < n; i++) {
+		unsigned r = (b->next + i) % n;
+		if (balancer_has_credit(b, r)
+		    && (pick < 0 || b->outstanding[r] < b->outstanding[pick]))
+			pick = r;
+	}
+	b->next = (b->next + 1) % n;
+
+	return pick;
+}
+
+/* Replica of the next RPC, -1 if all the replicas are out of credits */
+static inline int balancer_pick(struct balancer *b)
+{
+	unsigned n = b->nreplicas;
+	int pick = -1;
+
+	if (n <= 1)
+		return balancer_has_credit(b, 0) ? 0 : -1;
+
+	switch (b->policy) {
+	case LB_LEAST:
+		pick = balancer_least(b);
+		break;
+	case LB_P2C: {
+		unsigned a = balancer_rand(b, n);
+		unsigned c = (a + 1 + balancer_rand(b, n - 1)) % n;
+		if (b->outstanding[c] < b->outstanding[a])
+			a = c;
+		/* Look further if the choice has no credits */
+		pick = balancer_has_credit(b, a) ? (int)a : balancer_least(b);
+		break;
+	}
+	default:
+		/* Replicas out of credits lose their turn */
+		for (unsigned i = 0; i < n; i++) {
+			unsigned r = (b->next + i) % n;
+			if (balancer_has_credit(b, r)) {
+				pick = r;
+				break;
+			}
+		}
+		b->next = (b->next + 1) % n;
+		break;
+	}
+
+	return pick;
+}
+
+/* Replica with credits and the fewest RPCs outstanding other than @replica,
+ * to send a duplicate of an RPC to. Returns -1 if there is none.
+ */
+static inline int balancer_pick_other(struct balancer *b, unsigned replica)
+{
+	int pick = -1;
+
+	for (unsigned r = 0; r < b->nreplicas; r++) {
+		if (r != replica && balancer_has_credit(b, r)
+		    && (pick < 0 || b->outstanding[r] < b->outstanding[pick]))
+			pick = r;
+	}
+
+	return pick;
+}
+
+/* Some replica has credits left */
+static inline int balancer_available(struct balancer *b)
+{
+	for (unsigned i = 0; i < b->nreplicas; i++) {
+		if (balancer_has_credit(b, i))
+			return 1;
+	}
+
+	return 0;
+}
+
+static inline void balancer_sent(struct balancer *b, unsigned replica)
+{
+	b->outstanding[replica]++;
+}
+
+/* The RPC sent to @replica got its response, possibly after timing out */
+static inline void balancer_done(struct balancer *b, unsigned replica)
+{
+	b->outstanding[replica]--;
+}
+
+/* @replica now accepts @credits RPCs outstanding */
+static inline void balancer_grant(struct balancer *b, unsigned replica,
+				  unsigned credits)
+{
+	b->credits[replica] = credits;
+}
+
+#endif /* __BALANCE__ */
@@ -0,0 +1,181 @@
+/*
+ * Overload of a downstream service, with and without flow control: requests
+ * reach the frontend with exponential inter-arrival times and each makes an
+ * RPC to a downstream service that serves them in order, dropping those past
+ * their deadline. Without flow control every RPC is sent right away. With it
+ * the frontend has at most DEFAULT_CREDITS RPCs outstanding, queues the
+ * requests that find no credits and sheds new ones once DEFAULT_ADMIT_QUEUE
+ * are queued. Reports the requests answered in time per second (goodput),
+ * their latency, the requests shed and failed (timed out) and the most
+ * requests in flight, each holding shm buffers, on a clock driven by the
+ * model.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "service.h"
+
+#define NREQS 200000
+/* Service time: exponential with mean SERVICE_NS, dropping an expired request
+ * takes DROP_NS
+ */
+#define SERVICE_NS 2000
+#define DROP_NS 200
+#define DEADLINE_NS 1000000
+#define NEVER ((__nsec)-1)
+
+/* Offered load, relative to the capacity of the downstream service */
+static const double loads[] = { 0.5, 0.9, 1.2, 1.5, 2, 3 };
+#define NLOADS (sizeof(loads) / sizeof(loads[0]))
+
+static __nsec arrivals[NREQS];
+static __nsec service_times[NREQS];
+static __nsec latencies[NREQS];
+/* Requests waiting for credits and sent downstream, with the completion
+ * time of the latter, in order
+ */
+static unsigned waiting[NREQS];
+static unsigned sent[NREQS];
+static __nsec done[NREQS];
+
+static uint64_t rand_state = 88172645463325252ULL;
+
+static double rand_uniform(void)
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+
+	return ((rand_state >> 11) + 0.5) / (double)(1ULL << 53);
+}
+
+static void gen_requests(double load)
+{
+	double gap = SERVICE_NS / load;
+	double t = 0;
+
+	for (unsigned i = 0; i < NREQS; i++) {
+		t += -log(rand_uniform()) * gap;
+		arrivals[i] = t;
+		service_times[i] = -log(rand_uniform()) * SERVICE_NS;
+	}
+}
+
+static int cmp_nsec(const void *a, const void *b)
+{
+	__nsec x = *(const __nsec *)a, y = *(const __nsec *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+struct sim {
+	unsigned wait_head, wait_tail;
+	unsigned sent_head, sent_tail;
+	/* Completion time of the last RPC sent */
+	__nsec last_done;
+	unsigned ngood;
+	unsigned nshed;
+	unsigned nfailed;
+	unsigned max_inflight;
+};
+
+/* The downstream service serves RPCs in order, dropping those that start
+ * past their deadline
+ */
+static void send_rpc(struct sim *s, unsigned i, __nsec now)
+{
+	__nsec start = MAX(now, s->last_done);
+	__nsec cost = start >= arrivals[i] + DEADLINE_NS ? DROP_NS
+							: service_times[i];
+
+	s->last_done = start + cost;
+	sent[s->sent_tail] = i;
+	done[s->sent_tail++] = s->last_done;
+}
+
+/* Send the waiting requests that have credits, failing those past their
+ * deadline
+ */
+static void flush_waiting(struct sim *s, __nsec now)
+{
+	while (s->wait_head < s->wait_tail
+	       && s->sent_tail - s->sent_head < DEFAULT_CREDITS) {
+		unsigned i = waiting[s->wait_head++];
+
+		if (now >= arrivals[i] + DEADLINE_NS)
+			s->nfailed++;
+		else
+			send_rpc(s, i, now);
+	}
+}
+
+static void simulate(int flow_control)
+{
+	struct sim s = { 0 };
+	unsigned next = 0;
+
+	while (next < NREQS || s.sent_head < s.sent_tail) {
+		__nsec arrival = next < NREQS ? arrivals[next] : NEVER;
+		__nsec completion = s.sent_head < s.sent_tail
+				    ? done[s.sent_head] : NEVER;
+
+		if (completion <= arrival) {
+			unsigned i = sent[s.sent_head++];
+
+			if (completion <= arrivals[i] + DEADLINE_NS)
+				latencies[s.ngood++] = completion - arrivals[i];
+			else
+				s.nfailed++;
+
+			if (flow_control)
+				flush_waiting(&s, completion);
+			continue;
+		}
+
+		unsigned i = next++;
+		unsigned queued = s.wait_tail - s.wait_head;
+		if (!flow_control) {
+			send_rpc(&s, i, arrival);
+		} else if (!queued
+			   && s.sent_tail - s.sent_head < DEFAULT_CREDITS) {
+			send_rpc(&s, i, arrival);
+		} else if (queued >= DEFAULT_ADMIT_QUEUE) {
+			s.nshed++;
+		} else {
+			waiting[s.wait_tail++] = i;
+		}
+
+		unsigned inflight = s.sent_tail - s.sent_head
+				    + s.wait_tail - s.wait_head;
+		s.max_inflight = MAX(s.max_inflight, inflight);
+	}
+
+	qsort(latencies, s.ngood, sizeof(latencies[0]), cmp_nsec);
+
+	printf(" %10.0f %10lu %7.1f%% %7.1f%% %10u\n",
+	       s.ngood * 1e9 / arrivals[NREQS - 1],
+	       s.ngood ? (unsigned long)latencies[s.ngood * 99 / 100] : 0,
+	       s.nshed * 100.0 / NREQS, s.nfailed * 100.0 / NREQS,
+	       s.max_inflight);
+}
+
+int main(void)
+{
+	printf("Downstream service: %u ns per RPC on average (%.0f RPC/s), "
+	       "deadline %u us, %u credits, admission queue %u\n", SERVICE_NS,
+	       1e9 / SERVICE_NS, DEADLINE_NS / 1000, DEFAULT_CREDITS,
+	       DEFAULT_ADMIT_QUEUE);
+	printf("%6s %8s %10s %10s %8s %8s %10s\n", "load", "control",
+	       "goodput/s", "p99 ns", "shed", "failed", "inflight");
+
+	for (unsigned l = 0; l < NLOADS; l++) {
+		gen_requests(loads[l]);
+		for (int fc = 0; fc <= 1; fc++) {
+			printf("%6.1f %8s", loads[l], fc ? "credits" : "none");
+			simulate(fc);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,357 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* Size and cost of the compact encoding against the struct layout, for the
+ * RPCs of an order placed by the frontend with a cart of CART_ITEMS products:
+ * PlaceOrder and the RPCs of the checkout service it triggers. Every RPC
+ * crosses the wire twice, as request and as response.
+ *
+ * Transfer is the time for a reader on a cold cache to pull in every line of
+ * both messages, which is what a receiving core pays on a shared buffer. The
+ * compact encoding adds encoding on the sender and decoding on the receiver.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "service.h"
+
+#define ITERATIONS 100000
+/* Messages flushed and read per transfer measurement */
+#define TRANSFER_BATCH 64
+#define TRANSFER_ROUNDS 2000
+#define CACHE_LINE 64
+#define CART_ITEMS 3
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static const char *product_ids[] = {
+	"OLJCESPC7Z", "66VCHSJNUP", "1YMWWN1N4O"
+};
+
+static const Address address = {
+	.StreetAddress = "1600 Amphitheatre Parkway",
+	.City = "Mountain View",
+	.State = "CA",
+	.Country = "United States",
+	.ZipCode = 94043,
+};
+
+static const CreditCardInfo credit_card = {
+	.CreditCardNumber = "4432-8015-6152-0454",
+	.CreditCardCvv = 672,
+	.CreditCardExpirationYear = 2039,
+	.CreditCardExpirationMonth = 1,
+};
+
+static Money money(int64_t units, int32_t nanos)
+{
+	Money m = { .CurrencyCode = "USD", .Units = units, .Nanos = nanos };
+
+	return m;
+}
+
+static void fill_cart(Cart *cart)
+{
+	strcpy(cart->UserId, "federico");
+	cart->num_items = CART_ITEMS;
+	for (int i = 0; i < CART_ITEMS; i++) {
+		strcpy(cart->Items[i].ProductId, product_ids[i]);
+		cart->Items[i].Quantity = i + 1;
+	}
+}
+
+static void fill_order(OrderResult *order)
+{
+	strcpy(order->OrderId, "1b4e28ba-2fa1-11d2-883f-0016d3cca427");
+	strcpy(order->ShippingTrackingId, "JB-315189-154236523");
+	order->ShippingCost = money(8, 990000000);
+	order->ShippingAddress = address;
+	order->num_items = CART_ITEMS;
+	for (int i = 0; i < CART_ITEMS; i++) {
+		strcpy(order->Items[i].Item.ProductId, product_ids[i]);
+		order->Items[i].Item.Quantity = i + 1;
+		order->Items[i].Cost = money(19 + i, 990000000);
+	}
+}
+
+static void fill_place_order(void *body)
+{
+	PlaceOrderRR *rr = body;
+
+	strcpy(rr->req.UserId, "federico");
+	strcpy(rr->req.UserCurrency, "CAD");
+	rr->req.address = address;
+	strcpy(rr->req.Email, "someone@example.com");
+	rr->req.CreditCard = credit_card;
+	fill_order(&rr->res.order);
+}
+
+static void fill_get_cart(void *body)
+{
+	GetCartRR *rr = body;
+
+	strcpy(rr->req.UserId, "federico");
+	fill_cart(&rr->res);
+}
+
+static void fill_get_product(void *body)
+{
+	GetProductRR *rr = body;
+
+	strcpy(rr->req.Id, product_ids[0]);
+	strcpy(rr->res.Id, product_ids[0]);
+	strcpy(rr->res.Name, "Sunglasses");
+	strcpy(rr->res.Description, "Add a modern touch to your outfits with "
+	       "these sleek aviator sunglasses.");
+	strcpy(rr->res.Picture, "/static/img/products/sunglasses.jpg");
+	rr->res.PriceUsd = money(19, 990000000);
+	rr->res.num_categories = 1;
+	strcpy(rr->res.Categories[0], "accessories");
+}
+
+static void fill_get_quote(void *body)
+{
+	GetQuoteRR *rr = body;
+	Cart cart;
+
+	fill_cart(&cart);
+	rr->req.address = address;
+	rr->req.num_items = CART_ITEMS;
+	memcpy(rr->req.Items, cart.Items, sizeof(CartItem) * CART_ITEMS);
+	rr->res.conversion_flag = 0;
+	rr->res.CostUsd = money(8, 990000000);
+}
+
+static void fill_convert_batch(void *body)
+{
+	CurrencyConversionBatchRR *rr = body;
+
+	/* Shipping cost and products */
+	rr->req.num_amounts = CART_ITEMS + 1;
+	strcpy(rr->req.ToCode, "CAD");
+	for (int i = 0; i <= CART_ITEMS; i++) {
+		strcpy(rr->req.FromCodes[i], "USD");
+		rr->req.Units[i] = 19 + i;
+		rr->req.Nanos[i] = 990000000;
+	}
+	strcpy(rr->res.CurrencyCode, "CAD");
+	for (int i = 0; i <= CART_ITEMS; i++) {
+		rr->res.Units[i] = 27 + i;
+		rr->res.Nanos[i] = 370000000;
+	}
+}
+
+static void fill_charge(void *body)
+{
+	ChargeRR *rr = body;
+
+	rr->req.Amount = money(128, 920000000);
+	rr->req.CreditCard = credit_card;
+	strcpy(rr->res.TransactionId, "f1e5b8c2-7a8e-4e0f-9d6b-3c2a1b0e9f8d");
+}
+
+static void fill_ship_order(void *body)
+{
+	ShipOrderRR *rr = body;
+	Cart cart;
+
+	fill_cart(&cart);
+	rr->req.address = address;
+	memcpy(rr->req.Items, cart.Items, sizeof(rr->req.Items));
+	strcpy(rr->res.TrackingId, "JB-315189-154236523");
+}
+
+static void fill_empty_cart(void *body)
+{
+	strcpy(((EmptyCartRequest *)body)->UserId, "federico");
+}
+
+static void fill_send_confirmation(void *body)
+{
+	SendOrderConfirmationRequest *req = body;
+
+	strcpy(req->Email, "someone@example.com");
+	fill_order(&req->Order);
+}
+
+struct msg_bench {
+	const char *name;
+	enum command command;
+	/* Calls per order */
+	unsigned calls;
+	void (*fill)(void *body);
+};
+
+static const struct msg_bench msgs[] = {
+	{ "PlaceOrder", CHECKOUT_PLACE_ORDER, 1, fill_place_order },
+	{ "GetCart", CART_GET_CART, 1, fill_get_cart },
+	{ "GetProduct", PRODUCTCATALOG_GET_PRODUCT, CART_ITEMS,
+	  fill_get_product },
+	{ "GetQuote", SHIPPING_GET_QUOTE, 1, fill_get_quote },
+	{ "ConvertBatch", CURRENCY_CONVERT_BATCH, 1, fill_convert_batch },
+	{ "Charge", PAYMENT_CHARGE, 1, fill_charge },
+	{ "ShipOrder", SHIPPING_SHIP_ORDER, 1, fill_ship_order },
+	{ "EmptyCart", CART_EMPTY_CART, 1, fill_empty_cart },
+	{ "SendOrderConf", EMAIL_SEND_ORDER_CONFIRMATION, 1,
+	  fill_send_confirmation },
+};
+#define NMSGS (sizeof(msgs) / sizeof(msgs[0]))
+
+static void get_buffers(struct unimsg_shm_desc *descs, unsigned ndescs)
+{
+	if (unimsg_buffer_get(descs, ndescs)) {
+		fprintf(stderr, "Out of buffers\n");
+		exit(1);
+	}
+}
+
+static unsigned lines(unsigned size)
+{
+	return (size + CACHE_LINE - 1) / CACHE_LINE;
+}
+
+/* Time to read every line of TRANSFER_BATCH copies of @size bytes of @src
+ * after flushing them, per copy
+ */
+static double transfer_ns(void *src, unsigned size)
+{
+	struct unimsg_shm_desc descs[TRANSFER_BATCH];
+	volatile char sink;
+	double best = 0;
+
+	get_buffers(descs, TRANSFER_BATCH);
+	for (unsigned i = 0; i < TRANSFER_BATCH; i++)
+		memcpy(descs[i].addr, src, size);
+
+	for (unsigned r = 0; r < TRANSFER_ROUNDS; r++) {
+		for (unsigned i = 0; i < TRANSFER_BATCH; i++) {
+			for (unsigned off = 0; off < size; off += CACHE_LINE)
+				__builtin_ia32_clflush(descs[i].addr + off);
+		}
+		__builtin_ia32_mfence();
+
+		double start = now_ns();
+		for (unsigned i = 0; i < TRANSFER_BATCH; i++) {
+			for (unsigned off = 0; off < size; off += CACHE_LINE)
+				sink = ((char *)descs[i].addr)[off];
+		}
+		double t = (now_ns() - start) / TRANSFER_BATCH;
+		if (!best || t < best)
+			best = t;
+	}
+	(void)sink;
+
+	unimsg_buffer_put(descs, TRANSFER_BATCH);
+
+	return best;
+}
+
+int main(void)
+{
+	struct unimsg_shm_desc msg, wire[2];
+	double totals[4] = { 0 };
+	unsigned bytes[3] = { 0 }, nlines[2] = { 0 };
+
+	printf("Order of %d products through the %s service: bytes, cache "
+	       "lines and ns per RPC,\nrequest + response\n", CART_ITEMS,
+	       services[CHECKOUT_SERVICE].name);
+	printf("%-14s %6s %6s %6s %5s %5s %8s %8s %8s %8s\n", "rpc", "struct",
+	       "c.req", "c.res", "lines", "c.lin", "xfer", "c.xfer", "encode",
+	       "decode");
+
+	for (unsigned m = 0; m < NMSGS; m++) {
+		const struct msg_bench *b = &msgs[m];
+
+		get_buffers(&msg, 1);
+		get_buffers(wire, 2);
+		struct rpc *rpc = msg.addr;
+		rpc->id = 1;
+		rpc->command = b->command;
+		msg.size = get_rpc_size(b->command);
+		b->fill(rpc->rr);
+
+		/* Check the round trip, then time it */
+		for (int res = 0; res < 2; res++) {
+			struct unimsg_shm_desc dec;
+			get_buffers(&dec, 1);
+			rpc_compact_encode(&wire[res], &msg, res);
+			memset(dec.addr, 0, msg.size);
+			rpc_compact_decode(&dec, &wire[res], res);
+
+			struct unimsg_shm_desc check;
+			get_buffers(&check, 1);
+			rpc_compact_encode(&check, &dec, res);
+			if (check.size != wire[res].size
+			    || memcmp(check.addr, wire[res].addr, check.size)) {
+				fprintf(stderr, "%s: round trip mismatch\n",
+					b->name);
+				exit(1);
+			}
+
+			/* The receiver frames it by its header alone */
+			struct rpc_msg framed = { 0 };
+			if (!process_desc(&framed, &check)
+			    || framed.size != wire[res].size) {
+				fprintf(stderr, "%s: framing mismatch\n",
+					b->name);
+				exit(1);
+			}
+			rpc_msg_put(&framed);
+			unimsg_buffer_put(&dec, 1);
+		}
+
+		double start = now_ns();
+		for (unsigned i = 0; i < ITERATIONS; i++) {
+			unimsg_buffer_reset(&wire[0]);
+			unimsg_buffer_reset(&wire[1]);
+			rpc_compact_encode(&wire[0], &msg, 0);
+			rpc_compact_encode(&wire[1], &msg, 1);
+		}
+		double encode = (now_ns() - start) / ITERATIONS;
+
+		start = now_ns();
+		for (unsigned i = 0; i < ITERATIONS; i++) {
+			rpc_compact_decode(&msg, &wire[0], 0);
+			rpc_compact_decode(&msg, &wire[1], 1);
+		}
+		double decode = (now_ns() - start) / ITERATIONS;
+
+		double xfer = 2 * transfer_ns(msg.addr, msg.size);
+		double cxfer = transfer_ns(wire[0].addr, wire[0].size)
+			       + transfer_ns(wire[1].addr, wire[1].size);
+		unsigned clines = lines(wire[0].size) + lines(wire[1].size);
+
+		printf("%-14s %6u %6u %6u %5u %5u %8.1f %8.1f %8.1f %8.1f\n",
+		       b->name, msg.size, wire[0].size, wire[1].size,
+		       2 * lines(msg.size), clines, xfer, cxfer, encode,
+		       decode);
+
+		bytes[0] += b->calls * 2 * msg.size;
+		bytes[1] += b->calls * wire[0].size;
+		bytes[2] += b->calls * wire[1].size;
+		nlines[0] += b->calls * 2 * lines(msg.size);
+		nlines[1] += b->calls * clines;
+		totals[0] += b->calls * xfer;
+		totals[1] += b->calls * cxfer;
+		totals[2] += b->calls * encode;
+		totals[3] += b->calls * decode;
+
+		unimsg_buffer_put(wire, 2);
+		unimsg_buffer_put(&msg, 1);
+	}
+
+	printf("%-14s %6u %6u %6u %5u %5u %8.1f %8.1f %8.1f %8.1f\n",
+	       "order total", bytes[0], bytes[1], bytes[2], nlines[0],
+	       nlines[1], totals[0], totals[1], totals[2], totals[3]);
+	printf("struct: %.0f ns, compact: %.0f ns per order\n", totals[0],
+	       totals[1] + totals[2] + totals[3]);
+
+	return 0;
+}
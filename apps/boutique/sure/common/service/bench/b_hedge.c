@@ -0,0 +1,220 @@
+/*
+ * Hedging of the RPCs to a service with 2 replicas: a caller core sends RPCs
+ * with exponential inter-arrival times to the replica with the fewest RPCs
+ * outstanding. Every replica serves its RPCs in order, mostly quickly but with
+ * a few slow ones, like a replica stalling now and then. With hedging, an RPC
+ * still without a response once the QUANTILE of the latency of the previous
+ * WINDOW RPCs is past is sent again to the other replica, which serves it at
+ * its own pace, as long as at most DEFAULT_HEDGE_RATE percent of the RPCs are
+ * hedged. The first response counts. Reports the latency of the RPCs and the
+ * RPCs hedged and won by the hedge, on a clock driven by the model.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "service.h"
+
+#define NRPCS 200000
+#define NREPLICAS 2
+/* Service time: exponential with mean SERVICE_NS, SLOW_PERMIL per thousand
+ * RPCs SLOW_FACTOR times slower
+ */
+#define SERVICE_NS 2000
+#define SLOW_PERMIL 10
+#define SLOW_FACTOR 25
+/* Hedging policy, as the frontend and the framework set it */
+#define QUANTILE 9500
+#define WINDOW 1024
+#define BURST 8
+
+/* Utilization of each replica without hedging */
+static const double loads[] = { 0.3, 0.5, 0.7 };
+#define NLOADS (sizeof(loads) / sizeof(loads[0]))
+
+static __nsec arrivals[NRPCS];
+static __nsec service_times[NRPCS];
+/* Service time of the duplicates, slow or not regardless of the original */
+static __nsec hedge_times[NRPCS];
+static __nsec latencies[NRPCS];
+/* Completion time and replica of the RPCs */
+static __nsec done[NRPCS];
+static unsigned replicas[NRPCS];
+/* RPCs to hedge and when, in order */
+static unsigned hedges[NRPCS];
+static __nsec hedge_at[NRPCS];
+/* Completion times of the RPCs queued at each replica, in order */
+static __nsec queues[NREPLICAS][2 * NRPCS];
+
+static uint64_t rand_state = 88172645463325252ULL;
+
+static double rand_uniform(void)
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+
+	return ((rand_state >> 11) + 0.5) / (double)(1ULL << 53);
+}
+
+static __nsec rand_service_time(void)
+{
+	__nsec t = -log(rand_uniform()) * SERVICE_NS;
+
+	return rand_uniform() * 1000 < SLOW_PERMIL ? t * SLOW_FACTOR : t;
+}
+
+/* Mean service time, accounting for the slow RPCs */
+static double mean_service_ns(void)
+{
+	return SERVICE_NS * (1 + SLOW_PERMIL * (SLOW_FACTOR - 1) / 1000.0);
+}
+
+static void gen_rpcs(double load)
+{
+	double gap = mean_service_ns() / (load * NREPLICAS);
+	double t = 0;
+
+	for (unsigned i = 0; i < NRPCS; i++) {
+		t += -log(rand_uniform()) * gap;
+		arrivals[i] = t;
+		service_times[i] = rand_service_time();
+		hedge_times[i] = rand_service_time();
+	}
+}
+
+static int cmp_nsec(const void *a, const void *b)
+{
+	__nsec x = *(const __nsec *)a, y = *(const __nsec *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+struct sim {
+	struct balancer b;
+	unsigned head[NREPLICAS], tail[NREPLICAS];
+	struct hist window;
+	__nsec budget;
+	unsigned tokens;
+	unsigned hedge_head, hedge_tail;
+	unsigned nhedged;
+	unsigned nwon;
+};
+
+/* Responses received by @now */
+static void drain(struct sim *s, __nsec now)
+{
+	for (unsigned r = 0; r < NREPLICAS; r++) {
+		while (s->head[r] < s->tail[r] && queues[r][s->head[r]] <= now) {
+			s->head[r]++;
+			balancer_done(&s->b, r);
+		}
+	}
+}
+
+/* Queue an RPC taking @cost at @replica at @now, returns its completion */
+static __nsec enqueue(struct sim *s, unsigned replica, __nsec now, __nsec cost)
+{
+	unsigned *tail = &s->tail[replica];
+	__nsec start = *tail > s->head[replica]
+		       ? MAX(queues[replica][*tail - 1], now) : now;
+
+	queues[replica][(*tail)++] = start + cost;
+	balancer_sent(&s->b, replica);
+
+	return start + cost;
+}
+
+static void record(struct sim *s, unsigned i)
+{
+	latencies[i] = done[i] - arrivals[i];
+
+	hist_record(&s->window, latencies[i]);
+	if (s->window.count < WINDOW)
+		return;
+
+	s->budget = hist_quantile(&s->window, QUANTILE);
+	memset(&s->window, 0, sizeof(s->window));
+}
+
+/* Send the duplicates due by @now of the RPCs still without a response */
+static void send_hedges(struct sim *s, __nsec now)
+{
+	while (s->hedge_head < s->hedge_tail
+	       && hedge_at[s->hedge_head] <= now) {
+		__nsec at = hedge_at[s->hedge_head];
+		unsigned i = hedges[s->hedge_head++];
+		int r = -1;
+
+		drain(s, at);
+		if (done[i] > at && s->tokens >= 100)
+			r = balancer_pick_other(&s->b, replicas[i]);
+		if (r >= 0) {
+			__nsec hedge_done = enqueue(s, r, at, hedge_times[i]);
+
+			s->tokens -= 100;
+			s->nhedged++;
+			if (hedge_done < done[i]) {
+				done[i] = hedge_done;
+				s->nwon++;
+			}
+		}
+		record(s, i);
+	}
+}
+
+static void simulate(int hedging)
+{
+	static struct sim s;
+
+	memset(&s, 0, sizeof(s));
+	/* Replicas queue all they get, no credits */
+	balancer_init(&s.b, LB_LEAST, NREPLICAS, 2 * NRPCS, 1);
+
+	for (unsigned i = 0; i < NRPCS; i++) {
+		__nsec now = arrivals[i];
+
+		send_hedges(&s, now);
+		drain(&s, now);
+
+		replicas[i] = balancer_pick(&s.b);
+		done[i] = enqueue(&s, replicas[i], now, service_times[i]);
+
+		s.tokens = MIN(s.tokens + DEFAULT_HEDGE_RATE, BURST * 100);
+		if (hedging && s.budget && s.tokens >= 100) {
+			hedges[s.hedge_tail] = i;
+			hedge_at[s.hedge_tail++] = now + s.budget;
+		} else {
+			record(&s, i);
+		}
+	}
+	send_hedges(&s, (__nsec)-1);
+
+	qsort(latencies, NRPCS, sizeof(latencies[0]), cmp_nsec);
+
+	printf(" %10lu %10lu %10lu %7.1f%% %7.1f%%\n",
+	       (unsigned long)latencies[NRPCS / 2],
+	       (unsigned long)latencies[NRPCS * 99 / 100],
+	       (unsigned long)latencies[NRPCS * 999 / 1000],
+	       s.nhedged * 100.0 / NRPCS, s.nwon * 100.0 / NRPCS);
+}
+
+int main(void)
+{
+	printf("%u replicas: %.0f ns per RPC on average, %u%% RPCs %ux slower, "
+	       "hedged past p%.0f of the last %u RPCs, at most %u%%\n",
+	       NREPLICAS, mean_service_ns(), SLOW_PERMIL / 10, SLOW_FACTOR,
+	       QUANTILE / 100.0, WINDOW, DEFAULT_HEDGE_RATE);
+	printf("%6s %8s %10s %10s %10s %8s %8s\n", "load", "hedging",
+	       "p50 ns", "p99 ns", "p99.9 ns", "hedged", "won");
+
+	for (unsigned l = 0; l < NLOADS; l++) {
+		gen_rpcs(loads[l]);
+		for (int h = 0; h <= 1; h++) {
+			printf("%6.1f %8s", loads[l], h ? "p95" : "none");
+			simulate(h);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,319 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* Cost of taking in the requests of the frontend: the request line and
+ * headers, the route and the form of the body. The old way NUL-terminates the
+ * buffer and walks it with strstr() and strchr(), routes with a chain of
+ * strcmp() and reads forms with sscanf(). http_parse() finds the lines in one
+ * SIMD pass over the head and leaves the buffer alone, the route comes from
+ * one walk of the trie of the paths and forms are decoded in a single pass.
+ *
+ * Both ways start from a fresh copy of the request, as the old one writes in
+ * it. Pipelined is PIPELINED home requests in a buffer, framed one by one by
+ * their size, which the old way cannot do.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "service.h"
+#include "http.h"
+
+#define ITERATIONS 200000
+#define PIPELINED 8
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#define HEADERS "Host: 10.0.0.10:5010\r\n"					\
+		"User-Agent: python-requests/2.31.0\r\n"			\
+		"Accept-Encoding: gzip, deflate\r\n"				\
+		"Accept: */*\r\n"						\
+		"Connection: keep-alive\r\n"
+
+#define ORDER_FORM "email=someone%40example.com"				\
+		   "&street_address=1600+Amphitheatre+Parkway"		\
+		   "&zip_code=94043&city=Mountain+View&state=CA"		\
+		   "&country=United+States"					\
+		   "&credit_card_number=4432801561520454"			\
+		   "&credit_card_expiration_month=1"				\
+		   "&credit_card_expiration_year=2039"			\
+		   "&credit_card_cvv=672"
+
+static const char home_request[] = "GET / HTTP/1.1\r\n" HEADERS "\r\n";
+
+static const char product_request[] = "GET /product/OLJCESPC7Z HTTP/1.1\r\n"
+				      HEADERS "\r\n";
+
+static const char order_request[] =
+	"POST /cart/checkout HTTP/1.1\r\n" HEADERS
+	"Content-Type: application/x-www-form-urlencoded\r\n"
+	"Content-Length: 253\r\n\r\n" ORDER_FORM;
+
+_Static_assert(sizeof(ORDER_FORM) - 1 == 253, "Fix the Content-Length");
+
+static const struct {
+	const char *name;
+	const char *msg;
+} requests[] = {
+	{ "home", home_request },
+	{ "product", product_request },
+	{ "checkout", order_request },
+};
+#define NREQUESTS (sizeof(requests) / sizeof(requests[0]))
+
+static volatile unsigned long sink;
+
+/* ---------------- The old way ---------------- */
+
+static int legacy_parse(char *msg, char **method, char **url, char **body)
+{
+	char *line_end = strstr(msg, "\r\n");
+	if (!line_end)
+		return 1;
+	*line_end = 0;
+
+	char *method_end = strchr(msg, ' ');
+	if (!method_end)
+		return 1;
+	*method_end = 0;
+	*method = msg;
+
+	char *next = method_end + 1;
+	char *url_end = strchr(next, ' ');
+	if (!url_end)
+		return 1;
+	*url_end = 0;
+	*url = next;
+
+	*body = strstr(line_end + 1, "\r\n\r\n");
+	if (!*body)
+		return 1;
+	*body += 4;
+
+	return 0;
+}
+
+static void legacy_order(char *body)
+{
+	char *param;
+	char *param_end = body - 1;
+	char email[50], street_address[50], city[15], state[15], country[15];
+	char credit_card_number[30];
+	int zip_code, month, year, cvv;
+
+#define READ_PARAM(name, specifier, dst)				\
+	if (!param_end)							\
+		return;							\
+	param = param_end + 1;						\
+	param_end = strchr(param, '&');					\
+	if (param_end)							\
+		*param_end = 0;						\
+	if (sscanf(param, name "=" specifier, dst) != 1)		\
+		return;
+
+	READ_PARAM("email", "%s", email);
+	READ_PARAM("street_address", "%s", street_address);
+	READ_PARAM("zip_code", "%d", &zip_code);
+	READ_PARAM("city", "%s", city);
+	READ_PARAM("state", "%s", state);
+	READ_PARAM("country", "%s", country);
+	READ_PARAM("credit_card_number", "%s", credit_card_number);
+	READ_PARAM("credit_card_expiration_month", "%d", &month);
+	READ_PARAM("credit_card_expiration_year", "%d", &year);
+	READ_PARAM("credit_card_cvv", "%d", &cvv);
+
+#undef READ_PARAM
+
+	sink += zip_code + month + year + cvv + email[0] + street_address[0]
+		+ city[0] + state[0] + country[0] + credit_card_number[0];
+}
+
+static void legacy_handle(char *msg)
+{
+	char *method, *url, *body;
+
+	if (legacy_parse(msg, &method, &url, &body))
+		exit(1);
+
+	if (!strcmp(url, "/")) {
+		if (!strcmp(method, "GET"))
+			sink += 1;
+	} else if (!strncmp(url, "/product/", sizeof("/product/") - 1)) {
+		if (!strcmp(method, "GET"))
+			sink += url[sizeof("/product/") - 1];
+	} else if (!strcmp(url, "/cart")) {
+		if (!strcmp(method, "GET") || !strcmp(method, "POST"))
+			sink += 3;
+	} else if (!strcmp(url, "/cart/empty")) {
+		if (!strcmp(method, "POST"))
+			sink += 4;
+	} else if (!strcmp(url, "/setCurrency")) {
+		if (!strcmp(method, "POST"))
+			sink += 5;
+	} else if (!strcmp(url, "/logout")) {
+		if (!strcmp(method, "GET"))
+			sink += 6;
+	} else if (!strcmp(url, "/cart/checkout")) {
+		if (!strcmp(method, "POST"))
+			legacy_order(body);
+	}
+}
+
+/* ---------------- http.h ---------------- */
+
+static void home(struct unimsg_shm_desc *desc, const struct http_request *req,
+		 struct http_str param)
+{
+	sink += 1;
+}
+
+static void product(struct unimsg_shm_desc *desc,
+		    const struct http_request *req, struct http_str param)
+{
+	sink += *http_ptr(req, param);
+}
+
+static void other(struct unimsg_shm_desc *desc, const struct http_request *req,
+		  struct http_str param)
+{
+	sink += 3;
+}
+
+static void order(struct unimsg_shm_desc *desc, const struct http_request *req,
+		  struct http_str param)
+{
+	PlaceOrderRequest o;
+	const struct http_form_field fields[] = {
+		{ "email", HTTP_FORM_STR, o.Email, sizeof(o.Email) },
+		{ "street_address", HTTP_FORM_STR, o.address.StreetAddress,
+		  sizeof(o.address.StreetAddress) },
+		{ "zip_code", HTTP_FORM_INT, &o.address.ZipCode, 0 },
+		{ "city", HTTP_FORM_STR, o.address.City,
+		  sizeof(o.address.City) },
+		{ "state", HTTP_FORM_STR, o.address.State,
+		  sizeof(o.address.State) },
+		{ "country", HTTP_FORM_STR, o.address.Country,
+		  sizeof(o.address.Country) },
+		{ "credit_card_number", HTTP_FORM_STR,
+		  o.CreditCard.CreditCardNumber,
+		  sizeof(o.CreditCard.CreditCardNumber) },
+		{ "credit_card_expiration_month", HTTP_FORM_INT,
+		  &o.CreditCard.CreditCardExpirationMonth, 0 },
+		{ "credit_card_expiration_year", HTTP_FORM_INT,
+		  &o.CreditCard.CreditCardExpirationYear, 0 },
+		{ "credit_card_cvv", HTTP_FORM_INT, &o.CreditCard.CreditCardCvv,
+		  0 },
+	};
+
+	if (http_form_decode(http_ptr(req, req->body), req->body.len, fields,
+			     10) != (1 << 10) - 1) {
+		fprintf(stderr, "Form not decoded\n");
+		exit(1);
+	}
+
+	sink += o.address.ZipCode + o.CreditCard.CreditCardExpirationMonth
+		+ o.CreditCard.CreditCardExpirationYear
+		+ o.CreditCard.CreditCardCvv + o.Email[0]
+		+ o.address.StreetAddress[0] + o.address.City[0]
+		+ o.address.State[0] + o.address.Country[0]
+		+ o.CreditCard.CreditCardNumber[0];
+}
+
+static const struct http_route routes[] = {
+	{ HTTP_GET, "/", home },
+	{ HTTP_GET, "/product/*", product },
+	{ HTTP_GET, "/cart", other },
+	{ HTTP_POST, "/cart", other },
+	{ HTTP_POST, "/cart/empty", other },
+	{ HTTP_POST, "/setCurrency", other },
+	{ HTTP_GET, "/logout", other },
+	{ HTTP_POST, "/cart/checkout", order },
+};
+
+static struct http_router router;
+
+/* Handle the request at the start of the @len bytes at @msg, returns its
+ * size
+ */
+static unsigned handle(char *msg, unsigned len)
+{
+	struct http_request req;
+	struct http_str param;
+
+	int size = http_parse(msg, len, &req);
+	if (size <= 0 || (unsigned)size > len) {
+		fprintf(stderr, "Request not framed\n");
+		exit(1);
+	}
+	req.base = msg;
+
+	const struct http_route *route = http_router_match(&router, &req,
+							   &param);
+	if (!route) {
+		fprintf(stderr, "Request not routed\n");
+		exit(1);
+	}
+	route->handler(NULL, &req, param);
+
+	return size;
+}
+
+int main(void)
+{
+	static char buf[UNIMSG_BUFFER_SIZE];
+	double start, legacy, parsed;
+
+	http_router_init(&router, routes, sizeof(routes) / sizeof(routes[0]));
+
+	printf("%-10s %6s %12s %12s %8s\n", "request", "bytes", "legacy ns",
+	       "http.h ns", "speedup");
+
+	for (unsigned r = 0; r < NREQUESTS; r++) {
+		const char *msg = requests[r].msg;
+		unsigned len = strlen(msg);
+
+		start = now_ns();
+		for (unsigned i = 0; i < ITERATIONS; i++) {
+			memcpy(buf, msg, len + 1);
+			legacy_handle(buf);
+		}
+		legacy = (now_ns() - start) / ITERATIONS;
+
+		start = now_ns();
+		for (unsigned i = 0; i < ITERATIONS; i++) {
+			memcpy(buf, msg, len);
+			handle(buf, len);
+		}
+		parsed = (now_ns() - start) / ITERATIONS;
+
+		printf("%-10s %6u %12.1f %12.1f %7.1fx\n", requests[r].name, len,
+		       legacy, parsed, legacy / parsed);
+	}
+
+	unsigned len = strlen(home_request);
+	unsigned total = PIPELINED * len;
+	char pipelined[PIPELINED * sizeof(home_request)];
+
+	for (unsigned i = 0; i < PIPELINED; i++)
+		memcpy(pipelined + i * len, home_request, len);
+
+	start = now_ns();
+	for (unsigned i = 0; i < ITERATIONS; i++) {
+		memcpy(buf, pipelined, total);
+		for (unsigned off = 0; off < total;)
+			off += handle(buf + off, total - off);
+	}
+	parsed = (now_ns() - start) / ITERATIONS;
+
+	printf("%u pipelined home requests, %u bytes: %.1f ns per buffer, "
+	       "%.1f ns per request\n", PIPELINED, total, parsed,
+	       parsed / PIPELINED);
+
+	return 0;
+}
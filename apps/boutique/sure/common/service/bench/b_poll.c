@@ -0,0 +1,131 @@
+/*
+ * Polling policies of the services on a simulated hop: messages arrive with
+ * exponential inter-arrival times and the poller decides between blocking,
+ * which pays a wakeup when the service was asleep, and spinning, which burns
+ * the core. Reports the wait of the messages, from arrival to handling, and
+ * the CPU time used, on a clock driven by the model rather than by the host.
+ * A request of the boutique pays the wait once per hop.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "service.h"
+
+#define NMESSAGES 20000
+/* Cost of a blocking poll that has to sleep: doorbell, halt and wakeup of
+ * the vCPU
+ */
+#define WAKEUP_NS 10000
+/* Cost of a round that finds the sockets ready or of a spinning round */
+#define PROBE_NS 200
+/* Time to handle a message */
+#define SERVICE_NS 2000
+#define SPIN_US 50
+
+/* Mean inter-arrival times, in us */
+static const unsigned gaps_us[] = { 5, 20, 50, 200, 500 };
+#define NGAPS (sizeof(gaps_us) / sizeof(gaps_us[0]))
+
+static const struct {
+	enum poll_mode mode;
+	const char *name;
+} modes[] = {
+	{ POLL_BLOCK, "block" },
+	{ POLL_SPIN, "spin" },
+	{ POLL_HYBRID, "hybrid" },
+	{ POLL_ADAPTIVE, "adaptive" },
+};
+#define NMODES (sizeof(modes) / sizeof(modes[0]))
+
+static __nsec arrivals[NMESSAGES];
+static __nsec waits[NMESSAGES];
+
+static uint64_t rand_state = 88172645463325252ULL;
+
+static double rand_uniform(void)
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+
+	return ((rand_state >> 11) + 0.5) / (double)(1ULL << 53);
+}
+
+static void gen_arrivals(unsigned gap_us)
+{
+	double t = 0;
+
+	for (unsigned i = 0; i < NMESSAGES; i++) {
+		t += -log(rand_uniform()) * gap_us * 1000;
+		arrivals[i] = t;
+	}
+}
+
+static int cmp_nsec(const void *a, const void *b)
+{
+	__nsec x = *(const __nsec *)a, y = *(const __nsec *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void simulate(enum poll_mode mode)
+{
+	struct poller p;
+	__nsec t = 0;
+	unsigned next = 0;
+	double wait_sum = 0;
+
+	poller_init(&p, mode, SPIN_US * 1000ULL, t);
+
+	while (next < NMESSAGES) {
+		unsigned nwork = 0;
+
+		if (poller_begin(&p, t)) {
+			if (arrivals[next] > t)
+				t = arrivals[next] + WAKEUP_NS;
+			else
+				t += PROBE_NS;
+			poller_blocked(&p, t);
+		} else {
+			t += PROBE_NS;
+		}
+
+		while (next < NMESSAGES && arrivals[next] <= t) {
+			waits[next] = t - arrivals[next];
+			wait_sum += waits[next];
+			t += SERVICE_NS;
+			next++;
+			nwork++;
+		}
+
+		poller_done(&p, t, nwork);
+	}
+
+	qsort(waits, NMESSAGES, sizeof(waits[0]), cmp_nsec);
+
+	printf(" %10.0f %10lu %8.1f %8.1f %8.1f\n", wait_sum / NMESSAGES,
+	       (unsigned long)waits[NMESSAGES * 99 / 100],
+	       100.0 * (t - p.block_ns) / t, 100.0 * p.spin_ns / t,
+	       100.0 * NMESSAGES * SERVICE_NS / t);
+}
+
+int main(void)
+{
+	printf("Simulated hop of the %s service: %u ns wakeup, %u ns per "
+	       "message, %u us max spin\n", services[CART_SERVICE].name,
+	       WAKEUP_NS, SERVICE_NS, SPIN_US);
+	printf("%10s %10s %10s %8s %8s %8s\n", "gap us", "wait avg",
+	       "wait p99", "cpu %", "spin %", "work %");
+
+	for (unsigned g = 0; g < NGAPS; g++) {
+		printf("%10u\n", gaps_us[g]);
+		gen_arrivals(gaps_us[g]);
+		for (unsigned m = 0; m < NMODES; m++) {
+			printf("%10s", modes[m].name);
+			simulate(modes[m].mode);
+		}
+	}
+
+	return 0;
+}
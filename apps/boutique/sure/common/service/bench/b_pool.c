@@ -0,0 +1,128 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* Growth and shrinking of the coroutine pool of a core, on the host stand-in
+ * of libaco, where coroutines are allocated but never run. The pool grows to
+ * --max-coroutines, shrinks once the load drops and must be able to grow back
+ * to the maximum, whatever the order in which coroutines went idle: the
+ * shared stacks only have room for the coroutines beyond MIN_COROUTINES.
+ * Checks after every step that MIN_COROUTINES coroutines keep a private
+ * stack and that no shared stack has more than COROUTINES_PER_SHARED_STACK
+ * users.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+/* The stand-in, ahead of the libaco header pulled in by the framework */
+#include "libaco/aco.h"
+#include "service_async.h"
+
+#define MAX_POOL 256
+#define CYCLES 10000
+
+static struct coroutine *busy[MAX_POOL];
+static unsigned nbusy;
+
+static void fail(const char *what)
+{
+	fprintf(stderr, "%s: %u allocated, %u available, %u busy\n", what,
+		core->ncoroutines, core->n_available_cos, nbusy);
+	exit(1);
+}
+
+static void check(void)
+{
+	unsigned private = 0;
+
+	if (core->ncoroutines != core->n_available_cos + nbusy)
+		fail("Coroutines lost");
+
+	for (unsigned i = 0; i < MAX_POOL; i++) {
+		struct coroutine *co = core->coroutines[i];
+		if (co && !stack_is_shared(co->stack))
+			private++;
+	}
+	if (private != MIN_COROUTINES)
+		fail("Private stacks released");
+
+	for (unsigned i = 0; i < core->nshared_stacks; i++) {
+		if (core->shared_stacks[i].users > COROUTINES_PER_SHARED_STACK)
+			fail("Shared stack overcommitted");
+	}
+}
+
+/* Take coroutines until @n are busy, as requests come in */
+static void grow(unsigned n)
+{
+	while (nbusy < n) {
+		struct coroutine *co = get_coroutine();
+		if (!co)
+			fail("No coroutine below the maximum");
+		busy[nbusy++] = co;
+	}
+	check();
+}
+
+/* Make the coroutine in @i idle, as coroutine_fn() does when done */
+static void release(unsigned i)
+{
+	struct coroutine *co = busy[i];
+
+	busy[i] = busy[--nbusy];
+	core->available_cos[core->n_available_cos++] = co->id;
+}
+
+/* Let the busy coroutines go idle down to @n, in random order, and shrink */
+static void drop(unsigned n)
+{
+	while (nbusy > n)
+		release(rand() % nbusy);
+	shrink_coroutines();
+	check();
+}
+
+int main(void)
+{
+	core = &cores[0];
+	service_opts.max_coroutines = MAX_POOL;
+	coroutines_init();
+	check();
+
+	/* Idle with the private stacks on top of the available ones, the first
+	 * to go if the shrink did not tell them apart
+	 */
+	grow(MAX_POOL);
+	if (get_coroutine())
+		fail("Coroutine beyond the maximum");
+	for (unsigned i = nbusy; i-- > 0;) {
+		if (stack_is_shared(busy[i]->stack))
+			release(i);
+	}
+	while (nbusy)
+		release(nbusy - 1);
+	shrink_coroutines();
+	check();
+	if (core->ncoroutines != MIN_COROUTINES)
+		fail("Pool not shrunk");
+	grow(MAX_POOL);
+	drop(0);
+	printf("grow to %u, shrink to %u, grow to %u: ok\n", MAX_POOL,
+	       MIN_COROUTINES, MAX_POOL);
+
+	unsigned peak = 0;
+	srand(1);
+	for (unsigned c = 0; c < CYCLES; c++) {
+		unsigned n = rand() % (MAX_POOL + 1);
+		if (n > nbusy)
+			grow(n);
+		else
+			drop(n);
+		peak = MAX(peak, core->ncoroutines);
+	}
+	grow(MAX_POOL);
+	printf("%u random grow and shrink cycles, up to %u coroutines, then "
+	       "%u: ok\n", CYCLES, peak, MAX_POOL);
+
+	return 0;
+}
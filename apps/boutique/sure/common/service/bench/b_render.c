@@ -0,0 +1,286 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* Size and cost of the pages of the frontend, rendered as HTML and as JSON
+ * into shm buffers from models pointing into the responses of the downstream
+ * services, as the handlers build them: the 9 products of the catalog, a cart
+ * of CART_ITEMS products and an order of those. Checks that the Content-Length
+ * written in the head is the size of the body.
+ *
+ * Run with "dump" to print the pages.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+#include "service.h"
+#include "../../../frontend/pages.h"
+
+#define ITERATIONS 100000
+#define CART_ITEMS 3
+#define RECOMMENDATIONS 5
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static const struct {
+	const char *id, *name, *description, *picture;
+	int64_t units;
+	int32_t nanos;
+} catalog[] = {
+	{ "OLJCESPC7Z", "Sunglasses",
+	  "Add a modern touch to your outfits with these sleek aviator "
+	  "sunglasses.",
+	  "/static/img/products/sunglasses.jpg", 19, 990000000 },
+	{ "66VCHSJNUP", "Tank Top",
+	  "Perfectly cropped cotton tank, with a scooped neckline.",
+	  "/static/img/products/tank-top.jpg", 18, 990000000 },
+	{ "1YMWWN1N4O", "Watch",
+	  "This gold-tone stainless steel watch will work with most of your "
+	  "outfits.",
+	  "/static/img/products/watch.jpg", 109, 990000000 },
+	{ "L9ECAV7KIM", "Loafers",
+	  "A neat addition to your summer wardrobe.",
+	  "/static/img/products/loafers.jpg", 89, 990000000 },
+	{ "2ZYFJ3GM2N", "Hairdryer",
+	  "This lightweight hairdryer has 3 heat and speed settings. It's "
+	  "perfect for travel.",
+	  "/static/img/products/hairdryer.jpg", 24, 990000000 },
+	{ "0PUK6V6EV0", "Candle Holder",
+	  "This small but intricate candle holder is an excellent gift.",
+	  "/static/img/products/candle-holder.jpg", 18, 990000000 },
+	{ "LS4PSXUNUM", "Salt & Pepper Shakers",
+	  "Add some flavor to your kitchen.",
+	  "/static/img/products/salt-and-pepper-shakers.jpg", 18, 490000000 },
+	{ "9SIQT8TOJO", "Bamboo Glass Jar",
+	  "This bamboo glass jar can hold 57 oz (1.7 l) and is perfect for "
+	  "any kitchen.",
+	  "/static/img/products/bamboo-glass-jar.jpg", 5, 490000000 },
+	{ "6E92ZMYYFZ", "Mug",
+	  "A simple mug with a mustard interior.",
+	  "/static/img/products/mug.jpg", 8, 990000000 },
+};
+#define NPRODUCTS (sizeof(catalog) / sizeof(catalog[0]))
+
+/* Responses of the downstream services */
+static ListProductsResponse products;
+static GetSupportedCurrenciesResponse currencies = {
+	.num_currencies = 6,
+	.CurrencyCodes = { "EUR", "USD", "JPY", "GBP", "TRY", "CAD" },
+};
+static Cart cart;
+static ListRecommendationsResponse recommendations;
+static Ad ad = {
+	.RedirectUrl = "/product/2ZYFJ3GM2N",
+	.Text = "Hairdryer for sale. 50% off.",
+};
+static OrderResult order = {
+	.OrderId = "1f3c5e1a-8a53-11ee-b9d1-0242ac120002",
+	.ShippingTrackingId = "MZ-22417-90158911",
+	.ShippingCost = { "CAD", 11, 600000000 },
+};
+
+/* Price in CAD, as converted by the currency service */
+static Money price(const Product *p)
+{
+	Money m = { "CAD", p->PriceUsd.Units * 136 / 100,
+		    p->PriceUsd.Nanos / 100 * 136 % 1000000000 };
+
+	return m;
+}
+
+static void money_add(Money *total, const Money *m, int32_t quantity)
+{
+	int64_t nanos = total->Nanos + (int64_t)m->Nanos * quantity;
+
+	total->Units += m->Units * quantity + nanos / 1000000000;
+	total->Nanos = nanos % 1000000000;
+}
+
+static void fill_responses(void)
+{
+	products.num_products = NPRODUCTS;
+	for (unsigned i = 0; i < NPRODUCTS; i++) {
+		Product *p = &products.Products[i];
+
+		strcpy(p->Id, catalog[i].id);
+		strcpy(p->Name, catalog[i].name);
+		strcpy(p->Description, catalog[i].description);
+		strcpy(p->Picture, catalog[i].picture);
+		p->PriceUsd = (Money){ "USD", catalog[i].units,
+				       catalog[i].nanos };
+	}
+
+	cart.num_items = CART_ITEMS;
+	order.num_items = CART_ITEMS;
+	for (unsigned i = 0; i < CART_ITEMS; i++) {
+		strcpy(cart.Items[i].ProductId, catalog[i].id);
+		cart.Items[i].Quantity = i + 1;
+		order.Items[i].Item = cart.Items[i];
+		order.Items[i].Cost = price(&products.Products[i]);
+	}
+
+	recommendations.num_product_ids = RECOMMENDATIONS;
+	for (unsigned i = 0; i < RECOMMENDATIONS; i++)
+		strcpy(recommendations.product_ids[i],
+		       catalog[NPRODUCTS - 1 - i].id);
+}
+
+static struct page_header header = { .currency = "CAD",
+				     .currencies = &currencies };
+static struct home_page home;
+static struct product_page product;
+static struct cart_page cart_page;
+static struct order_page order_page;
+
+/* The models, as the handlers fill them */
+static void fill_models(void)
+{
+	header.cart_size = cart.num_items;
+
+	home = (struct home_page){ .header = &header, .ad = &ad };
+	home.nproducts = products.num_products;
+	for (unsigned i = 0; i < NPRODUCTS; i++) {
+		home.products[i].product = &products.Products[i];
+		home.products[i].price = price(&products.Products[i]);
+	}
+
+	product = (struct product_page){
+		.header = &header,
+		.product = &products.Products[4],
+		.price = price(&products.Products[4]),
+		.recommendations = &recommendations,
+		.ad = &ad,
+	};
+
+	cart_page = (struct cart_page){
+		.header = &header,
+		.nitems = cart.num_items,
+		.shipping = order.ShippingCost,
+		.total = order.ShippingCost,
+		.recommendations = &recommendations,
+	};
+	for (unsigned i = 0; i < CART_ITEMS; i++) {
+		struct cart_item *item = &cart_page.items[i];
+
+		item->product = &products.Products[i];
+		item->quantity = cart.Items[i].Quantity;
+		item->price = (Money){ "CAD", 0, 0 };
+		money_add(&item->price, &home.products[i].price,
+			  item->quantity);
+		money_add(&cart_page.total, &item->price, 1);
+	}
+
+	order_page = (struct order_page){
+		.header = &header,
+		.order = &order,
+		.total = cart_page.total,
+		.recommendations = &recommendations,
+	};
+}
+
+static const struct {
+	const char *name;
+	enum page page;
+	const void *model;
+} pages[] = {
+	{ "home", PAGE_HOME, &home },
+	{ "product", PAGE_PRODUCT, &product },
+	{ "cart", PAGE_CART, &cart_page },
+	{ "order", PAGE_ORDER, &order_page },
+};
+#define NPAGES (sizeof(pages) / sizeof(pages[0]))
+
+static void render_page(struct render_out *out, enum page page, int json,
+			const void *model)
+{
+	const struct render_template *t = page_template(page, json);
+
+	render_begin(out, t);
+	render(out, t, model);
+	if (render_end(out)) {
+		fprintf(stderr, "Page %d does not fit\n", page);
+		exit(1);
+	}
+}
+
+/* Size of the response, checking its Content-Length */
+static unsigned check(struct render_out *out, int dump)
+{
+	unsigned size = 0;
+	const char *head = out->descs[0].addr;
+	const char *end = memmem(head, out->descs[0].size, "\r\n\r\n", 4);
+	const char *length = memmem(head, out->descs[0].size, "Content-Length:",
+				    sizeof("Content-Length:") - 1);
+
+	for (unsigned i = 0; i < out->ndescs; i++) {
+		size += out->descs[i].size;
+		if (dump)
+			fwrite(out->descs[i].addr, 1, out->descs[i].size,
+			       stdout);
+	}
+
+	if (!end || !length
+	    || strtoul(length + sizeof("Content-Length:") - 1, NULL, 10)
+	       != size - (unsigned)(end + 4 - head)) {
+		fprintf(stderr, "Wrong Content-Length\n");
+		exit(1);
+	}
+
+	return size;
+}
+
+int main(int argc, char **argv)
+{
+	int dump = argc > 1 && !strcmp(argv[1], "dump");
+	struct render_out out;
+
+	fill_responses();
+	fill_models();
+	pages_init();
+
+	if (dump) {
+		for (unsigned p = 0; p < NPAGES; p++) {
+			for (int json = 0; json <= 1; json++) {
+				render_page(&out, pages[p].page, json,
+					    pages[p].model);
+				check(&out, 1);
+				render_put(&out);
+				printf("\n");
+			}
+		}
+		return 0;
+	}
+
+	printf("%-8s %-5s %7s %6s %10s %10s\n", "page", "type", "bytes",
+	       "descs", "ns/page", "ns/KB");
+
+	for (unsigned p = 0; p < NPAGES; p++) {
+		for (int json = 0; json <= 1; json++) {
+			render_page(&out, pages[p].page, json, pages[p].model);
+			unsigned size = check(&out, 0);
+			unsigned ndescs = out.ndescs;
+			render_put(&out);
+
+			double start = now_ns();
+			for (unsigned i = 0; i < ITERATIONS; i++) {
+				render_page(&out, pages[p].page, json,
+					    pages[p].model);
+				render_put(&out);
+			}
+			double ns = (now_ns() - start) / ITERATIONS;
+
+			printf("%-8s %-5s %7u %6u %10.1f %10.1f\n",
+			       pages[p].name, json ? "json" : "html", size,
+			       ndescs, ns, ns * 1024 / size);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Client-side balancing of a hot service scaled from 1 to 4 replicas: a
+ * caller core sends RPCs with exponential inter-arrival times and picks a
+ * replica for each with the balancer of the framework. Every replica serves
+ * its RPCs in order, mostly quickly but with a few slow ones, like a product
+ * catalog search among lookups. Offered load grows with the replicas so that
+ * each replica stays at the same utilization. Reports the throughput and the
+ * latency of the RPCs, from send to response, on a clock driven by the model.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "service.h"
+
+#define NRPCS 200000
+/* Service time: exponential with mean SERVICE_NS, SLOW_PERMIL per thousand
+ * RPCs SLOW_FACTOR times slower
+ */
+#define SERVICE_NS 2000
+#define SLOW_PERMIL 10
+#define SLOW_FACTOR 25
+/* Utilization of each replica */
+#define LOAD 0.8
+
+static const struct {
+	enum lb_policy policy;
+	const char *name;
+} policies[] = {
+	{ LB_RR, "rr" },
+	{ LB_LEAST, "least" },
+	{ LB_P2C, "p2c" },
+};
+#define NPOLICIES (sizeof(policies) / sizeof(policies[0]))
+
+static __nsec latencies[NRPCS];
+static __nsec arrivals[NRPCS];
+static __nsec service_times[NRPCS];
+/* Completion times of the RPCs queued at each replica, in order */
+static __nsec queues[MAX_REPLICAS][NRPCS];
+
+static uint64_t rand_state = 88172645463325252ULL;
+
+static double rand_uniform(void)
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+
+	return ((rand_state >> 11) + 0.5) / (double)(1ULL << 53);
+}
+
+/* Mean service time, accounting for the slow RPCs */
+static double mean_service_ns(void)
+{
+	return SERVICE_NS * (1 + SLOW_PERMIL * (SLOW_FACTOR - 1) / 1000.0);
+}
+
+static void gen_rpcs(unsigned nreplicas)
+{
+	double gap = mean_service_ns() / (LOAD * nreplicas);
+	double t = 0;
+
+	for (unsigned i = 0; i < NRPCS; i++) {
+		t += -log(rand_uniform()) * gap;
+		arrivals[i] = t;
+		service_times[i] = -log(rand_uniform()) * SERVICE_NS;
+		if (rand_uniform() * 1000 < SLOW_PERMIL)
+			service_times[i] *= SLOW_FACTOR;
+	}
+}
+
+static int cmp_nsec(const void *a, const void *b)
+{
+	__nsec x = *(const __nsec *)a, y = *(const __nsec *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void simulate(enum lb_policy policy, unsigned nreplicas)
+{
+	struct balancer b;
+	unsigned head[MAX_REPLICAS] = { 0 }, tail[MAX_REPLICAS] = { 0 };
+	__nsec end = 0;
+	double latency_sum = 0;
+
+	/* Replicas queue all they get, no credits */
+	balancer_init(&b, policy, nreplicas, NRPCS, 1);
+
+	for (unsigned i = 0; i < NRPCS; i++) {
+		__nsec now = arrivals[i];
+
+		/* Responses received by now */
+		for (unsigned r = 0; r < nreplicas; r++) {
+			while (head[r] < tail[r] && queues[r][head[r]] <= now) {
+				head[r]++;
+				balancer_done(&b, r);
+			}
+		}
+
+		unsigned r = balancer_pick(&b);
+		__nsec start = tail[r] > head[r]
+			       ? MAX(queues[r][tail[r] - 1], now) : now;
+		__nsec done = start + service_times[i];
+
+		queues[r][tail[r]++] = done;
+		balancer_sent(&b, r);
+		latencies[i] = done - now;
+		latency_sum += latencies[i];
+		end = MAX(end, done);
+	}
+
+	qsort(latencies, NRPCS, sizeof(latencies[0]), cmp_nsec);
+
+	printf(" %10.0f %10.0f %10lu %10lu\n", NRPCS * 1e9 / end,
+	       latency_sum / NRPCS, (unsigned long)latencies[NRPCS / 2],
+	       (unsigned long)latencies[NRPCS * 99 / 100]);
+}
+
+int main(void)
+{
+	printf("Hot %s service: %.0f ns per RPC on average, %u%% RPCs %ux "
+	       "slower, %.0f%% load per replica\n",
+	       services[PRODUCTCATALOG_SERVICE].name, mean_service_ns(),
+	       SLOW_PERMIL / 10, SLOW_FACTOR, LOAD * 100);
+	printf("%10s %10s %10s %10s %10s %10s\n", "replicas", "balancing",
+	       "rpc/s", "avg ns", "p50 ns", "p99 ns");
+
+	for (unsigned n = 1; n <= MAX_REPLICAS; n++) {
+		printf("%10u\n", n);
+		gen_rpcs(n);
+		for (unsigned p = 0; p < NPOLICIES; p++) {
+			printf("%10s %10s", "", policies[p].name);
+			simulate(policies[p].policy, n);
+		}
+	}
+
+	return 0;
+}
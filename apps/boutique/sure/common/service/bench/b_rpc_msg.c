@@ -0,0 +1,259 @@
+/*
+ * Reassembly of received RPCs as scatter-gather views over the descs they
+ * arrived in, read in place or linearized on demand, against the copying
+ * reassembly they replaced
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include "service.h"
+
+#define ITERATIONS 100000
+#define RUNS 9
+/* Messages sent back to back in a stream of descs */
+#define NMSGS 4
+#define MAX_DESCS 128
+
+/* Desc sizes, the first one delivers every message in a desc of its own */
+static const unsigned frag_sizes[] = { 0, 3000, 1500, 1024, 512, 100 };
+#define NFRAG_SIZES (sizeof(frag_sizes) / sizeof(frag_sizes[0]))
+
+#define MSG_SIZE (sizeof(struct rpc) + sizeof(ListProductsResponse))
+#define STREAM_SIZE (NMSGS * MSG_SIZE)
+/* Offset of a field past the first descs */
+#define PRICE_OFF (sizeof(struct rpc)					\
+		   + offsetof(ListProductsResponse, Products[8].PriceUsd))
+
+static char stream[STREAM_SIZE];
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* The copying reassembly: a message that fills a desc of its own is taken in
+ * place, any other is copied into a buffer of its own as its bytes arrive
+ */
+struct pending_buffer {
+	struct unimsg_shm_desc desc;
+	unsigned expected_sz;
+};
+
+static int copy_process_desc(struct pending_buffer *pending,
+			     struct unimsg_shm_desc *desc)
+{
+	if (!pending->desc.addr) {
+		pending->expected_sz = rpc_expected_size(desc->addr,
+							 desc->size);
+		if (pending->expected_sz
+		    && desc->size == pending->expected_sz) {
+			pending->desc = *desc;
+			desc->size = 0;
+			return 1;
+		}
+		unimsg_buffer_get(&pending->desc, 1);
+		pending->desc.size = 0;
+	}
+
+	while (desc->size && (!pending->expected_sz
+			      || pending->desc.size < pending->expected_sz)) {
+		unsigned needed = pending->expected_sz
+				  ? pending->expected_sz : sizeof(struct rpc);
+		unsigned n = MIN(needed - pending->desc.size, desc->size);
+
+		memcpy(pending->desc.addr + pending->desc.size, desc->addr, n);
+		pending->desc.size += n;
+		desc->addr += n;
+		desc->off += n;
+		desc->size -= n;
+		if (!pending->expected_sz) {
+			pending->expected_sz =
+				rpc_expected_size(pending->desc.addr,
+						  pending->desc.size);
+		}
+	}
+
+	if (desc->size == 0)
+		unimsg_buffer_put(desc, 1);
+
+	return pending->expected_sz
+	       && pending->desc.size == pending->expected_sz;
+}
+
+/* Split the stream in descs of @frag_size bytes, as received */
+static unsigned deliver(struct unimsg_shm_desc *descs, unsigned frag_size)
+{
+	unsigned ndescs = (STREAM_SIZE + frag_size - 1) / frag_size;
+
+	unimsg_buffer_get(descs, ndescs);
+	for (unsigned i = 0; i < ndescs; i++) {
+		unsigned off = i * frag_size;
+		descs[i].size = MIN(frag_size, STREAM_SIZE - off);
+		memcpy(descs[i].addr, stream + off, descs[i].size);
+	}
+
+	return ndescs;
+}
+
+static void check_msg(struct rpc_msg *msg, unsigned n, unsigned frag_size)
+{
+	static char buf[MSG_SIZE];
+
+	rpc_msg_read(msg, 0, buf, msg->size);
+	if (msg->size != MSG_SIZE
+	    || memcmp(buf, stream + n * MSG_SIZE, MSG_SIZE)) {
+		fprintf(stderr, "Message %u of descs of %u B reassembled "
+			"wrong\n", n, frag_size);
+		exit(1);
+	}
+}
+
+static void check_desc(struct unimsg_shm_desc *desc, unsigned n,
+		       unsigned frag_size)
+{
+	struct rpc_msg msg;
+
+	rpc_msg_init(&msg, desc);
+	check_msg(&msg, n, frag_size);
+}
+
+/* Price of the last product of the message, read in place */
+static int64_t read_price(struct rpc_msg *msg)
+{
+	Money *price = rpc_msg_ptr(msg, PRICE_OFF, sizeof(*price));
+	Money copy;
+
+	if (!price) {
+		rpc_msg_read(msg, PRICE_OFF, &copy, sizeof(copy));
+		price = &copy;
+	}
+
+	return price->Units;
+}
+
+enum mode { MODE_DELIVER, MODE_COPY, MODE_VIEW, MODE_LINEARIZE, NMODES };
+
+static const char *const mode_names[NMODES] = {
+	"deliver", "copy", "view", "linearize"
+};
+
+/* Reassemble the stream and read a field of every message, checking them if
+ * @check
+ */
+static int64_t reassemble(enum mode mode, unsigned frag_size, int check)
+{
+	struct unimsg_shm_desc descs[MAX_DESCS];
+	struct pending_buffer pending = { 0 };
+	struct rpc_msg msg = { 0 };
+	unsigned nmsgs = 0;
+	int64_t sum = 0;
+
+	unsigned ndescs = deliver(descs, frag_size);
+	if (mode == MODE_DELIVER) {
+		unimsg_buffer_put(descs, ndescs);
+		return ndescs;
+	}
+
+	for (unsigned i = 0; i < ndescs; ) {
+		struct unimsg_shm_desc desc;
+
+		if (mode == MODE_COPY) {
+			if (copy_process_desc(&pending, &descs[i])) {
+				desc = pending.desc;
+				pending.desc.addr = NULL;
+				Money *price = desc.addr + PRICE_OFF;
+				sum += price->Units;
+				if (check)
+					check_desc(&desc, nmsgs, frag_size);
+				unimsg_buffer_put(&desc, 1);
+				nmsgs++;
+			}
+		} else if (process_desc(&msg, &descs[i])) {
+			if (mode == MODE_VIEW) {
+				sum += read_price(&msg);
+				if (check)
+					check_msg(&msg, nmsgs, frag_size);
+				rpc_msg_put(&msg);
+			} else {
+				rpc_msg_take(&msg, &desc);
+				Money *price = desc.addr + PRICE_OFF;
+				sum += price->Units;
+				if (check)
+					check_desc(&desc, nmsgs, frag_size);
+				unimsg_buffer_put(&desc, 1);
+			}
+			nmsgs++;
+		}
+		if (descs[i].size == 0)
+			i++;
+	}
+
+	if (check && (nmsgs != NMSGS || pending.desc.addr || msg.nfrags)) {
+		fprintf(stderr, "%u messages reassembled from descs of %u B\n",
+			nmsgs, frag_size);
+		exit(1);
+	}
+
+	return sum;
+}
+
+int main(void)
+{
+	double start, ns[NMODES];
+	int64_t sum = 0;
+
+	for (unsigned m = 0; m < NMSGS; m++) {
+		struct rpc *rpc = (struct rpc *)(stream + m * MSG_SIZE);
+		rpc->command = PRODUCTCATALOG_LIST_PRODUCTS;
+		rpc->id = m;
+		ListProductsResponse *res = (ListProductsResponse *)rpc->rr;
+		res->num_products = 9;
+		for (int i = 0; i < 9; i++)
+			res->Products[i].PriceUsd.Units = m * 10 + i + 1;
+	}
+
+	printf("%u B ListProducts responses of the %s service, %u back to "
+	       "back, ns per message\n", (unsigned)MSG_SIZE,
+	       services[PRODUCTCATALOG_SERVICE].name, NMSGS);
+	printf("%10s %8s", "desc size", "descs");
+	for (unsigned m = 0; m < NMODES; m++)
+		printf(" %10s", mode_names[m]);
+	printf("\n");
+
+	for (unsigned i = 0; i < NFRAG_SIZES; i++) {
+		unsigned frag_size = frag_sizes[i] ? frag_sizes[i] : MSG_SIZE;
+
+		for (unsigned m = MODE_COPY; m < NMODES; m++)
+			reassemble(m, frag_size, 1);
+
+		/* Best of a few runs, the modes taking turns */
+		for (unsigned m = 0; m < NMODES; m++)
+			ns[m] = 0;
+		for (unsigned r = 0; r < RUNS; r++) {
+			for (unsigned m = 0; m < NMODES; m++) {
+				start = now_ns();
+				for (unsigned it = 0; it < ITERATIONS; it++)
+					sum += reassemble(m, frag_size, 0);
+				double t = (now_ns() - start)
+					   / ITERATIONS / NMSGS;
+				if (!ns[m] || t < ns[m])
+					ns[m] = t;
+			}
+		}
+
+		/* Delivery is common to all, report the reassembly only */
+		printf("%10u %8u %10.1f", frag_size,
+		       (unsigned)(STREAM_SIZE + frag_size - 1) / frag_size,
+		       ns[MODE_DELIVER]);
+		for (unsigned m = MODE_COPY; m < NMODES; m++)
+			printf(" %10.1f", ns[m] - ns[MODE_DELIVER]);
+		printf("\n");
+	}
+
+	/* Keep the reads alive */
+	return sum == 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* Host stand-in for libaco: coroutines and shared stacks are allocated and
+ * released like the real ones but never run, enough to exercise the pool of
+ * the service framework. Uses the include guard of libaco so that it wins
+ * over a fetched one when included first.
+ */
+
+#ifndef ACO_H
+#define ACO_H
+
+#include <stdlib.h>
+
+typedef void (*aco_cofuncp_t)(void);
+
+typedef struct {
+	size_t sz;
+	unsigned users;
+} aco_share_stack_t;
+
+typedef struct aco_s {
+	aco_share_stack_t *share_stack;
+	void *arg;
+} aco_t;
+
+static inline void aco_thread_init(aco_cofuncp_t fn)
+{
+}
+
+static inline aco_share_stack_t *aco_share_stack_new(size_t sz)
+{
+	aco_share_stack_t *stack = calloc(1, sizeof(*stack));
+
+	if (!stack)
+		abort();
+	stack->sz = sz;
+
+	return stack;
+}
+
+/* Destroying a stack still in use is a bug of the caller */
+static inline void aco_share_stack_destroy(aco_share_stack_t *stack)
+{
+	if (stack->users)
+		abort();
+	free(stack);
+}
+
+static inline aco_t *aco_create(aco_t *main_co, aco_share_stack_t *stack,
+				size_t save_sz, aco_cofuncp_t fn, void *arg)
+{
+	aco_t *co = calloc(1, sizeof(*co));
+
+	if (!co)
+		abort();
+	/* Only the main coroutine goes without a stack */
+	if (main_co && !stack)
+		abort();
+	co->share_stack = stack;
+	co->arg = arg;
+	if (stack)
+		stack->users++;
+
+	return co;
+}
+
+static inline void aco_destroy(aco_t *co)
+{
+	if (co->share_stack)
+		co->share_stack->users--;
+	free(co);
+}
+
+static inline void aco_resume(aco_t *co)
+{
+	abort();
+}
+
+static inline void aco_yield(void)
+{
+	abort();
+}
+
+static inline void *aco_get_arg(void)
+{
+	abort();
+}
+
+static inline void aco_exit(void)
+{
+	abort();
+}
+
+#endif /* ACO_H */
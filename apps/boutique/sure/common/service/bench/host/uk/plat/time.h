@@ -0,0 +1,25 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* Host stand-in for the monotonic clock of Unikraft */
+
+#ifndef __HOST_UK_PLAT_TIME__
+#define __HOST_UK_PLAT_TIME__
+
+#include <stdint.h>
+#include <time.h>
+
+typedef uint64_t __nsec;
+
+#define ukarch_time_sec_to_nsec(s) ((__nsec)(s) * 1000000000ULL)
+
+static inline __nsec ukplat_monotonic_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ukarch_time_sec_to_nsec(ts.tv_sec) + ts.tv_nsec;
+}
+
+#endif /* __HOST_UK_PLAT_TIME__ */
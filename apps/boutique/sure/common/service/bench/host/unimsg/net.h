@@ -0,0 +1,139 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* Host stand-in for the descriptor and buffer API of unimsg, enough to run
+ * the message handling code of the service framework in a process.
+ */
+
+#ifndef __HOST_UNIMSG_NET__
+#define __HOST_UNIMSG_NET__
+
+#include <errno.h>
+#include <stdint.h>
+
+#define UNIMSG_MAX_NSOCKS 64
+#define UNIMSG_MAX_DESCS_BULK 16
+#define UNIMSG_BUFFER_SIZE 4096
+#define UNIMSG_BUFFER_HEADROOM 64
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+struct unimsg_shm_desc {
+	void *addr;
+	unsigned size;
+	unsigned off;
+	unsigned idx;
+};
+
+/* Like the shm area of unimsg, buffers are UNIMSG_BUFFER_SIZE slots of one
+ * region, handed out and recycled in LIFO order
+ */
+#define HOST_NBUFFERS 256
+
+static char host_buffers[HOST_NBUFFERS][UNIMSG_BUFFER_SIZE]
+	__attribute__((aligned(UNIMSG_BUFFER_SIZE)));
+static unsigned host_free_buffers[HOST_NBUFFERS];
+static unsigned host_nfree_buffers;
+static int host_buffers_ready;
+
+static inline int unimsg_buffer_get(struct unimsg_shm_desc *descs,
+				    unsigned ndescs)
+{
+	if (!host_buffers_ready) {
+		for (unsigned i = 0; i < HOST_NBUFFERS; i++)
+			host_free_buffers[i] = HOST_NBUFFERS - 1 - i;
+		host_nfree_buffers = HOST_NBUFFERS;
+		host_buffers_ready = 1;
+	}
+
+	if (ndescs > host_nfree_buffers)
+		return -ENOMEM;
+
+	for (unsigned i = 0; i < ndescs; i++) {
+		unsigned idx = host_free_buffers[--host_nfree_buffers];
+		descs[i].addr = host_buffers[idx] + UNIMSG_BUFFER_HEADROOM;
+		descs[i].off = UNIMSG_BUFFER_HEADROOM;
+		descs[i].size = UNIMSG_BUFFER_SIZE - UNIMSG_BUFFER_HEADROOM;
+		descs[i].idx = idx;
+	}
+
+	return 0;
+}
+
+static inline void unimsg_buffer_put(struct unimsg_shm_desc *descs,
+				     unsigned ndescs)
+{
+	for (unsigned i = 0; i < ndescs; i++)
+		host_free_buffers[host_nfree_buffers++] = descs[i].idx;
+}
+
+/* Point the desc back to the whole payload of its buffer */
+static inline void unimsg_buffer_reset(struct unimsg_shm_desc *desc)
+{
+	desc->addr = host_buffers[desc->idx] + UNIMSG_BUFFER_HEADROOM;
+	desc->off = UNIMSG_BUFFER_HEADROOM;
+	desc->size = UNIMSG_BUFFER_SIZE - UNIMSG_BUFFER_HEADROOM;
+}
+
+/* Sockets are not emulated, the benchmarks never use them */
+struct unimsg_sock;
+
+static inline int unimsg_socket(struct unimsg_sock **s)
+{
+	return -ENOSYS;
+}
+
+static inline int unimsg_close(struct unimsg_sock *s)
+{
+	return -ENOSYS;
+}
+
+static inline int unimsg_bind(struct unimsg_sock *s, uint16_t port)
+{
+	return -ENOSYS;
+}
+
+static inline int unimsg_listen(struct unimsg_sock *s)
+{
+	return -ENOSYS;
+}
+
+static inline int unimsg_accept(struct unimsg_sock *s, struct unimsg_sock **n,
+				int nonblock)
+{
+	return -ENOSYS;
+}
+
+static inline int unimsg_connect(struct unimsg_sock *s, uint32_t addr,
+				 uint16_t port)
+{
+	return -ENOSYS;
+}
+
+static inline int unimsg_send(struct unimsg_sock *s,
+			      struct unimsg_shm_desc *descs, unsigned ndescs,
+			      int nonblock)
+{
+	return -ENOSYS;
+}
+
+static inline int unimsg_recv(struct unimsg_sock *s,
+			      struct unimsg_shm_desc *descs, unsigned *ndescs,
+			      int nonblock)
+{
+	return -ENOSYS;
+}
+
+static inline int unimsg_poll(struct unimsg_sock **socks, unsigned nsocks,
+			      int *ready)
+{
+	return -ENOSYS;
+}
+
+#endif /* __HOST_UNIMSG_NET__ */
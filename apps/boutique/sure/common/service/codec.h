@@ -0,0 +1,122 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* Compact wire encoding of RPC messages. Fields are written in struct order
+ * with no padding: integers as varints (signed ones zigzag-encoded), strings
+ * as their length followed by their bytes, without the terminator, and arrays
+ * with a count as the count followed by that many elements. Nested structs are
+ * inlined. The encoders and decoders of the messages are generated in
+ * message_codec.h by gen_rpc.py, these are their building blocks.
+ */
+
+#ifndef __CODEC__
+#define __CODEC__
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+/* Input of a decoder. Reads past the end or of malformed values set err and
+ * return zeroes, so that decoders check for errors only once at the end.
+ */
+struct codec_in {
+	const uint8_t *p;
+	const uint8_t *end;
+	int err;
+};
+
+static inline uint8_t *codec_put_uvarint(uint8_t *p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+
+	return p;
+}
+
+static inline uint8_t *codec_put_svarint(uint8_t *p, int64_t v)
+{
+	return codec_put_uvarint(p, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+/* Strings are not trusted to be terminated within their field */
+static inline uint8_t *codec_put_str(uint8_t *p, const char *s, unsigned size)
+{
+	unsigned len = strnlen(s, size - 1);
+
+	p = codec_put_uvarint(p, len);
+	memcpy(p, s, len);
+
+	return p + len;
+}
+
+/* Number of elements to encode for a count of @n over arrays of @max */
+static inline unsigned codec_count(int64_t n, unsigned max)
+{
+	return n < 0 ? 0 : MIN((uint64_t)n, max);
+}
+
+static inline void codec_fail(struct codec_in *in)
+{
+	in->err = 1;
+	in->p = in->end;
+}
+
+static inline uint64_t codec_get_uvarint(struct codec_in *in)
+{
+	uint64_t v = 0;
+
+	/* Counts, lengths and most values fit in a byte */
+	if (in->p < in->end && *in->p < 0x80)
+		return *in->p++;
+
+	for (unsigned shift = 0; shift < 64 && in->p < in->end; shift += 7) {
+		uint8_t b = *in->p++;
+		v |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return v;
+	}
+
+	codec_fail(in);
+	return 0;
+}
+
+static inline int64_t codec_get_svarint(struct codec_in *in)
+{
+	uint64_t v = codec_get_uvarint(in);
+
+	return (v >> 1) ^ -(v & 1);
+}
+
+static inline void codec_get_str(struct codec_in *in, char *s, unsigned size)
+{
+	uint64_t len = codec_get_uvarint(in);
+
+	if (len >= size || len > (uint64_t)(in->end - in->p)) {
+		codec_fail(in);
+		len = 0;
+	}
+	memcpy(s, in->p, len);
+	s[len] = 0;
+	in->p += len;
+}
+
+static inline unsigned codec_get_count(struct codec_in *in, unsigned max)
+{
+	uint64_t n = codec_get_uvarint(in);
+
+	if (n > max) {
+		codec_fail(in);
+		return 0;
+	}
+
+	return n;
+}
+
+#endif /* __CODEC__ */
@@ -0,0 +1,677 @@
+#!/usr/bin/python3
+
+# Compiles boutique.idl, the RPCs of the services, into:
+# - message_types.h: the structs of the messages, the RR structs of the
+#   commands and enum command;
+# - rpc_stubs.h: the size of the RPCs of each command, the handler tables of
+#   the services and the stubs filling in requests;
+# - message_codec.h: the encoders and decoders of the compact wire encoding
+#   (see codec.h).
+#
+# The body of an RPC is its request, or its response if the request is Empty,
+# or the RR struct of the command, named after the request with RR in place of
+# Request, holding the request as req and the response as res. Responses are
+# written in place of the request, in the same body.
+#
+# Counts are the fields named num_*, each counts the array fields that follow
+# it in its struct. Arrays with no count are encoded in full.
+#
+# Run it again after changing boutique.idl.
+
+import os
+import re
+import sys
+
+curdir = os.path.dirname(os.path.abspath(__file__))
+
+IDL = curdir + '/boutique.idl'
+TYPES_H = curdir + '/message_types.h'
+STUBS_H = curdir + '/rpc_stubs.h'
+CODEC_H = curdir + '/message_codec.h'
+
+HEADER = '/* Generated by gen_rpc.py from boutique.idl, do not edit */\n\n'
+
+# Scalar types of the IDL: C type, signed, max size of the encoding
+IDL_SCALARS = {
+	'int32': 'int32_t',
+	'int64': 'int64_t',
+	'uint32': 'uint32_t',
+}
+SCALARS = {
+	'int32_t': (True, 5),
+	'int64_t': (True, 10),
+	'uint32_t': (False, 5),
+}
+
+def varint_size(v):
+	n = 1
+	while v >= 0x80:
+		v >>= 7
+		n += 1
+	return n
+
+class Field:
+	def __init__(self, ctype, name, dims, defines, doc):
+		self.ctype = ctype
+		self.name = name
+		# Symbolic and numeric dimensions
+		self.dims = dims
+		self.ndims = [eval_dim(d, defines) for d in dims]
+		# Count field of the array, if any
+		self.count = None
+		self.doc = doc
+
+	def is_array(self):
+		return len(self.dims) == (2 if self.ctype == 'char' else 1)
+
+def eval_dim(dim, defines):
+	return int(defines.get(dim, dim))
+
+class Message:
+	def __init__(self, name, fields, doc):
+		self.name = name
+		self.fields = fields
+		self.doc = doc
+
+class Rpc:
+	def __init__(self, service, name, req, res, number, doc):
+		self.service = service
+		self.name = name
+		self.req = req
+		self.res = res
+		self.number = number
+		self.doc = doc
+		self.command = None
+		# Struct of the body, members for the request and response
+		self.body = None
+		self.parts = None
+
+class Service:
+	def __init__(self, name, doc):
+		self.name = name
+		self.doc = doc
+		self.options = {}
+		self.rpcs = []
+
+	# Name without the Service suffix
+	def short_name(self):
+		return self.name[:-len('Service')] if self.name.endswith('Service') \
+		       else self.name
+
+TOKEN = re.compile(r'\s*(?:(//.*)|(\w+)|("[^"]*")|([{}()<>;=]))')
+
+def tokenize(text):
+	tokens = []
+	for lineno, line in enumerate(text.split('\n'), 1):
+		pos = 0
+		while line[pos:].strip():
+			m = TOKEN.match(line, pos)
+			if not m:
+				sys.exit(f'boutique.idl:{lineno}: syntax error')
+			if m.group(1) is not None:
+				tokens.append(('comment', m.group(1)[2:], lineno))
+			elif m.group(2) is not None:
+				tokens.append(('word', m.group(2), lineno))
+			elif m.group(3) is not None:
+				tokens.append(('string', m.group(3)[1:-1], lineno))
+			else:
+				tokens.append(('punct', m.group(4), lineno))
+			pos = m.end()
+	return tokens
+
+class Parser:
+	def __init__(self, text):
+		self.tokens = tokenize(text)
+		self.pos = 0
+		# Comments since the last declaration
+		self.comments = []
+
+	def peek(self):
+		while self.pos < len(self.tokens) \
+		      and self.tokens[self.pos][0] == 'comment':
+			_, text, line = self.tokens[self.pos]
+			self.comments.append((line, text))
+			self.pos += 1
+		if self.pos == len(self.tokens):
+			return (None, None, self.tokens[-1][2] if self.tokens else 0)
+		return self.tokens[self.pos]
+
+	def next(self):
+		tok = self.peek()
+		if tok[0] is None:
+			sys.exit('boutique.idl: unexpected end of file')
+		self.pos += 1
+		return tok
+
+	def error(self, line, msg):
+		sys.exit(f'boutique.idl:{line}: {msg}')
+
+	def expect(self, value):
+		kind, v, line = self.next()
+		if v != value or kind == 'string':
+			self.error(line, f'expected "{value}", got "{v}"')
+
+	def word(self):
+		kind, v, line = self.next()
+		if kind != 'word':
+			self.error(line, f'expected a name, got "{v}"')
+		return v
+
+	def string(self):
+		kind, v, line = self.next()
+		if kind != 'string':
+			self.error(line, f'expected a string, got "{v}"')
+		return v
+
+	def accept(self, value):
+		kind, v, _ = self.peek()
+		if v == value and kind != 'string':
+			self.pos += 1
+			return True
+		return False
+
+	# Comment lines right above @line, the doc of the declaration there
+	def doc(self, line):
+		lines = []
+		for l, text in reversed(self.comments):
+			if l != line - 1 - len(lines):
+				break
+			lines.insert(0, text[1:] if text.startswith(' ') else text)
+		self.comments = []
+		return lines
+
+	# Dimension between angle brackets, a constant or a number
+	def dim(self, defines):
+		self.expect('<')
+		_, d, line = self.next()
+		if d not in defines and not d.isdigit():
+			self.error(line, f'unknown size {d}')
+		self.expect('>')
+		return d
+
+def parse_idl():
+	p = Parser(open(IDL).read())
+	defines = {}
+	messages = {}
+	services = []
+
+	while p.peek()[0] is not None:
+		_, kw, line = p.next()
+		doc = p.doc(line)
+		if kw == 'const':
+			name = p.word()
+			p.expect('=')
+			value = p.word()
+			if not value.isdigit():
+				p.error(line, f'{name} is not a number')
+			p.expect(';')
+			defines[name] = value
+		elif kw == 'message':
+			name = p.word()
+			if name in messages or name == 'Empty':
+				p.error(line, f'{name} redefined')
+			p.expect('{')
+			fields = []
+			while not p.accept('}'):
+				fields.append(parse_field(p, name, defines, messages))
+			messages[name] = Message(name, fields, doc)
+		elif kw == 'service':
+			s = Service(p.word(), doc)
+			p.expect('{')
+			while not p.accept('}'):
+				parse_service_item(p, s)
+			services.append(s)
+		else:
+			p.error(line, f'unexpected "{kw}"')
+
+	return defines, messages, services
+
+def parse_field(p, msg, defines, messages):
+	_, kw, line = p.peek()
+	doc = p.doc(line)
+	dims = []
+	if p.accept('repeated'):
+		dims.append(p.dim(defines))
+	kind, t, _ = p.next()
+	if t == 'string':
+		dims.append(p.dim(defines))
+		ctype = 'char'
+	elif t in IDL_SCALARS:
+		ctype = IDL_SCALARS[t]
+	elif t in messages:
+		ctype = t
+	else:
+		p.error(line, f'{msg}: unknown type {t}')
+	name = p.word()
+	p.expect(';')
+
+	return Field(ctype, name, dims, defines, doc)
+
+def parse_service_item(p, s):
+	_, kw, line = p.next()
+	doc = p.doc(line)
+	if kw == 'option':
+		name = p.word()
+		p.expect('=')
+		s.options[name] = p.string()
+		p.expect(';')
+	elif kw == 'rpc':
+		name = p.word()
+		p.expect('(')
+		req = p.word()
+		p.expect(')')
+		p.expect('returns')
+		p.expect('(')
+		res = p.word()
+		p.expect(')')
+		p.expect('=')
+		number = p.word()
+		if not number.isdigit():
+			p.error(line, f'{name}: bad command number {number}')
+		p.expect(';')
+		s.rpcs.append(Rpc(s, name, req, res, int(number), doc))
+	else:
+		p.error(line, f'{s.name}: unexpected "{kw}"')
+
+def upper_snake(name):
+	return re.sub(r'(?<=[a-z0-9])(?=[A-Z])', '_', name).upper()
+
+def lower_snake(name):
+	return upper_snake(name).lower()
+
+def lower_camel(name):
+	return name[0].lower() + name[1:]
+
+# Resolve the counts of the arrays of the messages, the commands and the
+# bodies of the RPCs. Returns the RR structs to define and the RPCs ordered by
+# command number.
+def check(messages, services):
+	for m in messages.values():
+		count = None
+		for f in m.fields:
+			if f.ctype == 'char' and len(f.dims) > 2 \
+			   or f.ctype != 'char' and len(f.dims) > 1:
+				sys.exit(f'{m.name}.{f.name}: unsupported array')
+			if f.name.startswith('num_'):
+				if f.ctype not in SCALARS or f.dims:
+					sys.exit(f'{m.name}.{f.name}: count is '
+						 f'not a scalar')
+				count = f
+			elif f.is_array():
+				f.count = count
+
+	rrs = []
+	rpcs = {}
+	for s in services:
+		prefix = s.options.get('command_prefix',
+				       s.short_name().upper())
+		for r in s.rpcs:
+			for t in (r.req, r.res):
+				if t != 'Empty' and t not in messages:
+					sys.exit(f'{s.name}.{r.name}: unknown '
+						 f'message {t}')
+			if r.number in rpcs:
+				sys.exit(f'{s.name}.{r.name}: command number '
+					 f'{r.number} already used')
+			rpcs[r.number] = r
+			r.command = f'{prefix}_{upper_snake(r.name)}'
+
+			if r.req == 'Empty' and r.res == 'Empty':
+				sys.exit(f'{s.name}.{r.name}: empty request and '
+					 f'response')
+			elif r.req == 'Empty':
+				r.body = r.res
+				r.parts = (None, (r.res, 'rr'))
+			elif r.res == 'Empty':
+				r.body = r.req
+				r.parts = ((r.req, 'rr'), None)
+			else:
+				if not r.req.endswith('Request'):
+					sys.exit(f'{s.name}.{r.name}: cannot name '
+						 f'the RR struct of {r.req}')
+				r.body = r.req[:-len('Request')] + 'RR'
+				if r.body in messages:
+					sys.exit(f'{s.name}.{r.name}: {r.body} '
+						 f'is a message')
+				r.parts = ((r.req, '&rr->req'), (r.res, '&rr->res'))
+				rrs.append(r)
+
+	if sorted(rpcs) != list(range(len(rpcs))):
+		sys.exit('Command numbers are not 0 to the number of rpcs - 1')
+
+	return rrs, [rpcs[n] for n in sorted(rpcs)]
+
+def c_comment(lines, indent):
+	if not lines:
+		return ''
+	if len(lines) == 1:
+		return f'{indent}/* {lines[0]} */\n'
+	out = f'{indent}/* {lines[0]}\n'
+	for line in lines[1:]:
+		out += f'{indent} *{" " + line if line else ""}\n'
+	return out + f'{indent} */\n'
+
+def field_decl(f):
+	ctype = f.ctype
+	dims = ''.join(f'[{d}]' for d in f.dims)
+	return f'\t{ctype} {f.name}{dims};\n'
+
+# Messages, each after the messages it contains
+def ordered(messages):
+	seen = []
+	def visit(name):
+		for f in messages[name].fields:
+			if f.ctype in messages:
+				visit(f.ctype)
+		if name not in seen:
+			seen.append(name)
+	for name in messages:
+		visit(name)
+	return seen
+
+def emit_types(defines, messages, rrs, rpcs):
+	out = open(TYPES_H, 'w')
+	out.write(HEADER +
+		  '#ifndef __MESSAGE_TYPES__\n'
+		  '#define __MESSAGE_TYPES__\n\n'
+		  '#include <stdint.h>\n\n')
+	width = max(len(name) for name in defines)
+	for name, value in defines.items():
+		out.write(f'#define {name.ljust(width)} {value}\n')
+	out.write('\n')
+
+	for name in ordered(messages):
+		m = messages[name]
+		out.write(c_comment(m.doc, '') +
+			  f'typedef struct _{lower_camel(name)} {{\n')
+		for f in m.fields:
+			out.write(c_comment(f.doc, '\t') + field_decl(f))
+		out.write(f'}} {name};\n\n')
+
+	for r in rrs:
+		out.write(f'/* Body of {r.service.name}.{r.name} */\n'
+			  f'typedef struct _{lower_camel(r.body)} {{\n'
+			  f'\t{r.req} req;\n'
+			  f'\t{r.res} res;\n'
+			  f'}} {r.body};\n\n')
+
+	out.write('enum command {\n')
+	for r in rpcs:
+		out.write(f'\t{r.command},\n')
+	out.write('\tNUM_COMMANDS\n};\n\n'
+		  '#endif /* __MESSAGE_TYPES__ */\n')
+	out.close()
+
+# Designated initializer of an array, wrapped after the index if too long
+def initializer(index, value):
+	line = f'\t[{index}] = {value},'
+	if len(line.expandtabs()) <= 80:
+		return line + '\n'
+	return f'\t[{index}] =\n\t\t{value},\n'
+
+def emit_stubs(services, rpcs):
+	out = open(STUBS_H, 'w')
+	out.write(HEADER +
+		  '#ifndef __RPC_STUBS__\n'
+		  '#define __RPC_STUBS__\n\n'
+		  '#include <stddef.h>\n'
+		  '#include <unimsg/net.h>\n'
+		  '#include "message.h"\n\n'
+		  '/* Size of the RPCs of each command, header included */\n'
+		  'static const size_t rpc_sizes[NUM_COMMANDS] '
+		  '__attribute__((unused)) = {\n')
+	for r in rpcs:
+		out.write(initializer(r.command, f'sizeof(struct rpc) + '
+						 f'sizeof({r.body})'))
+	out.write('};\n\n'
+		  '/* Name of each command, as Service.Rpc */\n'
+		  'static const char *const rpc_command_names[NUM_COMMANDS]\n'
+		  '__attribute__((unused)) = {\n')
+	for r in rpcs:
+		out.write(initializer(r.command, f'"{r.service.short_name()}.'
+						 f'{r.name}"'))
+	out.write('};\n\n'
+		  '/* Handler of a request, called on the body of the RPC, '
+		  'where it leaves\n'
+		  ' * the response\n'
+		  ' */\n'
+		  'typedef void (*rpc_handler_t)(void *body);\n\n'
+		  '/* Handlers of the commands served, registered with the '
+		  'register_*() of\n'
+		  ' * their service, NULL for the rest\n'
+		  ' */\n'
+		  'static rpc_handler_t rpc_handlers[NUM_COMMANDS] '
+		  '__attribute__((unused));\n\n')
+
+	for s in services:
+		sname = lower_snake(s.short_name())
+		out.write(c_comment(s.doc, '') +
+			  f'struct {sname}_handlers {{\n')
+		for r in s.rpcs:
+			out.write(c_comment(r.doc, '\t') +
+				  f'\tvoid (*{r.name})({r.body} *body);\n')
+		out.write('};\n\n'
+			  f'/* Serve the RPCs of {s.name} with the handlers in '
+			  f'@h,\n'
+			  f' * NULL ones being unimplemented\n'
+			  f' */\n' +
+			  signature('inline void ', f'register_{sname}_service',
+				    f'const struct {sname}_handlers *h') +
+			  '{\n')
+		for r in s.rpcs:
+			line = f'\trpc_handlers[{r.command}] ='
+			if len(f'{line} (rpc_handler_t)h->{r.name};'
+			       .expandtabs()) > 80:
+				line += '\n\t\t'
+			else:
+				line += ' '
+			out.write(f'{line}(rpc_handler_t)h->{r.name};\n')
+		out.write('}\n\n')
+
+		for r in s.rpcs:
+			fn = f'rpc_{sname}_{lower_snake(r.name)}'
+			out.write(f'/* Start a request to {s.name}.{r.name}\n'
+				  f' * in the buffer of @desc, returns its body '
+				  f'to fill in\n'
+				  f' */\n' +
+				  signature(f'inline {r.body} *', fn,
+					    'struct unimsg_shm_desc *desc') +
+				  '{\n'
+				  '\tstruct rpc *rpc = desc->addr;\n\n'
+				  f'\trpc->command = {r.command};\n'
+				  f'\tdesc->size = rpc_sizes[{r.command}];\n\n'
+				  f'\treturn ({r.body} *)rpc->rr;\n'
+				  '}\n\n')
+
+	out.write('#endif /* __RPC_STUBS__ */\n')
+	out.close()
+
+def max_size(structs, ctype):
+	if ctype in SCALARS:
+		return SCALARS[ctype][1]
+	size = 0
+	for f in structs[ctype]:
+		if f.ctype == 'char':
+			elem = varint_size(f.ndims[-1] - 1) + f.ndims[-1] - 1
+			n = f.ndims[0] if f.is_array() else 1
+		else:
+			elem = max_size(structs, f.ctype)
+			n = f.ndims[0] if f.dims else 1
+		size += elem * n
+	return size
+
+def reachable(structs, commands):
+	seen = []
+	def visit(name):
+		for f in structs[name]:
+			if f.ctype in structs:
+				visit(f.ctype)
+		if name not in seen:
+			seen.append(name)
+	for _, _, parts in commands:
+		for part in parts:
+			if part:
+				visit(part[0])
+	return seen
+
+def count_var(f):
+	return 'n_' + f.name[4:]
+
+# Max value of a count, the smallest size of the arrays it counts
+def count_bound(count, fields):
+	dims = sorted(set(f.dims[0] for f in fields if f.count is count))
+	if not dims:
+		sys.exit(f'{count.name} counts no array')
+	bound = dims[-1]
+	for d in reversed(dims[:-1]):
+		bound = f'MIN({d}, {bound})'
+	return bound
+
+# Signature of a function, wrapped after the return type if too long
+def signature(ret, fn, params):
+	line = f'static {ret}{fn}({params})'
+	if len(line.expandtabs()) <= 80:
+		return line + '\n'
+	return f'static {ret.rstrip()}\n{fn}({params})\n'
+
+def emit_encoder(out, name, fields):
+	out.write(signature('uint8_t *', f'encode_{name}',
+			    f'uint8_t *p, const {name} *m') + '{\n')
+	for f in fields:
+		if f.name.startswith('num_'):
+			out.write(f'\tunsigned {count_var(f)} = '
+				  f'codec_count(m->{f.name}, '
+				  f'{count_bound(f, fields)});\n'
+				  f'\tp = codec_put_uvarint(p, {count_var(f)});\n')
+			continue
+
+		elem = f'm->{f.name}'
+		if f.is_array():
+			n = count_var(f.count) if f.count else f.dims[0]
+			out.write(f'\tfor (unsigned i = 0; i < {n}; i++)\n\t')
+			elem += '[i]'
+		if f.ctype == 'char':
+			out.write(f'\tp = codec_put_str(p, {elem}, '
+				  f'sizeof({elem}));\n')
+		elif f.ctype in SCALARS:
+			kind = 's' if SCALARS[f.ctype][0] else 'u'
+			out.write(f'\tp = codec_put_{kind}varint(p, {elem});\n')
+		else:
+			out.write(f'\tp = encode_{f.ctype}(p, &{elem});\n')
+	out.write('\n\treturn p;\n}\n\n')
+
+def emit_decoder(out, name, fields):
+	out.write(signature('void ', f'decode_{name}',
+			    f'struct codec_in *in, {name} *m') + '{\n')
+	for f in fields:
+		if f.name.startswith('num_'):
+			out.write(f'\tunsigned {count_var(f)} = '
+				  f'codec_get_count(in, '
+				  f'{count_bound(f, fields)});\n'
+				  f'\tm->{f.name} = {count_var(f)};\n')
+			continue
+
+		elem = f'm->{f.name}'
+		if f.is_array():
+			n = count_var(f.count) if f.count else f.dims[0]
+			out.write(f'\tfor (unsigned i = 0; i < {n}; i++)\n\t')
+			elem += '[i]'
+		if f.ctype == 'char':
+			out.write(f'\tcodec_get_str(in, {elem}, sizeof({elem}));\n')
+		elif f.ctype in SCALARS:
+			kind = 's' if SCALARS[f.ctype][0] else 'u'
+			out.write(f'\t{elem} = codec_get_{kind}varint(in);\n')
+		else:
+			out.write(f'\tdecode_{f.ctype}(in, &{elem});\n')
+	out.write('}\n\n')
+
+def emit_dispatch(out, commands, encode):
+	if encode:
+		out.write('/* Encode the request (@res 0) or the response (@res 1) '
+			  'in the struct body\n'
+			  ' * @body of an RPC of @command to @p. Returns the end '
+			  'of the encoding.\n'
+			  ' */\n'
+			  'static uint8_t *codec_encode(enum command command, '
+			  'int res, const void *body,\n'
+			  '\t\t\t     uint8_t *p)\n'
+			  '{\n')
+	else:
+		out.write('/* Decode the request (@res 0) or the response (@res 1) '
+			  'of an RPC of\n'
+			  ' * @command from the @size bytes at @p to the struct '
+			  'body @body. The rest\n'
+			  ' * of the body is left untouched. Returns 0 on success, '
+			  '-1 if the encoding\n'
+			  ' * is malformed.\n'
+			  ' */\n'
+			  'static int codec_decode(enum command command, int res, '
+			  'const uint8_t *p,\n'
+			  '\t\t\tunsigned size, void *body)\n'
+			  '{\n'
+			  '\tstruct codec_in in = { p, p + size, 0 };\n\n')
+	out.write('\tswitch (command) {\n')
+	const = 'const ' if encode else ''
+	for command, body, (req, res) in commands:
+		out.write(f'\tcase {command}: {{\n'
+			  f'\t\t{const}{body} *rr = body;\n')
+		calls = []
+		for part in (req, res):
+			if not part:
+				calls.append(None)
+			elif encode:
+				calls.append(f'p = encode_{part[0]}(p, {part[1]});')
+			else:
+				calls.append(f'decode_{part[0]}(&in, {part[1]});')
+		if calls[0] and calls[1]:
+			out.write(f'\t\tif (res)\n\t\t\t{calls[1]}\n'
+				  f'\t\telse\n\t\t\t{calls[0]}\n')
+		elif calls[0]:
+			out.write(f'\t\tif (!res)\n\t\t\t{calls[0]}\n')
+		elif calls[1]:
+			out.write(f'\t\tif (res)\n\t\t\t{calls[1]}\n')
+		if not (calls[0] or calls[1]):
+			out.write('\t\t(void)rr;\n')
+		out.write('\t\tbreak;\n\t}\n')
+	if encode:
+		out.write('\tdefault:\n\t\tbreak;\n\t}\n\n\treturn p;\n}\n\n')
+	else:
+		out.write('\tdefault:\n\t\treturn -1;\n\t}\n\n'
+			  '\treturn in.err || in.p != in.end ? -1 : 0;\n}\n\n')
+
+def emit_codec(messages, rpcs):
+	structs = {name: m.fields for name, m in messages.items()}
+	commands = [(r.command, r.body, r.parts) for r in rpcs]
+
+	body_max = 0
+	for _, _, parts in commands:
+		for part in parts:
+			if part:
+				body_max = max(body_max, max_size(structs, part[0]))
+
+	out = open(CODEC_H, 'w')
+	out.write(HEADER +
+		  '#ifndef __MESSAGE_CODEC__\n'
+		  '#define __MESSAGE_CODEC__\n\n'
+		  '#include "codec.h"\n'
+		  '#include "message.h"\n\n'
+		  '/* Max size of an encoded request or response */\n'
+		  f'#define CODEC_MAX_SIZE {body_max}\n\n')
+	for name in reachable(structs, commands):
+		emit_encoder(out, name, structs[name])
+		emit_decoder(out, name, structs[name])
+	emit_dispatch(out, commands, True)
+	emit_dispatch(out, commands, False)
+	out.write('#endif /* __MESSAGE_CODEC__ */\n')
+	out.close()
+
+def main():
+	defines, messages, services = parse_idl()
+	rrs, rpcs = check(messages, services)
+
+	emit_types(defines, messages, rrs, rpcs)
+	emit_stubs(services, rpcs)
+	emit_codec(messages, rpcs)
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,755 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* HTTP/1.1 requests received by the frontend, parsed in place: the parser
+ * never writes to the buffer (no NUL terminators) and the parts of a request
+ * are kept as offsets and lengths from its start, which stay valid when the
+ * request is copied to a buffer of its own. The newlines of the head are found
+ * in a single pass, 16 bytes at a time with SSE2 where available, and only
+ * the few headers that matter are looked at past their first letter.
+ *
+ * Requests are framed by their head and their Content-Length: the framework
+ * splits pipelined requests and joins those spanning descs before handing
+ * them to the frontend (see handle_upstream_http()), which routes them with a
+ * trie built once from a table of routes and decodes their form bodies in a
+ * single pass.
+ */
+
+#ifndef __HTTP__
+#define __HTTP__
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unimsg/net.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Largest body accepted, larger Content-Lengths are malformed */
+#define HTTP_MAX_CONTENT_LENGTH (1U << 20)
+/* Nodes of a router, enough for the characters of all its paths */
+#define HTTP_ROUTER_MAX_NODES 128
+/* Descs a response can span, sent back to back */
+#define HTTP_MAX_RESPONSE_DESCS UNIMSG_MAX_DESCS_BULK
+
+enum http_method {
+	HTTP_GET,
+	HTTP_POST,
+	HTTP_HEAD,
+	HTTP_PUT,
+	HTTP_DELETE,
+	HTTP_NMETHODS,
+	/* Methods not routed */
+	HTTP_OTHER = HTTP_NMETHODS,
+};
+
+/* Part of a request, from its start */
+struct http_str {
+	uint32_t off;
+	uint32_t len;
+};
+
+struct http_request {
+	/* Start of the request, set when it is handed to the handler */
+	const char *base;
+	enum http_method method;
+	/* Target split at the '?', without it */
+	struct http_str path;
+	struct http_str query;
+	struct http_str body;
+	/* Head and body */
+	uint32_t size;
+	/* The client accepts JSON (Accept: application/json) */
+	int accept_json;
+	/* Request answered with an error without being handled, like a
+	 * malformed or oversized one, 0 if none
+	 */
+	int error;
+};
+
+typedef void (*http_handler_t)(struct unimsg_shm_desc *desc,
+			       const struct http_request *req);
+
+static inline const char *http_ptr(const struct http_request *req,
+				   struct http_str s)
+{
+	return req->base + s.off;
+}
+
+/* Whether @s is the string @lit */
+static inline int http_str_eq(const struct http_request *req,
+			      struct http_str s, const char *lit)
+{
+	return s.len == strlen(lit) && !memcmp(http_ptr(req, s), lit, s.len);
+}
+
+/* First byte equal to @c in [@p, @end), @end if none. Whole blocks are
+ * loaded up to @limit, the end of the buffer, so that the short ranges of the
+ * request line and headers are scanned in one go too.
+ */
+static inline const char *http_scan(const char *p, const char *end,
+				    const char *limit, char c)
+{
+#if defined(__SSE2__)
+	__m128i needle = _mm_set1_epi8(c);
+
+	for (; p < end && limit - p >= 16; p += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i *)p);
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block,
+								  needle));
+		if (mask)
+			return p + __builtin_ctz(mask) < end
+			       ? p + __builtin_ctz(mask) : end;
+	}
+#endif
+	for (; p < end; p++) {
+		if (*p == c)
+			return p;
+	}
+
+	return end;
+}
+
+static inline const char *http_find(const char *p, const char *end, char c)
+{
+	return http_scan(p, end, end, c);
+}
+
+/* Starts of the lines of a buffer, found from the newlines of a block of 64
+ * bytes at a time and handed out one by one, so that a head is scanned once
+ * however many lines it has
+ */
+struct http_lines {
+	/* Start of the buffer, bounds the load of the last bytes */
+	const char *start;
+	const char *block;
+	const char *end;
+	/* Starts of the block not handed out yet, bit i for block[i] */
+	uint64_t mask;
+	/* The previous block was full and ended with a newline */
+	unsigned carry;
+};
+
+#if defined(__SSE2__)
+static inline unsigned http_newlines16(const char *p)
+{
+	__m128i b = _mm_loadu_si128((const __m128i *)p);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(b, _mm_set1_epi8('\n')));
+}
+#endif
+
+static inline void http_lines_fill(struct http_lines *l)
+{
+	unsigned n = l->end - l->block < 64 ? l->end - l->block : 64;
+	uint64_t nl = 0;
+	unsigned i = 0;
+
+#if defined(__SSE2__)
+	for (; i + 16 <= n; i += 16)
+		nl |= (uint64_t)http_newlines16(l->block + i) << i;
+	/* The last bytes with a load ending at the end of the buffer */
+	if (i < n && l->end - l->start >= 16) {
+		nl |= (uint64_t)(http_newlines16(l->end - 16)
+				 >> (16 - (n - i))) << i;
+		i = n;
+	}
+#endif
+	for (; i < n; i++) {
+		if (l->block[i] == '\n')
+			nl |= 1ULL << i;
+	}
+
+	/* A line starting right after a full block is left to the next one */
+	l->mask = nl << 1 | l->carry;
+	l->carry = n == 64 ? nl >> 63 : 0;
+}
+
+/* Hand out the starts of the lines of [@p, @end) but @p */
+static inline void http_lines_init(struct http_lines *l, const char *p,
+				   const char *end)
+{
+	l->start = p;
+	l->block = p;
+	l->end = end;
+	l->carry = 0;
+	l->mask = 0;
+	if (p < end)
+		http_lines_fill(l);
+}
+
+/* Start of the next line, @l->end for a newline ending the buffer, NULL if
+ * none
+ */
+static inline const char *http_lines_next(struct http_lines *l)
+{
+	while (!l->mask) {
+		l->block += 64;
+		if (l->block >= l->end) {
+			const char *p = l->carry ? l->end : NULL;
+			l->carry = 0;
+			return p;
+		}
+		http_lines_fill(l);
+	}
+
+	const char *p = l->block + __builtin_ctzll(l->mask);
+	l->mask &= l->mask - 1;
+
+	return p;
+}
+
+/* Value of the header line at @p, before @end, if it is named @lit,
+ * lowercase, without its leading whitespace, NULL otherwise. The name is
+ * matched in place, ignoring the case of ASCII letters, without looking for
+ * the colon or the end of the line.
+ */
+static inline const char *http_header(const char *p, const char *end,
+				      const char *lit)
+{
+	unsigned len = strlen(lit);
+
+	if (end - p <= len || p[len] != ':')
+		return NULL;
+	for (unsigned i = 0; i < len; i++) {
+		if ((p[i] | 0x20) != lit[i])
+			return NULL;
+	}
+
+	const char *v = p + len + 1;
+	while (v < end && (*v == ' ' || *v == '\t'))
+		v++;
+
+	return v;
+}
+
+static inline enum http_method http_method(const char *p, unsigned len)
+{
+	switch (len) {
+	case 3:
+		if (!memcmp(p, "GET", 3))
+			return HTTP_GET;
+		if (!memcmp(p, "PUT", 3))
+			return HTTP_PUT;
+		break;
+	case 4:
+		if (!memcmp(p, "POST", 4))
+			return HTTP_POST;
+		if (!memcmp(p, "HEAD", 4))
+			return HTTP_HEAD;
+		break;
+	case 6:
+		if (!memcmp(p, "DELETE", 6))
+			return HTTP_DELETE;
+		break;
+	}
+
+	return HTTP_OTHER;
+}
+
+/* Parse the HTTP/1.1 request at the start of the @len bytes at @buf into
+ * @req. Returns the size of the request, head and body, once the head is
+ * complete, which is larger than @len if the body is not, 0 if the head is
+ * not complete and -EBADMSG if the request is malformed or uses features that
+ * are not supported (chunked bodies).
+ */
+static inline int http_parse(const char *buf, unsigned len,
+			     struct http_request *req)
+{
+	const char *end = buf + len;
+	unsigned long content_length = 0;
+	struct http_lines lines;
+	const char *p, *v;
+	uint32_t head;
+
+	req->accept_json = 0;
+
+	/* Request line: METHOD SP target SP version CRLF. The version is
+	 * HTTP/1.x, so the target ends right before it, without a scan.
+	 */
+	http_lines_init(&lines, buf, end);
+	p = http_lines_next(&lines);
+	if (!p)
+		return 0;
+	const char *eol = p - 1;
+
+	const char *version = (eol > buf && eol[-1] == '\r' ? eol - 1 : eol)
+			      - 8;
+	if (version - buf < 4 || version[-1] != ' '
+	    || memcmp(version, "HTTP/1.", 7))
+		return -EBADMSG;
+	const char *sp = version - 1;
+
+	const char *target;
+	if (!memcmp(buf, "GET ", 4)) {
+		req->method = HTTP_GET;
+		target = buf + 4;
+	} else {
+		const char *msp = http_scan(buf, sp, end, ' ');
+		if (msp == sp || msp == buf)
+			return -EBADMSG;
+		req->method = http_method(buf, msp - buf);
+		target = msp + 1;
+	}
+	if (target == sp || *target != '/')
+		return -EBADMSG;
+
+	const char *q = http_scan(target, sp, end, '?');
+	req->path = (struct http_str){ target - buf, q - target };
+	req->query = q == sp ? (struct http_str){ sp - buf, 0 }
+			     : (struct http_str){ q + 1 - buf, sp - q - 1 };
+
+	/* Headers, up to an empty line. Only the framing ones matter, the
+	 * others are skipped on their first letter.
+	 */
+	for (;; p = http_lines_next(&lines)) {
+		if (!p || p == end)
+			return 0;
+
+		if (*p == '\n') {
+			head = p + 1 - buf;
+			break;
+		}
+		if (*p == '\r') {
+			if (p + 1 == end)
+				return 0;
+			if (p[1] != '\n')
+				return -EBADMSG;
+			head = p + 2 - buf;
+			break;
+		}
+
+		switch (*p | 0x20) {
+		case 'c':
+			v = http_header(p, end, "content-length");
+			if (!v)
+				break;
+			content_length = 0;
+			for (p = v; p < end && *p >= '0' && *p <= '9'; p++) {
+				content_length = content_length * 10
+						 + (*p - '0');
+				if (content_length > HTTP_MAX_CONTENT_LENGTH)
+					return -EBADMSG;
+			}
+			while (p < end && (*p == ' ' || *p == '\t'))
+				p++;
+			if (p == end)
+				return 0;
+			if (p == v || (*p != '\r' && *p != '\n'))
+				return -EBADMSG;
+			break;
+		case 't':
+			if (http_header(p, end, "transfer-encoding"))
+				return -EBADMSG;
+			break;
+		case 'a':
+			v = http_header(p, end, "accept");
+			if (!v)
+				break;
+			eol = http_find(v, end, '\n');
+			for (; (v = http_scan(v, eol, end, '/')) + 5 <= eol;
+			     v++) {
+				if (!memcmp(v, "/json", 5))
+					req->accept_json = 1;
+			}
+			break;
+		}
+	}
+
+	req->body = (struct http_str){ head, content_length };
+	req->size = head + content_length;
+	req->error = 0;
+
+	return req->size;
+}
+
+/* ---------------- Form bodies ---------------- */
+
+enum http_form_type {
+	/* NUL-terminated string of at most size - 1 characters */
+	HTTP_FORM_STR,
+	/* int32_t */
+	HTTP_FORM_INT,
+};
+
+struct http_form_field {
+	const char *name;
+	enum http_form_type type;
+	void *dst;
+	/* Size of the string at @dst, NUL included */
+	unsigned size;
+};
+
+static inline int http_hex(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+
+	return -1;
+}
+
+/* Decode the URL-encoded @len bytes at @p into the NUL-terminated string
+ * @dst of @size bytes. Returns -EBADMSG if the value is malformed or does not
+ * fit.
+ */
+static inline int http_form_str(const char *p, unsigned len, char *dst,
+				unsigned size)
+{
+	const char *end = p + len;
+	unsigned n = 0;
+
+	while (p < end) {
+		char c = *p++;
+
+		if (c == '+') {
+			c = ' ';
+		} else if (c == '%') {
+			int hi, lo;
+			if (end - p < 2 || (hi = http_hex(p[0])) < 0
+			    || (lo = http_hex(p[1])) < 0)
+				return -EBADMSG;
+			c = hi << 4 | lo;
+			p += 2;
+		}
+
+		if (n + 1 >= size)
+			return -EBADMSG;
+		dst[n++] = c;
+	}
+	dst[n] = 0;
+
+	return 0;
+}
+
+static inline int http_form_int(const char *p, unsigned len, int32_t *dst)
+{
+	const char *end = p + len;
+	int neg = p < end && *p == '-';
+	int64_t v = 0;
+
+	p += neg;
+	if (p == end)
+		return -EBADMSG;
+
+	for (; p < end; p++) {
+		if (*p < '0' || *p > '9')
+			return -EBADMSG;
+		v = v * 10 + (*p - '0');
+		if (v > (int64_t)INT32_MAX + neg)
+			return -EBADMSG;
+	}
+	*dst = neg ? -v : v;
+
+	return 0;
+}
+
+/* Decode the application/x-www-form-urlencoded @len bytes at @p in a single
+ * pass, straight into the destinations of the @nfields @fields, at most 32.
+ * Unknown names are skipped. Returns the mask of the fields found, with bit i
+ * for @fields[i], or -EBADMSG if a value is malformed or does not fit.
+ */
+static inline int http_form_decode(const char *p, unsigned len,
+				   const struct http_form_field *fields,
+				   unsigned nfields)
+{
+	const char *end = p + len;
+	uint32_t found = 0;
+
+	while (p < end) {
+		const char *amp = http_find(p, end, '&');
+		const char *eq = http_find(p, amp, '=');
+		const char *v = eq < amp ? eq + 1 : amp;
+
+		for (unsigned i = 0; i < nfields; i++) {
+			const struct http_form_field *f = &fields[i];
+			int rc;
+
+			if (strlen(f->name) != (size_t)(eq - p)
+			    || memcmp(f->name, p, eq - p))
+				continue;
+
+			if (f->type == HTTP_FORM_STR)
+				rc = http_form_str(v, amp - v, f->dst, f->size);
+			else
+				rc = http_form_int(v, amp - v, f->dst);
+			if (rc)
+				return rc;
+			found |= 1U << i;
+			break;
+		}
+
+		p = amp + 1;
+	}
+
+	return found;
+}
+
+/* ---------------- Routing ---------------- */
+
+/* Handler of a route, @param is the rest of the path matched by a trailing
+ * '*' of the route, empty otherwise
+ */
+typedef void (*http_route_handler_t)(struct unimsg_shm_desc *desc,
+				     const struct http_request *req,
+				     struct http_str param);
+
+struct http_route {
+	enum http_method method;
+	/* Path to match exactly, or a prefix of the path if it ends with '*' */
+	const char *path;
+	http_route_handler_t handler;
+};
+
+/* Node of the trie of the paths. The children of a node are next to each
+ * other from @child, their characters at the same indexes in the keys of the
+ * router, so that finding the one for a character is a scan of a few bytes
+ * rather than a chase of links. Routes are indexes in the table of routes, -1
+ * if none.
+ *
+ * A chain of nodes with a single child and no routes is walked in one go:
+ * the @run characters from the node, its own and those of the chain after it,
+ * up to 8, lead to the node @end. They are compared as a word, @label holding
+ * them in memory order and @label_mask the bytes they take.
+ */
+struct http_trie_node {
+	uint8_t child;
+	uint8_t nkids;
+	uint8_t run;
+	uint8_t end;
+	/* Route of each method ending at this node, and route matching any
+	 * path going on from this node
+	 */
+	int8_t exact[HTTP_NMETHODS];
+	int8_t prefix[HTTP_NMETHODS];
+	uint64_t label;
+	uint64_t label_mask;
+};
+
+_Static_assert(HTTP_ROUTER_MAX_NODES <= 256, "Trie links must fit in 8 bits");
+
+struct http_router {
+	const struct http_route *routes;
+	struct http_trie_node nodes[HTTP_ROUTER_MAX_NODES];
+	char keys[HTTP_ROUTER_MAX_NODES];
+	unsigned nnodes;
+};
+
+/* Node of the trie while it is built, children linked from the first one */
+struct http_trie_build {
+	char c;
+	uint8_t child;
+	uint8_t sibling;
+	int8_t exact[HTTP_NMETHODS];
+	int8_t prefix[HTTP_NMETHODS];
+};
+
+static inline unsigned http_trie_new(struct http_trie_build *b,
+				     unsigned *nnodes, char c)
+{
+	if (*nnodes == HTTP_ROUTER_MAX_NODES) {
+		fprintf(stderr, "Too many routes, the trie is full\n");
+		exit(1);
+	}
+
+	struct http_trie_build *n = &b[*nnodes];
+	n->c = c;
+	n->child = 0;
+	n->sibling = 0;
+	memset(n->exact, -1, sizeof(n->exact));
+	memset(n->prefix, -1, sizeof(n->prefix));
+
+	return (*nnodes)++;
+}
+
+static inline int http_trie_routed(const struct http_trie_node *n)
+{
+	for (unsigned i = 0; i < HTTP_NMETHODS; i++) {
+		if (n->exact[i] >= 0 || n->prefix[i] >= 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Build the trie of the @nroutes @routes, which must stay around. Routes are
+ * checked once here, a path routed twice for a method is an error.
+ */
+static inline void http_router_init(struct http_router *r,
+				    const struct http_route *routes,
+				    unsigned nroutes)
+{
+	struct http_trie_build b[HTTP_ROUTER_MAX_NODES];
+	uint8_t order[HTTP_ROUTER_MAX_NODES];
+	unsigned nnodes = 0;
+
+	if (nroutes > INT8_MAX) {
+		fprintf(stderr, "Too many routes\n");
+		exit(1);
+	}
+
+	http_trie_new(b, &nnodes, 0);
+
+	for (unsigned i = 0; i < nroutes; i++) {
+		const char *path = routes[i].path;
+		size_t len = strlen(path);
+		int prefix = len && path[len - 1] == '*';
+		unsigned node = 0;
+
+		if (routes[i].method >= HTTP_NMETHODS) {
+			fprintf(stderr, "Route %s has no method\n", path);
+			exit(1);
+		}
+
+		for (size_t k = 0; k < len - prefix; k++) {
+			unsigned child = b[node].child;
+
+			while (child && b[child].c != path[k])
+				child = b[child].sibling;
+			if (!child) {
+				child = http_trie_new(b, &nnodes, path[k]);
+				b[child].sibling = b[node].child;
+				b[node].child = child;
+			}
+			node = child;
+		}
+
+		int8_t *slot = prefix ? &b[node].prefix[routes[i].method]
+				      : &b[node].exact[routes[i].method];
+		if (*slot >= 0) {
+			fprintf(stderr, "Route %s defined twice\n", path);
+			exit(1);
+		}
+		*slot = i;
+	}
+
+	/* Lay the children of each node out next to each other, breadth
+	 * first: @order maps the nodes of the router to the built ones
+	 */
+	r->routes = routes;
+	r->nnodes = 1;
+	order[0] = 0;
+	for (unsigned i = 0; i < r->nnodes; i++) {
+		const struct http_trie_build *o = &b[order[i]];
+		struct http_trie_node *n = &r->nodes[i];
+
+		n->child = o->child ? r->nnodes : 0;
+		n->nkids = 0;
+		memcpy(n->exact, o->exact, sizeof(n->exact));
+		memcpy(n->prefix, o->prefix, sizeof(n->prefix));
+		r->keys[i] = o->c;
+		for (unsigned c = o->child; c; c = b[c].sibling) {
+			order[r->nnodes++] = c;
+			n->nkids++;
+		}
+	}
+
+	/* The runs from each node but the root, which no run leads to */
+	r->nodes[0].run = 0;
+	r->nodes[0].end = 0;
+	r->nodes[0].label = 0;
+	r->nodes[0].label_mask = 0;
+	for (unsigned i = 1; i < r->nnodes; i++) {
+		struct http_trie_node *n = &r->nodes[i];
+		const struct http_trie_node *m = n;
+		char label[sizeof(n->label)] = { r->keys[i] };
+		char mask[sizeof(n->label)] = { (char)0xff };
+
+		n->run = 1;
+		while (m->nkids == 1 && !http_trie_routed(m)
+		       && n->run < sizeof(label)) {
+			label[n->run] = r->keys[m->child];
+			mask[n->run] = (char)0xff;
+			m = &r->nodes[m->child];
+			n->run++;
+		}
+		n->end = m - r->nodes;
+		memcpy(&n->label, label, sizeof(label));
+		memcpy(&n->label_mask, mask, sizeof(mask));
+	}
+}
+
+/* Whether the run of @n is at @p, the 8 bytes at @p are loaded at once */
+static inline int http_label_eq(const char *p, const struct http_trie_node *n)
+{
+	uint64_t word;
+
+	memcpy(&word, p, sizeof(word));
+
+	return (word & n->label_mask) == n->label;
+}
+
+/* Route of @req, NULL if none. Exact routes win over prefix ones and longer
+ * prefixes over shorter ones. Sets @param to the part of the path matched by
+ * the '*' of a prefix route. The path is read 8 bytes at a time, which stays
+ * within the request line as parsed by http_parse(): the version that follows
+ * the path is longer than that.
+ */
+static inline const struct http_route *
+http_router_match(const struct http_router *r, const struct http_request *req,
+		  struct http_str *param)
+{
+	const char *path = http_ptr(req, req->path);
+	unsigned method = req->method;
+	unsigned node = 0;
+	int best = -1;
+	unsigned best_len = 0;
+
+	if (method >= HTTP_NMETHODS)
+		return NULL;
+
+	for (unsigned k = 0;;) {
+		const struct http_trie_node *n = &r->nodes[node];
+
+		if (n->prefix[method] >= 0) {
+			best = n->prefix[method];
+			best_len = k;
+		}
+		if (k == req->path.len) {
+			if (n->exact[method] >= 0) {
+				*param = (struct http_str){ req->path.off
+							    + k, 0 };
+				return &r->routes[(int)n->exact[method]];
+			}
+			break;
+		}
+
+		unsigned i = 0;
+		while (i < n->nkids && r->keys[n->child + i] != path[k])
+			i++;
+		if (i == n->nkids)
+			break;
+
+		const struct http_trie_node *m = &r->nodes[n->child + i];
+		if (req->path.len - k < m->run || !http_label_eq(path + k, m))
+			break;
+		node = m->end;
+		k += m->run;
+	}
+
+	if (best < 0)
+		return NULL;
+
+	*param = (struct http_str){ req->path.off + best_len,
+				    req->path.len - best_len };
+
+	return &r->routes[best];
+}
+
+/* Replace the request in @desc with the response @msg */
+static inline void http_reply(struct unimsg_shm_desc *desc, const char *msg)
+{
+	size_t len = strlen(msg);
+
+	unimsg_buffer_reset(desc);
+	memcpy(desc->addr, msg, len);
+	desc->size = len;
+}
+
+#endif /* __HTTP__ */
@@ -0,0 +1,1048 @@
+/* Generated by gen_rpc.py from boutique.idl, do not edit */
+
+#ifndef __MESSAGE_CODEC__
+#define __MESSAGE_CODEC__
+
+#include "codec.h"
+#include "message.h"
+
+/* Max size of an encoded request or response */
+#define CODEC_MAX_SIZE 2650
+
+static uint8_t *encode_CartItem(uint8_t *p, const CartItem *m)
+{
+	p = codec_put_str(p, m->ProductId, sizeof(m->ProductId));
+	p = codec_put_svarint(p, m->Quantity);
+
+	return p;
+}
+
+static void decode_CartItem(struct codec_in *in, CartItem *m)
+{
+	codec_get_str(in, m->ProductId, sizeof(m->ProductId));
+	m->Quantity = codec_get_svarint(in);
+}
+
+static uint8_t *encode_AddItemRequest(uint8_t *p, const AddItemRequest *m)
+{
+	p = codec_put_str(p, m->UserId, sizeof(m->UserId));
+	p = encode_CartItem(p, &m->Item);
+
+	return p;
+}
+
+static void decode_AddItemRequest(struct codec_in *in, AddItemRequest *m)
+{
+	codec_get_str(in, m->UserId, sizeof(m->UserId));
+	decode_CartItem(in, &m->Item);
+}
+
+static uint8_t *encode_GetCartRequest(uint8_t *p, const GetCartRequest *m)
+{
+	p = codec_put_str(p, m->UserId, sizeof(m->UserId));
+
+	return p;
+}
+
+static void decode_GetCartRequest(struct codec_in *in, GetCartRequest *m)
+{
+	codec_get_str(in, m->UserId, sizeof(m->UserId));
+}
+
+static uint8_t *encode_Cart(uint8_t *p, const Cart *m)
+{
+	p = codec_put_str(p, m->UserId, sizeof(m->UserId));
+	unsigned n_items = codec_count(m->num_items, 10);
+	p = codec_put_uvarint(p, n_items);
+	for (unsigned i = 0; i < n_items; i++)
+		p = encode_CartItem(p, &m->Items[i]);
+
+	return p;
+}
+
+static void decode_Cart(struct codec_in *in, Cart *m)
+{
+	codec_get_str(in, m->UserId, sizeof(m->UserId));
+	unsigned n_items = codec_get_count(in, 10);
+	m->num_items = n_items;
+	for (unsigned i = 0; i < n_items; i++)
+		decode_CartItem(in, &m->Items[i]);
+}
+
+static uint8_t *encode_EmptyCartRequest(uint8_t *p, const EmptyCartRequest *m)
+{
+	p = codec_put_str(p, m->UserId, sizeof(m->UserId));
+
+	return p;
+}
+
+static void decode_EmptyCartRequest(struct codec_in *in, EmptyCartRequest *m)
+{
+	codec_get_str(in, m->UserId, sizeof(m->UserId));
+}
+
+static uint8_t *
+encode_ListRecommendationsRequest(uint8_t *p, const ListRecommendationsRequest *m)
+{
+	p = codec_put_str(p, m->user_id, sizeof(m->user_id));
+	unsigned n_product_ids = codec_count(m->num_product_ids, 10);
+	p = codec_put_uvarint(p, n_product_ids);
+	for (unsigned i = 0; i < n_product_ids; i++)
+		p = codec_put_str(p, m->product_ids[i], sizeof(m->product_ids[i]));
+
+	return p;
+}
+
+static void
+decode_ListRecommendationsRequest(struct codec_in *in, ListRecommendationsRequest *m)
+{
+	codec_get_str(in, m->user_id, sizeof(m->user_id));
+	unsigned n_product_ids = codec_get_count(in, 10);
+	m->num_product_ids = n_product_ids;
+	for (unsigned i = 0; i < n_product_ids; i++)
+		codec_get_str(in, m->product_ids[i], sizeof(m->product_ids[i]));
+}
+
+static uint8_t *
+encode_ListRecommendationsResponse(uint8_t *p, const ListRecommendationsResponse *m)
+{
+	unsigned n_product_ids = codec_count(m->num_product_ids, 10);
+	p = codec_put_uvarint(p, n_product_ids);
+	for (unsigned i = 0; i < n_product_ids; i++)
+		p = codec_put_str(p, m->product_ids[i], sizeof(m->product_ids[i]));
+
+	return p;
+}
+
+static void
+decode_ListRecommendationsResponse(struct codec_in *in, ListRecommendationsResponse *m)
+{
+	unsigned n_product_ids = codec_get_count(in, 10);
+	m->num_product_ids = n_product_ids;
+	for (unsigned i = 0; i < n_product_ids; i++)
+		codec_get_str(in, m->product_ids[i], sizeof(m->product_ids[i]));
+}
+
+static uint8_t *
+encode_GetSupportedCurrenciesResponse(uint8_t *p, const GetSupportedCurrenciesResponse *m)
+{
+	unsigned n_currencies = codec_count(m->num_currencies, 6);
+	p = codec_put_uvarint(p, n_currencies);
+	for (unsigned i = 0; i < n_currencies; i++)
+		p = codec_put_str(p, m->CurrencyCodes[i], sizeof(m->CurrencyCodes[i]));
+
+	return p;
+}
+
+static void
+decode_GetSupportedCurrenciesResponse(struct codec_in *in, GetSupportedCurrenciesResponse *m)
+{
+	unsigned n_currencies = codec_get_count(in, 6);
+	m->num_currencies = n_currencies;
+	for (unsigned i = 0; i < n_currencies; i++)
+		codec_get_str(in, m->CurrencyCodes[i], sizeof(m->CurrencyCodes[i]));
+}
+
+static uint8_t *encode_Money(uint8_t *p, const Money *m)
+{
+	p = codec_put_str(p, m->CurrencyCode, sizeof(m->CurrencyCode));
+	p = codec_put_svarint(p, m->Units);
+	p = codec_put_svarint(p, m->Nanos);
+
+	return p;
+}
+
+static void decode_Money(struct codec_in *in, Money *m)
+{
+	codec_get_str(in, m->CurrencyCode, sizeof(m->CurrencyCode));
+	m->Units = codec_get_svarint(in);
+	m->Nanos = codec_get_svarint(in);
+}
+
+static uint8_t *
+encode_CurrencyConversionRequest(uint8_t *p, const CurrencyConversionRequest *m)
+{
+	p = encode_Money(p, &m->From);
+	p = codec_put_str(p, m->ToCode, sizeof(m->ToCode));
+
+	return p;
+}
+
+static void
+decode_CurrencyConversionRequest(struct codec_in *in, CurrencyConversionRequest *m)
+{
+	decode_Money(in, &m->From);
+	codec_get_str(in, m->ToCode, sizeof(m->ToCode));
+}
+
+static uint8_t *encode_Product(uint8_t *p, const Product *m)
+{
+	p = codec_put_str(p, m->Id, sizeof(m->Id));
+	p = codec_put_str(p, m->Name, sizeof(m->Name));
+	p = codec_put_str(p, m->Description, sizeof(m->Description));
+	p = codec_put_str(p, m->Picture, sizeof(m->Picture));
+	p = encode_Money(p, &m->PriceUsd);
+	unsigned n_categories = codec_count(m->num_categories, PRODUCT_MAX_CATEGORIES);
+	p = codec_put_uvarint(p, n_categories);
+	for (unsigned i = 0; i < n_categories; i++)
+		p = codec_put_str(p, m->Categories[i], sizeof(m->Categories[i]));
+
+	return p;
+}
+
+static void decode_Product(struct codec_in *in, Product *m)
+{
+	codec_get_str(in, m->Id, sizeof(m->Id));
+	codec_get_str(in, m->Name, sizeof(m->Name));
+	codec_get_str(in, m->Description, sizeof(m->Description));
+	codec_get_str(in, m->Picture, sizeof(m->Picture));
+	decode_Money(in, &m->PriceUsd);
+	unsigned n_categories = codec_get_count(in, PRODUCT_MAX_CATEGORIES);
+	m->num_categories = n_categories;
+	for (unsigned i = 0; i < n_categories; i++)
+		codec_get_str(in, m->Categories[i], sizeof(m->Categories[i]));
+}
+
+static uint8_t *
+encode_ListProductsResponse(uint8_t *p, const ListProductsResponse *m)
+{
+	unsigned n_products = codec_count(m->num_products, 9);
+	p = codec_put_uvarint(p, n_products);
+	for (unsigned i = 0; i < n_products; i++)
+		p = encode_Product(p, &m->Products[i]);
+
+	return p;
+}
+
+static void
+decode_ListProductsResponse(struct codec_in *in, ListProductsResponse *m)
+{
+	unsigned n_products = codec_get_count(in, 9);
+	m->num_products = n_products;
+	for (unsigned i = 0; i < n_products; i++)
+		decode_Product(in, &m->Products[i]);
+}
+
+static uint8_t *encode_GetProductRequest(uint8_t *p, const GetProductRequest *m)
+{
+	p = codec_put_str(p, m->Id, sizeof(m->Id));
+
+	return p;
+}
+
+static void decode_GetProductRequest(struct codec_in *in, GetProductRequest *m)
+{
+	codec_get_str(in, m->Id, sizeof(m->Id));
+}
+
+static uint8_t *
+encode_SearchProductsRequest(uint8_t *p, const SearchProductsRequest *m)
+{
+	p = codec_put_str(p, m->Query, sizeof(m->Query));
+
+	return p;
+}
+
+static void
+decode_SearchProductsRequest(struct codec_in *in, SearchProductsRequest *m)
+{
+	codec_get_str(in, m->Query, sizeof(m->Query));
+}
+
+static uint8_t *
+encode_SearchProductsResponse(uint8_t *p, const SearchProductsResponse *m)
+{
+	unsigned n_products = codec_count(m->num_products, 9);
+	p = codec_put_uvarint(p, n_products);
+	for (unsigned i = 0; i < n_products; i++)
+		p = encode_Product(p, &m->Results[i]);
+
+	return p;
+}
+
+static void
+decode_SearchProductsResponse(struct codec_in *in, SearchProductsResponse *m)
+{
+	unsigned n_products = codec_get_count(in, 9);
+	m->num_products = n_products;
+	for (unsigned i = 0; i < n_products; i++)
+		decode_Product(in, &m->Results[i]);
+}
+
+static uint8_t *encode_Address(uint8_t *p, const Address *m)
+{
+	p = codec_put_str(p, m->StreetAddress, sizeof(m->StreetAddress));
+	p = codec_put_str(p, m->City, sizeof(m->City));
+	p = codec_put_str(p, m->State, sizeof(m->State));
+	p = codec_put_str(p, m->Country, sizeof(m->Country));
+	p = codec_put_svarint(p, m->ZipCode);
+
+	return p;
+}
+
+static void decode_Address(struct codec_in *in, Address *m)
+{
+	codec_get_str(in, m->StreetAddress, sizeof(m->StreetAddress));
+	codec_get_str(in, m->City, sizeof(m->City));
+	codec_get_str(in, m->State, sizeof(m->State));
+	codec_get_str(in, m->Country, sizeof(m->Country));
+	m->ZipCode = codec_get_svarint(in);
+}
+
+static uint8_t *encode_GetQuoteRequest(uint8_t *p, const GetQuoteRequest *m)
+{
+	p = encode_Address(p, &m->address);
+	unsigned n_items = codec_count(m->num_items, 10);
+	p = codec_put_uvarint(p, n_items);
+	for (unsigned i = 0; i < n_items; i++)
+		p = encode_CartItem(p, &m->Items[i]);
+
+	return p;
+}
+
+static void decode_GetQuoteRequest(struct codec_in *in, GetQuoteRequest *m)
+{
+	decode_Address(in, &m->address);
+	unsigned n_items = codec_get_count(in, 10);
+	m->num_items = n_items;
+	for (unsigned i = 0; i < n_items; i++)
+		decode_CartItem(in, &m->Items[i]);
+}
+
+static uint8_t *encode_GetQuoteResponse(uint8_t *p, const GetQuoteResponse *m)
+{
+	p = codec_put_svarint(p, m->conversion_flag);
+	p = encode_Money(p, &m->CostUsd);
+
+	return p;
+}
+
+static void decode_GetQuoteResponse(struct codec_in *in, GetQuoteResponse *m)
+{
+	m->conversion_flag = codec_get_svarint(in);
+	decode_Money(in, &m->CostUsd);
+}
+
+static uint8_t *encode_ShipOrderRequest(uint8_t *p, const ShipOrderRequest *m)
+{
+	p = encode_Address(p, &m->address);
+	for (unsigned i = 0; i < 10; i++)
+		p = encode_CartItem(p, &m->Items[i]);
+
+	return p;
+}
+
+static void decode_ShipOrderRequest(struct codec_in *in, ShipOrderRequest *m)
+{
+	decode_Address(in, &m->address);
+	for (unsigned i = 0; i < 10; i++)
+		decode_CartItem(in, &m->Items[i]);
+}
+
+static uint8_t *encode_ShipOrderResponse(uint8_t *p, const ShipOrderResponse *m)
+{
+	p = codec_put_str(p, m->TrackingId, sizeof(m->TrackingId));
+
+	return p;
+}
+
+static void decode_ShipOrderResponse(struct codec_in *in, ShipOrderResponse *m)
+{
+	codec_get_str(in, m->TrackingId, sizeof(m->TrackingId));
+}
+
+static uint8_t *encode_CreditCardInfo(uint8_t *p, const CreditCardInfo *m)
+{
+	p = codec_put_str(p, m->CreditCardNumber, sizeof(m->CreditCardNumber));
+	p = codec_put_svarint(p, m->CreditCardCvv);
+	p = codec_put_svarint(p, m->CreditCardExpirationYear);
+	p = codec_put_svarint(p, m->CreditCardExpirationMonth);
+
+	return p;
+}
+
+static void decode_CreditCardInfo(struct codec_in *in, CreditCardInfo *m)
+{
+	codec_get_str(in, m->CreditCardNumber, sizeof(m->CreditCardNumber));
+	m->CreditCardCvv = codec_get_svarint(in);
+	m->CreditCardExpirationYear = codec_get_svarint(in);
+	m->CreditCardExpirationMonth = codec_get_svarint(in);
+}
+
+static uint8_t *encode_ChargeRequest(uint8_t *p, const ChargeRequest *m)
+{
+	p = encode_Money(p, &m->Amount);
+	p = encode_CreditCardInfo(p, &m->CreditCard);
+
+	return p;
+}
+
+static void decode_ChargeRequest(struct codec_in *in, ChargeRequest *m)
+{
+	decode_Money(in, &m->Amount);
+	decode_CreditCardInfo(in, &m->CreditCard);
+}
+
+static uint8_t *encode_ChargeResponse(uint8_t *p, const ChargeResponse *m)
+{
+	p = codec_put_str(p, m->TransactionId, sizeof(m->TransactionId));
+
+	return p;
+}
+
+static void decode_ChargeResponse(struct codec_in *in, ChargeResponse *m)
+{
+	codec_get_str(in, m->TransactionId, sizeof(m->TransactionId));
+}
+
+static uint8_t *encode_OrderItem(uint8_t *p, const OrderItem *m)
+{
+	p = encode_CartItem(p, &m->Item);
+	p = encode_Money(p, &m->Cost);
+
+	return p;
+}
+
+static void decode_OrderItem(struct codec_in *in, OrderItem *m)
+{
+	decode_CartItem(in, &m->Item);
+	decode_Money(in, &m->Cost);
+}
+
+static uint8_t *encode_OrderResult(uint8_t *p, const OrderResult *m)
+{
+	p = codec_put_str(p, m->OrderId, sizeof(m->OrderId));
+	p = codec_put_str(p, m->ShippingTrackingId, sizeof(m->ShippingTrackingId));
+	p = encode_Money(p, &m->ShippingCost);
+	p = encode_Address(p, &m->ShippingAddress);
+	unsigned n_items = codec_count(m->num_items, 10);
+	p = codec_put_uvarint(p, n_items);
+	for (unsigned i = 0; i < n_items; i++)
+		p = encode_OrderItem(p, &m->Items[i]);
+
+	return p;
+}
+
+static void decode_OrderResult(struct codec_in *in, OrderResult *m)
+{
+	codec_get_str(in, m->OrderId, sizeof(m->OrderId));
+	codec_get_str(in, m->ShippingTrackingId, sizeof(m->ShippingTrackingId));
+	decode_Money(in, &m->ShippingCost);
+	decode_Address(in, &m->ShippingAddress);
+	unsigned n_items = codec_get_count(in, 10);
+	m->num_items = n_items;
+	for (unsigned i = 0; i < n_items; i++)
+		decode_OrderItem(in, &m->Items[i]);
+}
+
+static uint8_t *
+encode_SendOrderConfirmationRequest(uint8_t *p, const SendOrderConfirmationRequest *m)
+{
+	p = codec_put_str(p, m->Email, sizeof(m->Email));
+	p = encode_OrderResult(p, &m->Order);
+
+	return p;
+}
+
+static void
+decode_SendOrderConfirmationRequest(struct codec_in *in, SendOrderConfirmationRequest *m)
+{
+	codec_get_str(in, m->Email, sizeof(m->Email));
+	decode_OrderResult(in, &m->Order);
+}
+
+static uint8_t *encode_PlaceOrderRequest(uint8_t *p, const PlaceOrderRequest *m)
+{
+	p = codec_put_str(p, m->UserId, sizeof(m->UserId));
+	p = codec_put_str(p, m->UserCurrency, sizeof(m->UserCurrency));
+	p = encode_Address(p, &m->address);
+	p = codec_put_str(p, m->Email, sizeof(m->Email));
+	p = encode_CreditCardInfo(p, &m->CreditCard);
+
+	return p;
+}
+
+static void decode_PlaceOrderRequest(struct codec_in *in, PlaceOrderRequest *m)
+{
+	codec_get_str(in, m->UserId, sizeof(m->UserId));
+	codec_get_str(in, m->UserCurrency, sizeof(m->UserCurrency));
+	decode_Address(in, &m->address);
+	codec_get_str(in, m->Email, sizeof(m->Email));
+	decode_CreditCardInfo(in, &m->CreditCard);
+}
+
+static uint8_t *
+encode_PlaceOrderResponse(uint8_t *p, const PlaceOrderResponse *m)
+{
+	p = encode_OrderResult(p, &m->order);
+
+	return p;
+}
+
+static void
+decode_PlaceOrderResponse(struct codec_in *in, PlaceOrderResponse *m)
+{
+	decode_OrderResult(in, &m->order);
+}
+
+static uint8_t *encode_AdRequest(uint8_t *p, const AdRequest *m)
+{
+	unsigned n_context_keys = codec_count(m->num_context_keys, 10);
+	p = codec_put_uvarint(p, n_context_keys);
+	for (unsigned i = 0; i < n_context_keys; i++)
+		p = codec_put_str(p, m->ContextKeys[i], sizeof(m->ContextKeys[i]));
+
+	return p;
+}
+
+static void decode_AdRequest(struct codec_in *in, AdRequest *m)
+{
+	unsigned n_context_keys = codec_get_count(in, 10);
+	m->num_context_keys = n_context_keys;
+	for (unsigned i = 0; i < n_context_keys; i++)
+		codec_get_str(in, m->ContextKeys[i], sizeof(m->ContextKeys[i]));
+}
+
+static uint8_t *encode_Ad(uint8_t *p, const Ad *m)
+{
+	p = codec_put_str(p, m->RedirectUrl, sizeof(m->RedirectUrl));
+	p = codec_put_str(p, m->Text, sizeof(m->Text));
+
+	return p;
+}
+
+static void decode_Ad(struct codec_in *in, Ad *m)
+{
+	codec_get_str(in, m->RedirectUrl, sizeof(m->RedirectUrl));
+	codec_get_str(in, m->Text, sizeof(m->Text));
+}
+
+static uint8_t *encode_AdResponse(uint8_t *p, const AdResponse *m)
+{
+	unsigned n_ads = codec_count(m->num_ads, 10);
+	p = codec_put_uvarint(p, n_ads);
+	for (unsigned i = 0; i < n_ads; i++)
+		p = encode_Ad(p, &m->Ads[i]);
+
+	return p;
+}
+
+static void decode_AdResponse(struct codec_in *in, AdResponse *m)
+{
+	unsigned n_ads = codec_get_count(in, 10);
+	m->num_ads = n_ads;
+	for (unsigned i = 0; i < n_ads; i++)
+		decode_Ad(in, &m->Ads[i]);
+}
+
+static uint8_t *
+encode_CurrencyConversionBatchRequest(uint8_t *p, const CurrencyConversionBatchRequest *m)
+{
+	unsigned n_amounts = codec_count(m->num_amounts, CURRENCY_CONVERT_BATCH_MAX);
+	p = codec_put_uvarint(p, n_amounts);
+	p = codec_put_str(p, m->ToCode, sizeof(m->ToCode));
+	for (unsigned i = 0; i < n_amounts; i++)
+		p = codec_put_str(p, m->FromCodes[i], sizeof(m->FromCodes[i]));
+	for (unsigned i = 0; i < n_amounts; i++)
+		p = codec_put_svarint(p, m->Units[i]);
+	for (unsigned i = 0; i < n_amounts; i++)
+		p = codec_put_svarint(p, m->Nanos[i]);
+
+	return p;
+}
+
+static void
+decode_CurrencyConversionBatchRequest(struct codec_in *in, CurrencyConversionBatchRequest *m)
+{
+	unsigned n_amounts = codec_get_count(in, CURRENCY_CONVERT_BATCH_MAX);
+	m->num_amounts = n_amounts;
+	codec_get_str(in, m->ToCode, sizeof(m->ToCode));
+	for (unsigned i = 0; i < n_amounts; i++)
+		codec_get_str(in, m->FromCodes[i], sizeof(m->FromCodes[i]));
+	for (unsigned i = 0; i < n_amounts; i++)
+		m->Units[i] = codec_get_svarint(in);
+	for (unsigned i = 0; i < n_amounts; i++)
+		m->Nanos[i] = codec_get_svarint(in);
+}
+
+static uint8_t *
+encode_CurrencyConversionBatchResponse(uint8_t *p, const CurrencyConversionBatchResponse *m)
+{
+	p = codec_put_str(p, m->CurrencyCode, sizeof(m->CurrencyCode));
+	for (unsigned i = 0; i < CURRENCY_CONVERT_BATCH_MAX; i++)
+		p = codec_put_svarint(p, m->Units[i]);
+	for (unsigned i = 0; i < CURRENCY_CONVERT_BATCH_MAX; i++)
+		p = codec_put_svarint(p, m->Nanos[i]);
+
+	return p;
+}
+
+static void
+decode_CurrencyConversionBatchResponse(struct codec_in *in, CurrencyConversionBatchResponse *m)
+{
+	codec_get_str(in, m->CurrencyCode, sizeof(m->CurrencyCode));
+	for (unsigned i = 0; i < CURRENCY_CONVERT_BATCH_MAX; i++)
+		m->Units[i] = codec_get_svarint(in);
+	for (unsigned i = 0; i < CURRENCY_CONVERT_BATCH_MAX; i++)
+		m->Nanos[i] = codec_get_svarint(in);
+}
+
+static uint8_t *encode_LatencySummary(uint8_t *p, const LatencySummary *m)
+{
+	p = codec_put_svarint(p, m->Command);
+	p = codec_put_svarint(p, m->Count);
+	p = codec_put_svarint(p, m->MeanNs);
+	p = codec_put_svarint(p, m->P50Ns);
+	p = codec_put_svarint(p, m->P99Ns);
+	p = codec_put_svarint(p, m->P999Ns);
+	p = codec_put_svarint(p, m->MaxNs);
+
+	return p;
+}
+
+static void decode_LatencySummary(struct codec_in *in, LatencySummary *m)
+{
+	m->Command = codec_get_svarint(in);
+	m->Count = codec_get_svarint(in);
+	m->MeanNs = codec_get_svarint(in);
+	m->P50Ns = codec_get_svarint(in);
+	m->P99Ns = codec_get_svarint(in);
+	m->P999Ns = codec_get_svarint(in);
+	m->MaxNs = codec_get_svarint(in);
+}
+
+static uint8_t *encode_CoreStats(uint8_t *p, const CoreStats *m)
+{
+	p = codec_put_svarint(p, m->Connections);
+	p = codec_put_svarint(p, m->Stolen);
+
+	return p;
+}
+
+static void decode_CoreStats(struct codec_in *in, CoreStats *m)
+{
+	m->Connections = codec_get_svarint(in);
+	m->Stolen = codec_get_svarint(in);
+}
+
+static uint8_t *encode_GetStatsResponse(uint8_t *p, const GetStatsResponse *m)
+{
+	p = codec_put_svarint(p, m->Cores);
+	p = codec_put_svarint(p, m->Connections);
+	p = codec_put_svarint(p, m->QueueDepth);
+	p = codec_put_svarint(p, m->QueueDepthMax);
+	p = codec_put_svarint(p, m->Coroutines);
+	p = codec_put_svarint(p, m->CoroutinesBusy);
+	p = codec_put_svarint(p, m->CoroutinesBusyMax);
+	unsigned n_served = codec_count(m->num_served, STATS_MAX_COMMANDS);
+	p = codec_put_uvarint(p, n_served);
+	for (unsigned i = 0; i < n_served; i++)
+		p = encode_LatencySummary(p, &m->Served[i]);
+	unsigned n_issued = codec_count(m->num_issued, STATS_MAX_COMMANDS);
+	p = codec_put_uvarint(p, n_issued);
+	for (unsigned i = 0; i < n_issued; i++)
+		p = encode_LatencySummary(p, &m->Issued[i]);
+	p = codec_put_svarint(p, m->Timeouts);
+	p = codec_put_svarint(p, m->LateResponses);
+	p = codec_put_svarint(p, m->Expired);
+	p = codec_put_svarint(p, m->CreditWaits);
+	p = codec_put_svarint(p, m->Shed);
+	p = codec_put_svarint(p, m->Hedges);
+	p = codec_put_svarint(p, m->HedgeWins);
+	unsigned n_per_core = codec_count(m->num_per_core, STATS_MAX_CORES);
+	p = codec_put_uvarint(p, n_per_core);
+	for (unsigned i = 0; i < n_per_core; i++)
+		p = encode_CoreStats(p, &m->PerCore[i]);
+
+	return p;
+}
+
+static void decode_GetStatsResponse(struct codec_in *in, GetStatsResponse *m)
+{
+	m->Cores = codec_get_svarint(in);
+	m->Connections = codec_get_svarint(in);
+	m->QueueDepth = codec_get_svarint(in);
+	m->QueueDepthMax = codec_get_svarint(in);
+	m->Coroutines = codec_get_svarint(in);
+	m->CoroutinesBusy = codec_get_svarint(in);
+	m->CoroutinesBusyMax = codec_get_svarint(in);
+	unsigned n_served = codec_get_count(in, STATS_MAX_COMMANDS);
+	m->num_served = n_served;
+	for (unsigned i = 0; i < n_served; i++)
+		decode_LatencySummary(in, &m->Served[i]);
+	unsigned n_issued = codec_get_count(in, STATS_MAX_COMMANDS);
+	m->num_issued = n_issued;
+	for (unsigned i = 0; i < n_issued; i++)
+		decode_LatencySummary(in, &m->Issued[i]);
+	m->Timeouts = codec_get_svarint(in);
+	m->LateResponses = codec_get_svarint(in);
+	m->Expired = codec_get_svarint(in);
+	m->CreditWaits = codec_get_svarint(in);
+	m->Shed = codec_get_svarint(in);
+	m->Hedges = codec_get_svarint(in);
+	m->HedgeWins = codec_get_svarint(in);
+	unsigned n_per_core = codec_get_count(in, STATS_MAX_CORES);
+	m->num_per_core = n_per_core;
+	for (unsigned i = 0; i < n_per_core; i++)
+		decode_CoreStats(in, &m->PerCore[i]);
+}
+
+static uint8_t *encode_GetSpansRequest(uint8_t *p, const GetSpansRequest *m)
+{
+	p = codec_put_svarint(p, m->Core);
+	p = codec_put_svarint(p, m->Cursor);
+
+	return p;
+}
+
+static void decode_GetSpansRequest(struct codec_in *in, GetSpansRequest *m)
+{
+	m->Core = codec_get_svarint(in);
+	m->Cursor = codec_get_svarint(in);
+}
+
+static uint8_t *encode_Span(uint8_t *p, const Span *m)
+{
+	p = codec_put_svarint(p, m->TraceId);
+	p = codec_put_uvarint(p, m->SpanId);
+	p = codec_put_uvarint(p, m->ParentSpanId);
+	p = codec_put_svarint(p, m->Service);
+	p = codec_put_svarint(p, m->Command);
+	p = codec_put_svarint(p, m->StartNs);
+	p = codec_put_svarint(p, m->EndNs);
+
+	return p;
+}
+
+static void decode_Span(struct codec_in *in, Span *m)
+{
+	m->TraceId = codec_get_svarint(in);
+	m->SpanId = codec_get_uvarint(in);
+	m->ParentSpanId = codec_get_uvarint(in);
+	m->Service = codec_get_svarint(in);
+	m->Command = codec_get_svarint(in);
+	m->StartNs = codec_get_svarint(in);
+	m->EndNs = codec_get_svarint(in);
+}
+
+static uint8_t *encode_GetSpansResponse(uint8_t *p, const GetSpansResponse *m)
+{
+	p = codec_put_svarint(p, m->Cores);
+	p = codec_put_svarint(p, m->Cursor);
+	p = codec_put_svarint(p, m->Lost);
+	unsigned n_spans = codec_count(m->num_spans, TRACE_MAX_SPANS);
+	p = codec_put_uvarint(p, n_spans);
+	for (unsigned i = 0; i < n_spans; i++)
+		p = encode_Span(p, &m->Spans[i]);
+
+	return p;
+}
+
+static void decode_GetSpansResponse(struct codec_in *in, GetSpansResponse *m)
+{
+	m->Cores = codec_get_svarint(in);
+	m->Cursor = codec_get_svarint(in);
+	m->Lost = codec_get_svarint(in);
+	unsigned n_spans = codec_get_count(in, TRACE_MAX_SPANS);
+	m->num_spans = n_spans;
+	for (unsigned i = 0; i < n_spans; i++)
+		decode_Span(in, &m->Spans[i]);
+}
+
+/* Encode the request (@res 0) or the response (@res 1) in the struct body
+ * @body of an RPC of @command to @p. Returns the end of the encoding.
+ */
+static uint8_t *codec_encode(enum command command, int res, const void *body,
+			     uint8_t *p)
+{
+	switch (command) {
+	case CART_ADD_ITEM: {
+		const AddItemRequest *rr = body;
+		if (!res)
+			p = encode_AddItemRequest(p, rr);
+		break;
+	}
+	case CART_GET_CART: {
+		const GetCartRR *rr = body;
+		if (res)
+			p = encode_Cart(p, &rr->res);
+		else
+			p = encode_GetCartRequest(p, &rr->req);
+		break;
+	}
+	case CART_EMPTY_CART: {
+		const EmptyCartRequest *rr = body;
+		if (!res)
+			p = encode_EmptyCartRequest(p, rr);
+		break;
+	}
+	case RECOMMENDATION_LIST_RECOMMENDATIONS: {
+		const ListRecommendationsRR *rr = body;
+		if (res)
+			p = encode_ListRecommendationsResponse(p, &rr->res);
+		else
+			p = encode_ListRecommendationsRequest(p, &rr->req);
+		break;
+	}
+	case CURRENCY_GET_SUPPORTED_CURRENCIES: {
+		const GetSupportedCurrenciesResponse *rr = body;
+		if (res)
+			p = encode_GetSupportedCurrenciesResponse(p, rr);
+		break;
+	}
+	case CURRENCY_CONVERT: {
+		const CurrencyConversionRR *rr = body;
+		if (res)
+			p = encode_Money(p, &rr->res);
+		else
+			p = encode_CurrencyConversionRequest(p, &rr->req);
+		break;
+	}
+	case PRODUCTCATALOG_LIST_PRODUCTS: {
+		const ListProductsResponse *rr = body;
+		if (res)
+			p = encode_ListProductsResponse(p, rr);
+		break;
+	}
+	case PRODUCTCATALOG_GET_PRODUCT: {
+		const GetProductRR *rr = body;
+		if (res)
+			p = encode_Product(p, &rr->res);
+		else
+			p = encode_GetProductRequest(p, &rr->req);
+		break;
+	}
+	case PRODUCTCATALOG_SEARCH_PRODUCTS: {
+		const SearchProductsRR *rr = body;
+		if (res)
+			p = encode_SearchProductsResponse(p, &rr->res);
+		else
+			p = encode_SearchProductsRequest(p, &rr->req);
+		break;
+	}
+	case SHIPPING_GET_QUOTE: {
+		const GetQuoteRR *rr = body;
+		if (res)
+			p = encode_GetQuoteResponse(p, &rr->res);
+		else
+			p = encode_GetQuoteRequest(p, &rr->req);
+		break;
+	}
+	case SHIPPING_SHIP_ORDER: {
+		const ShipOrderRR *rr = body;
+		if (res)
+			p = encode_ShipOrderResponse(p, &rr->res);
+		else
+			p = encode_ShipOrderRequest(p, &rr->req);
+		break;
+	}
+	case PAYMENT_CHARGE: {
+		const ChargeRR *rr = body;
+		if (res)
+			p = encode_ChargeResponse(p, &rr->res);
+		else
+			p = encode_ChargeRequest(p, &rr->req);
+		break;
+	}
+	case EMAIL_SEND_ORDER_CONFIRMATION: {
+		const SendOrderConfirmationRequest *rr = body;
+		if (!res)
+			p = encode_SendOrderConfirmationRequest(p, rr);
+		break;
+	}
+	case CHECKOUT_PLACE_ORDER: {
+		const PlaceOrderRR *rr = body;
+		if (res)
+			p = encode_PlaceOrderResponse(p, &rr->res);
+		else
+			p = encode_PlaceOrderRequest(p, &rr->req);
+		break;
+	}
+	case AD_GET_ADS: {
+		const AdRR *rr = body;
+		if (res)
+			p = encode_AdResponse(p, &rr->res);
+		else
+			p = encode_AdRequest(p, &rr->req);
+		break;
+	}
+	case CURRENCY_CONVERT_BATCH: {
+		const CurrencyConversionBatchRR *rr = body;
+		if (res)
+			p = encode_CurrencyConversionBatchResponse(p, &rr->res);
+		else
+			p = encode_CurrencyConversionBatchRequest(p, &rr->req);
+		break;
+	}
+	case SERVICE_GET_STATS: {
+		const GetStatsResponse *rr = body;
+		if (res)
+			p = encode_GetStatsResponse(p, rr);
+		break;
+	}
+	case SERVICE_GET_SPANS: {
+		const GetSpansRR *rr = body;
+		if (res)
+			p = encode_GetSpansResponse(p, &rr->res);
+		else
+			p = encode_GetSpansRequest(p, &rr->req);
+		break;
+	}
+	default:
+		break;
+	}
+
+	return p;
+}
+
+/* Decode the request (@res 0) or the response (@res 1) of an RPC of
+ * @command from the @size bytes at @p to the struct body @body. The rest
+ * of the body is left untouched. Returns 0 on success, -1 if the encoding
+ * is malformed.
+ */
+static int codec_decode(enum command command, int res, const uint8_t *p,
+			unsigned size, void *body)
+{
+	struct codec_in in = { p, p + size, 0 };
+
+	switch (command) {
+	case CART_ADD_ITEM: {
+		AddItemRequest *rr = body;
+		if (!res)
+			decode_AddItemRequest(&in, rr);
+		break;
+	}
+	case CART_GET_CART: {
+		GetCartRR *rr = body;
+		if (res)
+			decode_Cart(&in, &rr->res);
+		else
+			decode_GetCartRequest(&in, &rr->req);
+		break;
+	}
+	case CART_EMPTY_CART: {
+		EmptyCartRequest *rr = body;
+		if (!res)
+			decode_EmptyCartRequest(&in, rr);
+		break;
+	}
+	case RECOMMENDATION_LIST_RECOMMENDATIONS: {
+		ListRecommendationsRR *rr = body;
+		if (res)
+			decode_ListRecommendationsResponse(&in, &rr->res);
+		else
+			decode_ListRecommendationsRequest(&in, &rr->req);
+		break;
+	}
+	case CURRENCY_GET_SUPPORTED_CURRENCIES: {
+		GetSupportedCurrenciesResponse *rr = body;
+		if (res)
+			decode_GetSupportedCurrenciesResponse(&in, rr);
+		break;
+	}
+	case CURRENCY_CONVERT: {
+		CurrencyConversionRR *rr = body;
+		if (res)
+			decode_Money(&in, &rr->res);
+		else
+			decode_CurrencyConversionRequest(&in, &rr->req);
+		break;
+	}
+	case PRODUCTCATALOG_LIST_PRODUCTS: {
+		ListProductsResponse *rr = body;
+		if (res)
+			decode_ListProductsResponse(&in, rr);
+		break;
+	}
+	case PRODUCTCATALOG_GET_PRODUCT: {
+		GetProductRR *rr = body;
+		if (res)
+			decode_Product(&in, &rr->res);
+		else
+			decode_GetProductRequest(&in, &rr->req);
+		break;
+	}
+	case PRODUCTCATALOG_SEARCH_PRODUCTS: {
+		SearchProductsRR *rr = body;
+		if (res)
+			decode_SearchProductsResponse(&in, &rr->res);
+		else
+			decode_SearchProductsRequest(&in, &rr->req);
+		break;
+	}
+	case SHIPPING_GET_QUOTE: {
+		GetQuoteRR *rr = body;
+		if (res)
+			decode_GetQuoteResponse(&in, &rr->res);
+		else
+			decode_GetQuoteRequest(&in, &rr->req);
+		break;
+	}
+	case SHIPPING_SHIP_ORDER: {
+		ShipOrderRR *rr = body;
+		if (res)
+			decode_ShipOrderResponse(&in, &rr->res);
+		else
+			decode_ShipOrderRequest(&in, &rr->req);
+		break;
+	}
+	case PAYMENT_CHARGE: {
+		ChargeRR *rr = body;
+		if (res)
+			decode_ChargeResponse(&in, &rr->res);
+		else
+			decode_ChargeRequest(&in, &rr->req);
+		break;
+	}
+	case EMAIL_SEND_ORDER_CONFIRMATION: {
+		SendOrderConfirmationRequest *rr = body;
+		if (!res)
+			decode_SendOrderConfirmationRequest(&in, rr);
+		break;
+	}
+	case CHECKOUT_PLACE_ORDER: {
+		PlaceOrderRR *rr = body;
+		if (res)
+			decode_PlaceOrderResponse(&in, &rr->res);
+		else
+			decode_PlaceOrderRequest(&in, &rr->req);
+		break;
+	}
+	case AD_GET_ADS: {
+		AdRR *rr = body;
+		if (res)
+			decode_AdResponse(&in, &rr->res);
+		else
+			decode_AdRequest(&in, &rr->req);
+		break;
+	}
+	case CURRENCY_CONVERT_BATCH: {
+		CurrencyConversionBatchRR *rr = body;
+		if (res)
+			decode_CurrencyConversionBatchResponse(&in, &rr->res);
+		else
+			decode_CurrencyConversionBatchRequest(&in, &rr->req);
+		break;
+	}
+	case SERVICE_GET_STATS: {
+		GetStatsResponse *rr = body;
+		if (res)
+			decode_GetStatsResponse(&in, rr);
+		break;
+	}
+	case SERVICE_GET_SPANS: {
+		GetSpansRR *rr = body;
+		if (res)
+			decode_GetSpansResponse(&in, &rr->res);
+		else
+			decode_GetSpansRequest(&in, &rr->req);
+		break;
+	}
+	default:
+		return -1;
+	}
+
+	return in.err || in.p != in.end ? -1 : 0;
+}
+
+#endif /* __MESSAGE_CODEC__ */
@@ -0,0 +1,404 @@
+/* Generated by gen_rpc.py from boutique.idl, do not edit */
+
+#ifndef __MESSAGE_TYPES__
+#define __MESSAGE_TYPES__
+
+#include <stdint.h>
+
+#define MONEY_CURRENCY_CODE_SIZE   4
+#define PRODUCT_ID_SIZE            11
+#define PRODUCT_NAME_SIZE          22
+#define PRODUCT_DESCRIPTION_SIZE   83
+#define PRODUCT_PICTURE_SIZE       49
+#define PRODUCT_CATEGORY_SIZE      12
+#define PRODUCT_MAX_CATEGORIES     2
+#define CURRENCY_CONVERT_BATCH_MAX 16
+#define STATS_MAX_COMMANDS         18
+#define STATS_MAX_CORES            8
+#define TRACE_MAX_SPANS            40
+
+typedef struct _cartItem {
+	char ProductId[PRODUCT_ID_SIZE];
+	int32_t Quantity;
+} CartItem;
+
+typedef struct _addItemRequest {
+	char UserId[50];
+	CartItem Item;
+} AddItemRequest;
+
+typedef struct _emptyCartRequest {
+	char UserId[50];
+} EmptyCartRequest;
+
+typedef struct _getCartRequest {
+	char UserId[50];
+} GetCartRequest;
+
+typedef struct _cart {
+	char UserId[50];
+	int32_t num_items;
+	CartItem Items[10];
+} Cart;
+
+typedef struct _listRecommendationsRequest {
+	char user_id[50];
+	uint32_t num_product_ids;
+	char product_ids[10][PRODUCT_ID_SIZE];
+} ListRecommendationsRequest;
+
+typedef struct _listRecommendationsResponse {
+	uint32_t num_product_ids;
+	char product_ids[10][PRODUCT_ID_SIZE];
+} ListRecommendationsResponse;
+
+/* Represents an amount of money with its currency type. */
+typedef struct _money {
+	/* The 3-letter currency code defined in ISO 4217. */
+	char CurrencyCode[MONEY_CURRENCY_CODE_SIZE];
+	/* The whole units of the amount.
+	 * For example if `currencyCode` is `"USD"`, then 1 unit is one US dollar.
+	 */
+	int64_t Units;
+	/* Number of nano (10^-9) units of the amount.
+	 * The value must be between -999,999,999 and +999,999,999 inclusive.
+	 * If `units` is positive, `nanos` must be positive or zero.
+	 * If `units` is zero, `nanos` can be positive, zero, or negative.
+	 * If `units` is negative, `nanos` must be negative or zero.
+	 * For example $-1.75 is represented as `units`=-1 and `nanos`=-750,000,000.
+	 */
+	int32_t Nanos;
+} Money;
+
+typedef struct _getSupportedCurrenciesResponse {
+	int32_t num_currencies;
+	/* The 3-letter currency codes defined in ISO 4217. */
+	char CurrencyCodes[6][10];
+} GetSupportedCurrenciesResponse;
+
+typedef struct _currencyConversionRequest {
+	Money From;
+	/* The 3-letter currency code defined in ISO 4217. */
+	char ToCode[10];
+} CurrencyConversionRequest;
+
+/* Amounts are stored as separate arrays of units and nanos so that the
+ * conversion can run over contiguous lanes
+ */
+typedef struct _currencyConversionBatchRequest {
+	uint32_t num_amounts;
+	char ToCode[10];
+	char FromCodes[CURRENCY_CONVERT_BATCH_MAX][MONEY_CURRENCY_CODE_SIZE];
+	int64_t Units[CURRENCY_CONVERT_BATCH_MAX];
+	int32_t Nanos[CURRENCY_CONVERT_BATCH_MAX];
+} CurrencyConversionBatchRequest;
+
+typedef struct _currencyConversionBatchResponse {
+	char CurrencyCode[MONEY_CURRENCY_CODE_SIZE];
+	int64_t Units[CURRENCY_CONVERT_BATCH_MAX];
+	int32_t Nanos[CURRENCY_CONVERT_BATCH_MAX];
+} CurrencyConversionBatchResponse;
+
+typedef struct _product {
+	char Id[PRODUCT_ID_SIZE];
+	char Name[PRODUCT_NAME_SIZE];
+	char Description[PRODUCT_DESCRIPTION_SIZE];
+	char Picture[PRODUCT_PICTURE_SIZE];
+	Money PriceUsd;
+	/* Categories such as "clothing" or "kitchen" that can be used to look up
+	 * other related products.
+	 */
+	int32_t num_categories;
+	char Categories[PRODUCT_MAX_CATEGORIES][PRODUCT_CATEGORY_SIZE];
+} Product;
+
+typedef struct _listProductsResponse {
+	int32_t num_products;
+	Product Products[9];
+} ListProductsResponse;
+
+typedef struct _getProductRequest {
+	char Id[PRODUCT_ID_SIZE];
+} GetProductRequest;
+
+typedef struct _searchProductsRequest {
+	char Query[50];
+} SearchProductsRequest;
+
+typedef struct _searchProductsResponse {
+	int32_t num_products;
+	Product Results[9];
+} SearchProductsResponse;
+
+typedef struct _address {
+	char StreetAddress[50];
+	char City[15];
+	char State[15];
+	char Country[15];
+	int32_t ZipCode;
+} Address;
+
+typedef struct _getQuoteRequest {
+	Address address;
+	int32_t num_items;
+	CartItem Items[10];
+} GetQuoteRequest;
+
+typedef struct _getQuoteResponse {
+	int32_t conversion_flag;
+	Money CostUsd;
+} GetQuoteResponse;
+
+typedef struct _shipOrderRequest {
+	Address address;
+	CartItem Items[10];
+} ShipOrderRequest;
+
+typedef struct _shipOrderResponse {
+	char TrackingId[100];
+} ShipOrderResponse;
+
+typedef struct _creditCardInfo {
+	char CreditCardNumber[30];
+	int32_t CreditCardCvv;
+	int32_t CreditCardExpirationYear;
+	int32_t CreditCardExpirationMonth;
+} CreditCardInfo;
+
+typedef struct _chargeRequest {
+	Money Amount;
+	CreditCardInfo CreditCard;
+} ChargeRequest;
+
+typedef struct _chargeResponse {
+	char TransactionId[40];
+} ChargeResponse;
+
+typedef struct _orderItem {
+	CartItem Item;
+	Money Cost;
+} OrderItem;
+
+typedef struct _orderResult {
+	char OrderId[40];
+	char ShippingTrackingId[100];
+	Money ShippingCost;
+	Address ShippingAddress;
+	uint32_t num_items;
+	OrderItem Items[10];
+} OrderResult;
+
+typedef struct _sendOrderConfirmationRequest {
+	char Email[50];
+	OrderResult Order;
+} SendOrderConfirmationRequest;
+
+typedef struct _placeOrderRequest {
+	char UserId[50];
+	char UserCurrency[5];
+	Address address;
+	char Email[50];
+	CreditCardInfo CreditCard;
+} PlaceOrderRequest;
+
+typedef struct _placeOrderResponse {
+	OrderResult order;
+} PlaceOrderResponse;
+
+typedef struct _ad {
+	/* url to redirect to when an ad is clicked. */
+	char RedirectUrl[100];
+	/* short advertisement text to display. */
+	char Text[100];
+} Ad;
+
+typedef struct _adRequest {
+	/* List of important key words from the current page describing the
+	 * context.
+	 */
+	int32_t num_context_keys;
+	char ContextKeys[10][100];
+} AdRequest;
+
+typedef struct _adResponse {
+	int32_t num_ads;
+	Ad Ads[10];
+} AdResponse;
+
+/* Latency of the RPCs of a command, from reception to response for served
+ * ones, from send to response for issued ones.
+ */
+typedef struct _latencySummary {
+	int32_t Command;
+	int64_t Count;
+	int64_t MeanNs;
+	int64_t P50Ns;
+	int64_t P99Ns;
+	int64_t P999Ns;
+	int64_t MaxNs;
+} LatencySummary;
+
+/* Upstream connections of a core, now, and those it took over from loaded
+ * cores.
+ */
+typedef struct _coreStats {
+	int64_t Connections;
+	int64_t Stolen;
+} CoreStats;
+
+typedef struct _getStatsResponse {
+	int32_t Cores;
+	int64_t Connections;
+	/* Requests waiting for a coroutine, now and at most. */
+	int64_t QueueDepth;
+	int64_t QueueDepthMax;
+	/* Coroutines allocated and handling requests, now and at most. */
+	int64_t Coroutines;
+	int64_t CoroutinesBusy;
+	int64_t CoroutinesBusyMax;
+	int32_t num_served;
+	LatencySummary Served[STATS_MAX_COMMANDS];
+	int32_t num_issued;
+	LatencySummary Issued[STATS_MAX_COMMANDS];
+	/* RPCs issued that timed out, their responses received late and
+	 * requests dropped for being past their deadline.
+	 */
+	int64_t Timeouts;
+	int64_t LateResponses;
+	int64_t Expired;
+	/* RPCs issued that waited for credits and requests shed by admission
+	 * control.
+	 */
+	int64_t CreditWaits;
+	int64_t Shed;
+	/* RPCs issued that were hedged with a duplicate and those the
+	 * duplicate answered first.
+	 */
+	int64_t Hedges;
+	int64_t HedgeWins;
+	int32_t num_per_core;
+	CoreStats PerCore[STATS_MAX_CORES];
+} GetStatsResponse;
+
+/* Handling of a sampled request by a service, from reception to response. */
+typedef struct _span {
+	int64_t TraceId;
+	uint32_t SpanId;
+	uint32_t ParentSpanId;
+	int32_t Service;
+	int32_t Command;
+	int64_t StartNs;
+	int64_t EndNs;
+} Span;
+
+/* Spans recorded by a core of the service from a cursor on. */
+typedef struct _getSpansRequest {
+	int32_t Core;
+	int64_t Cursor;
+} GetSpansRequest;
+
+typedef struct _getSpansResponse {
+	int32_t Cores;
+	/* Cursor of the next call. */
+	int64_t Cursor;
+	/* Spans overwritten before being read. */
+	int64_t Lost;
+	int32_t num_spans;
+	Span Spans[TRACE_MAX_SPANS];
+} GetSpansResponse;
+
+/* Body of CartService.GetCart */
+typedef struct _getCartRR {
+	GetCartRequest req;
+	Cart res;
+} GetCartRR;
+
+/* Body of RecommendationService.ListRecommendations */
+typedef struct _listRecommendationsRR {
+	ListRecommendationsRequest req;
+	ListRecommendationsResponse res;
+} ListRecommendationsRR;
+
+/* Body of CurrencyService.Convert */
+typedef struct _currencyConversionRR {
+	CurrencyConversionRequest req;
+	Money res;
+} CurrencyConversionRR;
+
+/* Body of CurrencyService.ConvertBatch */
+typedef struct _currencyConversionBatchRR {
+	CurrencyConversionBatchRequest req;
+	CurrencyConversionBatchResponse res;
+} CurrencyConversionBatchRR;
+
+/* Body of ProductCatalogService.GetProduct */
+typedef struct _getProductRR {
+	GetProductRequest req;
+	Product res;
+} GetProductRR;
+
+/* Body of ProductCatalogService.SearchProducts */
+typedef struct _searchProductsRR {
+	SearchProductsRequest req;
+	SearchProductsResponse res;
+} SearchProductsRR;
+
+/* Body of ShippingService.GetQuote */
+typedef struct _getQuoteRR {
+	GetQuoteRequest req;
+	GetQuoteResponse res;
+} GetQuoteRR;
+
+/* Body of ShippingService.ShipOrder */
+typedef struct _shipOrderRR {
+	ShipOrderRequest req;
+	ShipOrderResponse res;
+} ShipOrderRR;
+
+/* Body of PaymentService.Charge */
+typedef struct _chargeRR {
+	ChargeRequest req;
+	ChargeResponse res;
+} ChargeRR;
+
+/* Body of CheckoutService.PlaceOrder */
+typedef struct _placeOrderRR {
+	PlaceOrderRequest req;
+	PlaceOrderResponse res;
+} PlaceOrderRR;
+
+/* Body of AdService.GetAds */
+typedef struct _adRR {
+	AdRequest req;
+	AdResponse res;
+} AdRR;
+
+/* Body of TraceService.GetSpans */
+typedef struct _getSpansRR {
+	GetSpansRequest req;
+	GetSpansResponse res;
+} GetSpansRR;
+
+enum command {
+	CART_ADD_ITEM,
+	CART_GET_CART,
+	CART_EMPTY_CART,
+	RECOMMENDATION_LIST_RECOMMENDATIONS,
+	CURRENCY_GET_SUPPORTED_CURRENCIES,
+	CURRENCY_CONVERT,
+	PRODUCTCATALOG_LIST_PRODUCTS,
+	PRODUCTCATALOG_GET_PRODUCT,
+	PRODUCTCATALOG_SEARCH_PRODUCTS,
+	SHIPPING_GET_QUOTE,
+	SHIPPING_SHIP_ORDER,
+	PAYMENT_CHARGE,
+	EMAIL_SEND_ORDER_CONFIRMATION,
+	CHECKOUT_PLACE_ORDER,
+	AD_GET_ADS,
+	CURRENCY_CONVERT_BATCH,
+	SERVICE_GET_STATS,
+	SERVICE_GET_SPANS,
+	NUM_COMMANDS
+};
+
+#endif /* __MESSAGE_TYPES__ */
@@ -0,0 +1,127 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* Policy deciding how a service waits for its sockets: by blocking in the
+ * poll, which pays the doorbell and the wakeup on every message, or by
+ * spinning on the sockets, which burns the core while there's nothing to do.
+ * The hybrid policies spin for a budget after each round that found work and
+ * block when it runs out. The adaptive one sizes the budget after the time
+ * between rounds with work: it spins for twice the smoothed gap, enough to
+ * catch the next message in a steady stream, and does not spin at all when
+ * messages are further apart than the max budget.
+ *
+ * The policy is fed with timestamps rather than reading the clock, so that it
+ * can be driven by a simulated clock.
+ */
+
+#ifndef __POLLER__
+#define __POLLER__
+
+#include <uk/plat/time.h>
+
+enum poll_mode {
+	POLL_BLOCK,
+	POLL_SPIN,
+	/* Spin for the max budget, then block */
+	POLL_HYBRID,
+	/* Spin for a budget following the inter-arrival time, then block */
+	POLL_ADAPTIVE,
+};
+
+#define DEFAULT_SPIN_US 50
+
+struct poller {
+	enum poll_mode mode;
+	__nsec max_spin;
+	/* Current spin budget */
+	__nsec budget;
+	/* Smoothed time between rounds that found work */
+	__nsec gap;
+	__nsec last_work;
+	/* Start of the current idle period */
+	__nsec idle_since;
+	/* Start of the current round and whether it spins */
+	__nsec round_start;
+	int spinning;
+	/* Stats: rounds spent spinning, rounds of spinning that found work,
+	 * blocking polls, time spinning idle and time blocked since @start
+	 */
+	__nsec start;
+	unsigned long spins;
+	unsigned long spin_hits;
+	unsigned long blocks;
+	__nsec spin_ns;
+	__nsec block_ns;
+};
+
+static inline void poller_init(struct poller *p, enum poll_mode mode,
+			       __nsec max_spin, __nsec now)
+{
+	*p = (struct poller){
+		.mode = mode,
+		.max_spin = max_spin,
+		.budget = mode == POLL_ADAPTIVE ? 0 : max_spin,
+		.last_work = now,
+		.idle_since = now,
+		.start = now,
+	};
+}
+
+/* Start a round at @now. Returns 1 if the round should block in the poll, 0
+ * if it should just look at the sockets.
+ */
+static inline int poller_begin(struct poller *p, __nsec now)
+{
+	switch (p->mode) {
+	case POLL_SPIN:
+		p->spinning = 1;
+		break;
+	case POLL_HYBRID:
+	case POLL_ADAPTIVE:
+		p->spinning = now - p->idle_since < p->budget;
+		break;
+	default:
+		p->spinning = 0;
+		break;
+	}
+	p->round_start = now;
+
+	return !p->spinning;
+}
+
+/* The poll of the round returned at @now */
+static inline void poller_blocked(struct poller *p, __nsec now)
+{
+	p->spin_ns += p->round_start - p->idle_since;
+	p->blocks++;
+	p->block_ns += now - p->round_start;
+	p->idle_since = now;
+}
+
+/* The round found @nwork things to do, handled by @now. Spinning rounds that
+ * found nothing leave the idle period running.
+ */
+static inline void poller_done(struct poller *p, __nsec now, unsigned nwork)
+{
+	if (p->spinning)
+		p->spins++;
+	if (!nwork)
+		return;
+
+	if (p->spinning) {
+		p->spin_hits++;
+		p->spin_ns += p->round_start - p->idle_since;
+	}
+
+	__nsec gap = now - p->last_work;
+	p->last_work = now;
+	p->idle_since = now;
+	p->gap = p->gap ? p->gap - p->gap / 8 + gap / 8 : gap;
+
+	if (p->mode == POLL_ADAPTIVE)
+		p->budget = p->gap > p->max_spin ? 0
+			    : MIN(2 * p->gap, p->max_spin);
+}
+
+#endif /* __POLLER__ */
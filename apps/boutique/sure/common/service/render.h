@@ -0,0 +1,612 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* Responses of the frontend rendered from templates, as HTML or JSON. A
+ * template is compiled once, at startup, against a table of the fields it can
+ * show, which gives their type and their offset in the model the page is
+ * rendered from. Models hold pointers to the responses of the downstream
+ * services, so the products of a page are read where the RPC left them,
+ * never copied into the model.
+ *
+ * Templates are text with tags:
+ * - {{name}} is the value of a field, escaped for the format of the template;
+ * - {{#name}}...{{/name}} repeats the text in between for every element of a
+ *   list, or renders it once for the struct a reference points to, nothing
+ *   if it is NULL. Names in between are those of the elements. The text after
+ *   a '|' in the opening tag, as in {{#name|,}}, separates the elements.
+ *
+ * Rendering writes the response straight into shm buffers, chained as it
+ * grows, with its head first. The Content-Length is counted along and
+ * written at the end into room left for it in the head, so the body is
+ * rendered in a single pass.
+ */
+
+#ifndef __RENDER__
+#define __RENDER__
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unimsg/net.h>
+#include "http.h"
+#include "message_types.h"
+
+/* Ops of a template, nesting of its sections */
+#define RENDER_MAX_OPS 256
+#define RENDER_MAX_DEPTH 8
+/* Digits of the Content-Length, for any response that fits in its descs */
+#define RENDER_LENGTH_DIGITS 7
+#define RENDER_BUFFER_SIZE (UNIMSG_BUFFER_SIZE - UNIMSG_BUFFER_HEADROOM)
+
+_Static_assert(HTTP_MAX_RESPONSE_DESCS * RENDER_BUFFER_SIZE < 10000000,
+	       "Content-Length must fit in RENDER_LENGTH_DIGITS");
+
+enum render_format {
+	RENDER_HTML,
+	RENDER_JSON,
+};
+
+enum render_type {
+	/* char array, NUL-terminated unless full */
+	RENDER_STR,
+	/* int32_t */
+	RENDER_INT,
+	/* Money, as its currency code and amount with cents */
+	RENDER_MONEY,
+	/* Array of elements with their count, an int32_t or uint32_t */
+	RENDER_LIST,
+	/* Pointer to a struct */
+	RENDER_REF,
+};
+
+struct render_field {
+	const char *name;
+	enum render_type type;
+	/* Offset of the value in the struct of the field */
+	size_t off;
+	/* Bytes of a string, max elements of a list */
+	unsigned size;
+	/* Lists: offset of the count of elements and bytes between them */
+	size_t count_off;
+	size_t stride;
+	/* Lists and references: fields of the elements, up to one with a NULL
+	 * name
+	 */
+	const struct render_field *fields;
+};
+
+#define RENDER_MEMBER(type, member) (((type *)0)->member)
+
+#define RENDER_STR_FIELD(name, type, member)				\
+	{ name, RENDER_STR, offsetof(type, member),			\
+	  sizeof(RENDER_MEMBER(type, member)), 0, 0, NULL }
+#define RENDER_INT_FIELD(name, type, member)				\
+	{ name, RENDER_INT, offsetof(type, member), 0, 0, 0, NULL }
+#define RENDER_MONEY_FIELD(name, type, member)				\
+	{ name, RENDER_MONEY, offsetof(type, member), 0, 0, 0, NULL }
+#define RENDER_LIST_FIELD(name, type, member, count, fields)		\
+	{ name, RENDER_LIST, offsetof(type, member),			\
+	  sizeof(RENDER_MEMBER(type, member))				\
+	  / sizeof(RENDER_MEMBER(type, member)[0]),			\
+	  offsetof(type, count), sizeof(RENDER_MEMBER(type, member)[0]),	\
+	  fields }
+#define RENDER_REF_FIELD(name, type, member, fields)			\
+	{ name, RENDER_REF, offsetof(type, member), 0, 0, 0, fields }
+/* A list element that is a string itself, shown as {{.}} */
+#define RENDER_ELEMENT_STR(size)					\
+	{ ".", RENDER_STR, 0, size, 0, 0, NULL }
+#define RENDER_END_FIELDS { NULL, 0, 0, 0, 0, 0, NULL }
+
+enum render_op_type {
+	RENDER_OP_TEXT,
+	RENDER_OP_FIELD,
+	RENDER_OP_SECTION,
+	RENDER_OP_END,
+};
+
+struct render_op {
+	enum render_op_type type;
+	/* Fields and sections */
+	const struct render_field *field;
+	/* Text, separator of the elements of sections */
+	const char *text;
+	unsigned len;
+	/* Sections: index of their end */
+	unsigned end;
+};
+
+/* A compiled template, its text must stay around */
+struct render_template {
+	enum render_format format;
+	const char *content_type;
+	struct render_op ops[RENDER_MAX_OPS];
+	unsigned nops;
+};
+
+/* Response being rendered, in @ndescs descs */
+struct render_out {
+	struct unimsg_shm_desc descs[HTTP_MAX_RESPONSE_DESCS];
+	unsigned ndescs;
+	/* Free part of the last desc */
+	char *p;
+	char *end;
+	/* Bytes of the body so far, and room for their count in the head */
+	unsigned body;
+	char *length;
+	/* -EMSGSIZE once the response does not fit in its descs */
+	int error;
+};
+
+static inline struct render_op *render_op(struct render_template *t,
+					  const char *src, const char *at)
+{
+	if (t->nops == RENDER_MAX_OPS) {
+		fprintf(stderr, "Template too long at offset %ld\n",
+			(long)(at - src));
+		exit(1);
+	}
+
+	return &t->ops[t->nops++];
+}
+
+static inline const struct render_field *
+render_lookup(const struct render_field *fields, const char *name,
+	      unsigned len)
+{
+	for (; fields->name; fields++) {
+		if (strlen(fields->name) == len
+		    && !memcmp(fields->name, name, len))
+			return fields;
+	}
+
+	return NULL;
+}
+
+/* Compile the template @src of @format, showing the @fields of the model it
+ * is rendered from. Templates are part of the service, an error in one is
+ * fatal.
+ */
+static inline void render_compile(struct render_template *t,
+				  enum render_format format, const char *src,
+				  const struct render_field *fields)
+{
+	const struct render_field *scopes[RENDER_MAX_DEPTH];
+	unsigned sections[RENDER_MAX_DEPTH];
+	unsigned depth = 0;
+	const char *p = src;
+
+	t->format = format;
+	t->content_type = format == RENDER_JSON ? "application/json"
+						: "text/html; charset=utf-8";
+	t->nops = 0;
+	scopes[0] = fields;
+
+	for (;;) {
+		const char *open = strstr(p, "{{");
+		/* Braces of the text right before a tag, as in JSON */
+		while (open && open[2] == '{')
+			open++;
+		const char *text_end = open ? open : p + strlen(p);
+
+		if (text_end > p) {
+			struct render_op *op = render_op(t, src, p);
+			op->type = RENDER_OP_TEXT;
+			op->text = p;
+			op->len = text_end - p;
+		}
+		if (!open)
+			break;
+
+		const char *close = strstr(open + 2, "}}");
+		if (!close) {
+			fprintf(stderr, "Unterminated tag at offset %ld\n",
+				(long)(open - src));
+			exit(1);
+		}
+
+		const char *name = open + 2;
+		char kind = *name;
+		if (kind == '#' || kind == '/')
+			name++;
+		const char *sep = memchr(name, '|', close - name);
+		const char *name_end = kind == '#' && sep ? sep : close;
+		unsigned len = name_end - name;
+		/* Sections end in the scope they started from */
+		unsigned scope = kind == '/' && depth ? depth - 1 : depth;
+		const struct render_field *f = render_lookup(scopes[scope],
+							     name, len);
+
+		if (!f) {
+			fprintf(stderr, "Unknown field %.*s at offset %ld\n",
+				(int)len, name, (long)(open - src));
+			exit(1);
+		}
+
+		struct render_op *op = render_op(t, src, open);
+		op->field = f;
+
+		if (kind == '#') {
+			if ((f->type != RENDER_LIST && f->type != RENDER_REF)
+			    || depth + 1 == RENDER_MAX_DEPTH) {
+				fprintf(stderr, "Bad section %.*s at offset "
+					"%ld\n", (int)len, name,
+					(long)(open - src));
+				exit(1);
+			}
+			op->type = RENDER_OP_SECTION;
+			op->text = sep ? sep + 1 : NULL;
+			op->len = sep ? close - sep - 1 : 0;
+			sections[depth++] = op - t->ops;
+			scopes[depth] = f->fields;
+		} else if (kind == '/') {
+			if (!depth || t->ops[sections[depth - 1]].field != f) {
+				fprintf(stderr, "Unmatched end of section "
+					"%.*s at offset %ld\n", (int)len, name,
+					(long)(open - src));
+				exit(1);
+			}
+			op->type = RENDER_OP_END;
+			t->ops[sections[--depth]].end = op - t->ops;
+		} else {
+			if (f->type == RENDER_LIST || f->type == RENDER_REF) {
+				fprintf(stderr, "Section %.*s used as a field "
+					"at offset %ld\n", (int)len, name,
+					(long)(open - src));
+				exit(1);
+			}
+			op->type = RENDER_OP_FIELD;
+		}
+
+		p = close + 2;
+	}
+
+	if (depth) {
+		fprintf(stderr, "Unterminated section %s\n",
+			t->ops[sections[depth - 1]].field->name);
+		exit(1);
+	}
+}
+
+/* Chain another desc to the response, 1 if it is full */
+static inline int render_grow(struct render_out *out)
+{
+	if (out->ndescs) {
+		struct unimsg_shm_desc *last = &out->descs[out->ndescs - 1];
+		last->size = out->p - (char *)last->addr;
+	}
+	if (out->ndescs == HTTP_MAX_RESPONSE_DESCS) {
+		out->error = -EMSGSIZE;
+		return 1;
+	}
+
+	struct unimsg_shm_desc *desc = &out->descs[out->ndescs];
+	int rc = unimsg_buffer_get(desc, 1);
+	if (rc) {
+		fprintf(stderr, "Error getting shm buffer: %s\n",
+			strerror(-rc));
+		exit(1);
+	}
+	out->ndescs++;
+	out->p = desc->addr;
+	out->end = out->p + RENDER_BUFFER_SIZE;
+
+	return 0;
+}
+
+static inline void render_write(struct render_out *out, const char *p,
+				unsigned len)
+{
+	while (len) {
+		if (out->p == out->end && render_grow(out))
+			return;
+
+		unsigned n = out->end - out->p;
+		if (n > len)
+			n = len;
+		memcpy(out->p, p, n);
+		out->p += n;
+		out->body += n;
+		p += n;
+		len -= n;
+	}
+}
+
+/* Characters that do not stand for themselves in each format, the NUL ending
+ * the strings among them
+ */
+static const unsigned char render_special[2][256] = {
+	[RENDER_HTML] = { [0] = 1, ['&'] = 1, ['<'] = 1, ['>'] = 1, ['"'] = 1,
+			  ['\''] = 1 },
+	[RENDER_JSON] = { [0 ... 0x1f] = 1, ['"'] = 1, ['\\'] = 1 },
+};
+
+/* Escape of the special character @c in @format */
+static inline const char *render_escape(enum render_format format,
+					unsigned char c, char tmp[7])
+{
+	static const char hex[] = "0123456789abcdef";
+
+	if (format == RENDER_HTML) {
+		switch (c) {
+		case '&':
+			return "&amp;";
+		case '<':
+			return "&lt;";
+		case '>':
+			return "&gt;";
+		case '"':
+			return "&quot;";
+		default:
+			return "&#39;";
+		}
+	}
+
+	if (c == '"')
+		return "\\\"";
+	if (c == '\\')
+		return "\\\\";
+	memcpy(tmp, "\\u00", 4);
+	tmp[4] = hex[c >> 4];
+	tmp[5] = hex[c & 0xf];
+	tmp[6] = 0;
+
+	return tmp;
+}
+
+/* First special character of @format in [@p, @end), @end if none. The
+ * strings are scanned a block at a time with SSE2 where available, as the
+ * requests are.
+ */
+static inline const char *render_scan(enum render_format format,
+				      const char *p, const char *end)
+{
+	const unsigned char *special = render_special[format];
+
+#if defined(__SSE2__)
+	for (; end - p >= 16; p += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i *)p);
+		__m128i hit;
+
+		if (format == RENDER_HTML) {
+			hit = _mm_or_si128(
+				_mm_or_si128(
+					_mm_cmpeq_epi8(block, _mm_setzero_si128()),
+					_mm_cmpeq_epi8(block, _mm_set1_epi8('&'))),
+				_mm_or_si128(
+					_mm_cmpeq_epi8(block, _mm_set1_epi8('"')),
+					_mm_cmpeq_epi8(block, _mm_set1_epi8('\''))));
+			hit = _mm_or_si128(
+				hit,
+				_mm_or_si128(
+					_mm_cmpeq_epi8(block, _mm_set1_epi8('<')),
+					_mm_cmpeq_epi8(block, _mm_set1_epi8('>'))));
+		} else {
+			/* Control characters are those up to 0x1f */
+			__m128i control = _mm_set1_epi8(0x1f);
+
+			hit = _mm_or_si128(
+				_mm_cmpeq_epi8(_mm_max_epu8(block, control),
+					       control),
+				_mm_or_si128(
+					_mm_cmpeq_epi8(block, _mm_set1_epi8('"')),
+					_mm_cmpeq_epi8(block, _mm_set1_epi8('\\'))));
+		}
+
+		unsigned mask = _mm_movemask_epi8(hit);
+		if (mask)
+			return p + __builtin_ctz(mask);
+	}
+#endif
+	for (; p < end; p++) {
+		if (special[(unsigned char)*p])
+			return p;
+	}
+
+	return end;
+}
+
+/* The string of at most @size bytes at @s, found and escaped in one pass. Runs
+ * of characters that stand for themselves are copied at once.
+ */
+static inline void render_str(struct render_out *out, enum render_format format,
+			      const char *s, unsigned size)
+{
+	const char *end = s + size;
+	const char *p = s;
+	char tmp[7];
+
+	for (;;) {
+		const char *run = p;
+
+		p = render_scan(format, p, end);
+		render_write(out, run, p - run);
+		if (p == end || !*p)
+			return;
+
+		const char *esc = render_escape(format, *p, tmp);
+		render_write(out, esc, strlen(esc));
+		p++;
+	}
+}
+
+/* Decimal digits of @n, ending at @end. Returns their start. */
+static inline char *render_digits(char *end, uint64_t n)
+{
+	do {
+		*--end = '0' + n % 10;
+		n /= 10;
+	} while (n);
+
+	return end;
+}
+
+static inline void render_int(struct render_out *out, int64_t n)
+{
+	char buf[21];
+	char *end = buf + sizeof(buf);
+	char *p = render_digits(end, n < 0 ? -(uint64_t)n : (uint64_t)n);
+
+	if (n < 0)
+		*--p = '-';
+	render_write(out, p, end - p);
+}
+
+static inline void render_money(struct render_out *out, const Money *m)
+{
+	char buf[MONEY_CURRENCY_CODE_SIZE + 25];
+	char *end = buf + sizeof(buf);
+	int neg = m->Units < 0 || m->Nanos < 0;
+	uint64_t units = m->Units < 0 ? -(uint64_t)m->Units
+				      : (uint64_t)m->Units;
+	unsigned cents = (m->Nanos < 0 ? -m->Nanos : m->Nanos) / 10000000;
+	char *p = end;
+
+	*--p = '0' + cents % 10;
+	*--p = '0' + cents / 10 % 10;
+	*--p = '.';
+	p = render_digits(p, units);
+	if (neg)
+		*--p = '-';
+	*--p = ' ';
+
+	/* Currency codes are letters, nothing to escape */
+	unsigned len = strnlen(m->CurrencyCode, MONEY_CURRENCY_CODE_SIZE);
+	p -= len;
+	memcpy(p, m->CurrencyCode, len);
+	render_write(out, p, end - p);
+}
+
+static inline void render_ops(struct render_out *out,
+			      const struct render_template *t, unsigned from,
+			      unsigned to, const char *base);
+
+static inline void render_field(struct render_out *out,
+				enum render_format format,
+				const struct render_field *f, const char *base)
+{
+	const char *v = base + f->off;
+
+	switch (f->type) {
+	case RENDER_STR:
+		render_str(out, format, v, f->size);
+		break;
+	case RENDER_INT:
+		render_int(out, *(const int32_t *)v);
+		break;
+	default:
+		render_money(out, (const Money *)v);
+		break;
+	}
+}
+
+/* The section starting at op @i, for the struct at @base */
+static inline void render_section(struct render_out *out,
+				  const struct render_template *t, unsigned i,
+				  const char *base)
+{
+	const struct render_op *op = &t->ops[i];
+	const struct render_field *f = op->field;
+	const char *v = base + f->off;
+
+	if (f->type == RENDER_REF) {
+		const char *ref = *(const char *const *)v;
+		if (ref)
+			render_ops(out, t, i + 1, op->end, ref);
+		return;
+	}
+
+	int32_t n = *(const int32_t *)(base + f->count_off);
+	if (n < 0)
+		n = 0;
+	if ((unsigned)n > f->size)
+		n = f->size;
+
+	for (int32_t k = 0; k < n; k++) {
+		if (k)
+			render_write(out, op->text, op->len);
+		render_ops(out, t, i + 1, op->end, v + k * f->stride);
+	}
+}
+
+static inline void render_ops(struct render_out *out,
+			      const struct render_template *t, unsigned from,
+			      unsigned to, const char *base)
+{
+	for (unsigned i = from; i < to; i++) {
+		const struct render_op *op = &t->ops[i];
+
+		switch (op->type) {
+		case RENDER_OP_TEXT:
+			render_write(out, op->text, op->len);
+			break;
+		case RENDER_OP_FIELD:
+			render_field(out, t->format, op->field, base);
+			break;
+		case RENDER_OP_SECTION:
+			render_section(out, t, i, base);
+			i = op->end;
+			break;
+		case RENDER_OP_END:
+			break;
+		}
+	}
+}
+
+/* Start a response rendered with @t, in new descs */
+static inline void render_begin(struct render_out *out,
+				const struct render_template *t)
+{
+	static const char spaces[RENDER_LENGTH_DIGITS] = "       ";
+
+	out->ndescs = 0;
+	out->p = NULL;
+	out->end = NULL;
+	out->error = 0;
+
+	render_write(out, "HTTP/1.1 200 OK\r\nContent-Type: ",
+		     sizeof("HTTP/1.1 200 OK\r\nContent-Type: ") - 1);
+	render_write(out, t->content_type, strlen(t->content_type));
+	render_write(out, "\r\nContent-Length:",
+		     sizeof("\r\nContent-Length:") - 1);
+	out->length = out->p;
+	render_write(out, spaces, sizeof(spaces));
+	render_write(out, "\r\n\r\n", 4);
+	out->body = 0;
+}
+
+/* Render the model at @model with @t */
+static inline void render(struct render_out *out,
+			  const struct render_template *t, const void *model)
+{
+	render_ops(out, t, 0, t->nops, model);
+}
+
+/* Finish the response, filling in its Content-Length. Returns -EMSGSIZE if it
+ * did not fit in its descs.
+ */
+static inline int render_end(struct render_out *out)
+{
+	struct unimsg_shm_desc *last = &out->descs[out->ndescs - 1];
+
+	last->size = out->p - (char *)last->addr;
+	if (out->error)
+		return out->error;
+
+	/* Right-aligned, the spaces before are whitespace after the colon */
+	render_digits(out->length + RENDER_LENGTH_DIGITS, out->body);
+
+	return 0;
+}
+
+/* Release the descs of a response not sent */
+static inline void render_put(struct render_out *out)
+{
+	unimsg_buffer_put(out->descs, out->ndescs);
+	out->ndescs = 0;
+}
+
+#endif /* __RENDER__ */
@@ -0,0 +1,473 @@
+/* Generated by gen_rpc.py from boutique.idl, do not edit */
+
+#ifndef __RPC_STUBS__
+#define __RPC_STUBS__
+
+#include <stddef.h>
+#include <unimsg/net.h>
+#include "message.h"
+
+/* Size of the RPCs of each command, header included */
+static const size_t rpc_sizes[NUM_COMMANDS] __attribute__((unused)) = {
+	[CART_ADD_ITEM] = sizeof(struct rpc) + sizeof(AddItemRequest),
+	[CART_GET_CART] = sizeof(struct rpc) + sizeof(GetCartRR),
+	[CART_EMPTY_CART] = sizeof(struct rpc) + sizeof(EmptyCartRequest),
+	[RECOMMENDATION_LIST_RECOMMENDATIONS] =
+		sizeof(struct rpc) + sizeof(ListRecommendationsRR),
+	[CURRENCY_GET_SUPPORTED_CURRENCIES] =
+		sizeof(struct rpc) + sizeof(GetSupportedCurrenciesResponse),
+	[CURRENCY_CONVERT] = sizeof(struct rpc) + sizeof(CurrencyConversionRR),
+	[PRODUCTCATALOG_LIST_PRODUCTS] =
+		sizeof(struct rpc) + sizeof(ListProductsResponse),
+	[PRODUCTCATALOG_GET_PRODUCT] =
+		sizeof(struct rpc) + sizeof(GetProductRR),
+	[PRODUCTCATALOG_SEARCH_PRODUCTS] =
+		sizeof(struct rpc) + sizeof(SearchProductsRR),
+	[SHIPPING_GET_QUOTE] = sizeof(struct rpc) + sizeof(GetQuoteRR),
+	[SHIPPING_SHIP_ORDER] = sizeof(struct rpc) + sizeof(ShipOrderRR),
+	[PAYMENT_CHARGE] = sizeof(struct rpc) + sizeof(ChargeRR),
+	[EMAIL_SEND_ORDER_CONFIRMATION] =
+		sizeof(struct rpc) + sizeof(SendOrderConfirmationRequest),
+	[CHECKOUT_PLACE_ORDER] = sizeof(struct rpc) + sizeof(PlaceOrderRR),
+	[AD_GET_ADS] = sizeof(struct rpc) + sizeof(AdRR),
+	[CURRENCY_CONVERT_BATCH] =
+		sizeof(struct rpc) + sizeof(CurrencyConversionBatchRR),
+	[SERVICE_GET_STATS] = sizeof(struct rpc) + sizeof(GetStatsResponse),
+	[SERVICE_GET_SPANS] = sizeof(struct rpc) + sizeof(GetSpansRR),
+};
+
+/* Name of each command, as Service.Rpc */
+static const char *const rpc_command_names[NUM_COMMANDS]
+__attribute__((unused)) = {
+	[CART_ADD_ITEM] = "Cart.AddItem",
+	[CART_GET_CART] = "Cart.GetCart",
+	[CART_EMPTY_CART] = "Cart.EmptyCart",
+	[RECOMMENDATION_LIST_RECOMMENDATIONS] =
+		"Recommendation.ListRecommendations",
+	[CURRENCY_GET_SUPPORTED_CURRENCIES] = "Currency.GetSupportedCurrencies",
+	[CURRENCY_CONVERT] = "Currency.Convert",
+	[PRODUCTCATALOG_LIST_PRODUCTS] = "ProductCatalog.ListProducts",
+	[PRODUCTCATALOG_GET_PRODUCT] = "ProductCatalog.GetProduct",
+	[PRODUCTCATALOG_SEARCH_PRODUCTS] = "ProductCatalog.SearchProducts",
+	[SHIPPING_GET_QUOTE] = "Shipping.GetQuote",
+	[SHIPPING_SHIP_ORDER] = "Shipping.ShipOrder",
+	[PAYMENT_CHARGE] = "Payment.Charge",
+	[EMAIL_SEND_ORDER_CONFIRMATION] = "Email.SendOrderConfirmation",
+	[CHECKOUT_PLACE_ORDER] = "Checkout.PlaceOrder",
+	[AD_GET_ADS] = "Ad.GetAds",
+	[CURRENCY_CONVERT_BATCH] = "Currency.ConvertBatch",
+	[SERVICE_GET_STATS] = "Stats.GetStats",
+	[SERVICE_GET_SPANS] = "Trace.GetSpans",
+};
+
+/* Handler of a request, called on the body of the RPC, where it leaves
+ * the response
+ */
+typedef void (*rpc_handler_t)(void *body);
+
+/* Handlers of the commands served, registered with the register_*() of
+ * their service, NULL for the rest
+ */
+static rpc_handler_t rpc_handlers[NUM_COMMANDS] __attribute__((unused));
+
+struct cart_handlers {
+	void (*AddItem)(AddItemRequest *body);
+	void (*GetCart)(GetCartRR *body);
+	void (*EmptyCart)(EmptyCartRequest *body);
+};
+
+/* Serve the RPCs of CartService with the handlers in @h,
+ * NULL ones being unimplemented
+ */
+static inline void register_cart_service(const struct cart_handlers *h)
+{
+	rpc_handlers[CART_ADD_ITEM] = (rpc_handler_t)h->AddItem;
+	rpc_handlers[CART_GET_CART] = (rpc_handler_t)h->GetCart;
+	rpc_handlers[CART_EMPTY_CART] = (rpc_handler_t)h->EmptyCart;
+}
+
+/* Start a request to CartService.AddItem
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline AddItemRequest *rpc_cart_add_item(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = CART_ADD_ITEM;
+	desc->size = rpc_sizes[CART_ADD_ITEM];
+
+	return (AddItemRequest *)rpc->rr;
+}
+
+/* Start a request to CartService.GetCart
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline GetCartRR *rpc_cart_get_cart(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = CART_GET_CART;
+	desc->size = rpc_sizes[CART_GET_CART];
+
+	return (GetCartRR *)rpc->rr;
+}
+
+/* Start a request to CartService.EmptyCart
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline EmptyCartRequest *
+rpc_cart_empty_cart(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = CART_EMPTY_CART;
+	desc->size = rpc_sizes[CART_EMPTY_CART];
+
+	return (EmptyCartRequest *)rpc->rr;
+}
+
+struct recommendation_handlers {
+	void (*ListRecommendations)(ListRecommendationsRR *body);
+};
+
+/* Serve the RPCs of RecommendationService with the handlers in @h,
+ * NULL ones being unimplemented
+ */
+static inline void
+register_recommendation_service(const struct recommendation_handlers *h)
+{
+	rpc_handlers[RECOMMENDATION_LIST_RECOMMENDATIONS] =
+		(rpc_handler_t)h->ListRecommendations;
+}
+
+/* Start a request to RecommendationService.ListRecommendations
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline ListRecommendationsRR *
+rpc_recommendation_list_recommendations(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = RECOMMENDATION_LIST_RECOMMENDATIONS;
+	desc->size = rpc_sizes[RECOMMENDATION_LIST_RECOMMENDATIONS];
+
+	return (ListRecommendationsRR *)rpc->rr;
+}
+
+struct currency_handlers {
+	void (*GetSupportedCurrencies)(GetSupportedCurrenciesResponse *body);
+	void (*Convert)(CurrencyConversionRR *body);
+	void (*ConvertBatch)(CurrencyConversionBatchRR *body);
+};
+
+/* Serve the RPCs of CurrencyService with the handlers in @h,
+ * NULL ones being unimplemented
+ */
+static inline void register_currency_service(const struct currency_handlers *h)
+{
+	rpc_handlers[CURRENCY_GET_SUPPORTED_CURRENCIES] =
+		(rpc_handler_t)h->GetSupportedCurrencies;
+	rpc_handlers[CURRENCY_CONVERT] = (rpc_handler_t)h->Convert;
+	rpc_handlers[CURRENCY_CONVERT_BATCH] = (rpc_handler_t)h->ConvertBatch;
+}
+
+/* Start a request to CurrencyService.GetSupportedCurrencies
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline GetSupportedCurrenciesResponse *
+rpc_currency_get_supported_currencies(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = CURRENCY_GET_SUPPORTED_CURRENCIES;
+	desc->size = rpc_sizes[CURRENCY_GET_SUPPORTED_CURRENCIES];
+
+	return (GetSupportedCurrenciesResponse *)rpc->rr;
+}
+
+/* Start a request to CurrencyService.Convert
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline CurrencyConversionRR *
+rpc_currency_convert(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = CURRENCY_CONVERT;
+	desc->size = rpc_sizes[CURRENCY_CONVERT];
+
+	return (CurrencyConversionRR *)rpc->rr;
+}
+
+/* Start a request to CurrencyService.ConvertBatch
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline CurrencyConversionBatchRR *
+rpc_currency_convert_batch(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = CURRENCY_CONVERT_BATCH;
+	desc->size = rpc_sizes[CURRENCY_CONVERT_BATCH];
+
+	return (CurrencyConversionBatchRR *)rpc->rr;
+}
+
+struct product_catalog_handlers {
+	void (*ListProducts)(ListProductsResponse *body);
+	void (*GetProduct)(GetProductRR *body);
+	void (*SearchProducts)(SearchProductsRR *body);
+};
+
+/* Serve the RPCs of ProductCatalogService with the handlers in @h,
+ * NULL ones being unimplemented
+ */
+static inline void
+register_product_catalog_service(const struct product_catalog_handlers *h)
+{
+	rpc_handlers[PRODUCTCATALOG_LIST_PRODUCTS] =
+		(rpc_handler_t)h->ListProducts;
+	rpc_handlers[PRODUCTCATALOG_GET_PRODUCT] = (rpc_handler_t)h->GetProduct;
+	rpc_handlers[PRODUCTCATALOG_SEARCH_PRODUCTS] =
+		(rpc_handler_t)h->SearchProducts;
+}
+
+/* Start a request to ProductCatalogService.ListProducts
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline ListProductsResponse *
+rpc_product_catalog_list_products(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = PRODUCTCATALOG_LIST_PRODUCTS;
+	desc->size = rpc_sizes[PRODUCTCATALOG_LIST_PRODUCTS];
+
+	return (ListProductsResponse *)rpc->rr;
+}
+
+/* Start a request to ProductCatalogService.GetProduct
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline GetProductRR *
+rpc_product_catalog_get_product(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = PRODUCTCATALOG_GET_PRODUCT;
+	desc->size = rpc_sizes[PRODUCTCATALOG_GET_PRODUCT];
+
+	return (GetProductRR *)rpc->rr;
+}
+
+/* Start a request to ProductCatalogService.SearchProducts
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline SearchProductsRR *
+rpc_product_catalog_search_products(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = PRODUCTCATALOG_SEARCH_PRODUCTS;
+	desc->size = rpc_sizes[PRODUCTCATALOG_SEARCH_PRODUCTS];
+
+	return (SearchProductsRR *)rpc->rr;
+}
+
+struct shipping_handlers {
+	void (*GetQuote)(GetQuoteRR *body);
+	void (*ShipOrder)(ShipOrderRR *body);
+};
+
+/* Serve the RPCs of ShippingService with the handlers in @h,
+ * NULL ones being unimplemented
+ */
+static inline void register_shipping_service(const struct shipping_handlers *h)
+{
+	rpc_handlers[SHIPPING_GET_QUOTE] = (rpc_handler_t)h->GetQuote;
+	rpc_handlers[SHIPPING_SHIP_ORDER] = (rpc_handler_t)h->ShipOrder;
+}
+
+/* Start a request to ShippingService.GetQuote
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline GetQuoteRR *rpc_shipping_get_quote(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = SHIPPING_GET_QUOTE;
+	desc->size = rpc_sizes[SHIPPING_GET_QUOTE];
+
+	return (GetQuoteRR *)rpc->rr;
+}
+
+/* Start a request to ShippingService.ShipOrder
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline ShipOrderRR *rpc_shipping_ship_order(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = SHIPPING_SHIP_ORDER;
+	desc->size = rpc_sizes[SHIPPING_SHIP_ORDER];
+
+	return (ShipOrderRR *)rpc->rr;
+}
+
+struct payment_handlers {
+	void (*Charge)(ChargeRR *body);
+};
+
+/* Serve the RPCs of PaymentService with the handlers in @h,
+ * NULL ones being unimplemented
+ */
+static inline void register_payment_service(const struct payment_handlers *h)
+{
+	rpc_handlers[PAYMENT_CHARGE] = (rpc_handler_t)h->Charge;
+}
+
+/* Start a request to PaymentService.Charge
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline ChargeRR *rpc_payment_charge(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = PAYMENT_CHARGE;
+	desc->size = rpc_sizes[PAYMENT_CHARGE];
+
+	return (ChargeRR *)rpc->rr;
+}
+
+struct email_handlers {
+	void (*SendOrderConfirmation)(SendOrderConfirmationRequest *body);
+};
+
+/* Serve the RPCs of EmailService with the handlers in @h,
+ * NULL ones being unimplemented
+ */
+static inline void register_email_service(const struct email_handlers *h)
+{
+	rpc_handlers[EMAIL_SEND_ORDER_CONFIRMATION] =
+		(rpc_handler_t)h->SendOrderConfirmation;
+}
+
+/* Start a request to EmailService.SendOrderConfirmation
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline SendOrderConfirmationRequest *
+rpc_email_send_order_confirmation(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = EMAIL_SEND_ORDER_CONFIRMATION;
+	desc->size = rpc_sizes[EMAIL_SEND_ORDER_CONFIRMATION];
+
+	return (SendOrderConfirmationRequest *)rpc->rr;
+}
+
+struct checkout_handlers {
+	void (*PlaceOrder)(PlaceOrderRR *body);
+};
+
+/* Serve the RPCs of CheckoutService with the handlers in @h,
+ * NULL ones being unimplemented
+ */
+static inline void register_checkout_service(const struct checkout_handlers *h)
+{
+	rpc_handlers[CHECKOUT_PLACE_ORDER] = (rpc_handler_t)h->PlaceOrder;
+}
+
+/* Start a request to CheckoutService.PlaceOrder
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline PlaceOrderRR *
+rpc_checkout_place_order(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = CHECKOUT_PLACE_ORDER;
+	desc->size = rpc_sizes[CHECKOUT_PLACE_ORDER];
+
+	return (PlaceOrderRR *)rpc->rr;
+}
+
+struct ad_handlers {
+	void (*GetAds)(AdRR *body);
+};
+
+/* Serve the RPCs of AdService with the handlers in @h,
+ * NULL ones being unimplemented
+ */
+static inline void register_ad_service(const struct ad_handlers *h)
+{
+	rpc_handlers[AD_GET_ADS] = (rpc_handler_t)h->GetAds;
+}
+
+/* Start a request to AdService.GetAds
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline AdRR *rpc_ad_get_ads(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = AD_GET_ADS;
+	desc->size = rpc_sizes[AD_GET_ADS];
+
+	return (AdRR *)rpc->rr;
+}
+
+/* Served by the framework of every service reachable over RPC, see stats.h. */
+struct stats_handlers {
+	void (*GetStats)(GetStatsResponse *body);
+};
+
+/* Serve the RPCs of StatsService with the handlers in @h,
+ * NULL ones being unimplemented
+ */
+static inline void register_stats_service(const struct stats_handlers *h)
+{
+	rpc_handlers[SERVICE_GET_STATS] = (rpc_handler_t)h->GetStats;
+}
+
+/* Start a request to StatsService.GetStats
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline GetStatsResponse *
+rpc_stats_get_stats(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = SERVICE_GET_STATS;
+	desc->size = rpc_sizes[SERVICE_GET_STATS];
+
+	return (GetStatsResponse *)rpc->rr;
+}
+
+/* Served by the framework of every service reachable over RPC, see trace.h. */
+struct trace_handlers {
+	void (*GetSpans)(GetSpansRR *body);
+};
+
+/* Serve the RPCs of TraceService with the handlers in @h,
+ * NULL ones being unimplemented
+ */
+static inline void register_trace_service(const struct trace_handlers *h)
+{
+	rpc_handlers[SERVICE_GET_SPANS] = (rpc_handler_t)h->GetSpans;
+}
+
+/* Start a request to TraceService.GetSpans
+ * in the buffer of @desc, returns its body to fill in
+ */
+static inline GetSpansRR *rpc_trace_get_spans(struct unimsg_shm_desc *desc)
+{
+	struct rpc *rpc = desc->addr;
+
+	rpc->command = SERVICE_GET_SPANS;
+	desc->size = rpc_sizes[SERVICE_GET_SPANS];
+
+	return (GetSpansRR *)rpc->rr;
+}
+
+#endif /* __RPC_STUBS__ */
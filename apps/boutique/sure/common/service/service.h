@@ -5,11 +5,21 @@
 #ifndef __SERVICE__
 #define __SERVICE__
 
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unimsg/net.h>
 #include "message.h"
+#include "message_codec.h"
+#include "rpc_stubs.h"
+#include "balance.h"
+#include "poller.h"
+#include "stats.h"
+#include "timer.h"
+#include "trace.h"
+
+int usleep(unsigned usec);
 
 #ifndef ENABLE_DEBUG
 #define ENABLE_DEBUG 0
@@ -39,20 +49,31 @@ struct service_desc {
 	char *name;
 	uint32_t addr;
 	uint16_t port;
+	/* Addresses of the replicas of the service, the first one is addr.
+	 * Replicas listen on the same port.
+	 */
+	unsigned nreplicas;
+	uint32_t replica_addrs[MAX_REPLICAS];
 };
 
+/* Address of the VM attached to sidecar @id */
+#define SIDECAR_ADDR(id) (0x0000000a | ((uint32_t)(id) << 24))
+/* Sidecars of replica @replica (from 1) of service @id, after the ones of the
+ * first replicas of all services
+ */
+#define REPLICA_SIDECAR(id, replica)					\
+	(NUM_SERVICES + (id) * (MAX_REPLICAS - 1) + (replica))
+
 #define DEFINE_SERVICE(_id, _name, _addr, _port) {			\
 	.id = (_id),							\
 	.name = (_name),						\
 	.addr = (_addr),						\
-	.port = (_port)							\
-}
-#define DEFAULT_SERVICE(_id, _name) {					\
-	.id = (_id),							\
-	.name = (_name),						\
-	.addr = 0x0000000a | ((_id + 1) << 24),				\
-	.port = 5000 + (_id + 1)					\
+	.port = (_port),						\
+	.nreplicas = 1,							\
+	.replica_addrs = { (_addr) }					\
 }
+#define DEFAULT_SERVICE(_id, _name)					\
+	DEFINE_SERVICE(_id, _name, SIDECAR_ADDR(_id + 1), 5000 + (_id + 1))
 
 static struct service_desc services[] = {
 	DEFAULT_SERVICE(AD_SERVICE, "ad"),
@@ -83,156 +104,918 @@ static struct service_desc services[] = {
 #define _ERR_CLOSE(s) ({ unimsg_close(s); exit(1); })
 #define __unused __attribute__((unused))
 
-typedef void (*handle_request_t)(struct unimsg_shm_desc *desc);
+#ifndef SERVICE_MAX_CORES
+#define SERVICE_MAX_CORES 8
+#endif
+_Static_assert(SERVICE_MAX_CORES <= STATS_MAX_CORES,
+	       "Stats response too small for all cores");
+#define DEFAULT_MAX_COROUTINES 1024
+
+/* Order in which async services receive from ready upstream connections */
+enum upstream_sched {
+	/* One bulk from every connection in turn */
+	SCHED_RR,
+	/* Deficit round-robin, a quantum of requests per connection */
+	SCHED_DRR_REQUESTS,
+	/* Deficit round-robin, a quantum of bytes per connection */
+	SCHED_DRR_BYTES,
+};
+
+#define DEFAULT_DRR_QUANTUM_REQUESTS 4
+#define DEFAULT_DRR_QUANTUM_BYTES 4096
+#define DEFAULT_TRACE_SAMPLE 256
+#define DEFAULT_DEADLINE_US 1000000
+#define DEFAULT_CREDITS 32
+#define DEFAULT_ADMIT_QUEUE 256
+#define DEFAULT_HEDGE_RATE 5
+/* Sleep of a blocking round with timers armed, bounds the latency added to
+ * the messages arriving meanwhile
+ */
+#define TIMED_WAIT_SLICE_US 20
+
+struct service_opts {
+	/* Number of cores serving requests (async services only) */
+	unsigned ncores;
+	/* High-water mark of the coroutine pool of each core, also bounds the
+	 * number of queued requests (async services only)
+	 */
+	unsigned max_coroutines;
+	/* Send the responses to the requests of a received bulk together
+	 * (sync services only)
+	 */
+	int batch;
+	/* Send downstream RPCs in the compact encoding (async services only) */
+	int compact;
+	/* Upstream scheduler and its quantum, 0 for the default of the
+	 * scheduler (async services only)
+	 */
+	enum upstream_sched sched;
+	long quantum;
+	/* How to wait for the sockets and max spin time */
+	enum poll_mode poll_mode;
+	unsigned spin_us;
+	/* Trace one request out of trace_sample, 0 for none (frontend only) */
+	unsigned trace_sample;
+	/* Deadline of requests received without one, 0 for none */
+	unsigned deadline_us;
+	/* Balancing of RPCs among the replicas of a service (async services
+	 * only)
+	 */
+	enum lb_policy lb;
+	/* Max RPCs in flight granted to each upstream connection, and assumed
+	 * of downstream services until they grant theirs
+	 */
+	unsigned credits;
+	/* Requests waiting for downstream credits beyond which new ones are
+	 * shed, 0 for none (frontend only)
+	 */
+	unsigned admit_queue;
+	/* Max RPCs of a hedged command sent twice, in percent (async services
+	 * only)
+	 */
+	unsigned hedge_rate;
+};
+
+static struct service_opts service_opts = {
+	.ncores = 1,
+	.max_coroutines = DEFAULT_MAX_COROUTINES,
+	.batch = 1,
+	.spin_us = DEFAULT_SPIN_US,
+	.trace_sample = DEFAULT_TRACE_SAMPLE,
+	.deadline_us = DEFAULT_DEADLINE_US,
+	.credits = DEFAULT_CREDITS,
+	.admit_queue = DEFAULT_ADMIT_QUEUE,
+	.hedge_rate = DEFAULT_HEDGE_RATE,
+};
+
+__unused
+static void service_usage(const char *prog)
+{
+	fprintf(stderr,
+		"  Usage: %s [OPTIONS]\n"
+		"  Options:\n"
+		"  -c, --cores		Number of cores serving requests (default 1, max %u)\n"
+		"  -m, --max-coroutines	Max coroutines per core (default %u)\n"
+		"  -B, --no-batch	Send every response on its own\n"
+		"  -z, --compact		Send RPCs in the compact encoding\n"
+		"  -s, --sched		Upstream scheduler: rr, drr (requests) or drr-bytes (default rr)\n"
+		"  -q, --quantum		DRR quantum (default %u requests or %u bytes)\n"
+		"  -p, --poll		Wait for messages: block, spin, hybrid (spin then block) or adaptive (default block)\n"
+		"  -u, --spin-us		Max spin time of hybrid and adaptive polling (default %u)\n"
+		"  -t, --trace-sample	Trace one request out of N at the frontend, 0 for none (default %u)\n"
+		"  -d, --deadline-us	Deadline of requests received without one, 0 for none (default %u)\n"
+		"  -R, --replicas	Replicas of a downstream service, as SERVICE=N with the name or id of the service (max %u)\n"
+		"  -l, --lb		Balancing among replicas: rr, least (outstanding RPCs) or p2c (power of two choices) (default rr)\n"
+		"  -k, --credits		Max RPCs in flight on each connection, granted upstream (default %u)\n"
+		"  -a, --admit-queue	Requests waiting for downstream credits before shedding at the frontend, 0 for no shedding (default %u)\n"
+		"  -H, --hedge-rate	Max RPCs of a hedged command sent twice, in percent (default %u)\n",
+		prog, SERVICE_MAX_CORES, DEFAULT_MAX_COROUTINES,
+		DEFAULT_DRR_QUANTUM_REQUESTS, DEFAULT_DRR_QUANTUM_BYTES,
+		DEFAULT_SPIN_US, DEFAULT_TRACE_SAMPLE, DEFAULT_DEADLINE_US,
+		MAX_REPLICAS, DEFAULT_CREDITS, DEFAULT_ADMIT_QUEUE,
+		DEFAULT_HEDGE_RATE);
+
+	exit(1);
+}
+
+/* Set the replicas of a service from SERVICE=N. Replica 0 is the service
+ * itself, the others sit on the sidecars given by REPLICA_SIDECAR().
+ */
+static void parse_replicas(const char *prog, const char *arg)
+{
+	const char *eq = strrchr(arg, '=');
+	struct service_desc *service = NULL;
+
+	if (!eq) {
+		fprintf(stderr, "Replicas must be given as SERVICE=N\n");
+		service_usage(prog);
+	}
+
+	for (unsigned i = 0; i < NUM_SERVICES; i++) {
+		char id[8];
+
+		snprintf(id, sizeof(id), "%u", services[i].id);
+		if ((strlen(services[i].name) == (size_t)(eq - arg)
+		     && !strncmp(arg, services[i].name, eq - arg))
+		    || (strlen(id) == (size_t)(eq - arg)
+			&& !strncmp(arg, id, eq - arg)))
+			service = &services[i];
+	}
+	if (!service) {
+		fprintf(stderr, "Unknown service %.*s\n", (int)(eq - arg),
+			arg);
+		service_usage(prog);
+	}
+
+	int n = atoi(eq + 1);
+	if (n < 1 || n > MAX_REPLICAS) {
+		fprintf(stderr, "Replicas must be between 1 and %u\n",
+			MAX_REPLICAS);
+		service_usage(prog);
+	}
+
+	service->nreplicas = n;
+	for (int i = 1; i < n; i++) {
+		service->replica_addrs[i] =
+			SIDECAR_ADDR(REPLICA_SIDECAR(service->id, i));
+	}
+}
+
+__unused
+static void parse_service_args(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"cores", required_argument, 0, 'c'},
+		{"max-coroutines", required_argument, 0, 'm'},
+		{"no-batch", no_argument, 0, 'B'},
+		{"compact", no_argument, 0, 'z'},
+		{"sched", required_argument, 0, 's'},
+		{"quantum", required_argument, 0, 'q'},
+		{"poll", required_argument, 0, 'p'},
+		{"spin-us", required_argument, 0, 'u'},
+		{"trace-sample", required_argument, 0, 't'},
+		{"deadline-us", required_argument, 0, 'd'},
+		{"replicas", required_argument, 0, 'R'},
+		{"lb", required_argument, 0, 'l'},
+		{"credits", required_argument, 0, 'k'},
+		{"admit-queue", required_argument, 0, 'a'},
+		{"hedge-rate", required_argument, 0, 'H'},
+		{0, 0, 0, 0}
+	};
+	int option_index, c;
+
+	for (;;) {
+		c = getopt_long(argc, argv, "c:m:Bzs:q:p:u:t:d:R:l:k:a:H:",
+				long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'c':
+			service_opts.ncores = atoi(optarg);
+			break;
+		case 'm':
+			service_opts.max_coroutines = atoi(optarg);
+			break;
+		case 'B':
+			service_opts.batch = 0;
+			break;
+		case 'z':
+			service_opts.compact = 1;
+			break;
+		case 's':
+			if (!strcmp(optarg, "rr")) {
+				service_opts.sched = SCHED_RR;
+			} else if (!strcmp(optarg, "drr")) {
+				service_opts.sched = SCHED_DRR_REQUESTS;
+			} else if (!strcmp(optarg, "drr-bytes")) {
+				service_opts.sched = SCHED_DRR_BYTES;
+			} else {
+				fprintf(stderr, "Unknown scheduler %s\n",
+					optarg);
+				service_usage(argv[0]);
+			}
+			break;
+		case 'q':
+			service_opts.quantum = atol(optarg);
+			break;
+		case 'p':
+			if (!strcmp(optarg, "block")) {
+				service_opts.poll_mode = POLL_BLOCK;
+			} else if (!strcmp(optarg, "spin")) {
+				service_opts.poll_mode = POLL_SPIN;
+			} else if (!strcmp(optarg, "hybrid")) {
+				service_opts.poll_mode = POLL_HYBRID;
+			} else if (!strcmp(optarg, "adaptive")) {
+				service_opts.poll_mode = POLL_ADAPTIVE;
+			} else {
+				fprintf(stderr, "Unknown polling mode %s\n",
+					optarg);
+				service_usage(argv[0]);
+			}
+			break;
+		case 'u':
+			service_opts.spin_us = atoi(optarg);
+			break;
+		case 't':
+			service_opts.trace_sample = atoi(optarg);
+			break;
+		case 'd':
+			service_opts.deadline_us = atoi(optarg);
+			break;
+		case 'R':
+			parse_replicas(argv[0], optarg);
+			break;
+		case 'l':
+			if (!strcmp(optarg, "rr")) {
+				service_opts.lb = LB_RR;
+			} else if (!strcmp(optarg, "least")) {
+				service_opts.lb = LB_LEAST;
+			} else if (!strcmp(optarg, "p2c")) {
+				service_opts.lb = LB_P2C;
+			} else {
+				fprintf(stderr, "Unknown balancing %s\n",
+					optarg);
+				service_usage(argv[0]);
+			}
+			break;
+		case 'k':
+			service_opts.credits = atoi(optarg);
+			break;
+		case 'a':
+			service_opts.admit_queue = atoi(optarg);
+			break;
+		case 'H':
+			service_opts.hedge_rate = atoi(optarg);
+			break;
+		default:
+			service_usage(argv[0]);
+		}
+	}
+
+	if (service_opts.ncores == 0
+	    || service_opts.ncores > SERVICE_MAX_CORES) {
+		fprintf(stderr, "Cores must be between 1 and %u\n",
+			SERVICE_MAX_CORES);
+		service_usage(argv[0]);
+	}
+
+	if (service_opts.credits == 0) {
+		fprintf(stderr, "Credits must be > 0\n");
+		service_usage(argv[0]);
+	}
+
+	if (service_opts.hedge_rate > 100) {
+		fprintf(stderr, "Hedge rate must be <= 100\n");
+		service_usage(argv[0]);
+	}
+
+	if (service_opts.quantum < 0) {
+		fprintf(stderr, "Quantum must be > 0\n");
+		service_usage(argv[0]);
+	} else if (!service_opts.quantum) {
+		service_opts.quantum =
+			service_opts.sched == SCHED_DRR_BYTES
+			? DEFAULT_DRR_QUANTUM_BYTES
+			: DEFAULT_DRR_QUANTUM_REQUESTS;
+	}
+}
+
+/* Sockets polled by a service. Sockets are added at the end and removed by
+ * moving the last one into the hole, both in O(1), so positions are not
+ * stable: owners of data kept in arrays parallel to socks[] move it along
+ * (see sock_set_remove()). After a poll, the positions of the ready sockets
+ * are listed in decreasing order, so that the list stays valid while the
+ * sockets it visits are removed.
+ */
+struct sock_set {
+	struct unimsg_sock *socks[UNIMSG_MAX_NSOCKS];
+	int ready[UNIMSG_MAX_NSOCKS];
+	unsigned nsocks;
+	unsigned ready_list[UNIMSG_MAX_NSOCKS];
+	unsigned nready;
+};
+
+static inline int sock_set_full(struct sock_set *set)
+{
+	return set->nsocks == UNIMSG_MAX_NSOCKS;
+}
+
+/* Returns the position of the socket */
+static inline unsigned sock_set_add(struct sock_set *set,
+				    struct unimsg_sock *s)
+{
+	set->socks[set->nsocks] = s;
+	set->ready[set->nsocks] = 0;
+
+	return set->nsocks++;
+}
+
+/* Remove the socket at position @i. Returns the former position of the socket
+ * moved to @i, or @i if it was the last one.
+ */
+static inline unsigned sock_set_remove(struct sock_set *set, unsigned i)
+{
+	unsigned last = --set->nsocks;
+
+	set->socks[i] = set->socks[last];
+	set->ready[i] = set->ready[last];
+
+	return last;
+}
+
+/* Wait for any of the first @npoll sockets to be ready and list the ready
+ * ones
+ */
+__unused
+static void sock_set_poll(struct sock_set *set, unsigned npoll)
+{
+	int rc = unimsg_poll(set->socks, npoll, set->ready);
+	if (rc) {
+		fprintf(stderr, "Error polling: %s\n", strerror(-rc));
+		exit(1);
+	}
+
+	set->nready = 0;
+	for (unsigned i = npoll; i-- > 0; ) {
+		if (set->ready[i])
+			set->ready_list[set->nready++] = i;
+	}
+}
+
+/* List the first @npoll sockets as ready without polling, for a spinning
+ * round. Handlers of the sockets never block, so listing idle ones is
+ * harmless.
+ */
+static void sock_set_all(struct sock_set *set, unsigned npoll)
+{
+	set->nready = 0;
+	for (unsigned i = npoll; i-- > 0; ) {
+		set->ready[i] = 1;
+		set->ready_list[set->nready++] = i;
+	}
+}
+
+/* Start a round of the poll loop of a service: block in the poll or spin on
+ * the first @npoll sockets of @set as decided by @poller. The poll has no
+ * timeout, so a service with @timers armed blocks by sleeping for a slice
+ * instead and then looks at all the sockets, for its timers to fire on time.
+ */
+__unused
+static void service_wait(struct poller *poller, struct sock_set *set,
+			 unsigned npoll, int timers)
+{
+	if (!poller_begin(poller, ukplat_monotonic_clock())) {
+		sock_set_all(set, npoll);
+		return;
+	}
+
+	if (timers) {
+		usleep(TIMED_WAIT_SLICE_US);
+		sock_set_all(set, npoll);
+	} else {
+		sock_set_poll(set, npoll);
+	}
+	poller_blocked(poller, ukplat_monotonic_clock());
+}
+
+__unused
+static void poller_print(struct poller *poller, const char *who)
+{
+	__nsec elapsed = ukplat_monotonic_clock() - poller->start;
+	__nsec busy = elapsed - poller->block_ns;
+
+	printf("%s: %lu%% busy, %lu%% spinning idle, %lu blocking polls, %lu "
+	       "spins, %lu found work, budget %lu ns, gap %lu ns\n", who,
+	       elapsed ? (unsigned long)(100 * busy / elapsed) : 0,
+	       elapsed ? (unsigned long)(100 * poller->spin_ns / elapsed) : 0,
+	       poller->blocks, poller->spins, poller->spin_hits,
+	       (unsigned long)poller->budget, (unsigned long)poller->gap);
+}
 
 static size_t get_rpc_size(enum command command)
 {
-	ssize_t size;
-
-	switch (command) {
-	case CART_ADD_ITEM:
-		size = sizeof(AddItemRequest);
-		break;
-	case CART_GET_CART:
-		size = sizeof(GetCartRR);
-		break;
-	case CART_EMPTY_CART:
-		size = sizeof(EmptyCartRequest);
-		break;
-	case RECOMMENDATION_LIST_RECOMMENDATIONS:
-		size = sizeof(ListRecommendationsRR);
-		break;
-	case CURRENCY_GET_SUPPORTED_CURRENCIES:
-		size = sizeof(GetSupportedCurrenciesResponse);
-		break;
-	case CURRENCY_CONVERT:
-		size = sizeof(CurrencyConversionRR);
-		break;
-	case PRODUCTCATALOG_LIST_PRODUCTS:
-		size = sizeof(ListProductsResponse);
-		break;
-	case PRODUCTCATALOG_GET_PRODUCT:
-		size = sizeof(GetProductRR);
-		break;
-	case PRODUCTCATALOG_SEARCH_PRODUCTS:
-		size = sizeof(SearchProductsRR);
-		break;
-	case SHIPPING_GET_QUOTE:
-		size = sizeof(GetQuoteRR);
-		break;
-	case SHIPPING_SHIP_ORDER:
-		size = sizeof(ShipOrderRR);
-		break;
-	case PAYMENT_CHARGE:
-		size = sizeof(ChargeRR);
-		break;
-	case EMAIL_SEND_ORDER_CONFIRMATION:
-		size = sizeof(SendOrderConfirmationRR);
-		break;
-	case CHECKOUT_PLACE_ORDER:
-		size = sizeof(PlaceOrderRR);
-		break;
-	case AD_GET_ADS:
-		size = sizeof(AdRR);
-		break;
-	default:
+	if ((unsigned)command >= NUM_COMMANDS) {
 		fprintf(stderr, "Unknown gRPC command %d\n", command);
 		exit(1);
 	}
 
-	return size + sizeof(struct rpc);
+	return rpc_sizes[command];
 }
 
-struct pending_buffer {
-	struct unimsg_shm_desc desc;
+/* Commands served by the framework of every service rather than by the
+ * service itself
+ */
+static inline int framework_command(enum command command)
+{
+	return command == SERVICE_GET_STATS || command == SERVICE_GET_SPANS;
+}
+
+/* Time left to @deadline at @now, for the header of an RPC sent then. An RPC
+ * is never sent past its deadline, it is at least 1 ns to tell it from none.
+ */
+static inline uint64_t rpc_budget(__nsec deadline, __nsec now)
+{
+	if (!deadline)
+		return 0;
+
+	return deadline > now ? deadline - now : 1;
+}
+
+/* Deadline on the local clock of a request received at @received with
+ * @budget in its header, the default one if the caller set none, 0 for none
+ */
+static inline __nsec rpc_deadline(uint64_t budget, __nsec received)
+{
+	if (budget)
+		return received + budget;
+
+	return service_opts.deadline_us
+	       ? received + service_opts.deadline_us * 1000ULL : 0;
+}
+
+/* Turn the RPC in @desc, a whole buffer, into a response to @command failed
+ * with @status. The body is zeroed, so that handlers reading it anyway find
+ * empty fields rather than leftovers of the request.
+ */
+__unused
+static void rpc_fail(struct unimsg_shm_desc *desc, enum command command,
+		     int status)
+{
+	size_t size = get_rpc_size(command);
+
+	/* The RPC might sit at the end of a buffer shared with others */
+	unimsg_buffer_reset(desc);
+	memset(desc->addr, 0, size);
+
+	struct rpc *rpc = desc->addr;
+	rpc->command = command;
+	rpc->status = status;
+	desc->size = size;
+}
+
+/* Header of compact RPCs, including the size of the body */
+#define RPC_COMPACT_HDR_SIZE (sizeof(struct rpc) + sizeof(uint32_t))
+
+/* Bytes of payload of a shm buffer */
+#define RPC_BUFFER_AVAILABLE (UNIMSG_BUFFER_SIZE - UNIMSG_BUFFER_HEADROOM)
+
+/* Descs a received RPC is kept in. The fragments of a message arriving in
+ * more are merged as they come: messages fit in a buffer, so only a sender
+ * cutting them in tiny pieces gets there.
+ */
+#define RPC_MAX_FRAGS 4
+
+/* Scatter-gather view of a received RPC over the descs it arrived in. The
+ * bytes of a message are not copied on reception: the rpc_msg_*() helpers
+ * access them in place, and rpc_msg_linearize() makes the message contiguous
+ * for those who need it, copying it only if it spans descs.
+ */
+struct rpc_msg {
+	struct unimsg_shm_desc frags[RPC_MAX_FRAGS];
+	unsigned nfrags;
+	/* Bytes received so far */
+	unsigned size;
+	/* Size of the full message, 0 until the header is complete */
 	unsigned expected_sz;
 };
 
-static void move_data(struct unimsg_shm_desc *dst, struct unimsg_shm_desc *src,
-		      unsigned size)
+static inline void rpc_msg_reset(struct rpc_msg *msg)
 {
-	memcpy(dst->addr + dst->size, src->addr, size);
-	dst->size += size;
-	src->addr += size;
-	src->off += size;
-	src->size -= size;
+	msg->nfrags = 0;
+	msg->size = 0;
+	msg->expected_sz = 0;
 }
 
-static int process_desc(struct pending_buffer *pending,
-			struct unimsg_shm_desc *desc)
+/* View of the whole message in @desc */
+static inline void rpc_msg_init(struct rpc_msg *msg,
+				struct unimsg_shm_desc *desc)
 {
-	int rc;
+	msg->frags[0] = *desc;
+	msg->nfrags = 1;
+	msg->size = desc->size;
+	msg->expected_sz = desc->size;
+}
 
-	if (!pending->desc.addr) {
-		/* There's nothing pending */
+/* Release the descs of the message, if any */
+static inline void rpc_msg_put(struct rpc_msg *msg)
+{
+	if (msg->nfrags)
+		unimsg_buffer_put(msg->frags, msg->nfrags);
+	rpc_msg_reset(msg);
+}
 
-		if (desc->size < sizeof(struct rpc)) {
-			pending->desc = *desc;
-			desc->size = 0;
+/* Copy @len bytes at offset @off of the message to @dst */
+static void rpc_msg_read(const struct rpc_msg *msg, unsigned off, void *dst,
+			 unsigned len)
+{
+	const struct unimsg_shm_desc *frag = msg->frags;
+
+	if (!len)
+		return;
+
+	while (off >= frag->size)
+		off -= (frag++)->size;
+
+	while (len) {
+		unsigned n = MIN(len, frag->size - off);
+
+		memcpy(dst, frag->addr + off, n);
+		dst += n;
+		len -= n;
+		off = 0;
+		frag++;
+	}
+}
+
+/* Address of @len bytes at offset @off of the message, NULL if they straddle
+ * descs, in which case rpc_msg_read() gets them
+ */
+__unused
+static void *rpc_msg_ptr(const struct rpc_msg *msg, unsigned off,
+			 unsigned len)
+{
+	const struct unimsg_shm_desc *frag = msg->frags;
+
+	while (off >= frag->size)
+		off -= (frag++)->size;
+
+	return off + len <= frag->size ? frag->addr + off : NULL;
+}
+
+/* Header of the message, which can straddle descs too */
+static inline struct rpc rpc_msg_header(const struct rpc_msg *msg)
+{
+	struct rpc hdr;
+
+	rpc_msg_read(msg, 0, &hdr, sizeof(hdr));
+
+	return hdr;
+}
+
+/* Make the message contiguous, in a single desc, and return its address. The
+ * message is copied to a buffer of its own if it spans descs, which are
+ * released.
+ */
+__unused
+static void *rpc_msg_linearize(struct rpc_msg *msg)
+{
+	if (msg->nfrags == 1)
+		return msg->frags[0].addr;
+
+	struct unimsg_shm_desc desc;
+	int rc = unimsg_buffer_get(&desc, 1);
+	if (rc) {
+		fprintf(stderr, "Error getting shm buffer: %s\n",
+			strerror(-rc));
+		exit(1);
+	}
+	rpc_msg_read(msg, 0, desc.addr, msg->size);
+	desc.size = msg->size;
+	unimsg_buffer_put(msg->frags, msg->nfrags);
+
+	msg->frags[0] = desc;
+	msg->nfrags = 1;
+
+	return desc.addr;
+}
+
+/* Hand the complete message over to @desc, contiguous, leaving @msg empty */
+static inline void rpc_msg_take(struct rpc_msg *msg,
+				struct unimsg_shm_desc *desc)
+{
+	rpc_msg_linearize(msg);
+	*desc = msg->frags[0];
+	rpc_msg_reset(msg);
+}
+
+/* Size of the message starting at @addr given its first @size bytes, 0 if its
+ * header is not complete yet
+ */
+static unsigned rpc_expected_size(void *addr, unsigned size)
+{
+	struct rpc *rpc = addr;
+	unsigned expected;
+
+	if (size < sizeof(struct rpc))
+		return 0;
+	if (!(rpc->command & RPC_COMPACT)) {
+		expected = get_rpc_size(rpc->command);
+	} else {
+		if (size < RPC_COMPACT_HDR_SIZE)
 			return 0;
-		}
+		expected = RPC_COMPACT_HDR_SIZE + *(uint32_t *)rpc->rr;
+	}
 
-		struct rpc *rpc = desc->addr;
-		pending->expected_sz = get_rpc_size(rpc->command);
+	if (expected > RPC_BUFFER_AVAILABLE) {
+		fprintf(stderr, "RPC of %u B does not fit in a buffer\n",
+			expected);
+		exit(1);
+	}
+
+	return expected;
+}
 
-		if (desc->size == pending->expected_sz) {
-			pending->desc = *desc;
+/* Split @desc after its first @size bytes, which go to @head, leaving the
+ * rest in @desc. The smaller part is copied to a buffer of its own, as a
+ * buffer cannot be owned by two messages.
+ */
+static void desc_split(struct unimsg_shm_desc *desc,
+		       struct unimsg_shm_desc *head, unsigned size)
+{
+	struct unimsg_shm_desc copy;
+	unsigned rest = desc->size - size;
+
+	int rc = unimsg_buffer_get(&copy, 1);
+	if (rc) {
+		fprintf(stderr, "Error getting shm buffer: %s\n",
+			strerror(-rc));
+		exit(1);
+	}
+
+	if (size <= rest) {
+		memcpy(copy.addr, desc->addr, size);
+		copy.size = size;
+		*head = copy;
+		desc->addr += size;
+		desc->off += size;
+		desc->size = rest;
+	} else {
+		memcpy(copy.addr, desc->addr + size, rest);
+		copy.size = rest;
+		*head = *desc;
+		head->size = size;
+		*desc = copy;
+	}
+}
+
+/* Add the bytes of the message in @desc, which is left with the bytes of the
+ * next ones if any. Returns 1 when the message is complete.
+ */
+__unused
+static int process_desc(struct rpc_msg *msg, struct unimsg_shm_desc *desc)
+{
+	if (!msg->nfrags) {
+		msg->expected_sz = rpc_expected_size(desc->addr, desc->size);
+		if (msg->expected_sz && msg->expected_sz == desc->size) {
+			/* The desc holds just the message */
+			rpc_msg_init(msg, desc);
 			desc->size = 0;
 			return 1;
+		}
+	} else if (!msg->expected_sz) {
+		/* The header straddles descs */
+		_Alignas(struct rpc) char hdr[RPC_COMPACT_HDR_SIZE];
+		unsigned n = MIN(msg->size + desc->size, sizeof(hdr));
 
-		} else if (desc->size < pending->expected_sz) {
-			if (UNIMSG_BUFFER_SIZE - 68 - desc->off >=
-			    pending->expected_sz) {
-				/* The buffer can hold the full message */
-				pending->desc = *desc;
-				desc->size = 0;
-			} else {
-				/* The buffer can't hold the full message */
-				rc = unimsg_buffer_get(&pending->desc, 1);
-				if (rc) {
-					fprintf(stderr, "Error getting shm "
-						"buffer: %s\n", strerror(-rc));
-					exit(1);
-				}
-				pending->desc.size = 0;
-				move_data(&pending->desc, desc, desc->size);
-			}
+		rpc_msg_read(msg, 0, hdr, msg->size);
+		memcpy(hdr + msg->size, desc->addr, n - msg->size);
+		msg->expected_sz = rpc_expected_size(hdr, n);
+	}
 
-			return 0;
+	if (msg->nfrags == RPC_MAX_FRAGS) {
+		/* Out of fragments, the bytes go after the last one if there's
+		 * room in its buffer, which is the message's alone
+		 */
+		struct unimsg_shm_desc *last = &msg->frags[RPC_MAX_FRAGS - 1];
+		unsigned n = msg->expected_sz
+			     ? MIN(desc->size, msg->expected_sz - msg->size)
+			     : desc->size;
 
-		} else { /* desc->size > pending->expected_sz */
-			rc = unimsg_buffer_get(&pending->desc, 1);
-			if (rc) {
-				fprintf(stderr, "Error getting shm buffer: "
-					"%s\n", strerror(-rc));
-				exit(1);
-			}
-			pending->desc.size = 0;
-			move_data(&pending->desc, desc, pending->expected_sz);
+		if (n > UNIMSG_BUFFER_SIZE - last->off - last->size) {
+			rpc_msg_linearize(msg);
+		} else {
+			memcpy(last->addr + last->size, desc->addr, n);
+			last->size += n;
+			msg->size += n;
+			desc->addr += n;
+			desc->off += n;
+			desc->size -= n;
+			if (!desc->size)
+				unimsg_buffer_put(desc, 1);
 
-			return 1;
+			return msg->expected_sz
+			       && msg->size == msg->expected_sz;
 		}
+	}
 
+	struct unimsg_shm_desc *frag = &msg->frags[msg->nfrags++];
+	if (msg->expected_sz && desc->size > msg->expected_sz - msg->size) {
+		desc_split(desc, frag, msg->expected_sz - msg->size);
 	} else {
-		/* There's something pending */
-		unsigned needed = pending->expected_sz ?
-				  pending->expected_sz - pending->desc.size :
-				  sizeof(struct rpc) - pending->desc.size;
-
-		unsigned to_copy = MIN(needed, desc->size);
-		move_data(&pending->desc, desc, to_copy);
-
-		if (!pending->expected_sz
-		    && pending->desc.size > sizeof(struct rpc)) {
-			struct rpc *rpc = pending->desc.addr;
-			pending->expected_sz = get_rpc_size(rpc->command);
-		}
+		*frag = *desc;
+		desc->size = 0;
+	}
+	msg->size += frag->size;
+
+	return msg->expected_sz && msg->size == msg->expected_sz;
+}
+
+_Static_assert(RPC_COMPACT_HDR_SIZE + CODEC_MAX_SIZE <= RPC_BUFFER_AVAILABLE,
+	       "Compact RPCs must fit in a buffer");
+
+/* Write to @dst the request (@res 0) or the response (@res 1) of the RPC in
+ * @src, in the struct layout, in the compact encoding
+ */
+__unused
+static void rpc_compact_encode(struct unimsg_shm_desc *dst,
+			       struct unimsg_shm_desc *src, int res)
+{
+	struct rpc *in = src->addr;
+	struct rpc *out = dst->addr;
+	uint8_t *body = (uint8_t *)out->rr + sizeof(uint32_t);
+
+	uint8_t *end = codec_encode(in->command, res, in->rr, body);
+	out->id = in->id;
+	out->command = in->command | RPC_COMPACT;
+	out->trace = in->trace;
+	out->deadline = in->deadline;
+	out->status = in->status;
+	out->credits = in->credits;
+	*(uint32_t *)out->rr = end - body;
+	dst->size = end - (uint8_t *)dst->addr;
+}
 
-		if (desc->size == 0)
-			unimsg_buffer_put(desc, 1);
+/* Decode the request (@res 0) or the response (@res 1) of the compact RPC in
+ * @src into the RPC in @dst, in the struct layout. Only the fields of the
+ * request or of the response are written, the rest of @dst is left as is.
+ */
+__unused
+static void rpc_compact_decode(struct unimsg_shm_desc *dst,
+			       struct unimsg_shm_desc *src, int res)
+{
+	struct rpc *in = src->addr;
+	struct rpc *out = dst->addr;
+	enum command command = in->command & ~RPC_COMPACT;
 
-		return pending->desc.size == pending->expected_sz ? 1 : 0;
+	if (codec_decode(command, res, (uint8_t *)in->rr + sizeof(uint32_t),
+			 src->size - RPC_COMPACT_HDR_SIZE, out->rr)) {
+		fprintf(stderr, "Malformed compact RPC, command %d\n",
+			command);
+		exit(1);
 	}
+	out->id = in->id;
+	out->command = command;
+	out->trace = in->trace;
+	out->deadline = in->deadline;
+	out->status = in->status;
+	out->credits = in->credits;
+	dst->size = get_rpc_size(command);
+}
+
+/* Handler of a request reading it through @req, a view over the descs it
+ * arrived in, and leaving the response in @res, the body of the RPC to send
+ * back. It calls rpc_msg_linearize() on @req if it needs it contiguous. As
+ * with rpc_handler_t, @res is the body of the request itself when this fits in
+ * a single desc.
+ */
+typedef void (*rpc_view_handler_t)(struct rpc_msg *req, void *res);
+
+/* Handlers registered with register_view_handler(), taking the place of the
+ * rpc_handlers of their command
+ */
+static rpc_view_handler_t rpc_view_handlers[NUM_COMMANDS] __unused;
+
+/* Serve @command with @handler, reading requests in place */
+__unused
+static void register_view_handler(enum command command,
+				  rpc_view_handler_t handler)
+{
+	rpc_view_handlers[command] = handler;
+}
+
+/* Serve the request in @msg with the handler registered for its command,
+ * leaving the response in @desc and @msg empty. Requests spanning descs are
+ * copied only for the handlers that take them as structs. Returns -ENOSYS if
+ * the command has no handler.
+ */
+__unused
+static int rpc_dispatch(struct rpc_msg *msg, struct unimsg_shm_desc *desc)
+{
+	enum command command = rpc_msg_header(msg).command;
+	rpc_view_handler_t view = rpc_view_handlers[command];
+
+	if (!view) {
+		rpc_handler_t handler = rpc_handlers[command];
+
+		rpc_msg_take(msg, desc);
+		if (!handler)
+			return -ENOSYS;
+		handler(((struct rpc *)desc->addr)->rr);
+		return 0;
+	}
+
+	if (msg->nfrags == 1) {
+		*desc = msg->frags[0];
+		view(msg, ((struct rpc *)desc->addr)->rr);
+		rpc_msg_reset(msg);
+		return 0;
+	}
+
+	int rc = unimsg_buffer_get(desc, 1);
+	if (rc) {
+		fprintf(stderr, "Error getting shm buffer: %s\n",
+			strerror(-rc));
+		exit(1);
+	}
+	rpc_msg_read(msg, 0, desc->addr, sizeof(struct rpc));
+	desc->size = get_rpc_size(command);
+	view(msg, ((struct rpc *)desc->addr)->rr);
+	rpc_msg_put(msg);
+
+	return 0;
+}
+
+/* Handlers of @command in a service fused into this image, either of them
+ * set, called by the host on the request in place
+ */
+struct fused_handler {
+	rpc_handler_t handler;
+	rpc_view_handler_t view;
+};
+
+#ifdef SERVICE_FUSED
+/* Handlers of the services fused into the image of this one (see FUSE in the
+ * Makefile), filled in by the guests at startup and called directly by the
+ * host instead of going through unimsg
+ */
+#ifdef SERVICE_GUEST
+extern struct fused_handler fused_handlers[NUM_COMMANDS];
+#else
+struct fused_handler fused_handlers[NUM_COMMANDS];
+#endif
+#endif
+
+/* Handlers of @command in a service fused into this image, NULL if the command
+ * is served over unimsg
+ */
+static inline const struct fused_handler *fused_handler(enum command command)
+{
+#ifdef SERVICE_FUSED
+	const struct fused_handler *f = &fused_handlers[command];
+
+	return f->handler || f->view ? f : NULL;
+#else
+	(void)command;
+	return NULL;
+#endif
+}
+
+/* Serve a request in @msg, leaving the response in @desc and @msg empty */
+typedef void (*handle_request_t)(struct rpc_msg *msg,
+				 struct unimsg_shm_desc *desc);
+
+/* Handle the request in @msg and leave the response in @desc. Compact requests
+ * are decoded to a separate buffer, handled there, and their response encoded
+ * back into @desc.
+ */
+__unused
+static void rpc_serve(handle_request_t handle_request, struct rpc_msg *msg,
+		      struct unimsg_shm_desc *desc)
+{
+	if (!(rpc_msg_header(msg).command & RPC_COMPACT)) {
+		handle_request(msg, desc);
+		return;
+	}
+
+	/* The decoder reads the request contiguous */
+	rpc_msg_take(msg, desc);
+
+	struct unimsg_shm_desc req, res;
+	int rc = unimsg_buffer_get(&req, 1);
+	if (rc) {
+		fprintf(stderr, "Error getting shm buffer: %s\n",
+			strerror(-rc));
+		exit(1);
+	}
+
+	rpc_compact_decode(&req, desc, 0);
+	rpc_msg_init(msg, &req);
+	handle_request(msg, &res);
+
+	unimsg_buffer_reset(desc);
+	rpc_compact_encode(desc, &res, 1);
+	unimsg_buffer_put(&res, 1);
 }
 
 #endif /* __SERVICE__ */
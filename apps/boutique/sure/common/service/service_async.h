@@ -7,405 +7,2861 @@
 
 #include "service.h"
 #include "../libaco/aco.h"
+#include <uk/plat/time.h>
+#if UPSTREAM_HTTP
+#include "http.h"
+#else
+/* Requests come as RPCs, there is no HTTP request to pass around and
+ * run_service() takes no HTTP handler
+ */
+struct http_request;
+typedef void (*http_handler_t)(struct unimsg_shm_desc *desc,
+			       const struct http_request *req);
+#endif
+#if SERVICE_MULTICORE
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
+
+#if ENABLE_DEBUG
+#define DEBUG_SVC(co_id, fmt, ...)					\
+	printf("[service %u (%d)] " fmt, core->id, co_id, ##__VA_ARGS__)
+#else
+#define DEBUG_SVC(...) (void)0
+#endif
+
+/* Coroutines kept allocated even when idle, each one with a private stack */
+#define MIN_COROUTINES 32
+/* Coroutines allocated beyond MIN_COROUTINES share stacks in groups, libaco
+ * saves the used portion of the stack in a per-coroutine buffer that grows as
+ * needed
+ */
+#define COROUTINES_PER_SHARED_STACK 8
+/* Downstream RPCs a coroutine can have in flight at the same time */
+#define MAX_PARALLEL_RPCS 32
+
+/* The id of a downstream RPC carries the id of the issuing coroutine, the
+ * slot of the RPC among the ones in flight for that coroutine and the
+ * generation of the slot, which tells late responses to RPCs that timed out
+ * from the responses to the RPCs that reused their slot
+ */
+#define RPC_ID(co_id, slot, gen)					\
+	((co_id) | (slot) << 16 | ((gen) & RPC_ID_GEN_MASK) << 21)
+#define RPC_ID_CO(id) ((id) & 0xffff)
+#define RPC_ID_SLOT(id) (((id) >> 16) & 0x1f)
+#define RPC_ID_GEN(id) ((id) >> 21)
+#define RPC_ID_GEN_MASK 0x7ff
+#define MAX_COROUTINE_ID 0xffff
+
+_Static_assert(MAX_PARALLEL_RPCS <= 32, "RPC slots must fit in 5 bits");
+
+#if UPSTREAM_HTTP
+/* Response of the frontend to requests that could not be served in time */
+#define HTTP_GATEWAY_TIMEOUT "HTTP/1.1 504 Gateway Timeout\r\n"		\
+			     "Content-Length: 0\r\n"			\
+			     "\r\n"
+#define HTTP_SERVICE_UNAVAILABLE "HTTP/1.1 503 Service Unavailable\r\n"	\
+				 "Content-Length: 0\r\n"		\
+				 "\r\n"
+/* Response of the frontend to malformed and oversized requests */
+#define HTTP_BAD_REQUEST "HTTP/1.1 400 Bad Request\r\n"			\
+			 "Content-Length: 0\r\n"			\
+			 "\r\n"
+#define HTTP_PAYLOAD_TOO_LARGE "HTTP/1.1 413 Payload Too Large\r\n"	\
+			       "Content-Length: 0\r\n"			\
+			       "\r\n"
+
+/* Initial size of the ring of the HTTP responses waiting for their turn */
+#define HTTP_PARKED_MIN 8
+#endif
+
+/* Entries of the RPC response cache of each core, looked up in sets of
+ * RPC_CACHE_WAYS consecutive entries
+ */
+#define RPC_CACHE_SIZE 64
+#define RPC_CACHE_WAYS 4
+
+/* RPCs of a hedged command whose latency sets the next hedging budget, and
+ * max hedges a command saves up for bursts
+ */
+#define HEDGE_WINDOW 1024
+#define HEDGE_BURST 8
+
+/* Time to set up the doorbell of a core before going without doorbells */
+#define BELL_CONNECT_TIMEOUT_NS 1000000000ULL
+
+/* Completion policies of rpc_wait() */
+#define RPC_WAIT_ALL 0
+#define RPC_WAIT_ANY 1
+
+#if SERVICE_MULTICORE
+#define __core_local __thread
+#define ATOMIC(type) _Atomic(type)
+#else
+#define __core_local
+#define ATOMIC(type) type
+#endif
+
+struct service_conn {
+	struct unimsg_sock *sock;
+	/* Position of the socket in the poll set of the core */
+	unsigned pos;
+	/* Message being received */
+	struct rpc_msg pending;
+	/* Number of requests of the connection currently being handled by
+	 * coroutines, a connection can only move to another core when 0
+	 */
+	unsigned inflight;
+	/* Closed by the client while requests were in flight, out of the poll
+	 * set and freed by the last of them
+	 */
+	int closed;
+	/* Credit of the connection with the DRR schedulers */
+	long deficit;
+	/* Service and replica of downstream connections */
+	unsigned service;
+	unsigned replica;
+	/* Stats of upstream connections: requests and bytes received, served
+	 * and shed, time from reception to response of the requests served
+	 */
+	unsigned long requests;
+	unsigned long bytes;
+	unsigned long served;
+	unsigned long shed;
+	__nsec latency_sum;
+	__nsec latency_max;
+#if UPSTREAM_HTTP
+	/* HTTP upstream connections: start of a request still incomplete,
+	 * copied to a buffer of its own (NULL addr if none), bytes of an
+	 * oversized request still to drop, and whether the stream can no
+	 * longer be framed after a malformed request
+	 */
+	struct unimsg_shm_desc http_partial;
+	unsigned long http_skip;
+	int http_broken;
+	/* Sequence numbers of the next request received and of the next
+	 * response to send, HTTP responses go out in the order of the
+	 * requests. Responses ready ahead of their turn wait in a ring indexed
+	 * by sequence number, a power of 2 in size.
+	 */
+	unsigned long http_rx_seq;
+	unsigned long http_tx_seq;
+	struct http_parked *http_parked;
+	unsigned http_parked_size;
+#endif
+};
+
+#if UPSTREAM_HTTP
+/* Response to an HTTP request waiting for those of the requests before it,
+ * in @ndescs descs, 0 if not ready
+ */
+struct http_parked {
+	struct unimsg_shm_desc descs[HTTP_MAX_RESPONSE_DESCS];
+	unsigned ndescs;
+};
+#endif
+
+/* Reception from an upstream connection in one visit of the scheduler */
+struct upstream_rx {
+	/* Max descs to receive */
+	unsigned max_descs;
+	/* Descs, requests and bytes received */
+	unsigned ndescs;
+	unsigned nrequests;
+	unsigned nbytes;
+};
+
+struct shared_stack {
+	aco_share_stack_t *stack;
+	unsigned users;
+};
+
+struct coroutine {
+	unsigned id;
+	aco_t *handle;
+	struct shared_stack *stack;
+	/* Data of upstream request: an RPC stays in the descs it arrived in
+	 * until served, its response and HTTP requests are in up_desc
+	 */
+	struct service_conn *up_conn;
+	struct rpc_msg up_msg;
+	struct unimsg_shm_desc up_desc;
+	__nsec up_received;
+#if UPSTREAM_HTTP
+	/* HTTP request and its sequence number on the connection, and descs
+	 * of the response after the one in up_desc, if it spans more
+	 */
+	struct http_request up_http;
+	unsigned long up_seq;
+	struct unimsg_shm_desc up_more[HTTP_MAX_RESPONSE_DESCS - 1];
+	unsigned up_nmore;
+#endif
+	/* Trace context of the request, passed on to the RPCs it issues, and
+	 * span of the caller
+	 */
+	struct rpc_trace trace;
+	uint32_t trace_parent;
+	/* Deadline of the request, passed on to the RPCs it issues, and status
+	 * of its response, the first error of those RPCs
+	 */
+	__nsec deadline;
+	int status;
+	/* Fires at the earliest explicit timeout or hedge of the RPCs awaited
+	 */
+	struct timer timer;
+	/* Responses of downtream requests, indexed by slot, stored here rather
+	 * than through pointers into the coroutine stack, which might be
+	 * swapped out of a shared stack when the response arrives
+	 */
+	struct unimsg_shm_desc down_descs[MAX_PARALLEL_RPCS];
+	/* Slots in flight, completed and awaited */
+	uint32_t down_inflight;
+	uint32_t down_completed;
+	uint32_t down_waited;
+	int down_wait_mode;
+	/* Issue time and cache generation of cacheable RPCs, indexed by slot */
+	__nsec down_sent[MAX_PARALLEL_RPCS];
+	unsigned down_cache_gen[MAX_PARALLEL_RPCS];
+	/* Command, deadline and generation of the RPCs, indexed by slot.
+	 * Slots whose deadline comes with an explicit timeout of the call.
+	 */
+	enum command down_command[MAX_PARALLEL_RPCS];
+	__nsec down_deadline[MAX_PARALLEL_RPCS];
+	unsigned down_gen[MAX_PARALLEL_RPCS];
+	uint32_t down_timed;
+	/* Service and replica the RPCs were sent to, indexed by slot */
+	unsigned down_service[MAX_PARALLEL_RPCS];
+	unsigned down_replica[MAX_PARALLEL_RPCS];
+	/* Hedged RPCs: copy of the request as sent, kept until it is sent
+	 * again to another replica, and time to do so, indexed by slot. Slots
+	 * holding a copy and slots with a duplicate in flight.
+	 */
+	struct unimsg_shm_desc down_spares[MAX_PARALLEL_RPCS];
+	__nsec down_hedge_at[MAX_PARALLEL_RPCS];
+	uint32_t down_spare;
+	uint32_t down_hedged;
+	/* Link in the queue of the coroutines waiting for credits of a
+	 * service, pointing to this coroutine, NULL if not waiting
+	 */
+	struct coroutine *credit_next;
+	struct coroutine **credit_pprev;
+	unsigned credit_service;
+};
+
+/* Downstream RPC issued as part of a group, see do_rpc_many() */
+struct rpc_call {
+	/* Request on issue, replaced by the response on completion */
+	struct unimsg_shm_desc *desc;
+	unsigned service;
+	/* Max time to wait for the response, 0 to only wait until the
+	 * deadline of the request being served. Only calls with a timeout
+	 * arm a timer, the others count on the downstream service to answer
+	 * past the deadline it was passed.
+	 */
+	__nsec timeout;
+	unsigned slot;
+	int done;
+	/* Status of the response, -ETIMEDOUT if it didn't come in time */
+	int status;
+	/* Handler of the service if fused into this image */
+	const struct fused_handler *fused;
+};
+
+#define RPC_CALL(_desc, _service) {					\
+	.desc = (_desc),						\
+	.service = (_service),						\
+}
+
+#define RPC_CALL_TIMEOUT(_desc, _service, _timeout) {			\
+	.desc = (_desc),						\
+	.service = (_service),						\
+	.timeout = (_timeout),						\
+}
+
+/* Response of a cacheable RPC, the key is the command and the first key_size
+ * bytes of the body, which hold the request
+ */
+struct rpc_cache_entry {
+	/* Copy of the full response message, NULL if the entry is unused */
+	struct rpc *msg;
+	unsigned size;
+	uint64_t hash;
+	__nsec expires;
+	/* Invalidation generation of the command when the entry was stored */
+	unsigned gen;
+};
+
+/* Latency of the recent RPCs of a hedged command, with the budget derived from
+ * it after which they are hedged, 0 until known, and the hedges the command
+ * may still send, in hundredths
+ */
+struct rpc_hedge {
+	struct hist *window;
+	__nsec budget;
+	unsigned tokens;
+};
+
+struct rpc_cache_stats {
+	unsigned long hits;
+	unsigned long misses;
+	/* Time spent serving hits and waiting for responses on misses */
+	__nsec hit_ns;
+	__nsec miss_ns;
+};
+
+/* Requests received while all coroutines are busy */
+struct backlog_entry {
+	struct service_conn *conn;
+#if UPSTREAM_HTTP
+	struct unimsg_shm_desc desc;
+#else
+	struct rpc_msg msg;
+#endif
+	__nsec received;
+#if UPSTREAM_HTTP
+	struct http_request http;
+	unsigned long seq;
+#endif
+};
+
+struct backlog {
+	struct backlog_entry *entries;
+	unsigned size;
+	unsigned head;
+	unsigned len;
+};
+
+/* Each core runs its own poll loop with a private pool of coroutines and a
+ * private set of connections, both downstream and upstream. Coroutines never
+ * leave the core that created them (libaco binds them to the main coroutine
+ * of the thread), so load is balanced by moving upstream connections instead:
+ * new connections are accepted by the least loaded core and an overloaded core
+ * offers one of its idle connections to be stolen by an idle one. Idle cores
+ * may be blocked in the poll, the offer rings their doorbell to wake them up.
+ */
+struct service_core {
+	unsigned id;
+	aco_t *main_co;
+	/* Coroutines indexed by id, NULL if not allocated */
+	struct coroutine **coroutines;
+	unsigned ncoroutines;
+	/* Allocated coroutines ready to handle a request */
+	unsigned *available_cos;
+	unsigned n_available_cos;
+	/* Ids not assigned to any allocated coroutine */
+	unsigned *free_ids;
+	unsigned n_free_ids;
+	/* Stacks shared by coroutines beyond MIN_COROUTINES */
+	struct shared_stack *shared_stacks;
+	unsigned nshared_stacks;
+	struct backlog backlog;
+	/* Connections to the replicas of the dependencies, indexed by service
+	 * id, and the balancing of RPCs among them
+	 */
+	struct service_conn downstream_conns[NUM_SERVICES][MAX_REPLICAS];
+	struct balancer balancers[NUM_SERVICES];
+	/* Coroutines waiting for credits of each service, in FIFO order, and
+	 * their total
+	 */
+	struct coroutine *credit_waiters[NUM_SERVICES];
+	struct coroutine **credit_tails[NUM_SERVICES];
+	unsigned ncredit_waiters;
+	/* Poll set: listening socket, downstream sockets, upstream sockets,
+	 * and the connections of the sockets
+	 */
+	struct sock_set set;
+	struct service_conn *conns[UNIMSG_MAX_NSOCKS];
+	/* Number of upstream connections, read by other cores */
+	ATOMIC(unsigned) nconns;
+	/* Connection offered to other cores */
+	ATOMIC(struct service_conn *) offer;
+	struct service_conn *offered;
+#if SERVICE_MULTICORE
+	/* Whether all the coroutines of the core are idle, so that it can
+	 * steal, read by other cores
+	 */
+	ATOMIC(int) idle;
+	/* Doorbell, a connection of the service to itself: other cores send
+	 * on bell_tx, one at a time, to wake the core up from a poll on
+	 * bell_rx. Rung until the core drains bell_rx.
+	 */
+	struct unimsg_sock *bell_tx;
+	struct unimsg_sock *bell_rx;
+	pthread_mutex_t bell_lock;
+	ATOMIC(int) bell_rung;
+#endif
+	struct poller poller;
+	/* Position among the upstream connections where the scheduler starts
+	 * the next round
+	 */
+	unsigned sched_next;
+	struct rpc_cache_entry rpc_cache[RPC_CACHE_SIZE];
+	/* Stats */
+	unsigned long served;
+	unsigned long stolen;
+	struct rpc_cache_stats rpc_cache_stats;
+	struct rpc_hedge hedges[NUM_COMMANDS];
+	struct service_stats stats;
+	/* Spans of sampled requests and requests seen by the sampler */
+	struct trace_ring trace_ring;
+	unsigned long trace_requests;
+	/* Timers of the coroutines waiting for RPCs or credits with a
+	 * deadline
+	 */
+	struct timer_wheel timers;
+	/* Generation of the next RPC issued */
+	unsigned rpc_gen;
+};
+
+static struct service_core cores[SERVICE_MAX_CORES];
+static __core_local struct service_core *core;
+static struct unimsg_sock *listen_sock;
+static unsigned service_id;
+#if UPSTREAM_HTTP
+static http_handler_t request_handler;
+#endif
+static int *service_dependencies;
+static unsigned service_ndependencies;
+/* Downstream connections of each core, to all the replicas of the
+ * dependencies
+ */
+static unsigned service_ndownstream;
+/* Whether the cores have a doorbell, polled after the downstream sockets */
+static int service_bells;
+/* Sockets at the start of the poll set of every core, before the upstream
+ * connections: listening socket, downstream sockets and doorbell
+ */
+static unsigned service_nfixed;
+
+/* Caching policy of each command, a TTL of 0 disables caching. Invalidations
+ * bump the generation of the command, making the entries of all cores stale
+ */
+static __nsec rpc_cache_ttl[NUM_COMMANDS];
+static unsigned rpc_cache_key_size[NUM_COMMANDS];
+static ATOMIC(unsigned) rpc_cache_gen[NUM_COMMANDS];
+/* Hedging policy of each command, the quantile of its latency, in
+ * permyriad, past which RPCs are sent again, 0 disables hedging
+ */
+static unsigned rpc_hedge_quantile[NUM_COMMANDS];
+
+static void backlog_push(struct service_conn *conn, struct rpc_msg *msg,
+			 struct unimsg_shm_desc *desc, __nsec received,
+			 struct http_request *http, unsigned long seq)
+{
+	struct backlog *b = &core->backlog;
+
+	if (b->len == b->size) {
+		/* Grow the ring, unrolling it at the start of the new buffer */
+		unsigned size = b->size ? b->size * 2 : MIN_COROUTINES;
+		struct backlog_entry *entries =
+			malloc(size * sizeof(*entries));
+		if (!entries) {
+			fprintf(stderr, "Error allocating backlog\n");
+			exit(1);
+		}
+		for (unsigned i = 0; i < b->len; i++)
+			entries[i] = b->entries[(b->head + i) % b->size];
+		free(b->entries);
+		b->entries = entries;
+		b->size = size;
+		b->head = 0;
+	}
+
+	struct backlog_entry *e = &b->entries[(b->head + b->len) % b->size];
+	e->conn = conn;
+	e->received = received;
+#if UPSTREAM_HTTP
+	e->desc = *desc;
+	if (http)
+		e->http = *http;
+	e->seq = seq;
+#else
+	e->msg = *msg;
+#endif
+	b->len++;
+	if (b->len > core->stats.queue_max)
+		core->stats.queue_max = b->len;
+}
+
+/* Hand the oldest queued request to @co */
+static int backlog_pop(struct coroutine *co)
+{
+	struct backlog *b = &core->backlog;
+
+	if (!b->len)
+		return 0;
+
+	struct backlog_entry *e = &b->entries[b->head];
+	co->up_conn = e->conn;
+	co->up_received = e->received;
+#if UPSTREAM_HTTP
+	co->up_desc = e->desc;
+	co->up_http = e->http;
+	co->up_seq = e->seq;
+#else
+	co->up_msg = e->msg;
+#endif
+	b->head = (b->head + 1) % b->size;
+	b->len--;
+
+	return 1;
+}
+
+/* Upstream reception stops when the backlog reaches the high-water mark */
+static int upstream_full(void)
+{
+	return core->ncoroutines == service_opts.max_coroutines
+	       && core->n_available_cos == 0
+	       && core->backlog.len >= service_opts.max_coroutines;
+}
+
+/* Credits granted to every upstream connection: the coroutines of the core
+ * shared among its connections, so that the requests they have in flight find
+ * a coroutine rather than piling up in the backlog
+ */
+__unused
+static int32_t credit_grant(void)
+{
+	unsigned share = service_opts.max_coroutines / MAX(core->nconns, 1U);
+
+	return MAX(1U, MIN(share, service_opts.credits));
+}
+
+static void serve_stats(GetStatsResponse *res)
+{
+	struct service_stats *stats[SERVICE_MAX_CORES];
+
+	/* Counters are summed over the cores, other cores are read without
+	 * synchronization
+	 */
+	memset(res, 0, sizeof(*res));
+	res->Cores = service_opts.ncores;
+	for (unsigned i = 0; i < service_opts.ncores; i++) {
+		struct service_core *c = &cores[i];
+
+		res->Connections += c->nconns;
+		res->QueueDepth += c->backlog.len;
+		res->QueueDepthMax += c->stats.queue_max;
+		res->Coroutines += c->ncoroutines;
+		res->CoroutinesBusy += c->ncoroutines - c->n_available_cos;
+		res->CoroutinesBusyMax += c->stats.busy_max;
+		res->Timeouts += c->stats.timeouts;
+		res->LateResponses += c->stats.late;
+		res->Expired += c->stats.expired;
+		res->CreditWaits += c->stats.credit_waits;
+		res->Shed += c->stats.shed;
+		res->Hedges += c->stats.hedges;
+		res->HedgeWins += c->stats.hedge_wins;
+		res->PerCore[i].Connections = c->nconns;
+		res->PerCore[i].Stolen = c->stolen;
+		stats[i] = &c->stats;
+	}
+	res->num_per_core = service_opts.ncores;
+	stats_fill(res, stats, service_opts.ncores);
+}
+
+static void serve_spans(GetSpansRR *rr)
+{
+	uint64_t cursor = rr->req.Cursor;
+	uint64_t lost = 0;
+	int span_core = rr->req.Core;
+
+	memset(&rr->res, 0, sizeof(rr->res));
+	rr->res.Cores = service_opts.ncores;
+	if (span_core >= 0 && (unsigned)span_core < service_opts.ncores) {
+		rr->res.num_spans = trace_ring_read(
+			&cores[span_core].trace_ring, &cursor, rr->res.Spans,
+			TRACE_MAX_SPANS, &lost);
+		rr->res.Cursor = cursor;
+		rr->res.Lost = lost;
+	}
+}
+
+/* Requests are served by the handler registered for their command, the
+ * framework registers its own ones in run_service()
+ */
+__unused
+static void serve_request(struct rpc_msg *msg, struct unimsg_shm_desc *desc)
+{
+	int rc = rpc_dispatch(msg, desc);
+
+	if (rc) {
+		struct coroutine *co = aco_get_arg();
+		co->status = rc;
+	}
+}
+
+/* Set the trace context of the request of @co: the frontend samples the
+ * requests to trace, the other services follow the decision of the caller
+ */
+static void trace_begin(struct coroutine *co)
+{
+#if UPSTREAM_HTTP
+	co->trace = (struct rpc_trace){ 0 };
+	co->trace_parent = 0;
+	if (service_opts.trace_sample
+	    && ++core->trace_requests % service_opts.trace_sample == 0) {
+		co->trace.trace_id = trace_new_id(&core->trace_ring, core->id);
+		co->trace.flags = RPC_TRACE_SAMPLED;
+	}
+#else
+	co->trace = rpc_msg_header(&co->up_msg).trace;
+	co->trace_parent = co->trace.span_id;
+#endif
+
+	if (co->trace.flags & RPC_TRACE_SAMPLED) {
+		co->trace.span_id = trace_new_span(&core->trace_ring,
+						   service_id, core->id);
+	}
+}
+
+/* Set the deadline of the request of @co. Returns 1 if it's already past:
+ * nobody waits for the response anymore, the request is answered with an
+ * error without doing the work it would cause.
+ */
+static int deadline_begin(struct coroutine *co)
+{
+	co->status = 0;
+#if UPSTREAM_HTTP
+	co->deadline = rpc_deadline(0, co->up_received);
+#else
+	co->deadline = rpc_deadline(rpc_msg_header(&co->up_msg).deadline,
+				    co->up_received);
+#endif
+
+	if (!co->deadline || ukplat_monotonic_clock() < co->deadline)
+		return 0;
+
+	DEBUG_SVC(co->id, "Request past its deadline\n");
+	core->stats.expired++;
+	co->status = -ETIMEDOUT;
+
+	return 1;
+}
+
+/* Admit the request of @co. The frontend sheds it if too many requests
+ * already wait for downstream credits: it is answered with an error right
+ * away rather than queued behind work the downstream services cannot take.
+ * Returns 1 if shed.
+ */
+static int admission_begin(struct coroutine *co __unused)
+{
+#if UPSTREAM_HTTP
+	if (!service_opts.admit_queue
+	    || core->ncredit_waiters < service_opts.admit_queue)
+		return 0;
+
+	DEBUG_SVC(co->id, "Shedding request, out of downstream credits\n");
+	core->stats.shed++;
+	co->up_conn->shed++;
+	co->status = -EBUSY;
+
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/* Check the HTTP request of @co, the framework answers those it could not
+ * frame (see http_frame()). Returns 1 if rejected.
+ */
+static int http_begin(struct coroutine *co __unused)
+{
+#if UPSTREAM_HTTP
+	if (!co->up_http.error)
+		return 0;
+
+	DEBUG_SVC(co->id, "Rejecting malformed or oversized request\n");
+	co->status = co->up_http.error;
+
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/* Report the failure of the request of @co, if any, in its response, and
+ * grant credits to its connection
+ */
+static void set_response_status(struct coroutine *co)
+{
+#if UPSTREAM_HTTP
+	const char *msg;
+
+	if (co->status && co->up_nmore) {
+		unimsg_buffer_put(co->up_more, co->up_nmore);
+		co->up_nmore = 0;
+	}
+
+	switch (co->status) {
+	case 0:
+		return;
+	case -EBUSY:
+		msg = HTTP_SERVICE_UNAVAILABLE;
+		break;
+	case -EBADMSG:
+		msg = HTTP_BAD_REQUEST;
+		break;
+	case -EMSGSIZE:
+		msg = HTTP_PAYLOAD_TOO_LARGE;
+		break;
+	default:
+		msg = HTTP_GATEWAY_TIMEOUT;
+		break;
+	}
+	http_reply(&co->up_desc, msg);
+#else
+	struct rpc *rpc = co->up_desc.addr;
+	rpc->status = co->status;
+	rpc->credits = credit_grant();
+#endif
+}
+
+static void upstream_send(struct service_conn *conn,
+			  struct unimsg_shm_desc *descs, unsigned ndescs)
+{
+	int rc = unimsg_send(conn->sock, descs, ndescs, 0);
+	if (rc) {
+		unimsg_buffer_put(descs, ndescs);
+		fprintf(stderr, "Error sending desc: %s\n", strerror(-rc));
+		_ERR_CLOSE(conn->sock);
+	}
+}
+
+#if UPSTREAM_HTTP
+/* Send the response in the @ndescs @descs to the HTTP request @seq of @conn,
+ * followed by the responses parked after it, or park it if responses to
+ * earlier requests are still missing
+ */
+__unused
+static void http_send(struct service_conn *conn, unsigned long seq,
+		      struct unimsg_shm_desc *descs, unsigned ndescs)
+{
+	unsigned long mask = conn->http_parked_size - 1;
+
+	if (seq != conn->http_tx_seq) {
+		struct http_parked *p = &conn->http_parked[seq & mask];
+
+		DEBUG_SVC(-1, "Parking response %lu, waiting for %lu\n", seq,
+			  conn->http_tx_seq);
+		memcpy(p->descs, descs, ndescs * sizeof(*descs));
+		p->ndescs = ndescs;
+		return;
+	}
+
+	upstream_send(conn, descs, ndescs);
+	conn->http_tx_seq++;
+
+	while (conn->http_parked_size) {
+		struct http_parked *p =
+			&conn->http_parked[conn->http_tx_seq & mask];
+
+		if (!p->ndescs)
+			break;
+		upstream_send(conn, p->descs, p->ndescs);
+		p->ndescs = 0;
+		conn->http_tx_seq++;
+	}
+}
+
+/* Answer the HTTP request being handled, in @desc, with the response in the
+ * @ndescs @descs instead, sent back to back. The buffer of the request is
+ * released, the handler must be done with it.
+ */
+__unused
+static void http_respond(struct unimsg_shm_desc *desc,
+			 const struct unimsg_shm_desc *descs, unsigned ndescs)
+{
+	struct coroutine *co = aco_get_arg();
+
+	if (!ndescs || ndescs > HTTP_MAX_RESPONSE_DESCS) {
+		fprintf(stderr, "Response of %u descs\n", ndescs);
+		exit(1);
+	}
+
+	unimsg_buffer_put(desc, 1);
+	*desc = descs[0];
+	co->up_nmore = ndescs - 1;
+	memcpy(co->up_more, descs + 1, co->up_nmore * sizeof(*descs));
+}
+
+/* Make room in the ring of parked responses of @conn for all the requests in
+ * flight, unrolling it into the new one
+ */
+static void http_parked_grow(struct service_conn *conn)
+{
+	unsigned old = conn->http_parked_size;
+	unsigned size = old ? old * 2 : HTTP_PARKED_MIN;
+	struct http_parked *ring = calloc(size, sizeof(*ring));
+	if (!ring) {
+		fprintf(stderr, "Error allocating parked responses\n");
+		exit(1);
+	}
+
+	for (unsigned long seq = conn->http_tx_seq;
+	     old && seq != conn->http_rx_seq; seq++)
+		ring[seq & (size - 1)] = conn->http_parked[seq & (old - 1)];
+	free(conn->http_parked);
+	conn->http_parked = ring;
+	conn->http_parked_size = size;
+}
+#endif /* UPSTREAM_HTTP */
+
+/* Release an upstream connection out of the poll set with no request in
+ * flight
+ */
+static void free_upstream_conn(struct service_conn *conn)
+{
+#if UPSTREAM_HTTP
+	free(conn->http_parked);
+#endif
+	free(conn);
+}
+
+static void coroutine_fn()
+{
+	struct coroutine *co = aco_get_arg();
+
+	while (1) {
+		DEBUG_SVC(co->id, "Handling request\n");
+
+		trace_begin(co);
+		int dropped = co->up_conn->closed || deadline_begin(co)
+			      || http_begin(co) || admission_begin(co);
+
+#if UPSTREAM_HTTP
+		/* HTTP requests have no command */
+		enum command command = NUM_COMMANDS;
+		co->up_http.base = co->up_desc.addr;
+		if (!dropped)
+			request_handler(&co->up_desc, &co->up_http);
+#else
+		enum command command = rpc_msg_header(&co->up_msg).command
+				       & ~RPC_COMPACT;
+		if (!dropped)
+			rpc_serve(serve_request, &co->up_msg, &co->up_desc);
+		else
+			rpc_msg_take(&co->up_msg, &co->up_desc);
+#endif
+		set_response_status(co);
+
+		struct service_conn *conn = co->up_conn;
+		if (conn->closed) {
+			/* Nobody is left to answer */
+			unimsg_buffer_put(&co->up_desc, 1);
+#if UPSTREAM_HTTP
+			if (co->up_nmore)
+				unimsg_buffer_put(co->up_more, co->up_nmore);
+			co->up_nmore = 0;
+#endif
+			DEBUG_SVC(co->id, "Dropped response to closed "
+				  "connection\n");
+		} else {
+#if UPSTREAM_HTTP
+			struct unimsg_shm_desc resp[HTTP_MAX_RESPONSE_DESCS];
+			resp[0] = co->up_desc;
+			memcpy(resp + 1, co->up_more,
+			       co->up_nmore * sizeof(*resp));
+			http_send(conn, co->up_seq, resp, co->up_nmore + 1);
+			co->up_nmore = 0;
+#else
+			upstream_send(conn, &co->up_desc, 1);
+#endif
+			DEBUG_SVC(co->id, "Sent response\n");
+		}
+
+		__nsec now = ukplat_monotonic_clock();
+		__nsec latency = now - co->up_received;
+		conn->inflight--;
+		conn->served++;
+		conn->latency_sum += latency;
+		if (latency > conn->latency_max)
+			conn->latency_max = latency;
+		if (command < NUM_COMMANDS && !dropped
+		    && !framework_command(command))
+			hist_record(&core->stats.served[command], latency);
+		if (co->trace.flags & RPC_TRACE_SAMPLED) {
+			trace_record(&core->trace_ring, &co->trace,
+				     co->trace_parent, service_id, command,
+				     co->up_received, now);
+		}
+		core->served++;
+		if (conn->closed && !conn->inflight)
+			free_upstream_conn(conn);
+
+		/* Serve queued requests without going back to the loop */
+		if (backlog_pop(co)) {
+			DEBUG_SVC(co->id, "Handling request from backlog\n");
+			continue;
+		}
+
+		core->available_cos[core->n_available_cos++] = co->id;
+
+		DEBUG_SVC(co->id, "Request handled\n");
+
+		aco_yield();
+	}
+
+	aco_exit();
+}
+
+static struct shared_stack *get_stack(void)
+{
+	struct shared_stack *stack = NULL;
+
+	if (core->ncoroutines < MIN_COROUTINES) {
+		/* Private stack, never shared */
+		stack = malloc(sizeof(*stack));
+		if (!stack) {
+			fprintf(stderr, "Error allocating stack\n");
+			exit(1);
+		}
+		stack->users = 0;
+		stack->stack = NULL;
+
+	} else {
+		for (unsigned i = 0; i < core->nshared_stacks; i++) {
+			struct shared_stack *s = &core->shared_stacks[i];
+			if (s->users < COROUTINES_PER_SHARED_STACK) {
+				stack = s;
+				if (s->stack)
+					break;
+			}
+		}
+	}
+
+	if (!stack->stack)
+		stack->stack = aco_share_stack_new(0);
+	stack->users++;
+
+	return stack;
+}
+
+static int stack_is_shared(struct shared_stack *stack)
+{
+	return stack >= core->shared_stacks
+	       && stack < core->shared_stacks + core->nshared_stacks;
+}
+
+static void put_stack(struct shared_stack *stack)
+{
+	if (--stack->users)
+		return;
+
+	aco_share_stack_destroy(stack->stack);
+	stack->stack = NULL;
+	if (!stack_is_shared(stack))
+		free(stack);
+}
+
+static struct coroutine *create_coroutine(void)
+{
+	struct coroutine *co = calloc(1, sizeof(*co));
+	if (!co) {
+		fprintf(stderr, "Error allocating coroutine\n");
+		exit(1);
+	}
+
+	co->id = core->free_ids[--core->n_free_ids];
+	co->stack = get_stack();
+	co->handle = aco_create(core->main_co, co->stack->stack, 0,
+				coroutine_fn, co);
+	core->coroutines[co->id] = co;
+	core->ncoroutines++;
+
+	DEBUG_SVC(co->id, "Coroutine created, %u allocated\n",
+		  core->ncoroutines);
+
+	return co;
+}
+
+static void destroy_coroutine(struct coroutine *co)
+{
+	DEBUG_SVC(co->id, "Coroutine destroyed, %u allocated\n",
+		  core->ncoroutines - 1);
+
+	aco_destroy(co->handle);
+	put_stack(co->stack);
+	core->coroutines[co->id] = NULL;
+	core->free_ids[core->n_free_ids++] = co->id;
+	core->ncoroutines--;
+	free(co);
+}
+
+static struct coroutine *get_coroutine(void)
+{
+	if (core->n_available_cos)
+		return core->coroutines[
+			core->available_cos[--core->n_available_cos]];
+
+	if (core->ncoroutines < service_opts.max_coroutines)
+		return create_coroutine();
+
+	return NULL;
+}
+
+/* Release idle coroutines once the load drops, keeping at most as many idle
+ * coroutines as busy ones (and never less than MIN_COROUTINES). Only those on
+ * shared stacks are released: the shared stacks have room for the coroutines
+ * beyond MIN_COROUTINES only, so the ones with a private stack must stay.
+ */
+static void shrink_coroutines(void)
+{
+	unsigned busy = core->ncoroutines - core->n_available_cos;
+	unsigned keep = MAX(busy, MIN_COROUTINES);
+	unsigned i = core->n_available_cos;
+
+	while (i-- > 0 && core->n_available_cos > keep) {
+		struct coroutine *co = core->coroutines[core->available_cos[i]];
+		if (!stack_is_shared(co->stack))
+			continue;
+
+		/* The entries above i were all kept, any can take its place */
+		core->available_cos[i] =
+			core->available_cos[--core->n_available_cos];
+		destroy_coroutine(co);
+	}
+}
+
+/* Hand a request to a coroutine, or queue it if the pool is at its high-water
+ * mark. RPCs come in @msg, HTTP requests in @desc, parsed in @http.
+ */
+static void start_request(struct service_conn *conn, struct rpc_msg *msg,
+			  struct unimsg_shm_desc *desc,
+			  struct http_request *http, __nsec received)
+{
+	unsigned long seq = 0;
+
+	conn->inflight++;
+	conn->requests++;
+
+#if UPSTREAM_HTTP
+	if (http) {
+		seq = conn->http_rx_seq++;
+		if (conn->http_rx_seq - conn->http_tx_seq
+		    > conn->http_parked_size)
+			http_parked_grow(conn);
+	}
+#endif
+
+	struct coroutine *co = get_coroutine();
+	if (!co) {
+		DEBUG_SVC(-1, "No available coroutines, queueing request\n");
+		backlog_push(conn, msg, desc, received, http, seq);
+		return;
+	}
+
+	co->up_conn = conn;
+	co->up_received = received;
+#if UPSTREAM_HTTP
+	co->up_desc = *desc;
+	if (http)
+		co->up_http = *http;
+	co->up_seq = seq;
+#else
+	co->up_msg = *msg;
+#endif
+
+	unsigned busy = core->ncoroutines - core->n_available_cos;
+	if (busy > core->stats.busy_max)
+		core->stats.busy_max = busy;
+
+	DEBUG_SVC(-1, "Starting coroutine %u\n", co->id);
+
+	aco_resume(co->handle);
+}
+
+static void credit_enqueue(struct coroutine *co, unsigned service)
+{
+	co->credit_service = service;
+	co->credit_next = NULL;
+	co->credit_pprev = core->credit_tails[service];
+	*co->credit_pprev = co;
+	core->credit_tails[service] = &co->credit_next;
+	core->ncredit_waiters++;
+}
+
+static void credit_dequeue(struct coroutine *co)
+{
+	if (!co->credit_pprev)
+		return;
+
+	*co->credit_pprev = co->credit_next;
+	if (co->credit_next)
+		co->credit_next->credit_pprev = co->credit_pprev;
+	else
+		core->credit_tails[co->credit_service] = co->credit_pprev;
+	co->credit_pprev = NULL;
+	core->ncredit_waiters--;
+}
+
+/* Replica of @service to send the next RPC of the running coroutine to. If
+ * the replicas are out of credits, or other coroutines wait for them already,
+ * yield until they get some, in order. Returns -1 if @timeout, if not 0,
+ * passes first.
+ */
+static int credit_acquire(unsigned service, __nsec timeout)
+{
+	struct coroutine *co = aco_get_arg();
+	struct balancer *b = &core->balancers[service];
+
+	if (!core->credit_waiters[service]) {
+		int replica = balancer_pick(b);
+		if (replica >= 0)
+			return replica;
+	}
+
+	DEBUG_SVC(co->id, "Out of credits for %s service, yielding\n",
+		  services[service].name);
+	core->stats.credit_waits++;
+	credit_enqueue(co, service);
+	if (timeout)
+		timer_arm(&core->timers, &co->timer, timeout);
+	aco_yield();
+	timer_cancel(&core->timers, &co->timer);
+
+	/* Still in line, resumed by the timer */
+	if (co->credit_pprev) {
+		credit_dequeue(co);
+		return -1;
+	}
+
+	return balancer_pick(b);
+}
+
+/* Resume the coroutines waiting for credits of @service, in order, as long as
+ * its replicas have some left
+ */
+static void credit_wake(unsigned service)
+{
+	struct balancer *b = &core->balancers[service];
+
+	while (core->credit_waiters[service] && balancer_available(b)) {
+		struct coroutine *co = core->credit_waiters[service];
+
+		credit_dequeue(co);
+		DEBUG_SVC(-1, "Resuming coroutine %u on credits\n", co->id);
+		aco_resume(co->handle);
+	}
+}
+
+/* Hand the complete response in @pending, received on @conn, to the
+ * coroutine that issued the RPC, resuming it if it was waiting for it
+ */
+static void complete_downstream(struct service_conn *conn,
+				struct rpc_msg *pending)
+{
+	struct balancer *b = &core->balancers[conn->service];
+	struct rpc hdr = rpc_msg_header(pending);
+
+	DEBUG_SVC(-1, "Received downstream response\n");
+
+	/* Late or not, the RPC is no longer outstanding on the replica, which
+	 * grants credits with every response
+	 */
+	balancer_done(b, conn->replica);
+	if (hdr.credits > 0)
+		balancer_grant(b, conn->replica, hdr.credits);
+
+	/* Identify the coroutine */
+	unsigned co_id = RPC_ID_CO(hdr.id);
+	unsigned slot = RPC_ID_SLOT(hdr.id);
+	if (co_id >= service_opts.max_coroutines || slot >= MAX_PARALLEL_RPCS) {
+		fprintf(stderr, "Detected invalid coroutine id\n");
+		exit(1);
+	}
+
+	/* The RPC timed out, its coroutine moved on and might even be gone,
+	 * or it was hedged and the other replica answered first
+	 */
+	struct coroutine *co = core->coroutines[co_id];
+	if (!co || !(co->down_inflight & (1U << slot))
+	    || co->down_gen[slot] != RPC_ID_GEN(hdr.id)
+	    || (co->down_completed & (1U << slot))) {
+		DEBUG_SVC(-1, "Dropping late response\n");
+		rpc_msg_put(pending);
+		core->stats.late++;
+		return;
+	}
+	if ((co->down_hedged & (1U << slot))
+	    && conn->replica != co->down_replica[slot])
+		core->stats.hedge_wins++;
+
+	/* Callers take responses as structs */
+	rpc_msg_take(pending, &co->down_descs[slot]);
+	co->down_completed |= 1U << slot;
+
+	/* Resume coroutine if it was waiting for this RPC */
+	uint32_t done = co->down_completed & co->down_waited;
+	if (co->down_wait_mode == RPC_WAIT_ANY ? done != 0
+	    : co->down_waited && done == co->down_waited) {
+		DEBUG_SVC(-1, "Resuming coroutine %u\n", co->id);
+		co->down_waited = 0;
+		aco_resume(co->handle);
+	}
+}
+
+/* Receive responses from a downstream connection, without blocking. Returns
+ * the number of descs received.
+ */
+static unsigned handle_downstream(struct service_conn *conn)
+{
+	struct unimsg_sock *s = conn->sock;
+	struct rpc_msg *pending = &conn->pending;
+	struct unimsg_shm_desc descs[UNIMSG_MAX_DESCS_BULK];
+	unsigned ndescs = UNIMSG_MAX_DESCS_BULK;
+
+	int rc = unimsg_recv(s, descs, &ndescs, 1);
+	if (rc == -EAGAIN) {
+		return 0;
+	} else if (rc) {
+		fprintf(stderr, "Error receiving from downstream: %s\n",
+			strerror(-rc));
+		_ERR_CLOSE(s);
+	}
+
+	DEBUG_SVC(-1, "Received %u descs from downstream\n", ndescs);
+
+	unsigned current = 0;
+	while (current < ndescs) {
+		if (process_desc(pending, &descs[current])) {
+			complete_downstream(conn, pending);
+			credit_wake(conn->service);
+		}
+
+		if (descs[current].size == 0)
+			current++;
+	}
+
+	DEBUG_SVC(-1, "Done processing bulk\n");
+
+	return ndescs;
+}
+
+/* A coroutine waited for RPCs past their timeout or hedge time */
+static void rpc_timer_fire(struct timer *t)
+{
+	struct coroutine *co = (struct coroutine *)((char *)t
+			       - offsetof(struct coroutine, timer));
+
+	DEBUG_SVC(-1, "Resuming coroutine %u on timeout\n", co->id);
+	co->down_waited = 0;
+	aco_resume(co->handle);
+}
+
+#if UPSTREAM_HTTP
+#define handle_upstream handle_upstream_http
+#else
+#define handle_upstream handle_upstream_grpc
+#endif
+
+#if UPSTREAM_HTTP
+static void desc_advance(struct unimsg_shm_desc *desc, unsigned n)
+{
+	desc->addr += n;
+	desc->off += n;
+	desc->size -= n;
+}
+
+/* Buffer holding a copy of the @len bytes at @p */
+static struct unimsg_shm_desc http_copy(const char *p, unsigned len)
+{
+	struct unimsg_shm_desc copy;
+
+	int rc = unimsg_buffer_get(&copy, 1);
+	if (rc) {
+		fprintf(stderr, "Error getting shm buffer: %s\n",
+			strerror(-rc));
+		exit(1);
+	}
+	memcpy(copy.addr, p, len);
+	copy.size = len;
+
+	return copy;
+}
+
+/* Start a request of @conn answered with @error, in @desc */
+static void http_fail(struct service_conn *conn, struct unimsg_shm_desc *desc,
+		      int error, __nsec now)
+{
+	struct http_request req = { .error = error };
+
+	DEBUG_SVC(-1, "Failed to frame request: %s\n", strerror(-error));
+	start_request(conn, NULL, desc, &req, now);
+}
+
+/* Start the HTTP requests in @desc, received on @conn. Requests are framed by
+ * their head and Content-Length, so several can come pipelined in a desc and
+ * one can span descs. The request filling the rest of @desc gets @desc itself,
+ * the others a copy in a buffer of their own, as every request turns into a
+ * response. The start of an incomplete request waits for the rest in a buffer
+ * of the connection. Requests that do not fit in a buffer are answered with
+ * an error and their body dropped, after a malformed one the stream cannot be
+ * framed anymore and the rest of it is dropped. Returns the number of
+ * requests started.
+ */
+static unsigned http_frame(struct service_conn *conn,
+			   struct unimsg_shm_desc *desc, __nsec now)
+{
+	struct unimsg_shm_desc *partial = &conn->http_partial;
+	struct http_request req;
+	unsigned nrequests = 0;
+	int size;
+
+	for (;;) {
+		unsigned skip = MIN(conn->http_skip, desc->size);
+		desc_advance(desc, skip);
+		conn->http_skip -= skip;
+
+		if (!desc->size || conn->http_broken) {
+			unimsg_buffer_put(desc, 1);
+			return nrequests;
+		}
+
+		/* Complete the pending request first, the bytes of the next
+		 * requests stay in @desc
+		 */
+		if (partial->addr) {
+			unsigned had = partial->size;
+			unsigned take = MIN(desc->size,
+					    RPC_BUFFER_AVAILABLE - had);
+
+			memcpy(partial->addr + had, desc->addr, take);
+			partial->size += take;
+			size = http_parse(partial->addr, partial->size, &req);
+			if (size > 0 && (unsigned)size <= partial->size) {
+				desc_advance(desc, size - had);
+				partial->size = size;
+				start_request(conn, NULL, partial, &req, now);
+			} else if (size == 0
+				   ? partial->size < RPC_BUFFER_AVAILABLE
+				   : size > 0 && size <= RPC_BUFFER_AVAILABLE) {
+				/* All of @desc taken, wait for more */
+				desc_advance(desc, take);
+				continue;
+			} else {
+				desc_advance(desc, take);
+				if (size > 0)
+					conn->http_skip = size - partial->size;
+				else
+					conn->http_broken = 1;
+				http_fail(conn, partial,
+					  size < 0 ? size : -EMSGSIZE, now);
+			}
+
+			partial->addr = NULL;
+			nrequests++;
+			continue;
+		}
+
+		size = http_parse(desc->addr, desc->size, &req);
+		if (size > 0 && (unsigned)size == desc->size) {
+			start_request(conn, NULL, desc, &req, now);
+			return nrequests + 1;
+		}
+
+		if (size > 0 && (unsigned)size < desc->size) {
+			struct unimsg_shm_desc copy = http_copy(desc->addr,
+								size);
+			start_request(conn, NULL, &copy, &req, now);
+			desc_advance(desc, size);
+			nrequests++;
+			continue;
+		}
+
+		if (size < 0 || size > RPC_BUFFER_AVAILABLE
+		    || (size == 0 && desc->size == RPC_BUFFER_AVAILABLE)) {
+			struct unimsg_shm_desc err = http_copy(desc->addr, 0);
+
+			if (size > 0)
+				conn->http_skip = size;
+			else
+				conn->http_broken = 1;
+			http_fail(conn, &err, size < 0 ? size : -EMSGSIZE,
+				  now);
+			nrequests++;
+			continue;
+		}
+
+		*partial = http_copy(desc->addr, desc->size);
+		desc_advance(desc, desc->size);
+	}
+}
+
+/* Receive at most rx->max_descs descs from an upstream connection, without
+ * blocking, and start the requests they complete. Returns 1 if the connection
+ * was closed, 2 if nothing could be received for lack of coroutines, 0
+ * otherwise.
+ */
+__unused
+static int handle_upstream_http(struct service_conn *conn,
+				struct upstream_rx *rx)
+{
+	rx->ndescs = 0;
+	rx->nrequests = 0;
+	rx->nbytes = 0;
+
+	if (upstream_full()) {
+		DEBUG_SVC(-1 , "Disabling upstream reception for lack of "
+			  "coroutines\n");
+		return 2;
+	}
+
+	struct unimsg_shm_desc descs[UNIMSG_MAX_DESCS_BULK];
+	unsigned ndescs = MIN(rx->max_descs, UNIMSG_MAX_DESCS_BULK);
+	int rc = unimsg_recv(conn->sock, descs, &ndescs, 1);
+	if (rc == -EAGAIN) {
+		return 0;
+	} else if (rc == -ECONNRESET) {
+		unimsg_close(conn->sock);
+		DEBUG_SVC(-1, "Connection closed\n");
+		return 1;
+	} else if (rc) {
+		fprintf(stderr, "Error receiving from upstream: %s\n",
+			strerror(-rc));
+		_ERR_CLOSE(conn->sock);
+	}
+
+	DEBUG_SVC(-1, "Received %u descs from upstream\n", ndescs);
+
+	rx->ndescs = ndescs;
+	for (unsigned i = 0; i < ndescs; i++)
+		rx->nbytes += descs[i].size;
+	conn->bytes += rx->nbytes;
+	__nsec now = ukplat_monotonic_clock();
+
+	/* Requests that find no coroutine are queued, the rest of the bulk is
+	 * never dropped
+	 */
+	for (unsigned i = 0; i < ndescs; i++)
+		rx->nrequests += http_frame(conn, &descs[i], now);
+
+	return 0;
+}
+#endif /* UPSTREAM_HTTP */
+
+__unused
+static int handle_upstream_grpc(struct service_conn *conn,
+				struct upstream_rx *rx)
+{
+	struct rpc_msg *pending = &conn->pending;
+
+	rx->ndescs = 0;
+	rx->nrequests = 0;
+	rx->nbytes = 0;
+
+	if (upstream_full()) {
+		DEBUG_SVC(-1 , "Disabling upstream reception for lack of "
+			  "coroutines\n");
+		return 2;
+	}
+
+	struct unimsg_shm_desc descs[UNIMSG_MAX_DESCS_BULK];
+	unsigned ndescs = MIN(rx->max_descs, UNIMSG_MAX_DESCS_BULK);
+	int rc = unimsg_recv(conn->sock, descs, &ndescs, 1);
+	if (rc == -EAGAIN) {
+		return 0;
+	} else if (rc == -ECONNRESET) {
+		rpc_msg_put(pending);
+		unimsg_close(conn->sock);
+		DEBUG_SVC(-1, "Connection closed\n");
+		return 1;
+	} else if (rc) {
+		fprintf(stderr, "Error receiving from upstream: %s\n",
+			strerror(-rc));
+		_ERR_CLOSE(conn->sock);
+	}
+
+	DEBUG_SVC(-1, "Received %u descs from upstream\n", ndescs);
+
+	rx->ndescs = ndescs;
+	for (unsigned i = 0; i < ndescs; i++)
+		rx->nbytes += descs[i].size;
+	conn->bytes += rx->nbytes;
+	__nsec now = ukplat_monotonic_clock();
+
+	unsigned current = 0;
+	while (current < ndescs) {
+		if (process_desc(pending, &descs[current])) {
+			DEBUG_SVC(-1, "Received request\n");
+
+			/* Requests that find no coroutine are queued, the
+			 * rest of the bulk is never dropped
+			 */
+			start_request(conn, pending, NULL, NULL, now);
+			rpc_msg_reset(pending);
+			rx->nrequests++;
+		}
+
+		if (descs[current].size == 0)
+			current++;
+	}
+
+	DEBUG_SVC(-1, "Done processing bulk\n");
+
+	return 0;
+}
+
+/* The caller makes sure there's room in the poll set */
+static void add_upstream_conn(struct service_conn *conn)
+{
+	conn->pos = sock_set_add(&core->set, conn->sock);
+	core->conns[conn->pos] = conn;
+	core->nconns++;
+}
+
+static void remove_upstream_conn(struct service_conn *conn)
+{
+	/* The last connection takes the place of the removed one */
+	unsigned last = sock_set_remove(&core->set, conn->pos);
+	core->conns[conn->pos] = core->conns[last];
+	core->conns[conn->pos]->pos = conn->pos;
+	core->nconns--;
+}
+
+/* Stop serving a connection closed by the client. Coroutines may still be
+ * handling its requests, in that case the last of them frees it and their
+ * responses are dropped.
+ */
+static void close_upstream_conn(struct service_conn *conn)
+{
+	DEBUG_SVC(-1, "Connection closed: %lu requests, %lu B, %lu served, "
+		  "%lu shed, latency avg %lu ns max %lu ns\n", conn->requests,
+		  conn->bytes, conn->served, conn->shed,
+		  conn->served ? (unsigned long)(conn->latency_sum
+						 / conn->served) : 0,
+		  (unsigned long)conn->latency_max);
+
+#if UPSTREAM_HTTP
+	if (conn->http_partial.addr)
+		unimsg_buffer_put(&conn->http_partial, 1);
+	for (unsigned i = 0; i < conn->http_parked_size; i++) {
+		if (conn->http_parked[i].ndescs)
+			unimsg_buffer_put(conn->http_parked[i].descs,
+					  conn->http_parked[i].ndescs);
+		conn->http_parked[i].ndescs = 0;
+	}
+#endif
+
+	remove_upstream_conn(conn);
+	if (conn->inflight)
+		conn->closed = 1;
+	else
+		free_upstream_conn(conn);
+
+#if ENABLE_DEBUG
+	char who[32];
+	snprintf(who, sizeof(who), "Core %u poller", core->id);
+	poller_print(&core->poller, who);
+#endif
+}
+
+#if SERVICE_MULTICORE
+static int is_least_loaded(void)
+{
+	unsigned nconns = atomic_load(&core->nconns);
+
+	for (unsigned i = 0; i < service_opts.ncores; i++) {
+		if (atomic_load(&cores[i].nconns) < nconns)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Wake up the idle cores, which may be blocked in the poll, to look at the
+ * offer of this one. Cores already rung are skipped, and so are those being
+ * rung by another core, sends on a doorbell never overlap.
+ */
+static void ring_idle_cores(void)
+{
+	if (!service_bells)
+		return;
+
+	for (unsigned i = 0; i < service_opts.ncores; i++) {
+		struct service_core *c = &cores[i];
+
+		if (c == core || !atomic_load(&c->idle)
+		    || atomic_load(&c->bell_rung))
+			continue;
+		if (pthread_mutex_trylock(&c->bell_lock))
+			continue;
+
+		if (!atomic_exchange(&c->bell_rung, 1)) {
+			struct unimsg_shm_desc desc;
+			int rc = unimsg_buffer_get(&desc, 1);
+			if (!rc) {
+				desc.size = 1;
+				rc = unimsg_send(c->bell_tx, &desc, 1, 1);
+				if (rc)
+					unimsg_buffer_put(&desc, 1);
+			}
+			if (rc) {
+				atomic_store(&c->bell_rung, 0);
+				DEBUG_SVC(-1, "Error ringing core %u: %s\n",
+					  c->id, strerror(-rc));
+			}
+		}
+
+		pthread_mutex_unlock(&c->bell_lock);
+	}
+}
+
+/* Outcome of the connection of a doorbell by bell_connect(): 0 while in
+ * progress, 1 if connected, an error otherwise
+ */
+static ATOMIC(int) bell_connected;
+
+static void *bell_connect(void *arg)
+{
+	struct service_core *c = arg;
+	struct service_desc *service = &services[service_id];
+
+	int rc = unimsg_socket(&c->bell_tx);
+	if (!rc) {
+		rc = unimsg_connect(c->bell_tx, service->addr, service->port);
+		if (rc)
+			unimsg_close(c->bell_tx);
+	}
+	atomic_store(&bell_connected, rc ? rc : 1);
+
+	return NULL;
+}
+
+/* Give every core a doorbell by connecting the service to itself, before it
+ * serves: callers start after their dependencies, so no client can be
+ * connecting yet. The connection is made in a thread of its own in case it
+ * waits for the accept. Replicas run on one core (see run.sh), so the address
+ * of the service is the address of this one. Without doorbells, idle cores
+ * only steal when their own sockets wake them up.
+ */
+static void bells_init(void)
+{
+	unsigned i;
+	int rc = 0;
+
+	for (i = 0; i < service_opts.ncores && !rc; i++) {
+		struct service_core *c = &cores[i];
+		pthread_t thread;
+
+		atomic_store(&bell_connected, 0);
+		rc = pthread_create(&thread, NULL, bell_connect, c);
+		if (rc) {
+			fprintf(stderr, "Error starting thread: %s\n",
+				strerror(rc));
+			exit(1);
+		}
+
+		__nsec start = ukplat_monotonic_clock();
+		do {
+			rc = unimsg_accept(listen_sock, &c->bell_rx, 1);
+		} while (rc == -EAGAIN && atomic_load(&bell_connected) >= 0
+			 && ukplat_monotonic_clock() - start
+			    < BELL_CONNECT_TIMEOUT_NS);
+
+		if (!rc) {
+			while (!atomic_load(&bell_connected))
+				;
+			pthread_join(thread, NULL);
+			pthread_mutex_init(&c->bell_lock, NULL);
+		} else {
+			/* The connect might never return */
+			pthread_detach(thread);
+			if (atomic_load(&bell_connected) < 0)
+				rc = atomic_load(&bell_connected);
+		}
+	}
+
+	if (!rc) {
+		service_bells = 1;
+		return;
+	}
+
+	fprintf(stderr, "Doorbells of the cores not available: %s\n",
+		rc == -EAGAIN ? "timed out" : strerror(-rc));
+	/* The core that failed has none of its ends */
+	for (unsigned j = 0; j + 1 < i; j++) {
+		unimsg_close(cores[j].bell_rx);
+		unimsg_close(cores[j].bell_tx);
+	}
+}
+
+/* Drain the doorbell of the core. Stealing comes after, so an offer made
+ * while draining is either seen then or rings again.
+ */
+static void answer_bell(void)
+{
+	struct unimsg_shm_desc descs[UNIMSG_MAX_DESCS_BULK];
+	unsigned ndescs = UNIMSG_MAX_DESCS_BULK;
+	int rc;
+
+	atomic_store(&core->bell_rung, 0);
+	while (!(rc = unimsg_recv(core->bell_rx, descs, &ndescs, 1))) {
+		unimsg_buffer_put(descs, ndescs);
+		ndescs = UNIMSG_MAX_DESCS_BULK;
+	}
+	if (rc != -EAGAIN) {
+		fprintf(stderr, "Error receiving from doorbell: %s\n",
+			strerror(-rc));
+		_ERR_CLOSE(core->bell_rx);
+	}
+}
+
+/* Offer an idle upstream connection to other cores. Only connections with no
+ * partial message and no request in flight can be offered, so that the thief
+ * never shares the socket with coroutines of this core.
+ */
+static void offer_conn(void)
+{
+	if (core->offered || service_opts.ncores == 1
+	    || core->nconns < 2)
+		return;
+
+	for (unsigned i = service_nfixed; i < core->set.nsocks; i++) {
+		struct service_conn *conn = core->conns[i];
+		if (!conn->inflight && !conn->pending.nfrags) {
+			core->offered = conn;
+			atomic_store(&core->offer, conn);
+			DEBUG_SVC(-1, "Offering connection\n");
+			ring_idle_cores();
+			return;
+		}
+	}
+}
+
+/* Take back the offered connection (force) or just check whether it has been
+ * stolen in the meantime. Returns 1 if the connection was stolen and removed
+ * from the poll set.
+ */
+static int revoke_offer(int force)
+{
+	struct service_conn *expected = core->offered;
+
+	if (!expected)
+		return 0;
+
+	if (force) {
+		if (atomic_compare_exchange_strong(&core->offer, &expected,
+						   NULL)) {
+			core->offered = NULL;
+			return 0;
+		}
+	} else if (atomic_load(&core->offer) == expected) {
+		return 0;
+	}
+
+	remove_upstream_conn(core->offered);
+	core->offered = NULL;
+	DEBUG_SVC(-1, "Connection stolen by another core\n");
+
+	return 1;
+}
+
+/* Take over a connection offered by a loaded core, if this one is @idle.
+ * Idle cores are marked as such before looking for offers, and loaded ones
+ * publish their offer before looking for idle cores to ring, so either the
+ * offer is found here or the doorbell rings.
+ */
+static void steal_conn(int idle)
+{
+	atomic_store(&core->idle, idle);
+	if (!idle || sock_set_full(&core->set))
+		return;
+
+	for (unsigned i = 1; i < service_opts.ncores; i++) {
+		struct service_core *victim =
+			&cores[(core->id + i) % service_opts.ncores];
+
+		if (!atomic_load(&victim->offer))
+			continue;
+
+		struct service_conn *conn = atomic_exchange(&victim->offer,
+							    NULL);
+		if (conn) {
+			add_upstream_conn(conn);
+			core->stolen++;
+			DEBUG_SVC(-1, "Stolen connection from core %u\n",
+				  victim->id);
+			return;
+		}
+	}
+}
+#else
+static int is_least_loaded(void)
+{
+	return 1;
+}
+
+static void answer_bell(void) {}
+
+static void offer_conn(void) {}
+
+static int revoke_offer(int force __unused)
+{
+	return 0;
+}
+
+static void steal_conn(int idle __unused) {}
+#endif /* SERVICE_MULTICORE */
+
+/* Serve a ready upstream connection for one round. Round-robin receives one
+ * bulk. Deficit round-robin adds a quantum to the credit of the connection
+ * and receives until the credit, charged by requests or by bytes, runs out;
+ * credit left when the connection has nothing more to receive is dropped.
+ * Adds the descs received to @ndescs. Returns like handle_upstream().
+ */
+static int sched_visit(struct service_conn *conn, unsigned *ndescs)
+{
+	struct upstream_rx rx;
+	int rc;
+
+	if (service_opts.sched == SCHED_RR) {
+		rx.max_descs = UNIMSG_MAX_DESCS_BULK;
+		rc = handle_upstream(conn, &rx);
+		*ndescs += rx.ndescs;
+		return rc;
+	}
+
+	conn->deficit += service_opts.quantum;
+	while (conn->deficit > 0) {
+		rx.max_descs = service_opts.sched == SCHED_DRR_REQUESTS
+			       ? MIN(conn->deficit, UNIMSG_MAX_DESCS_BULK)
+			       : UNIMSG_MAX_DESCS_BULK;
+		rc = handle_upstream(conn, &rx);
+		*ndescs += rx.ndescs;
+		if (rc)
+			return rc;
+
+		conn->deficit -= service_opts.sched == SCHED_DRR_REQUESTS
+				 ? rx.nrequests : rx.nbytes;
+		if (rx.ndescs < rx.max_descs) {
+			if (conn->deficit > 0)
+				conn->deficit = 0;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/* Serve the ready upstream connections in turn, starting from where the
+ * previous round stopped, so that the connections visited first don't starve
+ * the others when coroutines run out. Only the ready list of the poll is
+ * walked, idle connections cost nothing. Returns the number of descs received.
+ */
+static unsigned sched_upstream(void)
+{
+	struct sock_set *set = &core->set;
+	unsigned first = service_nfixed;
+	struct service_conn *ready[UNIMSG_MAX_NSOCKS];
+	unsigned nready = 0;
+	unsigned ndescs = 0;
+
+	/* The ready list goes down from the last position, upstream
+	 * connections come first
+	 */
+	while (nready < set->nready && set->ready_list[nready] >= first)
+		nready++;
+	if (!nready)
+		return 0;
+
+	/* Connections move while serving, visit a snapshot. Start from the
+	 * first ready connection at or below the position where the previous
+	 * round stopped.
+	 */
+	unsigned nup = set->nsocks - first;
+	unsigned start = core->sched_next % nup;
+	unsigned skip = 0;
+	while (skip < nready && set->ready_list[skip] - first > start)
+		skip++;
+	if (skip == nready)
+		skip = 0;
+	for (unsigned k = 0; k < nready; k++) {
+		unsigned i = set->ready_list[(skip + k) % nready];
+		ready[k] = core->conns[i];
+	}
+
+	for (unsigned k = 0; k < nready; k++) {
+		struct service_conn *conn = ready[k];
+
+		/* Stolen by another core */
+		if (conn == core->offered && revoke_offer(1))
+			continue;
+
+		int rc = sched_visit(conn, &ndescs);
+		if (rc == 1) {
+			close_upstream_conn(conn);
+		} else if (rc == 2) {
+			/* We cannot receive more, the backlog is full.
+			 * Resume from this connection next round and let an
+			 * idle core take over one of our connections.
+			 */
+			core->sched_next = conn->pos - first;
+			offer_conn();
+			return ndescs;
+		}
+	}
+
+	/* Everybody was served, rotate who goes first */
+	core->sched_next = start + nup - 1;
+
+	return ndescs;
+}
+
+/* Set up the coroutine pool of the core, only MIN_COROUTINES are allocated
+ * upfront
+ */
+static void coroutines_init(void)
+{
+	unsigned max = service_opts.max_coroutines;
+
+	core->nshared_stacks = (max - MIN_COROUTINES
+				+ COROUTINES_PER_SHARED_STACK - 1)
+			       / COROUTINES_PER_SHARED_STACK;
+	core->coroutines = calloc(max, sizeof(*core->coroutines));
+	core->available_cos = malloc(max * sizeof(*core->available_cos));
+	core->free_ids = malloc(max * sizeof(*core->free_ids));
+	core->shared_stacks = calloc(core->nshared_stacks,
+				     sizeof(*core->shared_stacks));
+	if (!core->coroutines || !core->available_cos || !core->free_ids
+	    || (core->nshared_stacks && !core->shared_stacks)) {
+		fprintf(stderr, "Error allocating coroutines\n");
+		exit(1);
+	}
+	for (unsigned i = 0; i < max; i++)
+		core->free_ids[i] = max - 1 - i;
+	core->n_free_ids = max;
+
+	aco_thread_init(NULL);
+	core->main_co = aco_create(NULL, NULL, 0, NULL, NULL);
+	for (unsigned i = 0; i < MIN_COROUTINES; i++) {
+		struct coroutine *co = create_coroutine();
+		core->available_cos[core->n_available_cos++] = co->id;
+	}
+}
+
+static void core_init(unsigned id)
+{
+	int rc;
+
+	core = &cores[id];
+	core->id = id;
+
+	coroutines_init();
+
+	sock_set_add(&core->set, listen_sock);
+	core->conns[0] = NULL;
+
+	/* Connect to every replica of the dependencies, every core has its
+	 * own connections so that responses are always delivered to the core
+	 * that issued the request
+	 */
+	for (unsigned i = 0; i < service_ndependencies; i++) {
+		unsigned id = service_dependencies[i];
+		struct service_desc *service = &services[id];
+
+		for (unsigned r = 0; r < service->nreplicas; r++) {
+			struct service_conn *conn =
+				&core->downstream_conns[id][r];
+
+			rc = unimsg_socket(&conn->sock);
+			if (rc) {
+				fprintf(stderr, "Error creating unimsg socket: "
+					"%s\n", strerror(-rc));
+				exit(1);
+			}
+
+			rc = unimsg_connect(conn->sock,
+					    service->replica_addrs[r],
+					    service->port);
+			if (rc) {
+				fprintf(stderr, "Error connecting to replica "
+					"%u of %s service: %s\n", r,
+					service->name, strerror(-rc));
+				exit(1);
+			}
+
+			conn->service = id;
+			conn->replica = r;
+			conn->pos = sock_set_add(&core->set, conn->sock);
+			core->conns[conn->pos] = conn;
+
+			DEBUG_SVC(-1, "Connected to replica %u of %s "
+				  "service\n", r, service->name);
+		}
+
+		balancer_init(&core->balancers[id], service_opts.lb,
+			      service->nreplicas, service_opts.credits,
+			      (uint64_t)core->id << 32 | id);
+	}
+#if SERVICE_MULTICORE
+	/* The doorbell comes right after the downstream sockets */
+	if (service_bells) {
+		unsigned pos = sock_set_add(&core->set, core->bell_rx);
+		core->conns[pos] = NULL;
+	}
+#endif
+
+	for (unsigned i = 0; i < NUM_SERVICES; i++)
+		core->credit_tails[i] = &core->credit_waiters[i];
+
+	for (unsigned i = 0; i < NUM_COMMANDS; i++) {
+		if (!rpc_hedge_quantile[i])
+			continue;
+
+		core->hedges[i].window = calloc(1, sizeof(struct hist));
+		if (!core->hedges[i].window) {
+			fprintf(stderr, "Error allocating histogram\n");
+			exit(1);
+		}
+	}
+
+	poller_init(&core->poller, service_opts.poll_mode,
+		    service_opts.spin_us * 1000ULL, ukplat_monotonic_clock());
+	timer_wheel_init(&core->timers, ukplat_monotonic_clock());
+}
+
+/* Accept a new upstream connection, if any and if there's room for it.
+ * Returns 0 if there was no connection to accept.
+ */
+static int accept_upstream_conn(void)
+{
+	struct unimsg_sock *s;
+	int rc = unimsg_accept(listen_sock, &s, 1);
+	if (rc == -EAGAIN) {
+		/* Accepted by another core, or nothing to accept while
+		 * spinning
+		 */
+		return 0;
+	} else if (rc) {
+		fprintf(stderr, "Error accepting connection: %s\n",
+			strerror(-rc));
+		_ERR_CLOSE(listen_sock);
+	}
+
+	/* The least loaded core is full, so are all the others: reject the
+	 * client rather than the service going down
+	 */
+	if (sock_set_full(&core->set)) {
+		unimsg_close(s);
+		DEBUG_SVC(-1, "Rejected client, too many connections\n");
+		return 1;
+	}
+
+	struct service_conn *conn = calloc(1, sizeof(*conn));
+	if (!conn) {
+		fprintf(stderr, "Error allocating connection\n");
+		exit(1);
+	}
+	conn->sock = s;
+	add_upstream_conn(conn);
+
+	DEBUG_SVC(-1, "New client connected\n");
+
+	return 1;
+}
+
+static void *core_run(void *arg)
+{
+	unsigned ndownstream = service_ndownstream;
+
+	core_init((unsigned long)arg);
+
+	while (1) {
+		unsigned npoll = upstream_full() ? ndownstream + 1
+						 : core->set.nsocks;
+		unsigned nwork = 0;
+		service_wait(&core->poller, &core->set, npoll,
+			     core->timers.narmed);
+
+		unsigned i;
+		/* Handle downstream sockets */
+		for (i = 1; i <= ndownstream; i++) {
+			if (core->set.ready[i])
+				nwork += handle_downstream(core->conns[i]);
+		}
+
+		/* Woken up by a loaded core, look for its offer below */
+		if (service_bells && npoll > i && core->set.ready[i])
+			answer_bell();
+
+		/* Resume the coroutines whose RPCs timed out, after the
+		 * responses that made it in time
+		 */
+		nwork += timer_wheel_advance(&core->timers,
+					     ukplat_monotonic_clock(),
+					     rpc_timer_fire);
+
+		/* Handle upstream sockets, if enabled */
+		nwork += sched_upstream();
+
+		/* Drop the offered connection if stolen by another core.
+		 * Not before serving, removals would move the sockets of the
+		 * ready list.
+		 */
+		revoke_offer(0);
+
+		/* Help loaded cores if idle, otherwise release the coroutines
+		 * no longer needed
+		 */
+		steal_conn(core->n_available_cos == core->ncoroutines);
+		shrink_coroutines();
+
+		/* Handle new connections, leaving them to less loaded cores */
+		if (core->set.ready[0] && is_least_loaded())
+			nwork += accept_upstream_conn();
+
+		poller_done(&core->poller, ukplat_monotonic_clock(), nwork);
+	}
+
+	return NULL;
+}
+
+/* Serve requests, with @handler for HTTP and the handlers registered with the
+ * register_*_service() of the service for RPCs, issuing RPCs to @dependencies
+ */
+__unused
+static void run_service(unsigned id, http_handler_t handler,
+			int *dependencies, unsigned ndependencies)
+{
+	int rc;
+
+	service_id = id;
+#if UPSTREAM_HTTP
+	request_handler = handler;
+#endif
+	register_stats_service(&(struct stats_handlers){ serve_stats });
+	register_trace_service(&(struct trace_handlers){ serve_spans });
+	service_dependencies = dependencies;
+	service_ndependencies = ndependencies;
+
+	service_ndownstream = 0;
+	for (unsigned i = 0; i < ndependencies; i++)
+		service_ndownstream += services[dependencies[i]].nreplicas;
+	/* Room for the listening socket, the doorbell and a client */
+	if (service_ndownstream + 2 >= UNIMSG_MAX_NSOCKS) {
+		fprintf(stderr, "Too many dependencies\n");
+		exit(1);
+	}
+
+	if (service_opts.max_coroutines < MIN_COROUTINES
+	    || service_opts.max_coroutines > MAX_COROUTINE_ID + 1) {
+		fprintf(stderr, "Max coroutines must be between %u and %u\n",
+			MIN_COROUTINES, MAX_COROUTINE_ID + 1);
+		exit(1);
+	}
+
+	/* Listen for incoming connections, the socket is shared by all cores */
+	rc = unimsg_socket(&listen_sock);
+	if (rc) {
+		fprintf(stderr, "Error creating unimsg socket: %s\n",
+			strerror(-rc));
+		exit(1);
+	}
+	rc = unimsg_bind(listen_sock, services[id].port);
+	if (rc) {
+		fprintf(stderr, "Error binding to port %d: %s\n",
+			services[id].port, strerror(-rc));
+		_ERR_CLOSE(listen_sock);
+	}
+	rc = unimsg_listen(listen_sock);
+	if (rc) {
+		fprintf(stderr, "Error listening: %s\n", strerror(-rc));
+		_ERR_CLOSE(listen_sock);
+	}
 
-#if ENABLE_DEBUG
-#define DEBUG_SVC(co_id, fmt, ...)					\
-	printf("[service (%d)] " fmt, co_id, ##__VA_ARGS__)
+#if SERVICE_MULTICORE
+	if (service_opts.ncores > 1)
+		bells_init();
+	service_nfixed = service_ndownstream + 1 + service_bells;
+	for (unsigned long i = 1; i < service_opts.ncores; i++) {
+		pthread_t thread;
+		rc = pthread_create(&thread, NULL, core_run, (void *)i);
+		if (rc) {
+			fprintf(stderr, "Error starting core %lu: %s\n", i,
+				strerror(rc));
+			exit(1);
+		}
+	}
 #else
-#define DEBUG_SVC(...) (void)0
+	if (service_opts.ncores > 1) {
+		fprintf(stderr, "Multi-core support not enabled, running on "
+			"1 core\n");
+		service_opts.ncores = 1;
+	}
+	service_nfixed = service_ndownstream + 1;
 #endif
 
-#define MAX_COROUTINES 32
+	printf("Waiting for incoming connections on %u cores...\n",
+	       service_opts.ncores);
 
-struct coroutine {
-	unsigned id;
-	aco_t *handle;
-	aco_share_stack_t *stack;
-	/* Data of upstream request */
-	struct unimsg_sock *up_sock;
-	struct unimsg_shm_desc up_desc;
-	/* Data of downtream request */
-	struct unimsg_shm_desc *down_desc;
-};
+	core_run((void *)0);
+}
 
-static struct coroutine coroutines[MAX_COROUTINES];
-static struct unimsg_sock *downstream_socks[NUM_SERVICES];
-static handle_request_t request_handler;
-static aco_t *main_co;
-static unsigned available_cos[MAX_COROUTINES];
-static unsigned n_available_cos;
-static int disable_upstream;
+/* Cache the responses of @command for @ttl ns, must be called before
+ * run_service(). Responses are keyed by the first @key_size bytes of the body,
+ * so callers must fully initialize them (e.g., pad strings with zeros) for
+ * equal requests to hit the same entry. Responses must carry the request they
+ * answer, as all RR messages do.
+ */
+__unused
+static void rpc_cache_enable(enum command command, unsigned key_size,
+			     __nsec ttl)
+{
+	if (key_size > get_rpc_size(command) - sizeof(struct rpc)) {
+		fprintf(stderr, "Cache key of command %d larger than the "
+			"message\n", command);
+		exit(1);
+	}
 
-static void coroutine_fn()
+	rpc_cache_key_size[command] = key_size;
+	rpc_cache_ttl[command] = ttl;
+}
+
+/* Drop the cached responses of @command on all cores, RPCs in flight when
+ * this is called are not cached either
+ */
+__unused
+static void rpc_cache_invalidate(enum command command)
 {
-	struct coroutine *co = aco_get_arg();
+	rpc_cache_gen[command]++;
+}
 
-	while (1) {
-		DEBUG_SVC(co->id, "Handling request\n");
+/* Sum the cache stats of all cores, stats of other cores might be slightly
+ * out of date
+ */
+__unused
+static void rpc_cache_get_stats(struct rpc_cache_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
 
-		request_handler(&co->up_desc);
+	for (unsigned i = 0; i < service_opts.ncores; i++) {
+		struct rpc_cache_stats *s = &cores[i].rpc_cache_stats;
 
-		int rc = unimsg_send(co->up_sock, &co->up_desc, 1, 0);
-		if (rc) {
-			unimsg_buffer_put(&co->up_desc, 1);
-			if (rc) {
-				fprintf(stderr, "Error sending desc: %s\n",
-					strerror(-rc));
-				_ERR_CLOSE(co->up_sock);
-			}
-		}
+		stats->hits += s->hits;
+		stats->misses += s->misses;
+		stats->hit_ns += s->hit_ns;
+		stats->miss_ns += s->miss_ns;
+	}
+}
 
-		DEBUG_SVC(co->id, "Sent response\n");
+/* Hedge the RPCs of @command: those still without a response once the
+ * @permyriad / 10000 quantile of the recent latency of the command is past
+ * are sent again to another replica of the service, and the first response is
+ * kept. Duplicates reach the service, so the command must be idempotent. At
+ * most service_opts.hedge_rate percent of the RPCs of the command are hedged,
+ * none before HEDGE_WINDOW of them completed. Must be called before
+ * run_service().
+ */
+__unused
+static void rpc_hedge_enable(enum command command, unsigned permyriad)
+{
+	if (!permyriad || permyriad >= 10000) {
+		fprintf(stderr, "Hedging quantile of command %d must be "
+			"between 1 and 9999\n", command);
+		exit(1);
+	}
 
-		if (n_available_cos == 0) {
-			DEBUG_SVC(co->id , "Enabling upstream reception on "
-				  "coroutine termination\n");
-			disable_upstream = 0;
-		}
-		available_cos[n_available_cos++] = co->id;
+	rpc_hedge_quantile[command] = permyriad;
+}
 
-		DEBUG_SVC(co->id, "Request handled\n");
+static uint64_t rpc_cache_hash(struct rpc *rpc)
+{
+	/* FNV-1a over the command and the key */
+	uint64_t hash = 0xcbf29ce484222325ULL ^ rpc->command;
+	unsigned char *key = (unsigned char *)rpc->rr;
+
+	hash *= 0x100000001b3ULL;
+	for (unsigned i = 0; i < rpc_cache_key_size[rpc->command]; i++) {
+		hash ^= key[i];
+		hash *= 0x100000001b3ULL;
+	}
 
-		aco_yield();
+	return hash;
+}
+
+static struct rpc_cache_entry *rpc_cache_set(uint64_t hash)
+{
+	return &core->rpc_cache[hash % (RPC_CACHE_SIZE / RPC_CACHE_WAYS)
+				* RPC_CACHE_WAYS];
+}
+
+static struct rpc_cache_entry *rpc_cache_lookup(struct rpc *rpc,
+						uint64_t hash)
+{
+	struct rpc_cache_entry *set = rpc_cache_set(hash);
+
+	for (unsigned i = 0; i < RPC_CACHE_WAYS; i++) {
+		struct rpc_cache_entry *e = &set[i];
+
+		if (e->msg && e->hash == hash && e->msg->command == rpc->command
+		    && !memcmp(e->msg->rr, rpc->rr,
+			       rpc_cache_key_size[rpc->command]))
+			return e;
 	}
 
-	aco_exit();
+	return NULL;
 }
 
-static void handle_downstream(struct unimsg_sock *s,
-			      struct pending_buffer *pending)
+/* Replace the request in @desc with its cached response, if any. Returns 1
+ * on hit, 0 on miss.
+ */
+static int rpc_cache_get(struct unimsg_shm_desc *desc)
 {
-	struct unimsg_shm_desc descs[UNIMSG_MAX_DESCS_BULK];
-	unsigned ndescs = UNIMSG_MAX_DESCS_BULK;
+	struct rpc *rpc = desc->addr;
+	enum command command = rpc->command;
+	__nsec start = ukplat_monotonic_clock();
 
-	int rc = unimsg_recv(s, descs, &ndescs, 0);
-	if (rc) {
-		fprintf(stderr, "Error receiving from downstream: %s\n",
-			strerror(-rc));
-		_ERR_CLOSE(s);
+	struct rpc_cache_entry *e = rpc_cache_lookup(rpc, rpc_cache_hash(rpc));
+	if (!e || e->expires <= start || e->gen != rpc_cache_gen[command]) {
+		core->rpc_cache_stats.misses++;
+		return 0;
 	}
 
-	DEBUG_SVC(-1, "Received %u descs from downstream\n", ndescs);
+	unsigned id = rpc->id;
+	memcpy(rpc, e->msg, e->size);
+	rpc->id = id;
+	desc->size = e->size;
 
-	unsigned current = 0;
-	while (current < ndescs) {
-		if (process_desc(pending, &descs[current])) {
-			DEBUG_SVC(-1, "Received downstream response\n");
+	core->rpc_cache_stats.hits++;
+	core->rpc_cache_stats.hit_ns += ukplat_monotonic_clock() - start;
 
-			/* Identify the coroutine */
-			struct rpc *rpc = pending->desc.addr;
-			if (rpc->id >= MAX_COROUTINES) {
-				fprintf(stderr, "Detected invalid coroutine "
-					"id\n");
-				exit(1);
-			}
-			struct coroutine *co = &coroutines[rpc->id];
+	return 1;
+}
 
-			/* Copy args */
-			*(co->down_desc) = pending->desc;
+/* Store the response in @desc, replacing the previous response to the same
+ * request or, if none, a free entry or the one closest to expiration
+ */
+static void rpc_cache_put(struct unimsg_shm_desc *desc, unsigned gen,
+			  __nsec now)
+{
+	struct rpc *rpc = desc->addr;
+	uint64_t hash = rpc_cache_hash(rpc);
 
-			/* Clear pending */
-			pending->desc.addr = 0;
-			pending->desc.size = 0;
-			pending->expected_sz = 0;
+	struct rpc_cache_entry *e = rpc_cache_lookup(rpc, hash);
+	if (!e) {
+		struct rpc_cache_entry *set = rpc_cache_set(hash);
 
-			/* Resume coroutine */
-			DEBUG_SVC(-1, "Resuming coroutine %u\n", co->id);
-			aco_resume(co->handle);
+		e = &set[0];
+		for (unsigned i = 0; i < RPC_CACHE_WAYS && e->msg; i++) {
+			if (!set[i].msg || set[i].expires < e->expires)
+				e = &set[i];
 		}
+	}
 
-		if (descs[current].size == 0)
-			current++;
+	if (!e->msg || e->size != desc->size) {
+		free(e->msg);
+		e->msg = malloc(desc->size);
+		if (!e->msg) {
+			fprintf(stderr, "Error allocating cache entry\n");
+			exit(1);
+		}
 	}
 
-	DEBUG_SVC(-1, "Done processing bulk\n");
+	memcpy(e->msg, rpc, desc->size);
+	e->size = desc->size;
+	e->hash = hash;
+	e->expires = now + rpc_cache_ttl[rpc->command];
+	e->gen = gen;
 }
 
-#if UPSTREAM_HTTP
-#define handle_upstream handle_upstream_http
-#else
-#define handle_upstream handle_upstream_grpc
-#endif
-
-__unused
-static int handle_upstream_http(struct unimsg_sock *s,
-				struct pending_buffer *pending __unused)
+/* Complete @call with a response to @command failed with @status, in place
+ * of the request if still @owned by the coroutine, or of the response @resp
+ * received, if any, or in a new buffer
+ */
+static void rpc_call_fail(struct rpc_call *call, enum command command,
+			  int owned, struct unimsg_shm_desc *resp, int status)
 {
-	/* Find available coroutine */
-	if (n_available_cos == 0) {
-		DEBUG_SVC(-1 , "Disabling upstream reception for lack of "
-			  "coroutines\n");
-		disable_upstream = 1;
-		return 2;
+	struct coroutine *co = aco_get_arg();
+
+	if (owned) {
+		if (resp)
+			unimsg_buffer_put(resp, 1);
+	} else if (resp) {
+		*call->desc = *resp;
+	} else {
+		int rc = unimsg_buffer_get(call->desc, 1);
+		if (rc) {
+			fprintf(stderr, "Error getting shm buffer: %s\n",
+				strerror(-rc));
+			exit(1);
+		}
 	}
-	struct coroutine *co = &coroutines[available_cos[n_available_cos - 1]];
-	co->up_sock = s;
 
-	unsigned ndescs = 1;
-	int rc = unimsg_recv(s, &co->up_desc, &ndescs, 0);
-	if (rc == -ECONNRESET) {
-		unimsg_close(s);
-		DEBUG_SVC(-1, "Connection closed\n");
-		return 1;
-	} else if (rc) {
-		fprintf(stderr, "Error receiving from upstream: %s\n",
-			strerror(-rc));
-		_ERR_CLOSE(s);
+	rpc_fail(call->desc, command, status);
+	call->done = 1;
+	call->status = status;
+	if (!co->status)
+		co->status = status;
+}
+
+/* Complete @call by running the handler of the fused service on the request
+ * in place, like a response received right away
+ */
+static void rpc_call_fused(struct rpc_call *call)
+{
+	struct rpc *rpc = call->desc->addr;
+	__nsec start = ukplat_monotonic_clock();
+
+	rpc->status = 0;
+	if (call->fused->view) {
+		struct rpc_msg msg;
+
+		rpc_msg_init(&msg, call->desc);
+		call->fused->view(&msg, rpc->rr);
+	} else {
+		call->fused->handler(rpc->rr);
 	}
+	call->done = 1;
+	hist_record(&core->stats.issued[rpc->command],
+		    ukplat_monotonic_clock() - start);
+}
 
-	n_available_cos--;
+/* Time to hedge the RPC of @command to @service sent at @now, 0 if it is not
+ * hedged: the budget of the command must be known and end before @deadline,
+ * there must be another replica and the hedge rate must allow it. Every RPC of
+ * a hedged command earns it service_opts.hedge_rate hundredths of a hedge.
+ */
+static __nsec rpc_hedge_at(unsigned service, enum command command,
+			   __nsec now, __nsec deadline)
+{
+	struct rpc_hedge *h = &core->hedges[command];
 
-	DEBUG_SVC(-1, "Received request\n");
-	DEBUG_SVC(-1, "Starting coroutine %u\n", co->id);
+	if (!h->window)
+		return 0;
 
-	aco_resume(co->handle);
+	h->tokens = MIN(h->tokens + service_opts.hedge_rate, HEDGE_BURST * 100);
+	if (!h->budget || h->tokens < 100
+	    || core->balancers[service].nreplicas < 2
+	    || (deadline && now + h->budget >= deadline))
+		return 0;
 
-	return 0;
+	return now + h->budget;
 }
 
-__unused
-static int handle_upstream_grpc(struct unimsg_sock *s,
-				struct pending_buffer *pending)
+/* Keep a copy of the request @msg of the RPC in @slot, about to be sent, to
+ * hedge it at @at
+ */
+static void rpc_hedge_arm(struct coroutine *co, unsigned slot,
+			  struct unimsg_shm_desc *msg, __nsec at)
 {
-	/* Check available coroutine */
-	if (n_available_cos == 0) {
-		DEBUG_SVC(-1 , "Disabling upstream reception for lack of "
-			  "coroutines\n");
-		disable_upstream = 1;
-		return 2;
-	}
+	struct unimsg_shm_desc *spare = &co->down_spares[slot];
 
-	struct unimsg_shm_desc descs[UNIMSG_MAX_DESCS_BULK];
-	unsigned ndescs = UNIMSG_MAX_DESCS_BULK;
-	int rc = unimsg_recv(s, descs, &ndescs, 0);
-	if (rc == -ECONNRESET) {
-		unimsg_close(s);
-		DEBUG_SVC(-1, "Connection closed\n");
-		return 1;
-	} else if (rc) {
-		fprintf(stderr, "Error receiving from upstream: %s\n",
+	int rc = unimsg_buffer_get(spare, 1);
+	if (rc) {
+		fprintf(stderr, "Error getting shm buffer: %s\n",
 			strerror(-rc));
-		_ERR_CLOSE(s);
+		exit(1);
 	}
+	memcpy(spare->addr, msg->addr, msg->size);
+	spare->size = msg->size;
 
-	DEBUG_SVC(-1, "Received %u descs from upstream\n", ndescs);
+	co->down_hedge_at[slot] = at;
+	co->down_spare |= 1U << slot;
+}
 
-	unsigned current = 0;
-	while (current < ndescs) {
-		/* Check available coroutine */
-		if (n_available_cos == 0) {
-			fprintf(stderr, "No more available coroutines but data "
-				"is already pending");
-			exit(1);
-		}
+/* Send the copy of the RPC in @slot to another replica, unless none has credits
+ * or the hedges of the command are used up meanwhile. Coroutines waiting for
+ * credits of the service go first.
+ */
+static void rpc_hedge_send(struct coroutine *co, unsigned slot)
+{
+	struct rpc_hedge *h = &core->hedges[co->down_command[slot]];
+	unsigned service = co->down_service[slot];
+	struct balancer *b = &core->balancers[service];
+	int replica = -1;
+
+	co->down_spare &= ~(1U << slot);
+	if (h->tokens >= 100 && !core->credit_waiters[service])
+		replica = balancer_pick_other(b, co->down_replica[slot]);
+	if (replica < 0) {
+		unimsg_buffer_put(&co->down_spares[slot], 1);
+		return;
+	}
 
-		if (process_desc(pending, &descs[current])) {
-			struct coroutine *co =
-				&coroutines[available_cos[n_available_cos - 1]];
-			n_available_cos--;
-
-			co->up_desc = pending->desc;
-			co->up_sock = s;
-
-			/* Clear pending */
-			pending->desc.addr = 0;
-			pending->desc.size = 0;
-			pending->expected_sz = 0;
-
-			/* Validate message */
-			struct rpc *rpc = co->up_desc.addr;
-			if (co->up_desc.size != get_rpc_size(rpc->command)) {
-				fprintf(stderr, "Expected %lu B, got %u B from "
-					"upstream\n",
-					get_rpc_size(rpc->command),
-					co->up_desc.size);
-				exit(1);
-			}
+	/* The copy leaves later, with less time left */
+	struct rpc *rpc = co->down_spares[slot].addr;
+	rpc->deadline = rpc_budget(co->down_deadline[slot],
+				   ukplat_monotonic_clock());
 
-			DEBUG_SVC(-1, "Received request\n");
-			DEBUG_SVC(-1, "Starting coroutine %u\n", co->id);
+	int rc = unimsg_send(core->downstream_conns[service][replica].sock,
+			     &co->down_spares[slot], 1, 0);
+	if (rc) {
+		fprintf(stderr, "Error sending desc: %s\n", strerror(-rc));
+		exit(1);
+	}
+	balancer_sent(b, replica);
+	h->tokens -= 100;
+	co->down_hedged |= 1U << slot;
+	core->stats.hedges++;
 
-			aco_resume(co->handle);
-		}
+	DEBUG_SVC(co->id, "Hedged request to %s service on replica %u "
+		  "(slot %u)\n", services[service].name, replica, slot);
+}
 
-		if (descs[current].size == 0)
-			current++;
+/* Hedge the slots among @pending whose budget passed by @now. Lowers @next to
+ * the earliest hedge still ahead, if any.
+ */
+static void rpc_hedge_due(struct coroutine *co, uint32_t pending, __nsec now,
+			  __nsec *next)
+{
+	for (pending &= co->down_spare; pending; pending &= pending - 1) {
+		unsigned slot = __builtin_ctz(pending);
+		__nsec at = co->down_hedge_at[slot];
+
+		if (at <= now)
+			rpc_hedge_send(co, slot);
+		else if (!*next || at < *next)
+			*next = at;
 	}
+}
 
-	DEBUG_SVC(-1, "Done processing bulk\n");
+/* The RPC in @slot is no longer in flight, drop its copy if not sent */
+static void rpc_hedge_done(struct coroutine *co, unsigned slot)
+{
+	uint32_t bit = 1U << slot;
 
-	return 0;
+	if (co->down_spare & bit)
+		unimsg_buffer_put(&co->down_spares[slot], 1);
+	co->down_spare &= ~bit;
+	co->down_hedged &= ~bit;
 }
 
-static void run_service(unsigned id, handle_request_t handler,
-			int *dependencies, unsigned ndependencies)
+/* Account the @latency of an RPC of @command, from the first send to the
+ * first response. Hedged RPCs only get a response after the budget, so they
+ * stay above the quantile as they would have without hedging.
+ */
+static void rpc_hedge_record(enum command command, __nsec latency)
 {
-	int rc;
-	struct unimsg_sock *socks[UNIMSG_MAX_NSOCKS];
-	struct pending_buffer pending_buffers[UNIMSG_MAX_NSOCKS];
-	int ready[UNIMSG_MAX_NSOCKS];
-	unsigned nsocks = 1;
+	struct rpc_hedge *h = &core->hedges[command];
 
-	/* Initialize coroutines */
-	aco_thread_init(NULL);
-	main_co = aco_create(NULL, NULL, 0, NULL, NULL);
-	request_handler = handler;
-	n_available_cos = 0;
-	for (unsigned i = 0; i < MAX_COROUTINES; i++) {
-		coroutines[i].id = i;
-		coroutines[i].stack = aco_share_stack_new(0);
-		coroutines[i].handle = aco_create(main_co, coroutines[i].stack,
-						  0, coroutine_fn,
-						  &coroutines[i]);
-		available_cos[i] = i;
-	}
-	n_available_cos = MAX_COROUTINES;
-
-	/* Connect to dependencies */
-	for (unsigned i = 0; i < ndependencies; i++) {
-		unsigned id = dependencies[i];
-
-		rc = unimsg_socket(&socks[nsocks]);
-		if (rc) {
-			fprintf(stderr, "Error creating unimsg socket: %s\n",
-				strerror(-rc));
+	if (!h->window)
+		return;
+
+	hist_record(h->window, latency);
+	if (h->window->count < HEDGE_WINDOW)
+		return;
+
+	h->budget = hist_quantile(h->window, rpc_hedge_quantile[command]);
+	memset(h->window, 0, sizeof(*h->window));
+}
+
+/* Send all the RPCs of a group without waiting for responses. RPCs with a
+ * cached response are completed right away without being sent, and so are
+ * RPCs already past their deadline, with -ETIMEDOUT. The deadline of an RPC is
+ * the one of the request being served, or the timeout of the call if earlier.
+ * RPCs to services out of credits wait for them, yielding, and time out the
+ * same way if they don't get any by the timeout of the call. RPCs to services
+ * fused into the image are served by direct calls once the others are sent.
+ * Returns the index of the first RPC completed without being sent, or -1 if
+ * none.
+ */
+__unused
+static int rpc_send_many(struct rpc_call *calls, unsigned ncalls)
+{
+	struct coroutine *co = aco_get_arg();
+	int first_hit = -1;
+
+	for (unsigned i = 0; i < ncalls; i++) {
+		struct rpc_call *call = &calls[i];
+		struct rpc *rpc = call->desc->addr;
+		int cacheable = rpc_cache_ttl[rpc->command] != 0;
+
+		call->status = 0;
+		call->fused = fused_handler(rpc->command);
+		if (call->fused)
+			continue;
+
+		if (cacheable && rpc_cache_get(call->desc)) {
+			call->done = 1;
+			if (first_hit < 0)
+				first_hit = i;
+
+			DEBUG_SVC(co->id, "Served request to %s service from "
+				  "cache\n", services[call->service].name);
+			continue;
+		}
+
+		__nsec now = ukplat_monotonic_clock();
+		__nsec deadline = co->deadline;
+		if (call->timeout
+		    && (!deadline || now + call->timeout < deadline))
+			deadline = now + call->timeout;
+		/* Hold the RPC back while the replicas are out of credits */
+		int replica = -1;
+		if (!deadline || now < deadline) {
+			replica = credit_acquire(call->service,
+						 call->timeout ? deadline : 0);
+		}
+		if (replica < 0) {
+			rpc_call_fail(call, rpc->command, 1, NULL, -ETIMEDOUT);
+			core->stats.timeouts++;
+			if (first_hit < 0)
+				first_hit = i;
+
+			DEBUG_SVC(co->id, "Cancelled request to %s service "
+				  "past its deadline\n",
+				  services[call->service].name);
+			continue;
+		}
+		now = ukplat_monotonic_clock();
+
+		uint32_t free_slots = ~co->down_inflight;
+		if (!free_slots) {
+			fprintf(stderr, "Too many RPCs in flight\n");
 			exit(1);
 		}
+		call->slot = __builtin_ctz(free_slots);
+		call->done = 0;
+
+		unsigned gen = core->rpc_gen++ & RPC_ID_GEN_MASK;
+		rpc->id = RPC_ID(co->id, call->slot, gen);
+		rpc->trace = co->trace;
+		rpc->deadline = rpc_budget(deadline, now);
+		rpc->status = 0;
+		co->down_command[call->slot] = rpc->command;
+		co->down_deadline[call->slot] = deadline;
+		if (call->timeout)
+			co->down_timed |= 1U << call->slot;
+		else
+			co->down_timed &= ~(1U << call->slot);
+		co->down_gen[call->slot] = gen;
+		co->down_sent[call->slot] = now;
+		co->down_service[call->slot] = call->service;
+		co->down_replica[call->slot] = replica;
+		if (cacheable) {
+			co->down_cache_gen[call->slot] =
+				rpc_cache_gen[rpc->command];
+		}
 
-		rc = unimsg_connect(socks[nsocks], services[id].addr,
-				    services[id].port);
+		/* In the compact encoding the request in the struct layout
+		 * stays here, to receive the response
+		 */
+		struct unimsg_shm_desc *msg = call->desc;
+		struct unimsg_shm_desc wire;
+		if (service_opts.compact) {
+			int rc = unimsg_buffer_get(&wire, 1);
+			if (rc) {
+				fprintf(stderr, "Error getting shm buffer: "
+					"%s\n", strerror(-rc));
+				exit(1);
+			}
+			rpc_compact_encode(&wire, call->desc, 0);
+			msg = &wire;
+		}
+
+		/* The request is handed off, so a hedge sends a copy */
+		__nsec hedge_at = rpc_hedge_at(call->service, rpc->command,
+					       now, deadline);
+		if (hedge_at)
+			rpc_hedge_arm(co, call->slot, msg, hedge_at);
+
+		int rc = unimsg_send(
+			core->downstream_conns[call->service][replica].sock,
+			msg, 1, 0);
 		if (rc) {
-			fprintf(stderr, "Error connecting to %s service: %s\n",
-				services[id].name, strerror(-rc));
+			fprintf(stderr, "Error sending desc: %s\n",
+				strerror(-rc));
 			exit(1);
 		}
+		balancer_sent(&core->balancers[call->service], replica);
+		co->down_inflight |= 1U << call->slot;
 
-		downstream_socks[id] = socks[nsocks];
-		nsocks++;
-
-		DEBUG_SVC(-1, "Connected to %s service\n", services[id].name);
+		DEBUG_SVC(co->id, "Sent request to replica %u of %s service "
+			  "(slot %u)\n", replica, services[call->service].name,
+			  call->slot);
 	}
 
-	/* Listen for incoming connections */
-	rc = unimsg_socket(&socks[0]);
-	if (rc) {
-		fprintf(stderr, "Error creating unimsg socket: %s\n",
-			strerror(-rc));
-		exit(1);
-	}
-	rc = unimsg_bind(socks[0], services[id].port);
-	if (rc) {
-		fprintf(stderr, "Error binding to port %d: %s\n",
-			services[id].port, strerror(-rc));
-		_ERR_CLOSE(socks[0]);
+	/* Fused services run while the other RPCs are in flight */
+	for (unsigned i = 0; i < ncalls; i++) {
+		if (!calls[i].fused)
+			continue;
+
+		rpc_call_fused(&calls[i]);
+		if (first_hit < 0 || (int)i < first_hit)
+			first_hit = i;
+
+		DEBUG_SVC(co->id, "Called fused %s service\n",
+			  services[calls[i].service].name);
 	}
-	rc = unimsg_listen(socks[0]);
-	if (rc) {
-		fprintf(stderr, "Error listening: %s\n", strerror(-rc));
-		_ERR_CLOSE(socks[0]);
+
+	return first_hit;
+}
+
+/* Slots among @pending whose deadline passed by @now. Sets @next to the
+ * earliest deadline still ahead of the slots with an explicit timeout, 0 if
+ * none: the deadline of the request alone does not arm a timer, a timer armed
+ * for every request in flight would keep the core from blocking.
+ */
+static uint32_t rpc_expired(struct coroutine *co, uint32_t pending,
+			    __nsec now, __nsec *next)
+{
+	uint32_t expired = 0;
+
+	*next = 0;
+	for (; pending; pending &= pending - 1) {
+		unsigned slot = __builtin_ctz(pending);
+		__nsec deadline = co->down_deadline[slot];
+
+		if (!deadline)
+			continue;
+		if (deadline <= now)
+			expired |= 1U << slot;
+		else if ((co->down_timed & (1U << slot))
+			 && (!*next || deadline < *next))
+			*next = deadline;
 	}
-	DEBUG_SVC(-1, "Waiting for incoming connections...\n");
 
-	disable_upstream = 0;
+	return expired;
+}
 
-	memset(pending_buffers, 0, sizeof(pending_buffers));
+/* Wait for all (RPC_WAIT_ALL) or at least one (RPC_WAIT_ANY) of the RPCs of
+ * the group not done yet, RPCs past their deadline count as completed.
+ * Completed RPCs have their desc replaced by the response, or the response
+ * decoded into it for compact RPCs, and are marked as done. RPCs that timed
+ * out or failed downstream get a zeroed response and their status set.
+ * Hedged RPCs still waited for past their budget are sent again meanwhile.
+ * Returns the index of the first RPC completed by this call, or -1 if all
+ * RPCs were already done.
+ */
+__unused
+static int rpc_wait(struct rpc_call *calls, unsigned ncalls, int mode)
+{
+	struct coroutine *co = aco_get_arg();
+	uint32_t waited = 0;
+	uint32_t expired;
+	int first = -1;
 
-	while (1) {
-		unsigned npoll = disable_upstream ? ndependencies + 1 : nsocks;
-		rc = unimsg_poll(socks, npoll, ready);
-		if (rc) {
-			fprintf(stderr, "Error polling: %s\n", strerror(-rc));
-			exit(1);
-		}
+	for (unsigned i = 0; i < ncalls; i++) {
+		if (!calls[i].done)
+			waited |= 1U << calls[i].slot;
+	}
+	if (!waited)
+		return -1;
+
+	/* Responses resume the coroutine once the wait is satisfied, the
+	 * timer when the next timeout passes or the next RPC is due a hedge.
+	 * Downstream services answer requests past their deadline, so the
+	 * response of an RPC without a timeout comes at the latest then.
+	 */
+	for (;;) {
+		__nsec now = ukplat_monotonic_clock();
+		__nsec next;
+		expired = rpc_expired(co, waited & ~co->down_completed, now,
+				      &next);
+		rpc_hedge_due(co, waited & ~co->down_completed & ~expired, now,
+			      &next);
+
+		uint32_t done = (co->down_completed & waited) | expired;
+		if (mode == RPC_WAIT_ANY ? done != 0 : done == waited)
+			break;
+
+		DEBUG_SVC(co->id, "Waiting for %d RPCs, yielding\n",
+			  __builtin_popcount(waited & ~done));
+		co->down_waited = waited & ~expired;
+		co->down_wait_mode = mode;
+		if (next)
+			timer_arm(&core->timers, &co->timer, next);
+		aco_yield();
+		timer_cancel(&core->timers, &co->timer);
+		DEBUG_SVC(co->id, "Resumed on downstream responses\n");
+	}
 
-		unsigned i;
-		/* Handle downstream sockets */
-		for (i = 1; i <= ndependencies; i++) {
-			if (ready[i]) {
-				handle_downstream(socks[i],
-						  &pending_buffers[i]);
-			}
+	for (unsigned i = 0; i < ncalls; i++) {
+		struct rpc_call *call = &calls[i];
+		uint32_t bit = 1U << call->slot;
+
+		if (call->done || !((co->down_completed | expired) & bit))
+			continue;
+
+		if (first < 0)
+			first = i;
+		co->down_inflight &= ~bit;
+		rpc_hedge_done(co, call->slot);
+
+		/* A late response is dropped on arrival */
+		if (!(co->down_completed & bit)) {
+			DEBUG_SVC(co->id, "Request to %s service timed out\n",
+				  services[call->service].name);
+			rpc_call_fail(call, co->down_command[call->slot],
+				      service_opts.compact, NULL, -ETIMEDOUT);
+			core->stats.timeouts++;
+			continue;
 		}
 
-		/* Handle upstream sockets, if enabled */
-		for (; i < npoll; i++) {
-			if (ready[i]) {
-				rc = handle_upstream(socks[i],
-						     &pending_buffers[i]);
-				if (rc == 1) {
-					/* The socket was closed, remove it from
-					 * the list and shift all other sockets
-					 */
-					nsocks--;
-					npoll--;
-					for (unsigned j = i; j < nsocks; j++) {
-						socks[j] = socks[j + 1];
-						ready[j] = ready[j + 1];
-					}
-
-				} else if (rc == 2) {
-					/* We cannot receive more due to lack of
-					 * coroutines
-					 */
-					/* TODO: to be fair, start receiveing
-					 * from the next socket on the next
-					 * round
-					 */
-					break;
-				}
-			}
+		struct unimsg_shm_desc *resp = &co->down_descs[call->slot];
+		struct rpc *hdr = resp->addr;
+		co->down_completed &= ~bit;
+		if (hdr->status) {
+			rpc_call_fail(call, co->down_command[call->slot],
+				      service_opts.compact, resp, hdr->status);
+			continue;
 		}
 
-		/* Handle new connections */
-		if (ready[0]) {
-			if (nsocks == UNIMSG_MAX_NSOCKS) {
-				fprintf(stderr, "Reached max number of "
-					"connections\n");
-				exit(1);
-			}
+		if (hdr->command & RPC_COMPACT) {
+			rpc_compact_decode(call->desc, resp, 1);
+			unimsg_buffer_put(resp, 1);
+		} else {
+			*call->desc = *resp;
+		}
+		call->done = 1;
 
-			struct unimsg_sock *s;
-			rc = unimsg_accept(socks[0], &s, 1);
-			if (rc) {
-				fprintf(stderr, "Error accepting connection: "
-					"%s\n", strerror(-rc));
-				_ERR_CLOSE(socks[0]);
-			}
+		struct rpc *rpc = call->desc->addr;
+		if (call->desc->size != get_rpc_size(rpc->command)) {
+			fprintf(stderr, "Expected %lu B, got %u B from %s "
+				"service\n", get_rpc_size(rpc->command),
+				call->desc->size, services[call->service].name);
+			exit(1);
+		}
 
-			socks[nsocks++] = s;
+		__nsec now = ukplat_monotonic_clock();
+		__nsec latency = now - co->down_sent[call->slot];
+		hist_record(&core->stats.issued[rpc->command], latency);
+		rpc_hedge_record(rpc->command, latency);
 
-			DEBUG_SVC(-1, "New client connected\n");
+		if (rpc_cache_ttl[rpc->command]) {
+			core->rpc_cache_stats.miss_ns += latency;
+			rpc_cache_put(call->desc,
+				      co->down_cache_gen[call->slot], now);
 		}
 	}
+
+	return first;
 }
 
+/* Issue a group of RPCs, possibly to different services, and yield until all
+ * (RPC_WAIT_ALL) or any (RPC_WAIT_ANY) of them complete. With RPC_WAIT_ANY the
+ * remaining RPCs stay in flight and must be collected with rpc_wait() before
+ * the coroutine terminates.
+ */
 __unused
-static void do_rpc(struct unimsg_shm_desc *desc, unsigned service)
+static int do_rpc_many(struct rpc_call *calls, unsigned ncalls, int mode)
 {
-	struct rpc *rpc = desc->addr;
-	struct coroutine *co = aco_get_arg();
-	rpc->id = co->id;
+	int first_hit = rpc_send_many(calls, ncalls);
 
-	int rc = unimsg_send(downstream_socks[service], desc, 1, 0);
-	if (rc) {
-		fprintf(stderr, "Error sending desc: %s\n", strerror(-rc));
-		exit(1);
-	}
+	/* An RPC completed without being sent already satisfies
+	 * RPC_WAIT_ANY
+	 */
+	if (first_hit >= 0 && mode == RPC_WAIT_ANY)
+		return first_hit;
 
-	DEBUG_SVC(co->id, "Sent request to %s service, yielding\n",
-		  services[service].name);
-	co->down_desc = desc;
-	aco_yield();
-	DEBUG_SVC(co->id, "Resumed on response from %s service\n",
-		  services[service].name);
+	int first = rpc_wait(calls, ncalls, mode);
 
-	rpc = desc->addr;
-	if (desc->size != get_rpc_size(rpc->command)) {
-		fprintf(stderr, "Expected %lu B, got %u B from %s service\n",
-			get_rpc_size(rpc->command), desc->size,
-			services[service].name);
-		exit(1);
-	}
+	return first >= 0 ? first : first_hit;
+}
+
+/* Issue an RPC and yield until its response replaces the request in @desc.
+ * Returns the status of the response, -ETIMEDOUT if it did not come by the
+ * deadline of the request being served.
+ */
+__unused
+static int do_rpc(struct unimsg_shm_desc *desc, unsigned service)
+{
+	struct rpc_call call = RPC_CALL(desc, service);
+
+	do_rpc_many(&call, 1, RPC_WAIT_ALL);
+
+	return call.status;
 }
 
-#endif /* __SERVICE_ASYNC__ */
\ No newline at end of file
+#endif /* __SERVICE_ASYNC__ */
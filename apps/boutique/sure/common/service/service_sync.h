@@ -14,14 +14,113 @@
 #define DEBUG_SVC(...) (void)0
 #endif
 
-static int handle_socket(struct unimsg_sock *s, handle_request_t handle_request,
-			 struct pending_buffer *pending)
+static struct service_stats service_stats;
+/* Trace context of the request being served, for the RPCs it issues */
+static struct rpc_trace current_trace;
+/* Deadline of the request being served, passed on to the RPCs it issues, and
+ * status of its response, the first error of those RPCs
+ */
+static __nsec current_deadline;
+static int current_status;
+
+#ifndef SERVICE_GUEST
+static unsigned service_id;
+/* Upstream connections */
+static unsigned nconns;
+static struct trace_ring trace_ring;
+
+static void serve_stats(GetStatsResponse *res)
+{
+	struct service_stats *stats = &service_stats;
+
+	memset(res, 0, sizeof(*res));
+	res->Cores = 1;
+	res->Connections = nconns;
+	res->num_per_core = 1;
+	res->PerCore[0].Connections = nconns;
+	stats_fill(res, &stats, 1);
+	res->Timeouts = service_stats.timeouts;
+	res->LateResponses = service_stats.late;
+	res->Expired = service_stats.expired;
+	res->CreditWaits = service_stats.credit_waits;
+	res->Shed = service_stats.shed;
+	res->Hedges = service_stats.hedges;
+	res->HedgeWins = service_stats.hedge_wins;
+}
+
+static void serve_spans(GetSpansRR *rr)
+{
+	uint64_t cursor = rr->req.Cursor;
+	uint64_t lost = 0;
+	int span_core = rr->req.Core;
+
+	memset(&rr->res, 0, sizeof(rr->res));
+	rr->res.Cores = 1;
+	if (span_core == 0) {
+		rr->res.num_spans = trace_ring_read(&trace_ring, &cursor,
+						    rr->res.Spans,
+						    TRACE_MAX_SPANS, &lost);
+		rr->res.Cursor = cursor;
+		rr->res.Lost = lost;
+	}
+}
+
+/* Requests are served by the handler registered for their command, the
+ * framework registers its own ones in run_service()
+ */
+static void serve_request(struct rpc_msg *msg, struct unimsg_shm_desc *desc)
+{
+	int rc = rpc_dispatch(msg, desc);
+
+	if (rc)
+		current_status = rc;
+}
+
+/* Send the responses collected so far on @s. Returns 1 if the connection
+ * was closed, in which case the responses are released.
+ */
+static int flush_responses(struct unimsg_sock *s, struct unimsg_shm_desc *resps,
+			   unsigned *nresps)
+{
+	if (!*nresps)
+		return 0;
+
+	int rc = unimsg_send(s, resps, *nresps, 0);
+	if (rc) {
+		unimsg_buffer_put(resps, *nresps);
+		if (rc == -ECONNRESET) {
+			unimsg_close(s);
+			DEBUG_SVC("Connection closed\n");
+			return 1;
+		}
+		fprintf(stderr, "Error sending descs: %s\n", strerror(-rc));
+		_ERR_CLOSE(s);
+	}
+
+	DEBUG_SVC("Sent %u responses\n", *nresps);
+	*nresps = 0;
+
+	return 0;
+}
+
+/* Handle all the complete requests of a received bulk. In batch mode the
+ * responses are sent together at the end of the bulk, so that the cost of
+ * a send is paid once per bulk rather than once per request. Returns 1 if the
+ * connection was closed, -EAGAIN if there was nothing to receive.
+ */
+static int handle_socket(struct unimsg_sock *s,
+			 struct rpc_msg *pending)
 {
 	struct unimsg_shm_desc descs[UNIMSG_MAX_DESCS_BULK];
 	unsigned ndescs = UNIMSG_MAX_DESCS_BULK;
-
-	int rc = unimsg_recv(s, descs, &ndescs, 0);
-	if (rc == -ECONNRESET) {
+	struct unimsg_shm_desc resps[UNIMSG_MAX_DESCS_BULK];
+	unsigned nresps = 0;
+
+	/* Spinning rounds try sockets that might not be ready */
+	int rc = unimsg_recv(s, descs, &ndescs, 1);
+	if (rc == -EAGAIN) {
+		return rc;
+	} else if (rc == -ECONNRESET) {
 		unimsg_close(s);
 		DEBUG_SVC("Connection closed\n");
 		return 1;
@@ -32,43 +131,76 @@ static int handle_socket(struct unimsg_sock *s, handle_request_t handle_request,
 
 	DEBUG_SVC("Received %u descs from upstream\n", ndescs);
 
+	__nsec received = ukplat_monotonic_clock();
+
 	unsigned current = 0;
 	while (current < ndescs) {
 		if (process_desc(pending, &descs[current])) {
-			/* Validate message */
-			struct rpc *rpc = pending->desc.addr;
-			if (pending->desc.size != get_rpc_size(rpc->command)) {
-				fprintf(stderr, "Expected %lu B, got %u B from "
-					"upstream\n",
-					get_rpc_size(rpc->command),
-					pending->desc.size);
-				exit(1);
-			}
-
 			DEBUG_SVC("Received request\n");
 
-			handle_request(&pending->desc);
+			struct unimsg_shm_desc desc;
+			struct rpc *rpc, hdr = rpc_msg_header(pending);
+			enum command command = hdr.command & ~RPC_COMPACT;
+			uint32_t parent = hdr.trace.span_id;
+			current_trace = hdr.trace;
+			if (current_trace.flags & RPC_TRACE_SAMPLED) {
+				current_trace.span_id =
+					trace_new_span(&trace_ring, service_id,
+						       0);
+			}
 
-			rc = unimsg_send(s, &pending->desc, 1, 0);
-			if (rc) {
-				unimsg_buffer_put(descs, ndescs);
-				if (rc == -ECONNRESET) {
-					unimsg_close(s);
-					DEBUG_SVC("Connection closed\n");
-					return 1;
-				} else if (rc) {
-					fprintf(stderr, "Error sending desc: "
-						"%s\n", strerror(-rc));
-					_ERR_CLOSE(s);
+			/* Nobody waits for the response of an expired request,
+			 * drop the work it would cause
+			 */
+			current_deadline = rpc_deadline(hdr.deadline,
+							 received);
+			current_status = 0;
+			int expired = current_deadline
+				      && ukplat_monotonic_clock()
+					 >= current_deadline;
+			if (expired) {
+				rpc_msg_take(pending, &desc);
+				rpc = desc.addr;
+				rpc->status = -ETIMEDOUT;
+				service_stats.expired++;
+			} else {
+				rpc_serve(serve_request, pending, &desc);
+				rpc = desc.addr;
+				rpc->status = current_status;
+			}
+			/* Requests are served in order, the caller may keep
+			 * the socket queue filled up to the window
+			 */
+			rpc->credits = service_opts.credits;
+			resps[nresps++] = desc;
+
+			/* Responses of a batch are all ready here */
+			__nsec now = ukplat_monotonic_clock();
+			if (command < NUM_COMMANDS && !expired
+			    && !framework_command(command)) {
+				hist_record(&service_stats.served[command],
+					    now - received);
+			}
+			if (current_trace.flags & RPC_TRACE_SAMPLED) {
+				trace_record(&trace_ring, &current_trace,
+					     parent, service_id, command,
+					     received, now);
+			}
+			current_trace = (struct rpc_trace){ 0 };
+
+			/* A desc can carry more than one request, flush early
+			 * if there's no room for more responses
+			 */
+			if ((!service_opts.batch
+			     || nresps == UNIMSG_MAX_DESCS_BULK)
+			    && flush_responses(s, resps, &nresps)) {
+				for (; current < ndescs; current++) {
+					if (descs[current].size)
+						unimsg_buffer_put(
+							&descs[current], 1);
 				}
+				return 1;
 			}
-
-			DEBUG_SVC("Sent response\n");
-
-			/* Clear pending */
-			pending->desc.addr = 0;
-			pending->desc.size = 0;
-			pending->expected_sz = 0;
 		}
 
 		if (descs[current].size == 0)
@@ -77,92 +209,180 @@ static int handle_socket(struct unimsg_sock *s, handle_request_t handle_request,
 
 	DEBUG_SVC("Done processing bulk\n");
 
-	return 0;
+	return flush_responses(s, resps, &nresps);
+}
+
+/* Accept a connection on the listening socket @listen_sock. If there's no room
+ * for it in @set the connection is closed right away, rejecting the client
+ * without disturbing the others. Returns 0 if there was no connection to
+ * accept.
+ */
+static int accept_conn(struct sock_set *set, struct unimsg_sock *listen_sock)
+{
+	struct unimsg_sock *s;
+	int rc = unimsg_accept(listen_sock, &s, 1);
+	if (rc == -EAGAIN) {
+		return 0;
+	} else if (rc) {
+		fprintf(stderr, "Error accepting connection: %s\n",
+			strerror(-rc));
+		_ERR_CLOSE(listen_sock);
+	}
+
+	if (sock_set_full(set)) {
+		unimsg_close(s);
+		DEBUG_SVC("Rejected client, too many connections\n");
+		return 1;
+	}
+
+	sock_set_add(set, s);
+	nconns++;
+
+	DEBUG_SVC("New client connected\n");
+
+	return 1;
 }
 
-static void run_service(unsigned id, handle_request_t handle_request)
+/* Serve requests with the handlers registered with the register_*_service()
+ * of the service
+ */
+static void run_service(unsigned id)
 {
 	int rc;
-	struct unimsg_sock *socks[UNIMSG_MAX_NSOCKS];
-	struct pending_buffer pending_buffers[UNIMSG_MAX_NSOCKS];
-	int ready[UNIMSG_MAX_NSOCKS];
-	unsigned nsocks = 1;
+	struct unimsg_sock *listen_sock;
+	static struct sock_set set;
+	/* Partial messages, parallel to the sockets of the set */
+	static struct rpc_msg pending_msgs[UNIMSG_MAX_NSOCKS];
+	struct poller poller;
+
+	service_id = id;
+	register_stats_service(&(struct stats_handlers){ serve_stats });
+	register_trace_service(&(struct trace_handlers){ serve_spans });
 
-	rc = unimsg_socket(&socks[0]);
+	rc = unimsg_socket(&listen_sock);
 	if (rc) {
 		fprintf(stderr, "Error creating unimsg socket: %s\n",
 			strerror(-rc));
 		exit(1);
 	}
 
-	rc = unimsg_bind(socks[0], services[id].port);
+	rc = unimsg_bind(listen_sock, services[id].port);
 	if (rc) {
 		fprintf(stderr, "Error binding to port %d: %s\n",
 			services[id].port, strerror(-rc));
-		_ERR_CLOSE(socks[0]);
+		_ERR_CLOSE(listen_sock);
 	}
 
-	rc = unimsg_listen(socks[0]);
+	rc = unimsg_listen(listen_sock);
 	if (rc) {
 		fprintf(stderr, "Error listening: %s\n", strerror(-rc));
-		_ERR_CLOSE(socks[0]);
+		_ERR_CLOSE(listen_sock);
 	}
 
-	memset(pending_buffers, 0, sizeof(pending_buffers));
+	sock_set_add(&set, listen_sock);
+	poller_init(&poller, service_opts.poll_mode,
+		    service_opts.spin_us * 1000ULL, ukplat_monotonic_clock());
 
 	DEBUG_SVC("Waiting for incoming connections...\n");
 
 	while (1) {
-		rc = unimsg_poll(socks, nsocks, ready);
-		if (rc) {
-			fprintf(stderr, "Error polling: %s\n", strerror(-rc));
-			exit(1);
-		}
-
-		for (unsigned i = 1; i < nsocks; i++) {
-			if (ready[i]) {
-				rc = handle_socket(socks[i], handle_request,
-						   &pending_buffers[i]);
-				if (rc) {
-					/* The socket was closed, remove it from
-					 * the list and shift all other sockets
-					 */
-					nsocks--;
-					for (unsigned j = i; j < nsocks; j++) {
-						socks[j] = socks[j + 1];
-						ready[j] = ready[j + 1];
-					}
-				}
+		unsigned nwork = 0;
+
+		service_wait(&poller, &set, set.nsocks, 0);
+
+		/* Only visit the ready sockets. The list goes from the last
+		 * position down, a socket moved into the place of a closed one
+		 * comes from a position already visited.
+		 */
+		for (unsigned k = 0; k < set.nready; k++) {
+			unsigned i = set.ready_list[k];
+			if (i == 0) {
+				nwork += accept_conn(&set, listen_sock);
+				continue;
 			}
-		}
 
-		if (ready[0]) {
-			if (nsocks == UNIMSG_MAX_NSOCKS) {
-				fprintf(stderr, "Reached max number of "
-					"connections\n");
-				exit(1);
-			}
+			rc = handle_socket(set.socks[i], &pending_msgs[i]);
+			if (rc == -EAGAIN)
+				continue;
 
-			struct unimsg_sock *s;
-			rc = unimsg_accept(socks[0], &s, 1);
+			nwork++;
 			if (rc) {
-				fprintf(stderr, "Error accepting connection: "
-					"%s\n", strerror(-rc));
-				_ERR_CLOSE(socks[0]);
+				/* The socket was closed, fill its place with
+				 * the last one
+				 */
+				rpc_msg_put(&pending_msgs[i]);
+				unsigned last = sock_set_remove(&set, i);
+				nconns--;
+				pending_msgs[i] = pending_msgs[last];
+				memset(&pending_msgs[last], 0,
+				       sizeof(pending_msgs[last]));
+#if ENABLE_DEBUG
+				poller_print(&poller, "Poller");
+#endif
 			}
+		}
 
-			socks[nsocks++] = s;
+		poller_done(&poller, ukplat_monotonic_clock(), nwork);
+	}
+}
+#else
+/* Fused into the image of another service, see FUSE in the Makefile. The
+ * service doesn't serve requests itself, run_service() hands its handlers to
+ * the host and main() runs at startup, as a constructor. The name of main() is
+ * the one of the service, to tell the guests of an image apart.
+ */
+#define __GUEST_MAIN(name) name##_main
+#define _GUEST_MAIN(name) __GUEST_MAIN(name)
+#define main _GUEST_MAIN(SERVICE_GUEST)
 
-			DEBUG_SVC("New client connected\n");
+int main(int argc, char **argv);
+
+static void run_service(unsigned id)
+{
+	for (unsigned c = 0; c < NUM_COMMANDS; c++) {
+		if (rpc_handlers[c] || rpc_view_handlers[c]) {
+			fused_handlers[c].handler = rpc_handlers[c];
+			fused_handlers[c].view = rpc_view_handlers[c];
 		}
 	}
+
+	DEBUG_SVC("Fused %s service\n", services[id].name);
 }
 
+__attribute__((constructor))
+static void run_guest(void)
+{
+	char *argv[] = { "guest", NULL };
+
+	main(1, argv);
+}
+#endif /* SERVICE_GUEST */
+
 static struct unimsg_sock *socks[NUM_SERVICES];
 
+/* Issue an RPC and block until its response replaces the request in @desc.
+ * The RPC carries the deadline of the request being served but the wait is
+ * not bounded, RPCs are only cancelled when issued past the deadline. Returns
+ * the status of the response, the body of failed responses is zeroed.
+ */
 __unused
-static void do_rpc(struct unimsg_shm_desc *desc, unsigned service)
+static int do_rpc(struct unimsg_shm_desc *desc, unsigned service)
 {
+	struct rpc *rpc = desc->addr;
+	enum command command = rpc->command;
+	rpc->trace = current_trace;
+	rpc->status = 0;
+	__nsec sent = ukplat_monotonic_clock();
+	rpc->deadline = rpc_budget(current_deadline, sent);
+
+	if (current_deadline && sent >= current_deadline) {
+		rpc_fail(desc, command, -ETIMEDOUT);
+		service_stats.timeouts++;
+		if (!current_status)
+			current_status = -ETIMEDOUT;
+		return -ETIMEDOUT;
+	}
+
 	int rc = unimsg_send(socks[service], desc, 1, 0);
 	if (rc) {
 		fprintf(stderr, "Error sending desc: %s\n", strerror(-rc));
@@ -176,13 +396,27 @@ static void do_rpc(struct unimsg_shm_desc *desc, unsigned service)
 		exit(1);
 	}
 
-	struct rpc *rpc = desc->addr;
+	rpc = desc->addr;
+	if (rpc->status) {
+		int status = rpc->status;
+
+		rpc_fail(desc, command, status);
+		if (!current_status)
+			current_status = status;
+		return status;
+	}
+
 	if (desc->size != get_rpc_size(rpc->command)) {
 		fprintf(stderr, "Expected %lu B, got %u B from %s service\n",
 			get_rpc_size(rpc->command), desc->size,
 			services[service].name);
 		exit(1);
 	}
+
+	hist_record(&service_stats.issued[command],
+		    ukplat_monotonic_clock() - sent);
+
+	return 0;
 }
 
 #endif /* __SERVICE_SYNC__ */
\ No newline at end of file
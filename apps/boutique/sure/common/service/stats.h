@@ -0,0 +1,172 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* Latency histograms of the RPCs served and issued by a service, per command,
+ * served to the SERVICE_GET_STATS command.
+ *
+ * Histograms are log-linear, like HDR histograms: every power of 2 is split
+ * in HIST_SUB buckets of the same width, so values are kept with a relative
+ * error below 1 / HIST_SUB over the whole range, with a constant cost per
+ * value. Histograms of the same kind can be merged by adding their buckets.
+ */
+
+#ifndef __STATS__
+#define __STATS__
+
+#include <uk/plat/time.h>
+#include "message.h"
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1U << HIST_SUB_BITS)
+/* Values from 2^HIST_MAX_EXP ns (~17 s) on go to the last bucket */
+#define HIST_MAX_EXP 34
+#define HIST_NBUCKETS ((HIST_MAX_EXP - HIST_SUB_BITS + 1) * HIST_SUB)
+
+_Static_assert(NUM_COMMANDS <= STATS_MAX_COMMANDS,
+	       "Stats response too small for all commands");
+
+struct hist {
+	unsigned long count;
+	__nsec sum;
+	__nsec max;
+	uint32_t buckets[HIST_NBUCKETS];
+};
+
+struct service_stats {
+	struct hist served[NUM_COMMANDS];
+	struct hist issued[NUM_COMMANDS];
+	/* High-water marks of the request queue and of the busy coroutines */
+	unsigned long queue_max;
+	unsigned long busy_max;
+	/* RPCs issued that timed out, responses received after that and
+	 * requests dropped past their deadline
+	 */
+	unsigned long timeouts;
+	unsigned long late;
+	unsigned long expired;
+	/* RPCs issued that waited for credits and requests shed by admission
+	 * control
+	 */
+	unsigned long credit_waits;
+	unsigned long shed;
+	/* RPCs issued that were hedged with a duplicate and those the
+	 * duplicate answered first
+	 */
+	unsigned long hedges;
+	unsigned long hedge_wins;
+};
+
+static inline unsigned hist_bucket(__nsec v)
+{
+	if (v < HIST_SUB)
+		return v;
+
+	unsigned exp = 63 - __builtin_clzll(v);
+	if (exp >= HIST_MAX_EXP)
+		return HIST_NBUCKETS - 1;
+
+	/* The top HIST_SUB_BITS + 1 bits of the value, the first one is
+	 * implied by the exponent
+	 */
+	return (exp - HIST_SUB_BITS + 1) * HIST_SUB
+	       + ((v >> (exp - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* Middle of the range of values of bucket @b */
+static inline __nsec hist_bucket_value(unsigned b)
+{
+	if (b < HIST_SUB)
+		return b;
+
+	unsigned shift = b / HIST_SUB - 1;
+	__nsec low = (__nsec)(HIST_SUB + b % HIST_SUB) << shift;
+
+	return low + ((1ULL << shift) >> 1);
+}
+
+static inline void hist_record(struct hist *h, __nsec v)
+{
+	h->count++;
+	h->sum += v;
+	if (v > h->max)
+		h->max = v;
+	h->buckets[hist_bucket(v)]++;
+}
+
+static inline void hist_merge(struct hist *dst, const struct hist *src)
+{
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	for (unsigned i = 0; i < HIST_NBUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+/* Value below which fall @permyriad / 10000 of the values */
+static inline __nsec hist_quantile(const struct hist *h, unsigned permyriad)
+{
+	unsigned long rank = (h->count * permyriad + 9999) / 10000;
+	unsigned long seen = 0;
+
+	if (!rank)
+		rank = 1;
+
+	for (unsigned i = 0; i < HIST_NBUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank)
+			return MIN(hist_bucket_value(i), h->max);
+	}
+
+	return h->max;
+}
+
+static void stats_summarize(LatencySummary *s, enum command command,
+			    const struct hist *h)
+{
+	s->Command = command;
+	s->Count = h->count;
+	s->MeanNs = h->count ? h->sum / h->count : 0;
+	s->P50Ns = hist_quantile(h, 5000);
+	s->P99Ns = hist_quantile(h, 9900);
+	s->P999Ns = hist_quantile(h, 9990);
+	s->MaxNs = h->max;
+}
+
+/* Fill the histogram part of @res with the commands served and issued in the
+ * @n stats of @stats, merged. The counters are left to the caller.
+ */
+__attribute__((unused))
+static void stats_fill(GetStatsResponse *res, struct service_stats **stats,
+		       unsigned n)
+{
+	/* Too large for the stack of a coroutine */
+	struct hist *merged = malloc(sizeof(*merged));
+	if (!merged) {
+		fprintf(stderr, "Error allocating histogram\n");
+		exit(1);
+	}
+
+	res->num_served = 0;
+	res->num_issued = 0;
+	for (unsigned c = 0; c < NUM_COMMANDS; c++) {
+		memset(merged, 0, sizeof(*merged));
+		for (unsigned i = 0; i < n; i++)
+			hist_merge(merged, &stats[i]->served[c]);
+		if (merged->count)
+			stats_summarize(&res->Served[res->num_served++], c,
+					merged);
+
+		memset(merged, 0, sizeof(*merged));
+		for (unsigned i = 0; i < n; i++)
+			hist_merge(merged, &stats[i]->issued[c]);
+		if (merged->count)
+			stats_summarize(&res->Issued[res->num_issued++], c,
+					merged);
+	}
+
+	free(merged);
+}
+
+#endif /* __STATS__ */
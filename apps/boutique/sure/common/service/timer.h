@@ -0,0 +1,124 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* Hashed timing wheel: timers are kept in the slot of the tick they expire
+ * in, modulo the number of slots, so arming and cancelling take constant time
+ * and advancing the clock only visits the slots of the ticks elapsed. Timers
+ * further than a turn of the wheel stay in their slot until their turn comes.
+ * Timers fire once their whole tick has elapsed, up to a tick late.
+ *
+ * Like the poller, the wheel is fed with timestamps rather than reading the
+ * clock.
+ */
+
+#ifndef __TIMER__
+#define __TIMER__
+
+#include <stddef.h>
+#include <uk/plat/time.h>
+
+/* Ticks of 2^16 ns (~65 us) */
+#define TIMER_TICK_SHIFT 16
+/* Slots of the wheel, a power of 2, a turn is ~16.8 ms */
+#define TIMER_WHEEL_SLOTS 256
+
+struct timer {
+	__nsec expires;
+	struct timer *next;
+	/* Link pointing to this timer, NULL if not armed */
+	struct timer **pprev;
+};
+
+struct timer_wheel {
+	/* First tick not fully elapsed */
+	uint64_t tick;
+	unsigned narmed;
+	struct timer *slots[TIMER_WHEEL_SLOTS];
+};
+
+static inline void timer_wheel_init(struct timer_wheel *w, __nsec now)
+{
+	*w = (struct timer_wheel){ .tick = now >> TIMER_TICK_SHIFT };
+}
+
+static inline int timer_armed(struct timer *t)
+{
+	return t->pprev != NULL;
+}
+
+static inline void timer_cancel(struct timer_wheel *w, struct timer *t)
+{
+	if (!timer_armed(t))
+		return;
+
+	*t->pprev = t->next;
+	if (t->next)
+		t->next->pprev = t->pprev;
+	t->pprev = NULL;
+	w->narmed--;
+}
+
+/* (Re)arm @t to expire at @expires, timers already expired fire on the next
+ * advance
+ */
+static inline void timer_arm(struct timer_wheel *w, struct timer *t,
+			     __nsec expires)
+{
+	uint64_t tick = MAX(expires >> TIMER_TICK_SHIFT, w->tick);
+	struct timer **slot = &w->slots[tick % TIMER_WHEEL_SLOTS];
+
+	timer_cancel(w, t);
+
+	t->expires = expires;
+	t->next = *slot;
+	if (t->next)
+		t->next->pprev = &t->next;
+	t->pprev = slot;
+	*slot = t;
+	w->narmed++;
+}
+
+/* Fire the timers whose tick elapsed by @now, calling @fire on each once it
+ * is disarmed. @fire can arm and cancel timers. Returns the number of timers
+ * fired.
+ */
+static inline unsigned timer_wheel_advance(struct timer_wheel *w, __nsec now,
+					   void (*fire)(struct timer *))
+{
+	uint64_t target = now >> TIMER_TICK_SHIFT;
+	unsigned nfired = 0;
+
+	if (!w->narmed) {
+		w->tick = MAX(w->tick, target);
+		return 0;
+	}
+
+	/* Every slot is visited at most once per advance */
+	if (target > w->tick + TIMER_WHEEL_SLOTS)
+		w->tick = target - TIMER_WHEEL_SLOTS;
+
+	for (; w->tick < target; w->tick++) {
+		struct timer **slot = &w->slots[w->tick % TIMER_WHEEL_SLOTS];
+		struct timer *t = *slot;
+
+		/* Restart from the head after firing, @fire might have
+		 * changed the slot
+		 */
+		while (t) {
+			if (t->expires >> TIMER_TICK_SHIFT > w->tick) {
+				t = t->next;
+				continue;
+			}
+
+			timer_cancel(w, t);
+			fire(t);
+			nfired++;
+			t = *slot;
+		}
+	}
+
+	return nfired;
+}
+
+#endif /* __TIMER__ */
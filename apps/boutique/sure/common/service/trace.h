@@ -0,0 +1,139 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* Tracing of requests across services. The frontend samples the requests to
+ * trace and gives them a trace id, every RPC carries the trace context of its
+ * caller (struct rpc_trace) and every service handling a sampled request
+ * records a span, linked to the span of the caller, in a ring of the core.
+ * Rings are read through the SERVICE_GET_SPANS command, the trace tool joins
+ * the spans of all services into call trees.
+ *
+ * Requests that are not sampled only pay for carrying the context. Recording
+ * a span takes a copy into the ring, which is never locked: the core is the
+ * only writer and readers detect overwritten slots with the sequence number of
+ * the slot, like a seqlock.
+ */
+
+#ifndef __TRACE__
+#define __TRACE__
+
+#include <string.h>
+#include <uk/plat/time.h>
+#include "message.h"
+
+/* Spans kept by each core, a power of 2 */
+#define TRACE_RING_SIZE 1024
+
+/* Span ids carry the service and the core that made them, so that ids made
+ * by different services or cores never clash
+ */
+#define TRACE_SPAN_ID(service, core, n)					\
+	(((uint32_t)(service) + 1) << 28 | (uint32_t)(core) << 24	\
+	 | ((n) & 0xffffff))
+#define TRACE_SPAN_SERVICE(span_id) ((int)((span_id) >> 28) - 1)
+
+struct trace_slot {
+	/* Position of the span in the ring plus one, 0 while being written */
+	uint64_t seq;
+	Span span;
+};
+
+struct trace_ring {
+	uint64_t head;
+	/* Spans made, for span ids */
+	uint32_t nspans;
+	struct trace_slot slots[TRACE_RING_SIZE];
+};
+
+static inline uint32_t trace_new_span(struct trace_ring *ring,
+				      unsigned service, unsigned core)
+{
+	return TRACE_SPAN_ID(service, core, ring->nspans++);
+}
+
+/* Start a trace with a random id */
+static inline uint64_t trace_new_id(struct trace_ring *ring, unsigned core)
+{
+	/* splitmix64 of the time, the core and the spans made */
+	uint64_t x = ukplat_monotonic_clock() ^ ((uint64_t)core << 56)
+		     ^ ((uint64_t)ring->nspans << 32);
+
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+	return x ^ (x >> 31);
+}
+
+/* Record a span, called by the core of the ring only */
+static inline void trace_ring_put(struct trace_ring *ring, const Span *span)
+{
+	uint64_t head = ring->head;
+	struct trace_slot *slot = &ring->slots[head % TRACE_RING_SIZE];
+
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->span = *span;
+	__atomic_store_n(&slot->seq, head + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Record the span of the handling of a request by @service from @start to
+ * @end, in the trace context @trace and with the caller span @parent
+ */
+static inline void trace_record(struct trace_ring *ring,
+				const struct rpc_trace *trace, uint32_t parent,
+				unsigned service, enum command command,
+				__nsec start, __nsec end)
+{
+	Span span = {
+		.TraceId = trace->trace_id,
+		.SpanId = trace->span_id,
+		.ParentSpanId = parent,
+		.Service = service,
+		.Command = command,
+		.StartNs = start,
+		.EndNs = end,
+	};
+
+	trace_ring_put(ring, &span);
+}
+
+/* Copy up to @max spans recorded from @cursor on to @spans, from any core.
+ * Advances @cursor past the spans read and adds the spans overwritten before
+ * they could be read to @lost. Returns the number of spans copied.
+ */
+static inline unsigned trace_ring_read(struct trace_ring *ring,
+				       uint64_t *cursor, Span *spans,
+				       unsigned max, uint64_t *lost)
+{
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	unsigned n = 0;
+
+	/* A cursor from the future comes from a previous run */
+	if (*cursor > head)
+		*cursor = 0;
+	if (head - *cursor > TRACE_RING_SIZE) {
+		*lost += head - TRACE_RING_SIZE - *cursor;
+		*cursor = head - TRACE_RING_SIZE;
+	}
+
+	for (; *cursor < head && n < max; (*cursor)++) {
+		struct trace_slot *slot = &ring->slots[*cursor
+						       % TRACE_RING_SIZE];
+		uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+		spans[n] = slot->span;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (seq != *cursor + 1
+		    || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+			(*lost)++;
+		else
+			n++;
+	}
+
+	return n;
+}
+
+#endif /* __TRACE__ */
@@ -5,6 +5,7 @@
 #ifndef __UTILITIES__
 #define __UTILITIES__
 
+#include <string.h>
 #include "message.h"
 
 #define NANOSMOD 1000000000
@@ -40,4 +41,28 @@ static void MoneyMultiplySlow(Money *total, uint32_t n)
 	}
 }
 
+static void ConversionBatchAdd(CurrencyConversionBatchRequest *req,
+			       Money *amount)
+{
+	unsigned i = req->num_amounts++;
+
+	memcpy(req->FromCodes[i], amount->CurrencyCode,
+	       MONEY_CURRENCY_CODE_SIZE);
+	req->Units[i] = amount->Units;
+	req->Nanos[i] = amount->Nanos;
+}
+
+static Money ConversionBatchGet(CurrencyConversionBatchResponse *res,
+				unsigned i)
+{
+	Money amount;
+
+	memcpy(amount.CurrencyCode, res->CurrencyCode,
+	       MONEY_CURRENCY_CODE_SIZE);
+	amount.Units = res->Units[i];
+	amount.Nanos = res->Nanos[i];
+
+	return amount;
+}
+
 #endif /* __UTILITIES__ */
\ No newline at end of file
@@ -73,28 +73,26 @@ static void Convert(CurrencyConversionRR *rr)
 
 	/* Convert: from_currency --> EUR */
 	double *rate;
-	if (!find_c_map(currency_data_map, in->From.CurrencyCode,
-			(void **)&rate)) {
+	if (!find_ref_c_map(currency_data_map, in->From.CurrencyCode,
+			    (void **)&rate)) {
 		fprintf(stderr, "Origin currency '%s' not found\n",
 			in->From.CurrencyCode);
 		exit(1);
 	}
 	euros->Units = (int64_t)((double)in->From.Units / *rate);
 	euros->Nanos = (int32_t)((double)in->From.Nanos / *rate);
-	free(rate);
 
 	Carry(euros);
 	euros->Nanos = (int32_t)(round((double)euros->Nanos));
 
 	/* Convert: EUR --> to_currency */
-	if (!find_c_map(currency_data_map, in->ToCode, (void **)&rate)) {
+	if (!find_ref_c_map(currency_data_map, in->ToCode, (void **)&rate)) {
 		fprintf(stderr, "Destination currency '%s' not found\n",
 			in->ToCode);
 		exit(1);
 	}
 	euros->Units = (int64_t)((double)euros->Units / *rate);
 	euros->Nanos = (int32_t)((double)euros->Nanos / *rate);
-	free(rate);
 	Carry(euros);
 
 	euros->Units = (int64_t)(floor((double)(euros->Units)));
@@ -105,32 +103,98 @@ static void Convert(CurrencyConversionRR *rr)
 	return;
 }
 
-static void handle_request(struct unimsg_shm_desc *desc)
+static double getRate(char *code, const char *role)
 {
-	struct rpc *rpc = desc->addr;
-
-	switch (rpc->command) {
-	case CURRENCY_GET_SUPPORTED_CURRENCIES:
-		GetSupportedCurrencies(
-			(GetSupportedCurrenciesResponse *)rpc->rr);
-		break;
-	case CURRENCY_CONVERT:
-		Convert((CurrencyConversionRR *)rpc->rr);
-		break;
-	default:
-		fprintf(stderr, "Received unknown command\n");
+	double *rate;
+
+	if (!find_ref_c_map(currency_data_map, code, (void **)&rate)) {
+		fprintf(stderr, "%s currency '%s' not found\n", role, code);
+		exit(1);
+	}
+
+	return *rate;
+}
+
+/**
+ * Same arithmetic as Convert(), applied lane by lane to arrays of units and
+ * nanos so that the compiler can vectorize each step. Nanos never carry
+ * fractional units here (Units % 1 is always 0), so Carry() reduces to moving
+ * whole units out of nanos.
+ */
+static void ConvertLanes(int64_t *units, int32_t *nanos, const double *rates,
+			 unsigned n)
+{
+	double fractionSize = 1e9;
+
+	for (unsigned i = 0; i < n; i++) {
+		units[i] = (int64_t)((double)units[i] / rates[i]);
+		nanos[i] = (int32_t)((double)nanos[i] / rates[i]);
+	}
+	for (unsigned i = 0; i < n; i++) {
+		units[i] = units[i] + (int64_t)floor((double)nanos[i]
+						     / fractionSize);
+		nanos[i] = nanos[i] % (int32_t)fractionSize;
 	}
 }
 
+static void ConvertBatch(CurrencyConversionBatchRR *rr)
+{
+	CurrencyConversionBatchRequest *in = &rr->req;
+	CurrencyConversionBatchResponse *out = &rr->res;
+	double rates[CURRENCY_CONVERT_BATCH_MAX];
+	unsigned n = in->num_amounts;
+
+	DEBUG("[ConvertBatch] Requested conversion of %u amounts to '%s'\n",
+	      n, in->ToCode);
+
+	if (n > CURRENCY_CONVERT_BATCH_MAX) {
+		fprintf(stderr, "Too many amounts in batch: %u\n", n);
+		exit(1);
+	}
+
+	/* Convert: from_currency --> EUR, amounts usually share the same
+	 * origin currency, so only look up the rate when it changes
+	 */
+	char *last_code = NULL;
+	double last_rate = 0;
+	for (unsigned i = 0; i < n; i++) {
+		if (!last_code || strcmp(last_code, in->FromCodes[i])) {
+			last_code = in->FromCodes[i];
+			last_rate = getRate(last_code, "Origin");
+		}
+		rates[i] = last_rate;
+	}
+
+	memcpy(out->Units, in->Units, n * sizeof(out->Units[0]));
+	memcpy(out->Nanos, in->Nanos, n * sizeof(out->Nanos[0]));
+	ConvertLanes(out->Units, out->Nanos, rates, n);
+
+	/* Convert: EUR --> to_currency */
+	double to_rate = getRate(in->ToCode, "Destination");
+	for (unsigned i = 0; i < n; i++)
+		rates[i] = to_rate;
+	ConvertLanes(out->Units, out->Nanos, rates, n);
+
+	strcpy(out->CurrencyCode, in->ToCode);
+
+	DEBUG("[ConvertBatch] Conversion completed\n");
+}
+
+static const struct currency_handlers handlers = {
+	.GetSupportedCurrencies = GetSupportedCurrencies,
+	.Convert = Convert,
+	.ConvertBatch = ConvertBatch,
+};
+
 int main(int argc, char **argv)
 {
-	(void)argc;
-	(void)argv;
+	parse_service_args(argc, argv);
 
 	currency_data_map = new_c_map(compare_e, NULL, NULL);
 	getCurrencyData(currency_data_map);
 
-	run_service(CURRENCY_SERVICE, handle_request);
+	register_currency_service(&handlers);
+	run_service(CURRENCY_SERVICE);
 
 	return 0;
 }
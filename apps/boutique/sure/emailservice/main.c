@@ -10,25 +10,29 @@
 	ERR_CLOSE(s);							\
 })
 
-static void SendOrderConfirmation(SendOrderConfirmationRR *rr __unused) {
-	DEBUG("A request to send order confirmation email to %s has been received\n", rr->req.Email);
+/* Only the address is read, in place, the order the request carries can stay
+ * spread over the descs it arrived in
+ */
+static void SendOrderConfirmation(struct rpc_msg *req __unused,
+				  void *res __unused) {
+#if ENABLE_DEBUG
+	char email[sizeof(((SendOrderConfirmationRequest *)0)->Email)];
+
+	rpc_msg_read(req, sizeof(struct rpc)
+		     + offsetof(SendOrderConfirmationRequest, Email),
+		     email, sizeof(email));
+	DEBUG("A request to send order confirmation email to %s has been received\n", email);
+#endif
 	return;
 }
 
-static void handle_request(struct unimsg_shm_desc *desc)
-{
-	struct rpc *rpc = desc->addr;
-	SendOrderConfirmationRR *rr = (SendOrderConfirmationRR *)rpc->rr;
-
-	SendOrderConfirmation(rr);
-}
-
 int main(int argc, char **argv)
 {
-	(void)argc;
-	(void)argv;
+	parse_service_args(argc, argv);
 
-	run_service(EMAIL_SERVICE, handle_request);
+	register_view_handler(EMAIL_SEND_ORDER_CONFIRMATION,
+			      SendOrderConfirmation);
+	run_service(EMAIL_SERVICE);
 
 	return 0;
 }
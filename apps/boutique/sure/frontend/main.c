@@ -11,6 +11,7 @@
 #include <unimsg/net.h>
 #include "../common/service/service_async.h"
 #include "../common/service/utilities.h"
+#include "pages.h"
 
 #define HTTP_ERROR() ({ fprintf(stderr, "HTTP error\n"); exit(0); })
 #define ERR_CLOSE(s) ({ unimsg_close(s); exit(1); })
@@ -23,16 +24,23 @@
 		"Content-Length: 0\r\n"					\
 		"\r\n"
 
-#define HTTP_BAD_REQUEST "HTTP/1.1 400 Bad Request\r\n"			\
-			 "Content-Length: 0\r\n"			\
-			 "\r\n"
-
 #define HTTP_NOT_FOUND "HTTP/1.1 404 Not Found\r\n"			\
 		       "Content-Length: 0\r\n"				\
 		       "\r\n"
 
+#define HTTP_INTERNAL_SERVER_ERROR "HTTP/1.1 500 Internal Server Error\r\n" \
+				   "Content-Length: 0\r\n"		\
+				   "\r\n"
+
 #define USER_ID "federico"
 
+/* Currencies and products are static, cache them on the client side */
+#define STATIC_DATA_CACHE_TTL ukarch_time_sec_to_nsec(60)
+/* Pages wait for many currency and product lookups in a row, send again those
+ * slower than 95% of their kind to another replica
+ */
+#define HEDGE_QUANTILE 9500
+
 static char currency[] = "CAD";
 static int dependencies[] = {
 	AD_SERVICE,
@@ -44,254 +52,381 @@ static int dependencies[] = {
 	CHECKOUT_SERVICE
 };
 
-static GetSupportedCurrenciesResponse *
-getCurrencies(struct unimsg_shm_desc *desc)
-{
-	DEBUG("getCurrencies()\n");
-
-	unimsg_buffer_reset(desc);
-	struct rpc *rpc = desc->addr;
-	rpc->command = CURRENCY_GET_SUPPORTED_CURRENCIES;
-	desc->size = get_rpc_size(CURRENCY_GET_SUPPORTED_CURRENCIES);
-
-	do_rpc(desc, CURRENCY_SERVICE);
+#define RPC_BODY(desc) ((void *)((struct rpc *)(desc)->addr)->rr)
 
-	DEBUG("/getCurrencies()\n");
+static void getBuffers(struct unimsg_shm_desc *descs, unsigned ndescs)
+{
+	if (!ndescs)
+		return;
 
-	rpc = desc->addr;
-	return (GetSupportedCurrenciesResponse *)rpc->rr;
+	int rc = unimsg_buffer_get(descs, ndescs);
+	if (rc) {
+		fprintf(stderr, "Error getting shm buffer: %s\n",
+			strerror(-rc));
+		exit(1);
+	}
 }
 
-static ListProductsResponse *getProducts(struct unimsg_shm_desc *desc)
+static void prepGetCurrencies(struct unimsg_shm_desc *desc)
 {
 	unimsg_buffer_reset(desc);
-	struct rpc *rpc = desc->addr;
-	rpc->command = PRODUCTCATALOG_LIST_PRODUCTS;
-	desc->size = get_rpc_size(PRODUCTCATALOG_LIST_PRODUCTS);
-
-	do_rpc(desc, PRODUCTCATALOG_SERVICE);
+	rpc_currency_get_supported_currencies(desc);
+}
 
-	rpc = desc->addr;
-	return (ListProductsResponse *)rpc->rr;
+static void prepGetProducts(struct unimsg_shm_desc *desc)
+{
+	unimsg_buffer_reset(desc);
+	rpc_product_catalog_list_products(desc);
 }
 
-static Cart *getCart(struct unimsg_shm_desc *desc, char *user_id)
+static void prepGetCart(struct unimsg_shm_desc *desc, char *user_id)
 {
 	unimsg_buffer_reset(desc);
-	struct rpc *rpc = desc->addr;
-	rpc->command = CART_GET_CART;
-	desc->size = get_rpc_size(CART_GET_CART);
-	GetCartRR *get_cart_rr = (GetCartRR *)rpc->rr;
+	GetCartRR *get_cart_rr = rpc_cart_get_cart(desc);
 	strcpy(get_cart_rr->req.UserId, user_id);
-
-	do_rpc(desc, CART_SERVICE);
-
-	return &((GetCartRR *)((struct rpc *)desc->addr)->rr)->res;
 }
 
-static Money convertCurrency(struct unimsg_shm_desc *desc, Money price_usd,
-			     char *user_currency)
+static void prepConvertCurrency(struct unimsg_shm_desc *desc, Money price_usd,
+				char *user_currency)
 {
 	unimsg_buffer_reset(desc);
-	struct rpc *rpc = desc->addr;
-	rpc->command = CURRENCY_CONVERT;
-	desc->size = get_rpc_size(CURRENCY_CONVERT);
-	CurrencyConversionRR *conv_rr = (CurrencyConversionRR *)rpc->rr;
+	CurrencyConversionRR *conv_rr = rpc_currency_convert(desc);
 	conv_rr->req.From = price_usd;
 	strcpy(conv_rr->req.ToCode, user_currency);
 
 	DEBUG("Requesting currency conversion from '%s' to '%s'\n",
 	      price_usd.CurrencyCode, user_currency);
+}
 
-	do_rpc(desc, CURRENCY_SERVICE);
+/* Start a batched conversion to @user_currency, amounts are appended with
+ * ConversionBatchAdd() on the returned request
+ */
+static CurrencyConversionBatchRequest *
+prepConvertCurrencyBatch(struct unimsg_shm_desc *desc, char *user_currency)
+{
+	unimsg_buffer_reset(desc);
+	CurrencyConversionBatchRR *rr = rpc_currency_convert_batch(desc);
+	rr->req.num_amounts = 0;
+	strcpy(rr->req.ToCode, user_currency);
 
-	return ((CurrencyConversionRR *)((struct rpc *)desc->addr)->rr)->res;
+	return &rr->req;
 }
 
-static AdResponse *getAd(struct unimsg_shm_desc *desc, char *ctx_keys[],
-			 unsigned num_ctx_keys)
+static void prepGetAd(struct unimsg_shm_desc *desc, char *ctx_keys[],
+		      unsigned num_ctx_keys)
 {
 	unimsg_buffer_reset(desc);
-	struct rpc *rpc = desc->addr;
-	rpc->command = AD_GET_ADS;
-	desc->size = get_rpc_size(AD_GET_ADS);
-	AdRR *rr = (AdRR *)rpc->rr;
+	AdRR *rr = rpc_ad_get_ads(desc);
 	for (unsigned i = 0; i < num_ctx_keys; i++)
 		strcpy(rr->req.ContextKeys[i], ctx_keys[i]);
 	rr->req.num_context_keys = num_ctx_keys;
-
-	do_rpc(desc, AD_SERVICE);
-
-	rr = (AdRR *)((struct rpc *)desc->addr)->rr;
-	return &rr->res;
 }
 
-static Ad *chooseAd(struct unimsg_shm_desc *desc, char *ctx_keys[],
-		    unsigned num_ctx_keys)
+/* Pick an ad from the response of an AD_GET_ADS RPC */
+static Ad *chooseAd(struct unimsg_shm_desc *desc)
 {
-	AdResponse *ads = getAd(desc, ctx_keys, num_ctx_keys);
+	AdResponse *ads = &((AdRR *)RPC_BODY(desc))->res;
 
 	return &ads->Ads[rand() % ads->num_ads];
 }
 
-static void homeHandler(struct unimsg_shm_desc *desc)
+/* Header of the pages, from the supported currencies in @currencies_desc and
+ * the cart in @cart_desc, NULL if the cart is known to be empty
+ */
+static void pageHeader(struct page_header *header,
+		       struct unimsg_shm_desc *currencies_desc,
+		       struct unimsg_shm_desc *cart_desc)
 {
-	/* Discard result */
-	getCurrencies(desc);
-
-	/* Discard result */
-	getCart(desc, USER_ID);
+	strcpy(header->currency, currency);
+	header->currencies = RPC_BODY(currencies_desc);
+	header->cart_size = cart_desc
+			    ? ((GetCartRR *)RPC_BODY(cart_desc))->res.num_items
+			    : 0;
+}
 
-	ListProductsResponse *products = getProducts(desc);
+/* Answer @req with @page rendered from @model, as JSON if the client accepts
+ * it. The buffers the model points to must still be around.
+ */
+static void renderPage(struct unimsg_shm_desc *desc,
+		       const struct http_request *req, enum page page,
+		       const void *model)
+{
+	const struct render_template *t = page_template(page,
+							req->accept_json);
+	struct render_out out;
+
+	render_begin(&out, t);
+	render(&out, t, model);
+	if (render_end(&out)) {
+		fprintf(stderr, "Page %d does not fit in %u descs\n", page,
+			HTTP_MAX_RESPONSE_DESCS);
+		render_put(&out);
+		http_reply(desc, HTTP_INTERNAL_SERVER_ERROR);
+		return;
+	}
 
-	DEBUG("Retrieved %d products from catalog\n", products->num_products);
+	DEBUG("Rendered page %d: %u B of body in %u descs\n", page, out.body,
+	      out.ndescs);
 
-	struct unimsg_shm_desc desc1;
-	int rc = unimsg_buffer_get(&desc1, 1);
-	if (rc) {
-		fprintf(stderr, "Error getting shm buffer: %s\n",
-			strerror(-rc));
-		exit(1);
-	}
+	http_respond(desc, out.descs, out.ndescs);
+}
 
-	for (int i = 0; i < products->num_products; i++) {
-		/* Discard result */
-		convertCurrency(&desc1, products->Products[i].PriceUsd,
-				currency);
-	}
+static void homeHandler(struct unimsg_shm_desc *desc,
+			const struct http_request *req,
+			struct http_str param __unused)
+{
+	/* The page shows all the responses, each keeps its buffer */
+	struct unimsg_shm_desc descs[4];
+	getBuffers(descs, 4);
+
+	/* Currencies, cart and products are independent, fetch them in
+	 * parallel
+	 */
+	prepGetCurrencies(desc);
+	prepGetCart(&descs[0], USER_ID);
+	prepGetProducts(&descs[1]);
+	struct rpc_call calls[] = {
+		RPC_CALL(desc, CURRENCY_SERVICE),
+		RPC_CALL(&descs[0], CART_SERVICE),
+		RPC_CALL(&descs[1], PRODUCTCATALOG_SERVICE),
+	};
+	do_rpc_many(calls, sizeof(calls) / sizeof(calls[0]), RPC_WAIT_ALL);
+
+	ListProductsResponse *products = RPC_BODY(&descs[1]);
 
-	unimsg_buffer_put(&desc1, 1);
+	DEBUG("Retrieved %d products from catalog\n", products->num_products);
 
-	chooseAd(desc, NULL, 0);
+	/* Convert all prices with a single RPC and get the ad in parallel */
+	unsigned nproducts = products->num_products;
+	CurrencyConversionBatchRequest *conv_req =
+		prepConvertCurrencyBatch(&descs[2], currency);
+	for (unsigned i = 0; i < nproducts; i++)
+		ConversionBatchAdd(conv_req, &products->Products[i].PriceUsd);
+	prepGetAd(&descs[3], NULL, 0);
+	struct rpc_call conv_calls[] = {
+		RPC_CALL(&descs[2], CURRENCY_SERVICE),
+		RPC_CALL(&descs[3], AD_SERVICE),
+	};
+	do_rpc_many(conv_calls, sizeof(conv_calls) / sizeof(conv_calls[0]),
+		    RPC_WAIT_ALL);
+
+	CurrencyConversionBatchResponse *prices =
+		&((CurrencyConversionBatchRR *)RPC_BODY(&descs[2]))->res;
+	struct page_header header;
+	struct home_page page = {
+		.header = &header,
+		.nproducts = nproducts,
+		.ad = chooseAd(&descs[3]),
+	};
+	pageHeader(&header, desc, &descs[0]);
+	for (unsigned i = 0; i < nproducts; i++) {
+		page.products[i].product = &products->Products[i];
+		page.products[i].price = ConversionBatchGet(prices, i);
+	}
+	renderPage(desc, req, PAGE_HOME, &page);
 
-	strcpy(desc->addr, HTTP_OK);
-	desc->size = strlen(desc->addr);
+	unimsg_buffer_put(descs, 4);
 }
 
-static Product getProduct(struct unimsg_shm_desc *desc, char *product_id)
+static void prepGetProduct(struct unimsg_shm_desc *desc, char *product_id)
 {
 	unimsg_buffer_reset(desc);
-	struct rpc *rpc = desc->addr;
-	rpc->command = PRODUCTCATALOG_GET_PRODUCT;
-	desc->size = get_rpc_size(PRODUCTCATALOG_GET_PRODUCT);
-	GetProductRR *rr = (GetProductRR *)rpc->rr;
-	strcpy(rr->req.Id, product_id);
+	GetProductRR *rr = rpc_product_catalog_get_product(desc);
+	/* Pad with zeros, the request is the cache key */
+	strncpy(rr->req.Id, product_id, sizeof(rr->req.Id));
+}
+
+static Product *getProduct(struct unimsg_shm_desc *desc, char *product_id)
+{
+	prepGetProduct(desc, product_id);
 
 	do_rpc(desc, PRODUCTCATALOG_SERVICE);
 
-	return ((GetProductRR *)(((struct rpc *)desc->addr)->rr))->res;
+	return &((GetProductRR *)RPC_BODY(desc))->res;
 }
 
-static ListRecommendationsResponse *
-getRecommendations(struct unimsg_shm_desc *desc, char *user_id,
-		   char *product_ids[], unsigned num_product_ids)
+static void prepGetRecommendations(struct unimsg_shm_desc *desc, char *user_id,
+				   char *product_ids[],
+				   unsigned num_product_ids)
 {
-	DEBUG("getRecommendations()\n");
-
 	unimsg_buffer_reset(desc);
-	struct rpc *rpc = desc->addr;
-	rpc->command =  RECOMMENDATION_LIST_RECOMMENDATIONS;
-	desc->size = get_rpc_size(RECOMMENDATION_LIST_RECOMMENDATIONS);
-	ListRecommendationsRR *rr = (ListRecommendationsRR *)rpc->rr;
+	ListRecommendationsRR *rr =
+		rpc_recommendation_list_recommendations(desc);
 	strcpy(rr->req.user_id, user_id);
 	for (unsigned i = 0; i < num_product_ids; i++)
 		strcpy(rr->req.product_ids[i], product_ids[i]);
 	rr->req.num_product_ids = num_product_ids;
-
-	do_rpc(desc, RECOMMENDATION_SERVICE);
-
-	DEBUG("/getRecommendations()\n");
-
-	rpc = desc->addr;
-	return &((ListRecommendationsRR *)rpc->rr)->res;
 }
 
-static void productHandler(struct unimsg_shm_desc *desc, char *id)
+static void productHandler(struct unimsg_shm_desc *desc,
+			   const struct http_request *req,
+			   struct http_str param)
 {
-	Product p = getProduct(desc, id);
-
-	/* Discard result */
-	getCurrencies(desc);
-
-	/* Discard result */
-	getCart(desc, USER_ID);
-
-	/* Discard result */
-	convertCurrency(desc, p.PriceUsd, currency);
-
-	/* Discard result */
-	char *product_id = p.Id;
-	getRecommendations(desc, USER_ID, &product_id, 1);
-
-	/* Discard result */
-	chooseAd(desc, NULL, 0);
-
-	strcpy(desc->addr, HTTP_OK);
-	desc->size = strlen(desc->addr);
+	/* The id lives in the request, which the RPCs overwrite */
+	char id[PRODUCT_ID_SIZE];
+	if (param.len >= sizeof(id)) {
+		http_reply(desc, HTTP_NOT_FOUND);
+		return;
+	}
+	memcpy(id, http_ptr(req, param), param.len);
+	id[param.len] = 0;
+
+	struct unimsg_shm_desc descs[5];
+	getBuffers(descs, 5);
+
+	Product *p = getProduct(&descs[0], id);
+
+	/* Everything else only depends on the product, issue all RPCs in
+	 * parallel
+	 */
+	char *product_id = p->Id;
+	prepGetCurrencies(desc);
+	prepGetCart(&descs[1], USER_ID);
+	prepConvertCurrency(&descs[2], p->PriceUsd, currency);
+	prepGetRecommendations(&descs[3], USER_ID, &product_id, 1);
+	prepGetAd(&descs[4], NULL, 0);
+	struct rpc_call calls[] = {
+		RPC_CALL(desc, CURRENCY_SERVICE),
+		RPC_CALL(&descs[1], CART_SERVICE),
+		RPC_CALL(&descs[2], CURRENCY_SERVICE),
+		RPC_CALL(&descs[3], RECOMMENDATION_SERVICE),
+		RPC_CALL(&descs[4], AD_SERVICE),
+	};
+	do_rpc_many(calls, sizeof(calls) / sizeof(calls[0]), RPC_WAIT_ALL);
+
+	struct page_header header;
+	struct product_page page = {
+		.header = &header,
+		.product = p,
+		.price = ((CurrencyConversionRR *)RPC_BODY(&descs[2]))->res,
+		.recommendations =
+			&((ListRecommendationsRR *)RPC_BODY(&descs[3]))->res,
+		.ad = chooseAd(&descs[4]),
+	};
+	pageHeader(&header, desc, &descs[1]);
+	renderPage(desc, req, PAGE_PRODUCT, &page);
+
+	unimsg_buffer_put(descs, 5);
 }
 
-static Money getShippingQuote(struct unimsg_shm_desc *desc,
-			      CartItem *items, unsigned num_items,
-			      char *currency)
+static void prepGetShippingQuote(struct unimsg_shm_desc *desc,
+				 CartItem *items, unsigned num_items)
 {
 	unimsg_buffer_reset(desc);
-	struct rpc *rpc = desc->addr;
-	desc->size = get_rpc_size(SHIPPING_GET_QUOTE);
-	rpc->command = SHIPPING_GET_QUOTE;
-	GetQuoteRR *rr = (GetQuoteRR *)rpc->rr;
+	GetQuoteRR *rr = rpc_shipping_get_quote(desc);
 
 	memset(&rr->req.address, 0, sizeof(rr->req.address));
 	for (unsigned i = 0; i < num_items; i++)
 		rr->req.Items[i] = items[i];
 	rr->req.num_items = num_items;
-
-	do_rpc(desc, SHIPPING_SERVICE);
-
-	rpc = desc->addr;
-	rr = (GetQuoteRR *)rpc->rr;
-	Money localized = convertCurrency(desc, rr->res.CostUsd, currency);
-
-	return localized;
 }
 
-static void viewCartHandler(struct unimsg_shm_desc *desc)
+static void viewCartHandler(struct unimsg_shm_desc *desc,
+			    const struct http_request *req,
+			    struct http_str param __unused)
 {
-	/* Discard result */
-	getCurrencies(desc);
+	struct unimsg_shm_desc cart_desc;
+	getBuffers(&cart_desc, 1);
 
-	Cart cart = *getCart(desc, USER_ID);
+	prepGetCurrencies(desc);
+	prepGetCart(&cart_desc, USER_ID);
+	struct rpc_call calls[] = {
+		RPC_CALL(desc, CURRENCY_SERVICE),
+		RPC_CALL(&cart_desc, CART_SERVICE),
+	};
+	do_rpc_many(calls, sizeof(calls) / sizeof(calls[0]), RPC_WAIT_ALL);
 
-	char *product_ids[10];
-	for (int i = 0; i < cart.num_items; i++)
-		product_ids[i] = cart.Items[i].ProductId;
-
-	/* Discard result */
-	getRecommendations(desc, USER_ID, product_ids, cart.num_items);
-
-	Money shipping_cost = getShippingQuote(desc, cart.Items, cart.num_items,
-					       currency);
+	Cart *cart = &((GetCartRR *)RPC_BODY(&cart_desc))->res;
+	unsigned num_items = cart->num_items;
 
-	Money total_price = {0};
-	for (int i = 0; i < cart.num_items; i++) {
-		Product p = getProduct(desc, cart.Items[i].ProductId);
-		Money price = convertCurrency(desc, p.PriceUsd, currency);
-		MoneyMultiplySlow(&price, cart.Items[i].Quantity);
-		MoneySum(&total_price, &price);
+	char *product_ids[10];
+	for (unsigned i = 0; i < num_items; i++)
+		product_ids[i] = cart->Items[i].ProductId;
+
+	/* Recommendations, shipping quote and all products in parallel, then
+	 * the conversion of the prices
+	 */
+	struct unimsg_shm_desc descs[num_items + 3];
+	struct rpc_call item_calls[num_items + 2];
+	struct unimsg_shm_desc *recs_desc = &descs[0];
+	struct unimsg_shm_desc *quote_desc = &descs[1];
+	struct unimsg_shm_desc *product_descs = &descs[2];
+	struct unimsg_shm_desc *conv_desc = &descs[num_items + 2];
+	getBuffers(descs, num_items + 3);
+
+	prepGetRecommendations(recs_desc, USER_ID, product_ids, num_items);
+	item_calls[0] = (struct rpc_call)RPC_CALL(recs_desc,
+						  RECOMMENDATION_SERVICE);
+	prepGetShippingQuote(quote_desc, cart->Items, num_items);
+	item_calls[1] = (struct rpc_call)RPC_CALL(quote_desc,
+						  SHIPPING_SERVICE);
+	for (unsigned i = 0; i < num_items; i++) {
+		prepGetProduct(&product_descs[i], cart->Items[i].ProductId);
+		item_calls[i + 2] = (struct rpc_call)RPC_CALL(
+			&product_descs[i], PRODUCTCATALOG_SERVICE);
+	}
+	do_rpc_many(item_calls, num_items + 2, RPC_WAIT_ALL);
+
+	/* Convert shipping cost and all prices with a single RPC, shipping
+	 * cost goes first
+	 */
+	CurrencyConversionBatchRequest *conv_req =
+		prepConvertCurrencyBatch(conv_desc, currency);
+	ConversionBatchAdd(conv_req,
+			   &((GetQuoteRR *)RPC_BODY(quote_desc))->res.CostUsd);
+	for (unsigned i = 0; i < num_items; i++)
+		ConversionBatchAdd(conv_req,
+				   &((GetProductRR *)RPC_BODY(&product_descs[i]))
+				   ->res.PriceUsd);
+	do_rpc(conv_desc, CURRENCY_SERVICE);
+
+	CurrencyConversionBatchResponse *conv_res =
+		&((CurrencyConversionBatchRR *)RPC_BODY(conv_desc))->res;
+	struct page_header header;
+	struct cart_page page = {
+		.header = &header,
+		.nitems = num_items,
+		.shipping = ConversionBatchGet(conv_res, 0),
+		.recommendations =
+			&((ListRecommendationsRR *)RPC_BODY(recs_desc))->res,
+	};
+	for (unsigned i = 0; i < num_items; i++) {
+		struct cart_item *item = &page.items[i];
+
+		item->product =
+			&((GetProductRR *)RPC_BODY(&product_descs[i]))->res;
+		item->quantity = cart->Items[i].Quantity;
+		item->price = ConversionBatchGet(conv_res, i + 1);
+		MoneyMultiplySlow(&item->price, item->quantity);
+		MoneySum(&page.total, &item->price);
 	}
-	MoneySum(&total_price, &shipping_cost);
+	MoneySum(&page.total, &page.shipping);
+	memcpy(page.total.CurrencyCode, conv_res->CurrencyCode,
+	       MONEY_CURRENCY_CODE_SIZE);
+	pageHeader(&header, desc, &cart_desc);
+	renderPage(desc, req, PAGE_CART, &page);
+
+	unimsg_buffer_put(descs, num_items + 3);
+	unimsg_buffer_put(&cart_desc, 1);
+}
 
-	strcpy(desc->addr, HTTP_OK);
-	desc->size = strlen(desc->addr);
+/* Decode the form in the body of @req into @fields, all of them required.
+ * Returns non-zero if a field is missing or malformed.
+ */
+static int decodeForm(const struct http_request *req,
+		      const struct http_form_field *fields, unsigned nfields)
+{
+	int found = http_form_decode(http_ptr(req, req->body), req->body.len,
+				     fields, nfields);
+
+	return found < 0 || (uint32_t)found != (1U << nfields) - 1;
 }
 
 static void insertCart(struct unimsg_shm_desc *desc, char *user_id,
 		       char *product_id, int quantity)
 {
 	unimsg_buffer_reset(desc);
-	struct rpc *rpc = desc->addr;
-	desc->size = get_rpc_size(CART_ADD_ITEM);
-	rpc->command = CART_ADD_ITEM;
-	AddItemRequest *req = (AddItemRequest *)rpc->rr;
+	AddItemRequest *req = rpc_cart_add_item(desc);
 
 	strcpy(req->Item.ProductId, product_id);
 	req->Item.Quantity = quantity;
@@ -300,15 +435,19 @@ static void insertCart(struct unimsg_shm_desc *desc, char *user_id,
 	do_rpc(desc, CART_SERVICE);
 }
 
-static void addToCartHandler(struct unimsg_shm_desc *desc, char *body)
+static void addToCartHandler(struct unimsg_shm_desc *desc,
+			     const struct http_request *req,
+			     struct http_str param __unused)
 {
-	char product_id[11];
-	int quantity;
-
-	if (sscanf(body, "product_id=%10s&quantity=%d", product_id, &quantity)
-	    != 2) {
-		strcpy(desc->addr, HTTP_BAD_REQUEST);
-		desc->size = strlen(desc->addr);
+	char product_id[PRODUCT_ID_SIZE];
+	int32_t quantity;
+	const struct http_form_field fields[] = {
+		{ "product_id", HTTP_FORM_STR, product_id, sizeof(product_id) },
+		{ "quantity", HTTP_FORM_INT, &quantity, 0 },
+	};
+
+	if (decodeForm(req, fields, sizeof(fields) / sizeof(fields[0]))) {
+		http_reply(desc, HTTP_BAD_REQUEST);
 		return;
 	}
 
@@ -319,103 +458,84 @@ static void addToCartHandler(struct unimsg_shm_desc *desc, char *body)
 
 	insertCart(desc, USER_ID, product_id, quantity);
 
-	strcpy(desc->addr, HTTP_OK);
-	desc->size = strlen(desc->addr);
+	http_reply(desc, HTTP_OK);
 }
 
 static void emptyCart(struct unimsg_shm_desc *desc, char *user_id)
 {
 	unimsg_buffer_reset(desc);
-	struct rpc *rpc = desc->addr;
-	desc->size = get_rpc_size(CART_EMPTY_CART);
-	rpc->command = CART_EMPTY_CART;
-	EmptyCartRequest *req = (EmptyCartRequest *)rpc->rr;
+	EmptyCartRequest *req = rpc_cart_empty_cart(desc);
 
 	strcpy(req->UserId, user_id);
 
 	do_rpc(desc, CART_SERVICE);
 }
 
-static void emptyCartHandler(struct unimsg_shm_desc *desc)
+static void emptyCartHandler(struct unimsg_shm_desc *desc,
+			     const struct http_request *req __unused,
+			     struct http_str param __unused)
 {
 	emptyCart(desc, USER_ID);
 
-	strcpy(desc->addr, HTTP_OK);
-	desc->size = strlen(desc->addr);
+	http_reply(desc, HTTP_OK);
 }
 
-static void setCurrencyHandler(struct unimsg_shm_desc *desc, char *body)
+static void setCurrencyHandler(struct unimsg_shm_desc *desc,
+			       const struct http_request *req,
+			       struct http_str param __unused)
 {
-	char curr[4];
-	if (sscanf(body, "currency_code=%3s", curr) != 1) {
-		strcpy(desc->addr, HTTP_BAD_REQUEST);
-		desc->size = strlen(desc->addr);
+	char curr[MONEY_CURRENCY_CODE_SIZE];
+	const struct http_form_field fields[] = {
+		{ "currency_code", HTTP_FORM_STR, curr, sizeof(curr) },
+	};
+
+	if (decodeForm(req, fields, sizeof(fields) / sizeof(fields[0]))) {
+		http_reply(desc, HTTP_BAD_REQUEST);
 		return;
 	}
 
 	strcpy(currency, curr);
 	DEBUG("Currency set to %s\n", currency);
 
-	strcpy(desc->addr, HTTP_OK);
-	desc->size = strlen(desc->addr);
+	http_reply(desc, HTTP_OK);
 }
 
-static void logoutHandler(struct unimsg_shm_desc *desc)
+static void logoutHandler(struct unimsg_shm_desc *desc,
+			  const struct http_request *req __unused,
+			  struct http_str param __unused)
 {
-	strcpy(desc->addr, HTTP_OK);
-	desc->size = strlen(desc->addr);
+	http_reply(desc, HTTP_OK);
 }
 
-static void placeOrderHandler(struct unimsg_shm_desc *desc, char *body __unused)
+static void placeOrderHandler(struct unimsg_shm_desc *desc,
+			      const struct http_request *req,
+			      struct http_str param __unused)
 {
-	int rc;
-
-	/* TODO: convert special characters */
-
-	char *param;
-	char *param_end = body - 1;
-
-#define READ_PARAM(name, specifier, dst)				\
-	if (!param_end)	{						\
-		strcpy(desc->addr, HTTP_BAD_REQUEST);			\
-		desc->size = strlen(desc->addr);			\
-		return;							\
-	}								\
-	param = param_end + 1;						\
-	param_end = strchr(param, '&');					\
-	if (param_end)							\
-		*param_end = 0;						\
-	if (sscanf(param, name "=" specifier, dst) != 1) {		\
-		strcpy(desc->addr, HTTP_BAD_REQUEST);			\
-		desc->size = strlen(desc->addr);			\
-		return;							\
+	PlaceOrderRequest order = {0};
+	Address *addr = &order.address;
+	CreditCardInfo *card = &order.CreditCard;
+	const struct http_form_field fields[] = {
+		{ "email", HTTP_FORM_STR, order.Email, sizeof(order.Email) },
+		{ "street_address", HTTP_FORM_STR, addr->StreetAddress,
+		  sizeof(addr->StreetAddress) },
+		{ "zip_code", HTTP_FORM_INT, &addr->ZipCode, 0 },
+		{ "city", HTTP_FORM_STR, addr->City, sizeof(addr->City) },
+		{ "state", HTTP_FORM_STR, addr->State, sizeof(addr->State) },
+		{ "country", HTTP_FORM_STR, addr->Country, sizeof(addr->Country) },
+		{ "credit_card_number", HTTP_FORM_STR, card->CreditCardNumber,
+		  sizeof(card->CreditCardNumber) },
+		{ "credit_card_expiration_month", HTTP_FORM_INT,
+		  &card->CreditCardExpirationMonth, 0 },
+		{ "credit_card_expiration_year", HTTP_FORM_INT,
+		  &card->CreditCardExpirationYear, 0 },
+		{ "credit_card_cvv", HTTP_FORM_INT, &card->CreditCardCvv, 0 },
+	};
+
+	if (decodeForm(req, fields, sizeof(fields) / sizeof(fields[0]))) {
+		http_reply(desc, HTTP_BAD_REQUEST);
+		return;
 	}
 
-	char email[50];
-	READ_PARAM("email", "%s", email);
-	char street_address[50];
-	READ_PARAM("street_address", "%s", street_address);
-	int zip_code;
-	READ_PARAM("zip_code", "%d", &zip_code);
-	char city[15];
-	READ_PARAM("city", "%s", city);
-	char state[15];
-	READ_PARAM("state", "%s", state);
-	char country[15];
-	READ_PARAM("country", "%s", country);
-	char credit_card_number[30];
-	READ_PARAM("credit_card_number", "%s", credit_card_number);
-	int credit_card_expiration_month;
-	READ_PARAM("credit_card_expiration_month", "%d",
-		   &credit_card_expiration_month);
-	int credit_card_expiration_year;
-	READ_PARAM("credit_card_expiration_year", "%d",
-		   &credit_card_expiration_year);
-	int credit_card_cvv;
-	READ_PARAM("credit_card_cvv", "%d", &credit_card_cvv);
-
-#undef READ_PARAM
-
 	DEBUG("Placing order:\n"
 	      "  email=%s\n"
 	      "  street_address=%s\n"
@@ -427,49 +547,34 @@ static void placeOrderHandler(struct unimsg_shm_desc *desc, char *body __unused)
 	      "  credit_card_expiration_month=%d\n"
 	      "  credit_card_expiration_year=%d\n"
 	      "  credit_card_cvv=%d\n",
-	      email, street_address, zip_code, city, state, country,
-	      credit_card_number, credit_card_expiration_month,
-	      credit_card_expiration_year, credit_card_cvv);
+	      order.Email, addr->StreetAddress, addr->ZipCode, addr->City,
+	      addr->State, addr->Country, card->CreditCardNumber,
+	      card->CreditCardExpirationMonth, card->CreditCardExpirationYear,
+	      card->CreditCardCvv);
 
+	/* The form was decoded out of the request, the buffer is free */
 	unimsg_buffer_reset(desc);
-	struct rpc *rpc = desc->addr;
-	rpc->command =  CHECKOUT_PLACE_ORDER;
-	desc->size = get_rpc_size(CHECKOUT_PLACE_ORDER);
-	PlaceOrderRR *rr = (PlaceOrderRR *)rpc->rr;
+	PlaceOrderRR *rr = rpc_checkout_place_order(desc);
 
+	rr->req = order;
 	strcpy(rr->req.UserId, USER_ID);
 	strcpy(rr->req.UserCurrency, currency);
 
-	strcpy(rr->req.Email, email);
-	strcpy(rr->req.address.StreetAddress, street_address);
-	rr->req.address.ZipCode = zip_code;
-	strcpy(rr->req.address.City, city);
-	strcpy(rr->req.address.State, state);
-	strcpy(rr->req.address.Country, country);
-	strcpy(rr->req.CreditCard.CreditCardNumber, credit_card_number);
-	rr->req.CreditCard.CreditCardExpirationMonth
-		= credit_card_expiration_month;
-	rr->req.CreditCard.CreditCardExpirationYear
-		= credit_card_expiration_year;
-	rr->req.CreditCard.CreditCardCvv = credit_card_cvv;
-
-	do_rpc(desc, CHECKOUT_SERVICE);
-
-	rpc = desc->addr;
-	rr = (PlaceOrderRR *)rpc->rr;
-
-	struct unimsg_shm_desc desc1;
-	rc = unimsg_buffer_get(&desc1, 1);
-	if (rc) {
-		fprintf(stderr, "Error getting shm buffer: %s\n",
-			strerror(-rc));
-		exit(1);
-	}
-
-	/* Discard result */
-	getRecommendations(&desc1, USER_ID, NULL, 0);
-
-	unimsg_buffer_put(&desc1, 1);
+	/* Recommendations and currencies don't depend on the order, overlap
+	 * them with the checkout
+	 */
+	struct unimsg_shm_desc descs[2];
+	getBuffers(descs, 2);
+	prepGetRecommendations(&descs[0], USER_ID, NULL, 0);
+	prepGetCurrencies(&descs[1]);
+	struct rpc_call calls[] = {
+		RPC_CALL(desc, CHECKOUT_SERVICE),
+		RPC_CALL(&descs[0], RECOMMENDATION_SERVICE),
+		RPC_CALL(&descs[1], CURRENCY_SERVICE),
+	};
+	do_rpc_many(calls, sizeof(calls) / sizeof(calls[0]), RPC_WAIT_ALL);
+
+	rr = RPC_BODY(desc);
 
 	Money total_paid = rr->res.order.ShippingCost;
 	for (unsigned i = 0; i < rr->res.order.num_items; i++) {
@@ -479,120 +584,70 @@ static void placeOrderHandler(struct unimsg_shm_desc *desc, char *body __unused)
 		MoneySum(&total_paid, &mult_price);
 	}
 
-	/* Discard result */
-	getCurrencies(desc);
-
-	strcpy(desc->addr, HTTP_OK);
-	desc->size = strlen(desc->addr);
+	/* The cart was emptied by the checkout */
+	struct page_header header;
+	struct order_page page = {
+		.header = &header,
+		.order = &rr->res.order,
+		.total = total_paid,
+		.recommendations =
+			&((ListRecommendationsRR *)RPC_BODY(&descs[0]))->res,
+	};
+	pageHeader(&header, &descs[1], NULL);
+	renderPage(desc, req, PAGE_ORDER, &page);
+
+	unimsg_buffer_put(descs, 2);
 }
 
-static int parse_http_request(struct unimsg_shm_desc *desc, char **method,
-			      char **url, char **body)
-{
-	char *msg = desc->addr;
-
-	/* TODO: handle desc->size == BUFFER_SIZE */
-	msg[desc->size] = 0;
-
-	char *line_end = strstr(msg, "\r\n");
-	if (!line_end)
-		return 1;
-
-	*line_end = 0;
-
-	char *method_end = strchr(msg, ' ');
-	if (!method_end)
-		return 1;
-	*method_end = 0;
-
-	*method = msg;
-	char *next = method_end + 1;
-
-	char *url_end = strchr(next, ' ');
-	if (!url_end)
-		return 1;
-	*url_end = 0;
-
-	*url = next;
-
-	*body = strstr(line_end + 1, "\r\n\r\n");
-	if (!*body)
-		return 1;
-	*body += 4;
+static const struct http_route routes[] = {
+	{ HTTP_GET, "/", homeHandler },
+	{ HTTP_GET, "/product/*", productHandler },
+	{ HTTP_GET, "/cart", viewCartHandler },
+	{ HTTP_POST, "/cart", addToCartHandler },
+	{ HTTP_POST, "/cart/empty", emptyCartHandler },
+	{ HTTP_POST, "/setCurrency", setCurrencyHandler },
+	{ HTTP_GET, "/logout", logoutHandler },
+	{ HTTP_POST, "/cart/checkout", placeOrderHandler },
+};
 
-	return 0;
-}
+/* Built once at startup, read-only afterwards */
+static struct http_router router;
 
-static void handle_request(struct unimsg_shm_desc *desc)
+static void handle_request(struct unimsg_shm_desc *desc,
+			   const struct http_request *req)
 {
-	char *method, *url, *body;
+	struct http_str param;
+	const struct http_route *route = http_router_match(&router, req,
+							   &param);
 
-	if (parse_http_request(desc, &method, &url, &body)) {
-		DEBUG("Error parsing request\n");
-		strcpy(desc->addr, HTTP_BAD_REQUEST);
-		desc->size = strlen(desc->addr);
-		return;
-	}
+	DEBUG("Handling %.*s\n", (int)req->path.len, http_ptr(req, req->path));
 
-	int handled = 0;
-
-	DEBUG("Handling %s %s\n", method, url);
-	DEBUG("BODY\n%s\n", body);
-
-	/* Request routing */
-	if (!strcmp(url, "/")) {
-		if (!strcmp(method, "GET")) {
-			homeHandler(desc);
-			handled = 1;
-		}
-	} else if (!strncmp(url, "/product/", sizeof("/product/") - 1)) {
-		if (!strcmp(method, "GET")) {
-			char id[20];
-			strncpy(id, url + sizeof("/product/") - 1,
-				sizeof(id) - 1);
-			productHandler(desc, id);
-			handled = 1;
-		}
-	} else if (!strcmp(url, "/cart")) {
-		if (!strcmp(method, "GET")) {
-			viewCartHandler(desc);
-			handled = 1;
-		} else if (!strcmp(method, "POST")) {
-			addToCartHandler(desc, body);
-			handled = 1;
-		}
-	} else if (!strcmp(url, "/cart/empty")) {
-		if (!strcmp(method, "POST")) {
-			emptyCartHandler(desc);
-			handled = 1;
-		}
-	} else if (!strcmp(url, "/setCurrency")) {
-		if (!strcmp(method, "POST")) {
-			setCurrencyHandler(desc, body);
-			handled = 1;
-		}
-	} else if (!strcmp(url, "/logout")) {
-		if (!strcmp(method, "GET")) {
-			logoutHandler(desc);
-			handled = 1;
-		}
-	} else if (!strcmp(url, "/cart/checkout")) {
-		if (!strcmp(method, "POST")) {
-			placeOrderHandler(desc, body);
-			handled = 1;
-		}
+	if (!route) {
+		http_reply(desc, HTTP_NOT_FOUND);
+		return;
 	}
 
-	if (!handled) {
-		strcpy(desc->addr, HTTP_NOT_FOUND);
-		desc->size = strlen(desc->addr);
-	}
+	route->handler(desc, req, param);
 }
 
 int main(int argc, char **argv)
 {
-	(void)argc;
-	(void)argv;
+	parse_service_args(argc, argv);
+
+	rpc_cache_enable(CURRENCY_GET_SUPPORTED_CURRENCIES, 0,
+			 STATIC_DATA_CACHE_TTL);
+	rpc_cache_enable(PRODUCTCATALOG_LIST_PRODUCTS, 0, STATIC_DATA_CACHE_TTL);
+	rpc_cache_enable(PRODUCTCATALOG_GET_PRODUCT, sizeof(GetProductRequest),
+			 STATIC_DATA_CACHE_TTL);
+
+	rpc_hedge_enable(CURRENCY_GET_SUPPORTED_CURRENCIES, HEDGE_QUANTILE);
+	rpc_hedge_enable(CURRENCY_CONVERT, HEDGE_QUANTILE);
+	rpc_hedge_enable(CURRENCY_CONVERT_BATCH, HEDGE_QUANTILE);
+	rpc_hedge_enable(PRODUCTCATALOG_LIST_PRODUCTS, HEDGE_QUANTILE);
+	rpc_hedge_enable(PRODUCTCATALOG_GET_PRODUCT, HEDGE_QUANTILE);
+
+	http_router_init(&router, routes, sizeof(routes) / sizeof(routes[0]));
+	pages_init();
 
 	run_service(FRONTEND, handle_request, dependencies,
 		    sizeof(dependencies) / sizeof(dependencies[0]));
@@ -0,0 +1,469 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (c) 2022 University of California, Riverside
+ */
+
+/* Pages of the frontend, rendered as HTML or as JSON (see render.h). The
+ * models point into the responses of the RPCs of the handlers, which must
+ * keep their buffers until the page is rendered. Prices are in the currency
+ * of the user, converted by the handlers.
+ */
+
+#ifndef __PAGES__
+#define __PAGES__
+
+#include "../common/service/service.h"
+#include "../common/service/render.h"
+
+enum page {
+	PAGE_HOME,
+	PAGE_PRODUCT,
+	PAGE_CART,
+	PAGE_ORDER,
+	NUM_PAGES,
+};
+
+#define PAGE_MAX_PRODUCTS						\
+	(sizeof(RENDER_MEMBER(ListProductsResponse, Products))		\
+	 / sizeof(Product))
+#define PAGE_MAX_CART_ITEMS						\
+	(sizeof(RENDER_MEMBER(Cart, Items)) / sizeof(CartItem))
+
+/* Currency selector and cart of the header of every page */
+struct page_header {
+	char currency[MONEY_CURRENCY_CODE_SIZE];
+	const GetSupportedCurrenciesResponse *currencies;
+	int32_t cart_size;
+};
+
+/* A product and its price */
+struct page_product {
+	const Product *product;
+	Money price;
+};
+
+struct home_page {
+	const struct page_header *header;
+	int32_t nproducts;
+	struct page_product products[PAGE_MAX_PRODUCTS];
+	const Ad *ad;
+};
+
+struct product_page {
+	const struct page_header *header;
+	const Product *product;
+	Money price;
+	const ListRecommendationsResponse *recommendations;
+	const Ad *ad;
+};
+
+/* A product in the cart, with the price of all its units */
+struct cart_item {
+	const Product *product;
+	int32_t quantity;
+	Money price;
+};
+
+struct cart_page {
+	const struct page_header *header;
+	int32_t nitems;
+	struct cart_item items[PAGE_MAX_CART_ITEMS];
+	Money shipping;
+	Money total;
+	const ListRecommendationsResponse *recommendations;
+};
+
+struct order_page {
+	const struct page_header *header;
+	const OrderResult *order;
+	Money total;
+	const ListRecommendationsResponse *recommendations;
+};
+
+static const struct render_field currencies_fields[] = {
+	RENDER_LIST_FIELD("codes", GetSupportedCurrenciesResponse,
+			  CurrencyCodes, num_currencies,
+			  ((const struct render_field[]){
+				RENDER_ELEMENT_STR(10),
+				RENDER_END_FIELDS,
+			  })),
+	RENDER_END_FIELDS,
+};
+
+static const struct render_field header_fields[] = {
+	RENDER_STR_FIELD("currency", struct page_header, currency),
+	RENDER_REF_FIELD("currencies", struct page_header, currencies,
+			 currencies_fields),
+	RENDER_INT_FIELD("cart_size", struct page_header, cart_size),
+	RENDER_END_FIELDS,
+};
+
+static const struct render_field product_fields[] = {
+	RENDER_STR_FIELD("id", Product, Id),
+	RENDER_STR_FIELD("name", Product, Name),
+	RENDER_STR_FIELD("description", Product, Description),
+	RENDER_STR_FIELD("picture", Product, Picture),
+	RENDER_END_FIELDS,
+};
+
+static const struct render_field page_product_fields[] = {
+	RENDER_REF_FIELD("product", struct page_product, product,
+			 product_fields),
+	RENDER_MONEY_FIELD("price", struct page_product, price),
+	RENDER_END_FIELDS,
+};
+
+static const struct render_field recommendations_fields[] = {
+	RENDER_LIST_FIELD("ids", ListRecommendationsResponse, product_ids,
+			  num_product_ids,
+			  ((const struct render_field[]){
+				RENDER_ELEMENT_STR(PRODUCT_ID_SIZE),
+				RENDER_END_FIELDS,
+			  })),
+	RENDER_END_FIELDS,
+};
+
+static const struct render_field ad_fields[] = {
+	RENDER_STR_FIELD("redirect_url", Ad, RedirectUrl),
+	RENDER_STR_FIELD("text", Ad, Text),
+	RENDER_END_FIELDS,
+};
+
+static const struct render_field home_fields[] = {
+	RENDER_REF_FIELD("header", struct home_page, header, header_fields),
+	RENDER_LIST_FIELD("products", struct home_page, products, nproducts,
+			  page_product_fields),
+	RENDER_REF_FIELD("ad", struct home_page, ad, ad_fields),
+	RENDER_END_FIELDS,
+};
+
+static const struct render_field product_page_fields[] = {
+	RENDER_REF_FIELD("header", struct product_page, header,
+			 header_fields),
+	RENDER_REF_FIELD("product", struct product_page, product,
+			 product_fields),
+	RENDER_MONEY_FIELD("price", struct product_page, price),
+	RENDER_REF_FIELD("recommendations", struct product_page,
+			 recommendations, recommendations_fields),
+	RENDER_REF_FIELD("ad", struct product_page, ad, ad_fields),
+	RENDER_END_FIELDS,
+};
+
+static const struct render_field cart_item_fields[] = {
+	RENDER_REF_FIELD("product", struct cart_item, product, product_fields),
+	RENDER_INT_FIELD("quantity", struct cart_item, quantity),
+	RENDER_MONEY_FIELD("price", struct cart_item, price),
+	RENDER_END_FIELDS,
+};
+
+static const struct render_field cart_fields[] = {
+	RENDER_REF_FIELD("header", struct cart_page, header, header_fields),
+	RENDER_LIST_FIELD("items", struct cart_page, items, nitems,
+			  cart_item_fields),
+	RENDER_MONEY_FIELD("shipping", struct cart_page, shipping),
+	RENDER_MONEY_FIELD("total", struct cart_page, total),
+	RENDER_REF_FIELD("recommendations", struct cart_page, recommendations,
+			 recommendations_fields),
+	RENDER_END_FIELDS,
+};
+
+static const struct render_field order_item_fields[] = {
+	RENDER_STR_FIELD("product_id", OrderItem, Item.ProductId),
+	RENDER_INT_FIELD("quantity", OrderItem, Item.Quantity),
+	RENDER_MONEY_FIELD("cost", OrderItem, Cost),
+	RENDER_END_FIELDS,
+};
+
+static const struct render_field order_result_fields[] = {
+	RENDER_STR_FIELD("id", OrderResult, OrderId),
+	RENDER_STR_FIELD("tracking_id", OrderResult, ShippingTrackingId),
+	RENDER_MONEY_FIELD("shipping", OrderResult, ShippingCost),
+	RENDER_LIST_FIELD("items", OrderResult, Items, num_items,
+			  order_item_fields),
+	RENDER_END_FIELDS,
+};
+
+static const struct render_field order_fields[] = {
+	RENDER_REF_FIELD("header", struct order_page, header, header_fields),
+	RENDER_REF_FIELD("order", struct order_page, order,
+			 order_result_fields),
+	RENDER_MONEY_FIELD("total", struct order_page, total),
+	RENDER_REF_FIELD("recommendations", struct order_page,
+			 recommendations, recommendations_fields),
+	RENDER_END_FIELDS,
+};
+
+/* ---------------- HTML ---------------- */
+
+#define HTML_HEAD							\
+	"<!DOCTYPE html>\n"						\
+	"<html lang=\"en\">\n"						\
+	"<head>\n"							\
+	"<meta charset=\"UTF-8\">\n"					\
+	"<meta name=\"viewport\" content=\"width=device-width, "	\
+	"initial-scale=1\">\n"						\
+	"<title>Online Boutique</title>\n"				\
+	"<link rel=\"stylesheet\" href=\"/static/styles/styles.css\">\n" \
+	"</head>\n"							\
+	"<body>\n"							\
+	"{{#header}}"							\
+	"<header>\n"							\
+	"<a href=\"/\" class=\"logo\">Online Boutique</a>\n"		\
+	"<form method=\"POST\" action=\"/setCurrency\">\n"		\
+	"<label>Currency: {{currency}}</label>\n"			\
+	"<select name=\"currency_code\" onchange=\"this.form.submit()\">\n" \
+	"{{#currencies}}{{#codes}}"					\
+	"<option value=\"{{.}}\">{{.}}</option>\n"			\
+	"{{/codes}}{{/currencies}}"					\
+	"</select>\n"							\
+	"</form>\n"							\
+	"<a href=\"/cart\" class=\"cart\">Cart ({{cart_size}})</a>\n"	\
+	"</header>\n"							\
+	"{{/header}}"
+
+#define HTML_RECOMMENDATIONS						\
+	"{{#recommendations}}"						\
+	"<section class=\"recommendations\">\n"				\
+	"<h2>You May Also Like</h2>\n"					\
+	"<ul>\n"							\
+	"{{#ids}}<li><a href=\"/product/{{.}}\">{{.}}</a></li>\n{{/ids}}" \
+	"</ul>\n"							\
+	"</section>\n"							\
+	"{{/recommendations}}"
+
+#define HTML_AD								\
+	"{{#ad}}"							\
+	"<div class=\"ad\">\n"						\
+	"<strong>Advertisement:</strong> "				\
+	"<a href=\"{{redirect_url}}\">{{text}}</a>\n"			\
+	"</div>\n"							\
+	"{{/ad}}"
+
+#define HTML_FOOT							\
+	"<footer>\n"							\
+	"<p>This website is hosted for demo purposes only.</p>\n"	\
+	"</footer>\n"							\
+	"</body>\n"							\
+	"</html>\n"
+
+static const char home_html[] =
+	HTML_HEAD
+	"<main>\n"
+	"<h1>Hot Products</h1>\n"
+	"<div class=\"products\">\n"
+	"{{#products}}"
+	"<div class=\"product\">\n"
+	"{{#product}}"
+	"<a href=\"/product/{{id}}\">"
+	"<img src=\"{{picture}}\" alt=\"{{name}}\"></a>\n"
+	"<div class=\"name\">{{name}}</div>\n"
+	"{{/product}}"
+	"<div class=\"price\">{{price}}</div>\n"
+	"</div>\n"
+	"{{/products}}"
+	"</div>\n"
+	"</main>\n"
+	HTML_AD
+	HTML_FOOT;
+
+static const char product_html[] =
+	HTML_HEAD
+	"<main>\n"
+	"{{#product}}"
+	"<div class=\"product\">\n"
+	"<img src=\"{{picture}}\" alt=\"{{name}}\">\n"
+	"<h1>{{name}}</h1>\n"
+	"{{/product}}"
+	"<p class=\"price\">{{price}}</p>\n"
+	"{{#product}}"
+	"<p>{{description}}</p>\n"
+	"<form method=\"POST\" action=\"/cart\">\n"
+	"<input type=\"hidden\" name=\"product_id\" value=\"{{id}}\">\n"
+	"<select name=\"quantity\">\n"
+	"<option>1</option>\n<option>2</option>\n<option>3</option>\n"
+	"<option>4</option>\n<option>5</option>\n<option>10</option>\n"
+	"</select>\n"
+	"<button type=\"submit\">Add to Cart</button>\n"
+	"</form>\n"
+	"</div>\n"
+	"{{/product}}"
+	"</main>\n"
+	HTML_RECOMMENDATIONS
+	HTML_AD
+	HTML_FOOT;
+
+static const char cart_html[] =
+	HTML_HEAD
+	"<main>\n"
+	"<h1>Shopping Cart</h1>\n"
+	"<form method=\"POST\" action=\"/cart/empty\">\n"
+	"<button type=\"submit\">Empty Cart</button>\n"
+	"</form>\n"
+	"<ul class=\"items\">\n"
+	"{{#items}}"
+	"<li>\n"
+	"{{#product}}"
+	"<a href=\"/product/{{id}}\">"
+	"<img src=\"{{picture}}\" alt=\"{{name}}\"></a>\n"
+	"<div class=\"name\">{{name}}</div>\n"
+	"<div class=\"id\">SKU #{{id}}</div>\n"
+	"{{/product}}"
+	"<div class=\"quantity\">Quantity: {{quantity}}</div>\n"
+	"<div class=\"price\">{{price}}</div>\n"
+	"</li>\n"
+	"{{/items}}"
+	"</ul>\n"
+	"<p>Shipping: {{shipping}}</p>\n"
+	"<p class=\"total\">Total: {{total}}</p>\n"
+	"<form method=\"POST\" action=\"/cart/checkout\">\n"
+	"<input type=\"email\" name=\"email\">\n"
+	"<input type=\"text\" name=\"street_address\">\n"
+	"<input type=\"number\" name=\"zip_code\">\n"
+	"<input type=\"text\" name=\"city\">\n"
+	"<input type=\"text\" name=\"state\">\n"
+	"<input type=\"text\" name=\"country\">\n"
+	"<input type=\"text\" name=\"credit_card_number\">\n"
+	"<input type=\"number\" name=\"credit_card_expiration_month\">\n"
+	"<input type=\"number\" name=\"credit_card_expiration_year\">\n"
+	"<input type=\"password\" name=\"credit_card_cvv\">\n"
+	"<button type=\"submit\">Place Order</button>\n"
+	"</form>\n"
+	"</main>\n"
+	HTML_RECOMMENDATIONS
+	HTML_FOOT;
+
+static const char order_html[] =
+	HTML_HEAD
+	"<main>\n"
+	"{{#order}}"
+	"<h1>Your order is complete!</h1>\n"
+	"<p>Confirmation #{{id}}</p>\n"
+	"<p>Tracking #{{tracking_id}}</p>\n"
+	"<ul class=\"items\">\n"
+	"{{#items}}"
+	"<li><a href=\"/product/{{product_id}}\">{{product_id}}</a> "
+	"x {{quantity}}: {{cost}}</li>\n"
+	"{{/items}}"
+	"</ul>\n"
+	"<p>Shipping: {{shipping}}</p>\n"
+	"{{/order}}"
+	"<p class=\"total\">Total paid: {{total}}</p>\n"
+	"<a href=\"/\">Continue Shopping</a>\n"
+	"</main>\n"
+	HTML_RECOMMENDATIONS
+	HTML_FOOT;
+
+/* ---------------- JSON ---------------- */
+
+#define JSON_HEADER							\
+	"\"header\":{{#header}}{"					\
+	"\"currency\":\"{{currency}}\","				\
+	"\"currencies\":["						\
+	"{{#currencies}}{{#codes|,}}\"{{.}}\"{{/codes}}{{/currencies}}"	\
+	"],"								\
+	"\"cart_size\":{{cart_size}}"					\
+	"}{{/header}}"
+
+#define JSON_PRODUCT							\
+	"\"id\":\"{{id}}\","						\
+	"\"name\":\"{{name}}\","					\
+	"\"picture\":\"{{picture}}\""
+
+#define JSON_RECOMMENDATIONS						\
+	"\"recommendations\":["						\
+	"{{#recommendations}}{{#ids|,}}\"{{.}}\"{{/ids}}"		\
+	"{{/recommendations}}"						\
+	"]"
+
+#define JSON_ADS							\
+	"\"ads\":["							\
+	"{{#ad}}{"							\
+	"\"redirect_url\":\"{{redirect_url}}\","			\
+	"\"text\":\"{{text}}\""						\
+	"}{{/ad}}"							\
+	"]"
+
+static const char home_json[] =
+	"{" JSON_HEADER ","
+	"\"products\":["
+	"{{#products|,}}{"
+	"{{#product}}" JSON_PRODUCT "{{/product}},"
+	"\"price\":\"{{price}}\""
+	"}{{/products}}"
+	"],"
+	JSON_ADS
+	"}\n";
+
+static const char product_json[] =
+	"{" JSON_HEADER ","
+	"\"product\":{"
+	"{{#product}}" JSON_PRODUCT ","
+	"\"description\":\"{{description}}\"{{/product}},"
+	"\"price\":\"{{price}}\""
+	"},"
+	JSON_RECOMMENDATIONS ","
+	JSON_ADS
+	"}\n";
+
+static const char cart_json[] =
+	"{" JSON_HEADER ","
+	"\"items\":["
+	"{{#items|,}}{"
+	"{{#product}}" JSON_PRODUCT "{{/product}},"
+	"\"quantity\":{{quantity}},"
+	"\"price\":\"{{price}}\""
+	"}{{/items}}"
+	"],"
+	"\"shipping\":\"{{shipping}}\","
+	"\"total\":\"{{total}}\","
+	JSON_RECOMMENDATIONS
+	"}\n";
+
+static const char order_json[] =
+	"{" JSON_HEADER ","
+	"\"order\":{{#order}}{"
+	"\"id\":\"{{id}}\","
+	"\"tracking_id\":\"{{tracking_id}}\","
+	"\"items\":["
+	"{{#items|,}}{"
+	"\"product_id\":\"{{product_id}}\","
+	"\"quantity\":{{quantity}},"
+	"\"cost\":\"{{cost}}\""
+	"}{{/items}}"
+	"],"
+	"\"shipping\":\"{{shipping}}\""
+	"}{{/order}},"
+	"\"total\":\"{{total}}\","
+	JSON_RECOMMENDATIONS
+	"}\n";
+
+static const struct {
+	const char *html;
+	const char *json;
+	const struct render_field *fields;
+} page_sources[NUM_PAGES] = {
+	[PAGE_HOME] = { home_html, home_json, home_fields },
+	[PAGE_PRODUCT] = { product_html, product_json, product_page_fields },
+	[PAGE_CART] = { cart_html, cart_json, cart_fields },
+	[PAGE_ORDER] = { order_html, order_json, order_fields },
+};
+
+/* Compiled once by pages_init(), read-only afterwards */
+static struct render_template page_templates[NUM_PAGES][2];
+
+static void pages_init(void)
+{
+	for (unsigned i = 0; i < NUM_PAGES; i++) {
+		render_compile(&page_templates[i][RENDER_HTML], RENDER_HTML,
+			       page_sources[i].html, page_sources[i].fields);
+		render_compile(&page_templates[i][RENDER_JSON], RENDER_JSON,
+			       page_sources[i].json, page_sources[i].fields);
+	}
+}
+
+static const struct render_template *page_template(enum page page, int json)
+{
+	return &page_templates[page][json ? RENDER_JSON : RENDER_HTML];
+}
+
+#endif /* __PAGES__ */
@@ -115,20 +115,16 @@ static void Charge(ChargeRR *rr) {
 	return;
 }
 
-static void handle_request(struct unimsg_shm_desc *desc)
-{
-	struct rpc *rpc = desc->addr;
-	ChargeRR *rr = (ChargeRR *)rpc->rr;
-
-	Charge(rr);
-}
+static const struct payment_handlers handlers = {
+	.Charge = Charge,
+};
 
 int main(int argc, char **argv)
 {
-	(void)argc;
-	(void)argv;
+	parse_service_args(argc, argv);
 
-	run_service(PAYMENT_SERVICE, handle_request);
+	register_payment_service(&handlers);
+	run_service(PAYMENT_SERVICE);
 
 	return 0;
 }
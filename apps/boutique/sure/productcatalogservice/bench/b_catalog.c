@@ -0,0 +1,89 @@
+/*
+ * Product lookup and search through the generated catalog indexes, against
+ * the linear scans they replaced
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "catalog.h"
+
+#define LOOKUPS  1000000
+#define SEARCHES 1000
+#define MAX_RESULTS 9
+
+static const char *queries[] = { "lamp", "warm colors", "sunglasses",
+				  "durable travel", "nothing" };
+#define NQUERIES (sizeof(queries) / sizeof(queries[0]))
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static const Product *scan_find(const char *id)
+{
+	for (uint32_t i = 0; i < catalog_nproducts; i++) {
+		if (!strcmp(catalog_products[i].Id, id))
+			return &catalog_products[i];
+	}
+	return NULL;
+}
+
+/* The old search, with the query taken as one substring */
+static unsigned scan_search(const char *query, const Product **results)
+{
+	unsigned n = 0;
+
+	for (uint32_t i = 0; i < catalog_nproducts && n < MAX_RESULTS; i++) {
+		if (strstr(catalog_products[i].Name, query)
+		    || strstr(catalog_products[i].Description, query))
+			results[n++] = &catalog_products[i];
+	}
+	return n;
+}
+
+int main(void)
+{
+	const Product *results[MAX_RESULTS];
+	unsigned long found = 0;
+	double start, find_ns, scan_ns, search_ns, scan_search_ns;
+	uint32_t lookups = LOOKUPS;
+
+	/* Linear scans get slow, keep their total run time in check */
+	if (catalog_nproducts > 1000)
+		lookups = LOOKUPS / 100;
+
+	start = now_ns();
+	for (uint32_t i = 0; i < lookups; i++)
+		found += catalog_find(catalog_products[(i * 40503u)
+				      % catalog_nproducts].Id) != NULL;
+	find_ns = (now_ns() - start) / lookups;
+
+	start = now_ns();
+	for (uint32_t i = 0; i < lookups; i++)
+		found -= scan_find(catalog_products[(i * 40503u)
+				   % catalog_nproducts].Id) != NULL;
+	scan_ns = (now_ns() - start) / lookups;
+
+	start = now_ns();
+	for (unsigned i = 0; i < SEARCHES; i++)
+		found += catalog_search(queries[i % NQUERIES], results,
+					MAX_RESULTS);
+	search_ns = (now_ns() - start) / SEARCHES;
+
+	start = now_ns();
+	for (unsigned i = 0; i < SEARCHES; i++)
+		found += scan_search(queries[i % NQUERIES], results);
+	scan_search_ns = (now_ns() - start) / SEARCHES;
+
+	printf("%7u products: find %6.1f ns (scan %10.1f ns) | "
+	       "search %8.1f ns (scan %10.1f ns) [%lu]\n",
+	       catalog_nproducts, find_ns, scan_ns, search_ns, scan_search_ns,
+	       found);
+
+	return 0;
+}
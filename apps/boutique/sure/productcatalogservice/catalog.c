@@ -0,0 +1,138 @@
+/*
+ * Some sort of Copyright
+ */
+
+#include <string.h>
+#include "catalog.h"
+
+/* Must match key_hash() and mix() in gen_catalog.py */
+static uint64_t key_hash(const char *key)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (*key) {
+		h ^= (unsigned char)*key++;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+static uint64_t mix(uint64_t h, uint32_t seed)
+{
+	h ^= seed * 0x9e3779b97f4a7c15ULL;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+/* Index of the only key that can be equal to @key, or CATALOG_EMPTY_SLOT */
+static uint32_t phash_lookup(const struct catalog_phash *ph, const char *key)
+{
+	uint64_t h = key_hash(key);
+	uint32_t seed = ph->seeds[(h >> 32) % ph->nbuckets];
+
+	return ph->slots[mix(h, seed) % ph->nslots];
+}
+
+const Product *catalog_find(const char *id)
+{
+	uint32_t i = phash_lookup(&catalog_id_index, id);
+
+	if (i == CATALOG_EMPTY_SLOT || strcmp(catalog_products[i].Id, id))
+		return NULL;
+
+	return &catalog_products[i];
+}
+
+/* Lowercase alphanumeric words, as tokenize() in gen_catalog.py */
+static const char *next_token(const char *s, char *token)
+{
+	unsigned len = 0;
+
+	while (*s && !((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z')
+		       || (*s >= '0' && *s <= '9')))
+		s++;
+	if (!*s)
+		return NULL;
+
+	for (; (*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z')
+	       || (*s >= '0' && *s <= '9'); s++) {
+		if (len < CATALOG_MAX_TOKEN_SIZE - 1)
+			token[len++] = (*s >= 'A' && *s <= 'Z') ? *s - 'A' + 'a'
+								: *s;
+	}
+	token[len] = 0;
+
+	return s;
+}
+
+static int contains(const uint32_t *postings, uint32_t n, uint32_t product)
+{
+	uint32_t lo = 0, hi = n;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (postings[mid] < product)
+			lo = mid + 1;
+		else if (postings[mid] > product)
+			hi = mid;
+		else
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Products whose name or description contains all the words of @query, in
+ * catalog order. An empty query matches every product.
+ */
+unsigned catalog_search(const char *query, const Product **results,
+			unsigned max_results)
+{
+	const struct catalog_token_index *idx = &catalog_token_index;
+	const uint32_t *lists[CATALOG_MAX_QUERY_TOKENS];
+	uint32_t lens[CATALOG_MAX_QUERY_TOKENS];
+	char token[CATALOG_MAX_TOKEN_SIZE];
+	unsigned ntokens = 0, shortest = 0, n = 0;
+
+	while ((query = next_token(query, token))
+	       && ntokens < CATALOG_MAX_QUERY_TOKENS) {
+		uint32_t t = phash_lookup(&idx->hash, token);
+		if (t == CATALOG_EMPTY_SLOT || strcmp(idx->tokens[t], token))
+			return 0;
+		lists[ntokens] = &idx->postings[idx->postings_start[t]];
+		lens[ntokens] = idx->postings_start[t + 1]
+				- idx->postings_start[t];
+		if (lens[ntokens] < lens[shortest])
+			shortest = ntokens;
+		ntokens++;
+	}
+
+	if (!ntokens) {
+		for (; n < max_results && n < catalog_nproducts; n++)
+			results[n] = &catalog_products[n];
+		return n;
+	}
+
+	/* Walk the shortest list and check the others */
+	for (uint32_t i = 0; i < lens[shortest] && n < max_results; i++) {
+		uint32_t product = lists[shortest][i];
+		unsigned j;
+
+		for (j = 0; j < ntokens; j++) {
+			if (j != shortest && !contains(lists[j], lens[j],
+						       product))
+				break;
+		}
+		if (j == ntokens)
+			results[n++] = &catalog_products[product];
+	}
+
+	return n;
+}
@@ -0,0 +1,50 @@
+/*
+ * Some sort of Copyright
+ */
+
+#ifndef __CATALOG__
+#define __CATALOG__
+
+#include <stdint.h>
+#include "../common/service/message.h"
+
+/* Query words longer than this are truncated, like the indexed ones */
+#define CATALOG_MAX_TOKEN_SIZE	 32
+#define CATALOG_MAX_QUERY_TOKENS 8
+#define CATALOG_EMPTY_SLOT	 0xffffffff
+
+/*
+ * Perfect hash generated by gen_catalog.py: a key with hash h goes to bucket
+ * (h >> 32) % nbuckets, then to slot mix(h, seeds[bucket]) % nslots, which
+ * holds the index of the only key that can match or CATALOG_EMPTY_SLOT
+ */
+struct catalog_phash {
+	const uint32_t *seeds;
+	const uint32_t *slots;
+	uint32_t nbuckets;
+	uint32_t nslots;
+};
+
+/*
+ * Inverted index from the words of product names and descriptions. The
+ * products containing tokens[i] are postings[postings_start[i]] up to
+ * postings[postings_start[i + 1]], in ascending order.
+ */
+struct catalog_token_index {
+	const char * const *tokens;
+	const uint32_t *postings_start;
+	const uint32_t *postings;
+	struct catalog_phash hash;
+};
+
+/* Generated tables */
+extern const uint32_t catalog_nproducts;
+extern const Product catalog_products[];
+extern const struct catalog_phash catalog_id_index;
+extern const struct catalog_token_index catalog_token_index;
+
+const Product *catalog_find(const char *id);
+unsigned catalog_search(const char *query, const Product **results,
+			unsigned max_results);
+
+#endif /* __CATALOG__ */
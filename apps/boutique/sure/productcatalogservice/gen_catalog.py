@@ -0,0 +1,246 @@
+#!/usr/bin/python3
+
+# Generates the constant product catalog of the product catalog service: the
+# product table, a perfect hash on product ID and an inverted index from the
+# words of product names and descriptions to the products containing them.
+# The catalog is read from a products.json file and can be extended with
+# synthetic products to benchmark the indexes at scale.
+#
+# The hash functions and the token rules must match catalog.c.
+
+import argparse
+import json
+import os
+import random
+import re
+import sys
+
+curdir = os.path.dirname(os.path.abspath(__file__))
+
+MESSAGE_H = curdir + '/../common/service/message_types.h'
+MAX_TOKEN_SIZE = 32 # Must match CATALOG_MAX_TOKEN_SIZE
+EMPTY_SLOT = 0xffffffff
+SLOTS_PER_KEY = 1.125
+KEYS_PER_BUCKET = 4
+
+def read_sizes():
+	sizes = {}
+	with open(MESSAGE_H) as f:
+		for m in re.finditer(r'#define\s+(PRODUCT_\w+|MONEY_\w+)\s+(\d+)',
+				     f.read()):
+			sizes[m.group(1)] = int(m.group(2))
+	return sizes
+
+M64 = 0xffffffffffffffff
+
+def key_hash(key):
+	h = 0xcbf29ce484222325
+	for c in key:
+		h = ((h ^ c) * 0x100000001b3) & M64
+	return h
+
+def mix(h, seed):
+	h ^= (seed * 0x9e3779b97f4a7c15) & M64
+	h ^= h >> 33
+	h = (h * 0xff51afd7ed558ccd) & M64
+	h ^= h >> 33
+	h = (h * 0xc4ceb9fe1a85ec53) & M64
+	h ^= h >> 33
+	return h
+
+# Hash and displace: keys are split in buckets by the high bits of their
+# hash, then every bucket, largest first, gets the first seed that mixes the
+# hashes of all of its keys into free slots
+def build_phash(keys):
+	hashes = [key_hash(k.encode()) for k in keys]
+	nbuckets = max(1, (len(keys) + KEYS_PER_BUCKET - 1) // KEYS_PER_BUCKET)
+	nslots = max(1, int(len(keys) * SLOTS_PER_KEY))
+
+	buckets = [[] for _ in range(nbuckets)]
+	for i, h in enumerate(hashes):
+		buckets[(h >> 32) % nbuckets].append(i)
+
+	seeds = [0] * nbuckets
+	slots = [EMPTY_SLOT] * nslots
+	for b in sorted(range(nbuckets), key=lambda b: -len(buckets[b])):
+		if not buckets[b]:
+			break
+		seed = 1
+		while True:
+			pos = [mix(hashes[i], seed) % nslots for i in buckets[b]]
+			if len(set(pos)) == len(pos) and \
+			   all(slots[p] == EMPTY_SLOT for p in pos):
+				break
+			seed += 1
+		for i, p in zip(buckets[b], pos):
+			slots[p] = i
+		seeds[b] = seed
+
+	return seeds, slots
+
+def tokenize(text):
+	return [t[:MAX_TOKEN_SIZE - 1] for t in
+		re.findall(r'[a-z0-9]+', text.lower())]
+
+ADJECTIVES = ['Classic', 'Modern', 'Vintage', 'Compact', 'Deluxe', 'Rustic',
+	      'Sleek', 'Cozy', 'Bold', 'Smart', 'Organic', 'Handmade', 'Urban',
+	      'Retro', 'Light', 'Sturdy', 'Soft', 'Bright', 'Mini', 'Grand']
+NOUNS = ['Lamp', 'Mug', 'Chair', 'Jacket', 'Watch', 'Kettle', 'Vase',
+	 'Backpack', 'Scarf', 'Sneakers', 'Blanket', 'Speaker', 'Notebook',
+	 'Bottle', 'Pillow', 'Wallet', 'Hat', 'Candle', 'Plate', 'Clock']
+WORDS = ['perfect', 'for', 'everyday', 'use', 'with', 'a', 'touch', 'of',
+	 'style', 'made', 'from', 'durable', 'materials', 'easy', 'to', 'clean',
+	 'great', 'gift', 'your', 'home', 'office', 'travel', 'and', 'outdoor',
+	 'adventures', 'designed', 'comfort', 'lasting', 'quality', 'finish',
+	 'in', 'warm', 'colors', 'lightweight', 'classic', 'look', 'that',
+	 'fits', 'any', 'room', 'season', 'crafted', 'care', 'new', 'favorite']
+CATEGORIES = ['accessories', 'clothing', 'tops', 'footwear', 'hair',
+	      'beauty', 'decor', 'home', 'kitchen', 'garden', 'sports', 'toys']
+ID_CHARS = 'ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789'
+
+def synthetic_products(n, taken, sizes):
+	rnd = random.Random(n)
+	products = []
+	while len(products) < n:
+		pid = ''.join(rnd.choice(ID_CHARS)
+			      for _ in range(sizes['PRODUCT_ID_SIZE'] - 1))
+		if pid in taken:
+			continue
+		taken.add(pid)
+		noun = rnd.choice(NOUNS)
+		desc = rnd.choice(WORDS).capitalize()
+		while True:
+			word = rnd.choice(WORDS)
+			if len(desc) + len(word) + 2 >= \
+			   sizes['PRODUCT_DESCRIPTION_SIZE'] or \
+			   (len(desc) > 40 and rnd.random() < 0.2):
+				break
+			desc += ' ' + word
+		products.append({
+			'id': pid,
+			'name': rnd.choice(ADJECTIVES) + ' ' + noun,
+			'description': desc + '.',
+			'picture': '/static/img/products/' + noun.lower() + '.jpg',
+			'priceUsd': {
+				'currencyCode': 'USD',
+				'units': rnd.randrange(1, 500),
+				'nanos': rnd.randrange(0, 100) * 10000000
+			},
+			'categories': rnd.sample(CATEGORIES,
+						 rnd.randrange(1, sizes['PRODUCT_MAX_CATEGORIES'] + 1))
+		})
+	return products
+
+def c_str(s):
+	return '"' + s.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+def check_size(product, field, value, size):
+	if len(value.encode()) >= size:
+		sys.exit(f'Product {product["id"]}: {field} "{value}" does not '
+			 f'fit in {size} bytes')
+
+def c_array(out, ctype, name, values, per_line=8):
+	out.write(f'static const {ctype} {name}[] = {{\n')
+	for i in range(0, len(values), per_line):
+		out.write('\t' + ', '.join(str(v) for v in
+					   values[i:i + per_line]) + ',\n')
+	out.write('};\n\n')
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument('products', help='products.json file')
+	parser.add_argument('-o', '--output', required=True)
+	parser.add_argument('--extra', type=int, default=0,
+			    help='number of synthetic products to append')
+	args = parser.parse_args()
+
+	sizes = read_sizes()
+	with open(args.products) as f:
+		products = json.load(f)['products']
+	products += synthetic_products(args.extra,
+				       set(p['id'] for p in products), sizes)
+
+	for p in products:
+		check_size(p, 'id', p['id'], sizes['PRODUCT_ID_SIZE'])
+		check_size(p, 'name', p['name'], sizes['PRODUCT_NAME_SIZE'])
+		check_size(p, 'description', p['description'],
+			   sizes['PRODUCT_DESCRIPTION_SIZE'])
+		check_size(p, 'picture', p['picture'],
+			   sizes['PRODUCT_PICTURE_SIZE'])
+		if len(p['categories']) > sizes['PRODUCT_MAX_CATEGORIES']:
+			sys.exit(f'Product {p["id"]}: too many categories')
+		for c in p['categories']:
+			check_size(p, 'category', c,
+				   sizes['PRODUCT_CATEGORY_SIZE'])
+
+	postings = {}
+	for i, p in enumerate(products):
+		for t in tokenize(p['name'] + ' ' + p['description']):
+			lst = postings.setdefault(t, [])
+			if not lst or lst[-1] != i:
+				lst.append(i)
+	tokens = sorted(postings)
+
+	id_seeds, id_slots = build_phash([p['id'] for p in products])
+	token_seeds, token_slots = build_phash(tokens)
+
+	out = open(args.output, 'w')
+	out.write(f'/* Generated by gen_catalog.py from '
+		  f'{os.path.basename(args.products)} with {args.extra} '
+		  f'synthetic products, do not edit */\n\n')
+	out.write('#include "catalog.h"\n\n')
+
+	out.write(f'const uint32_t catalog_nproducts = {len(products)};\n\n')
+	out.write('const Product catalog_products[] = {\n')
+	for p in products:
+		price = p['priceUsd']
+		cats = ', '.join(c_str(c) for c in p['categories'])
+		out.write(f'\t{{\n'
+			  f'\t\t.Id = {c_str(p["id"])},\n'
+			  f'\t\t.Name = {c_str(p["name"])},\n'
+			  f'\t\t.Description = {c_str(p["description"])},\n'
+			  f'\t\t.Picture = {c_str(p["picture"])},\n'
+			  f'\t\t.PriceUsd = {{\n'
+			  f'\t\t\t.CurrencyCode = {c_str(price["currencyCode"])},\n'
+			  f'\t\t\t.Units = {price["units"]},\n'
+			  f'\t\t\t.Nanos = {price["nanos"]}\n'
+			  f'\t\t}},\n'
+			  f'\t\t.num_categories = {len(p["categories"])},\n'
+			  f'\t\t.Categories = {{{cats}}}\n'
+			  f'\t}},\n')
+	out.write('};\n\n')
+
+	c_array(out, 'uint32_t', 'id_seeds', id_seeds)
+	c_array(out, 'uint32_t', 'id_slots', id_slots)
+	out.write('const struct catalog_phash catalog_id_index = {\n'
+		  '\t.seeds = id_seeds,\n'
+		  '\t.slots = id_slots,\n'
+		  f'\t.nbuckets = {len(id_seeds)},\n'
+		  f'\t.nslots = {len(id_slots)},\n'
+		  '};\n\n')
+
+	c_array(out, 'char * const', 'tokens',
+		[c_str(t) for t in tokens], 4)
+	start = [0]
+	for t in tokens:
+		start.append(start[-1] + len(postings[t]))
+	c_array(out, 'uint32_t', 'postings_start', start)
+	c_array(out, 'uint32_t', 'postings',
+		[i for t in tokens for i in postings[t]])
+	c_array(out, 'uint32_t', 'token_seeds', token_seeds)
+	c_array(out, 'uint32_t', 'token_slots', token_slots)
+	out.write('const struct catalog_token_index catalog_token_index = {\n'
+		  '\t.tokens = tokens,\n'
+		  '\t.postings_start = postings_start,\n'
+		  '\t.postings = postings,\n'
+		  '\t.hash = {\n'
+		  '\t\t.seeds = token_seeds,\n'
+		  '\t\t.slots = token_slots,\n'
+		  f'\t\t.nbuckets = {len(token_seeds)},\n'
+		  f'\t\t.nslots = {len(token_slots)},\n'
+		  '\t},\n'
+		  '};\n')
+	out.close()
+
+if __name__ == '__main__':
+	main()
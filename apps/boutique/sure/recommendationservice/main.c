@@ -15,6 +15,9 @@
 static int dependencies[] = {
 	PRODUCTCATALOG_SERVICE,
 };
+
+/* The product list is static, cache it on the client side */
+#define PRODUCTS_CACHE_TTL ukarch_time_sec_to_nsec(60)
 Product products[9] = {
 	{
 		.Id = "OLJCESPC7Z",
@@ -150,13 +153,11 @@ static void ListRecommendations(ListRecommendationsRR *rr)
 		exit(1);
 	}
 
-	struct rpc *rpc = desc.addr;
-	rpc->command = PRODUCTCATALOG_LIST_PRODUCTS;
-	desc.size = get_rpc_size(PRODUCTCATALOG_LIST_PRODUCTS);
+	rpc_product_catalog_list_products(&desc);
 
 	do_rpc(&desc, PRODUCTCATALOG_SERVICE);
 
-	rpc = desc.addr;
+	struct rpc *rpc = desc.addr;
 	ListProductsResponse *list_products_response =
 		(ListProductsResponse *)rpc->rr;
 	ListRecommendationsRequest *list_recommendations_request = &rr->req;
@@ -179,20 +180,18 @@ static void ListRecommendations(ListRecommendationsRR *rr)
 	return;
 }
 
-static void handle_request(struct unimsg_shm_desc *desc)
-{
-	struct rpc *rpc = desc->addr;
-	ListRecommendationsRR *rr = (ListRecommendationsRR *)rpc->rr;
-
-	ListRecommendations(rr);
-}
+static const struct recommendation_handlers handlers = {
+	.ListRecommendations = ListRecommendations,
+};
 
 int main(int argc, char **argv)
 {
-	(void)argc;
-	(void)argv;
+	parse_service_args(argc, argv);
+
+	rpc_cache_enable(PRODUCTCATALOG_LIST_PRODUCTS, 0, PRODUCTS_CACHE_TTL);
 
-	run_service(RECOMMENDATION_SERVICE, handle_request, dependencies,
+	register_recommendation_service(&handlers);
+	run_service(RECOMMENDATION_SERVICE, NULL, dependencies,
 		    sizeof(dependencies) / sizeof(dependencies[0]));
 
 	return 0;
@@ -7,6 +7,7 @@ fi
 
 id=$1
 shift
+ncores=${NCORES:-1}
 
 eval qemu-system-x86_64 \
 	-nographic \
@@ -15,6 +16,7 @@ eval qemu-system-x86_64 \
 	-kernel "$(dirname $0)/build/recommendationservice_qemu-x86_64" \
 	-enable-kvm \
 	-cpu host,migratable=no \
+	-smp $ncores \
 	-m 256M \
 	-device ivshmem-doorbell,vectors=1,chardev=id \
 	-chardev socket,path=/tmp/ivshmem_socket,id=id \
@@ -0,0 +1,224 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* Pipelined load generator for the sync services. Every connection keeps a
+ * window of GetSupportedCurrencies requests in flight to the currency service
+ * and sends as many new requests as the responses received in each bulk, so
+ * that the service always sees bulks of multiple requests.
+ */
+
+#include <uk/plat/time.h>
+#include "../common/service/service.h"
+
+#define DEFAULT_DURATION 10
+#define DEFAULT_CONNECTIONS 1
+#define DEFAULT_DEPTH 8
+
+static unsigned opt_duration = DEFAULT_DURATION;
+static unsigned opt_connections = DEFAULT_CONNECTIONS;
+static unsigned opt_depth = DEFAULT_DEPTH;
+
+static struct option long_options[] = {
+	{"duration", required_argument, 0, 'd'},
+	{"connections", required_argument, 0, 'c'},
+	{"depth", required_argument, 0, 'p'},
+	{0, 0, 0, 0}
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"  Usage: %s [OPTIONS]\n"
+		"  Options:\n"
+		"  -d, --duration	Duration of the test in seconds (default %u)\n"
+		"  -c, --connections	Number of connections (default %u)\n"
+		"  -p, --depth		Requests in flight per connection (default %u, max %u)\n",
+		prog, DEFAULT_DURATION, DEFAULT_CONNECTIONS, DEFAULT_DEPTH,
+		UNIMSG_MAX_DESCS_BULK);
+
+	exit(1);
+}
+
+static void parse_command_line(int argc, char **argv)
+{
+	int option_index, c;
+
+	for (;;) {
+		c = getopt_long(argc, argv, "d:c:p:", long_options,
+				&option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'd':
+			opt_duration = atoi(optarg);
+			break;
+		case 'c':
+			opt_connections = atoi(optarg);
+			break;
+		case 'p':
+			opt_depth = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (opt_duration == 0) {
+		fprintf(stderr, "Duration must be > 0\n");
+		usage(argv[0]);
+	}
+
+	if (opt_connections == 0 || opt_connections >= UNIMSG_MAX_NSOCKS) {
+		fprintf(stderr, "Connections must be between 1 and %u\n",
+			UNIMSG_MAX_NSOCKS - 1);
+		usage(argv[0]);
+	}
+
+	if (opt_depth == 0 || opt_depth > UNIMSG_MAX_DESCS_BULK) {
+		fprintf(stderr, "Depth must be between 1 and %u\n",
+			UNIMSG_MAX_DESCS_BULK);
+		usage(argv[0]);
+	}
+}
+
+static void send_requests(struct unimsg_sock *s, unsigned n)
+{
+	struct unimsg_shm_desc descs[UNIMSG_MAX_DESCS_BULK];
+	enum command command = CURRENCY_GET_SUPPORTED_CURRENCIES;
+
+	int rc = unimsg_buffer_get(descs, n);
+	if (rc) {
+		fprintf(stderr, "Error getting shm buffers: %s\n",
+			strerror(-rc));
+		exit(1);
+	}
+
+	for (unsigned i = 0; i < n; i++) {
+		struct rpc *rpc = descs[i].addr;
+		rpc->id = i;
+		rpc->command = command;
+		rpc->trace = (struct rpc_trace){ 0 };
+		rpc->deadline = 0;
+		descs[i].size = get_rpc_size(command);
+	}
+
+	rc = unimsg_send(s, descs, n, 0);
+	if (rc) {
+		fprintf(stderr, "Error sending descs: %s\n", strerror(-rc));
+		exit(1);
+	}
+}
+
+/* Returns the number of responses completed by the received bulk */
+static unsigned recv_responses(struct unimsg_sock *s,
+			       struct rpc_msg *pending)
+{
+	struct unimsg_shm_desc descs[UNIMSG_MAX_DESCS_BULK];
+	unsigned ndescs = UNIMSG_MAX_DESCS_BULK;
+	unsigned nresps = 0;
+
+	int rc = unimsg_recv(s, descs, &ndescs, 1);
+	if (rc == -EAGAIN) {
+		return 0;
+	} else if (rc) {
+		fprintf(stderr, "Error receiving descs: %s\n", strerror(-rc));
+		exit(1);
+	}
+
+	unsigned current = 0;
+	while (current < ndescs) {
+		if (process_desc(pending, &descs[current])) {
+			rpc_msg_put(pending);
+			nresps++;
+		}
+
+		if (descs[current].size == 0)
+			current++;
+	}
+
+	return nresps;
+}
+
+int main(int argc, char **argv)
+{
+	int rc;
+	struct unimsg_sock *socks[UNIMSG_MAX_NSOCKS];
+	struct rpc_msg pending[UNIMSG_MAX_NSOCKS];
+	unsigned inflight[UNIMSG_MAX_NSOCKS];
+	int ready[UNIMSG_MAX_NSOCKS];
+	struct service_desc *service = &services[CURRENCY_SERVICE];
+
+	parse_command_line(argc, argv);
+
+	memset(pending, 0, sizeof(pending));
+
+	for (unsigned i = 0; i < opt_connections; i++) {
+		rc = unimsg_socket(&socks[i]);
+		if (rc) {
+			fprintf(stderr, "Error creating unimsg socket: %s\n",
+				strerror(-rc));
+			exit(1);
+		}
+
+		rc = unimsg_connect(socks[i], service->addr, service->port);
+		if (rc) {
+			fprintf(stderr, "Error connecting to %s service: %s\n",
+				service->name, strerror(-rc));
+			exit(1);
+		}
+	}
+
+	printf("Running %u connections with %u requests in flight for %u "
+	       "seconds\n", opt_connections, opt_depth, opt_duration);
+
+	unsigned long rrs = 0;
+	__nsec start = ukplat_monotonic_clock();
+	__nsec stop = start + ukarch_time_sec_to_nsec(opt_duration);
+
+	for (unsigned i = 0; i < opt_connections; i++) {
+		send_requests(socks[i], opt_depth);
+		inflight[i] = opt_depth;
+	}
+
+	while (ukplat_monotonic_clock() < stop) {
+		rc = unimsg_poll(socks, opt_connections, ready);
+		if (rc) {
+			fprintf(stderr, "Error polling: %s\n", strerror(-rc));
+			exit(1);
+		}
+
+		for (unsigned i = 0; i < opt_connections; i++) {
+			if (!ready[i])
+				continue;
+
+			/* Refill the window */
+			unsigned n = recv_responses(socks[i], &pending[i]);
+			if (n) {
+				send_requests(socks[i], n);
+				rrs += n;
+			}
+		}
+	}
+
+	unsigned long elapsed = ukplat_monotonic_clock() - start;
+
+	/* Drain the requests still in flight */
+	for (unsigned i = 0; i < opt_connections; i++) {
+		while (inflight[i]) {
+			rc = unimsg_poll(&socks[i], 1, ready);
+			if (rc) {
+				fprintf(stderr, "Error polling: %s\n",
+					strerror(-rc));
+				exit(1);
+			}
+			inflight[i] -= recv_responses(socks[i], &pending[i]);
+		}
+		unimsg_close(socks[i]);
+	}
+
+	printf("rrs=%lu\nrps=%lu\n", rrs, rrs * 1000000000 / elapsed);
+
+	return 0;
+}
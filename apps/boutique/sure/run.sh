@@ -4,12 +4,50 @@ svc_names=("adservice" "emailservice" "paymentservice" "currencyservice"
 	   "shippingservice" "productcatalogservice" "cartservice"
 	   "recommendationservice" "checkoutservice" "frontend")
 num_svcs=10
+# Services built on the async framework can run on multiple cores
+multicore_svcs="recommendationservice checkoutservice frontend"
+ncores=${NCORES:-1}
+# Replicas of services as SERVICE_ID=N, e.g. REPLICAS="3=2 5=4" for 2 currency
+# and 4 product catalog replicas, balanced by the async services
+replicas=${REPLICAS:-}
+# Keep in sync with MAX_REPLICAS and REPLICA_SIDECAR() in balance.h and
+# service.h
+max_replicas=4
+
+cpu=1
+replica_args=""
+
+# Replicas beyond the first one come first, their callers connect to them
+# on startup
+for spec in $replicas; do
+	svc_id=${spec%=*}
+	n=${spec#*=}
+	name=${svc_names[$svc_id]}
+	for ((r=1; r < n; r++)); do
+		sidecar=$(($num_svcs + $svc_id * ($max_replicas - 1) + $r))
+		log=$name.$r.log
+		taskset -c $cpu ./$name/run.sh $sidecar > $log 2>&1 &
+		echo "Started replica $r of $name on cpu $cpu, logging to $log"
+		cpu=$(($cpu + 1))
+		sleep 0.5
+	done
+	replica_args="$replica_args --replicas $spec"
+done
 
 for ((svc_id=0; svc_id < num_svcs; svc_id++)); do
 	name=${svc_names[$svc_id]}
-	cpu=$(($svc_id + 1))
 	log=$name.log
-	taskset -c $cpu ./$name/run.sh $cpu > $log 2>&1 &
-	echo "Started $name, logging to $log"
+	if [[ " $multicore_svcs " == *" $name "* ]]; then
+		cpus=$cpu-$(($cpu + $ncores - 1))
+		NCORES=$ncores taskset -c $cpus ./$name/run.sh $(($svc_id + 1)) \
+			--cores $ncores $replica_args > $log 2>&1 &
+		cpu=$(($cpu + $ncores))
+	else
+		cpus=$cpu
+		NCORES=1 taskset -c $cpus ./$name/run.sh $(($svc_id + 1)) \
+			> $log 2>&1 &
+		cpu=$(($cpu + 1))
+	fi
+	echo "Started $name on cpus $cpus, logging to $log"
 	sleep 0.5
-done
\ No newline at end of file
+done
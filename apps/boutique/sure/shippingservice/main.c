@@ -135,28 +135,17 @@ static void ShipOrder(ShipOrderRR *rr) {
 	return;
 }
 
-static void handle_request(struct unimsg_shm_desc *desc)
-{
-	struct rpc *rpc = desc->addr;
-
-	switch (rpc->command) {
-	case SHIPPING_GET_QUOTE:
-		GetQuote((GetQuoteRR *)rpc->rr);
-		break;
-	case SHIPPING_SHIP_ORDER:
-		ShipOrder((ShipOrderRR *)rpc->rr);
-		break;
-	default:
-		fprintf(stderr, "Received unknown command\n");
-	}
-}
+static const struct shipping_handlers handlers = {
+	.GetQuote = GetQuote,
+	.ShipOrder = ShipOrder,
+};
 
 int main(int argc, char **argv)
 {
-	(void)argc;
-	(void)argv;
+	parse_service_args(argc, argv);
 
-	run_service(SHIPPING_SERVICE, handle_request);
+	register_shipping_service(&handlers);
+	run_service(SHIPPING_SERVICE);
 
 	return 0;
 }
@@ -0,0 +1,185 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* Dump the stats kept by the framework of the services: latency of the RPCs
+ * served and issued by every command, request queue and coroutines. The
+ * frontend is not reachable over RPC and is skipped.
+ */
+
+#include "../common/service/service.h"
+
+static const char *opt_service;
+
+static struct option long_options[] = {
+	{"service", required_argument, 0, 's'},
+	{0, 0, 0, 0}
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"  Usage: %s [OPTIONS]\n"
+		"  Options:\n"
+		"  -s, --service	Name of the service to query (default all)\n",
+		prog);
+
+	exit(1);
+}
+
+static void parse_command_line(int argc, char **argv)
+{
+	int option_index, c;
+
+	for (;;) {
+		c = getopt_long(argc, argv, "s:", long_options,
+				&option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 's':
+			opt_service = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+}
+
+static const char *command_name(int32_t command)
+{
+	if (command < 0 || command >= NUM_COMMANDS)
+		return "unknown";
+
+	return rpc_command_names[command];
+}
+
+static void print_latencies(const char *what, LatencySummary *s, int32_t n)
+{
+	if (n <= 0)
+		return;
+
+	printf("  %-8s %-36s %10s %10s %10s %10s %10s %10s\n", what,
+	       "command", "count", "mean ns", "p50 ns", "p99 ns", "p999 ns",
+	       "max ns");
+	for (int32_t i = 0; i < MIN(n, STATS_MAX_COMMANDS); i++) {
+		printf("  %-8s %-36s %10ld %10ld %10ld %10ld %10ld %10ld\n", "",
+		       command_name(s[i].Command), (long)s[i].Count,
+		       (long)s[i].MeanNs, (long)s[i].P50Ns, (long)s[i].P99Ns,
+		       (long)s[i].P999Ns, (long)s[i].MaxNs);
+	}
+}
+
+static void dump_stats(struct service_desc *service)
+{
+	struct unimsg_sock *s;
+	struct unimsg_shm_desc desc;
+	struct rpc_msg pending = { 0 };
+
+	int rc = unimsg_socket(&s);
+	if (rc) {
+		fprintf(stderr, "Error creating unimsg socket: %s\n",
+			strerror(-rc));
+		exit(1);
+	}
+
+	rc = unimsg_connect(s, service->addr, service->port);
+	if (rc) {
+		fprintf(stderr, "Error connecting to %s service: %s\n",
+			service->name, strerror(-rc));
+		exit(1);
+	}
+
+	rc = unimsg_buffer_get(&desc, 1);
+	if (rc) {
+		fprintf(stderr, "Error getting shm buffer: %s\n",
+			strerror(-rc));
+		exit(1);
+	}
+
+	struct rpc *rpc = desc.addr;
+	rpc->id = 0;
+	rpc->trace = (struct rpc_trace){ 0 };
+	rpc->deadline = 0;
+	rpc_stats_get_stats(&desc);
+
+	rc = unimsg_send(s, &desc, 1, 0);
+	if (rc) {
+		fprintf(stderr, "Error sending desc: %s\n", strerror(-rc));
+		_ERR_CLOSE(s);
+	}
+
+	/* The response might come in more than one desc */
+	struct unimsg_shm_desc descs[UNIMSG_MAX_DESCS_BULK];
+	unsigned ndescs = 0;
+	unsigned current = 0;
+	int done;
+	do {
+		if (current == ndescs) {
+			ndescs = UNIMSG_MAX_DESCS_BULK;
+			rc = unimsg_recv(s, descs, &ndescs, 0);
+			if (rc) {
+				fprintf(stderr, "Error receiving descs: %s\n",
+					strerror(-rc));
+				_ERR_CLOSE(s);
+			}
+			current = 0;
+		}
+
+		done = process_desc(&pending, &descs[current]);
+
+		if (descs[current].size == 0)
+			current++;
+	} while (!done);
+
+	rpc_msg_take(&pending, &desc);
+	rpc = desc.addr;
+	GetStatsResponse *res = (GetStatsResponse *)rpc->rr;
+
+	printf("%s service: %d cores, %ld connections, queue %ld (max %ld), "
+	       "coroutines %ld, busy %ld (max %ld)\n", service->name,
+	       res->Cores, (long)res->Connections, (long)res->QueueDepth,
+	       (long)res->QueueDepthMax, (long)res->Coroutines,
+	       (long)res->CoroutinesBusy, (long)res->CoroutinesBusyMax);
+	print_latencies("served", res->Served, res->num_served);
+	print_latencies("issued", res->Issued, res->num_issued);
+	printf("  timeouts %ld, late responses %ld, expired requests %ld\n",
+	       (long)res->Timeouts, (long)res->LateResponses,
+	       (long)res->Expired);
+	printf("  rpcs waiting for credits %ld, shed requests %ld\n",
+	       (long)res->CreditWaits, (long)res->Shed);
+	printf("  hedged rpcs %ld, won by the hedge %ld\n", (long)res->Hedges,
+	       (long)res->HedgeWins);
+	for (int i = 0; i < res->num_per_core; i++)
+		printf("  core %d: %ld connections, %ld stolen\n", i,
+		       (long)res->PerCore[i].Connections,
+		       (long)res->PerCore[i].Stolen);
+
+	unimsg_buffer_put(&desc, 1);
+	unimsg_close(s);
+}
+
+int main(int argc, char **argv)
+{
+	int found = 0;
+
+	parse_command_line(argc, argv);
+
+	for (unsigned i = 0; i < NUM_SERVICES; i++) {
+		if (services[i].id == FRONTEND)
+			continue;
+		if (opt_service && strcmp(opt_service, services[i].name))
+			continue;
+
+		dump_stats(&services[i]);
+		found = 1;
+	}
+
+	if (!found) {
+		fprintf(stderr, "Unknown service %s\n", opt_service);
+		usage(argv[0]);
+	}
+
+	return 0;
+}
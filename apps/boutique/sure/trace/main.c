@@ -0,0 +1,307 @@
+/*
+ * Some sort of Copyright
+ */
+
+/* Collect the spans of the requests traced by the services and print them as
+ * call trees, one per trace. The frontend is not reachable over RPC, its spans
+ * are shown as the roots of the spans of the services it called.
+ */
+
+#include "../common/service/service.h"
+
+static const char *opt_service;
+static unsigned opt_min_us;
+
+static Span *spans;
+static unsigned nspans;
+static unsigned spans_size;
+
+static struct option long_options[] = {
+	{"service", required_argument, 0, 's'},
+	{"min-us", required_argument, 0, 'm'},
+	{0, 0, 0, 0}
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"  Usage: %s [OPTIONS]\n"
+		"  Options:\n"
+		"  -s, --service	Name of the only service to collect spans from (default all)\n"
+		"  -m, --min-us	Only print traces lasting at least this many us (default 0)\n",
+		prog);
+
+	exit(1);
+}
+
+static void parse_command_line(int argc, char **argv)
+{
+	int option_index, c;
+
+	for (;;) {
+		c = getopt_long(argc, argv, "s:m:", long_options,
+				&option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 's':
+			opt_service = optarg;
+			break;
+		case 'm':
+			opt_min_us = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+}
+
+static const char *command_name(int32_t command)
+{
+	if (command < 0 || command >= NUM_COMMANDS)
+		return "unknown";
+
+	return rpc_command_names[command];
+}
+
+static const char *service_name(int service)
+{
+	if (service < 0 || service >= NUM_SERVICES)
+		return "unknown";
+
+	return services[service].name;
+}
+
+/* Send the request in @desc and replace it with the response */
+static void query(struct unimsg_sock *s, struct unimsg_shm_desc *desc)
+{
+	struct rpc_msg pending = { 0 };
+
+	int rc = unimsg_send(s, desc, 1, 0);
+	if (rc) {
+		fprintf(stderr, "Error sending desc: %s\n", strerror(-rc));
+		_ERR_CLOSE(s);
+	}
+
+	/* The response might come in more than one desc */
+	struct unimsg_shm_desc descs[UNIMSG_MAX_DESCS_BULK];
+	unsigned ndescs = 0;
+	unsigned current = 0;
+	int done;
+	do {
+		if (current == ndescs) {
+			ndescs = UNIMSG_MAX_DESCS_BULK;
+			rc = unimsg_recv(s, descs, &ndescs, 0);
+			if (rc) {
+				fprintf(stderr, "Error receiving descs: %s\n",
+					strerror(-rc));
+				_ERR_CLOSE(s);
+			}
+			current = 0;
+		}
+
+		done = process_desc(&pending, &descs[current]);
+
+		if (descs[current].size == 0)
+			current++;
+	} while (!done);
+
+	rpc_msg_take(&pending, desc);
+}
+
+static void add_spans(Span *s, unsigned n)
+{
+	if (nspans + n > spans_size) {
+		spans_size = MAX(2 * spans_size, nspans + n);
+		spans = realloc(spans, spans_size * sizeof(*spans));
+		if (!spans) {
+			fprintf(stderr, "Error allocating spans\n");
+			exit(1);
+		}
+	}
+
+	memcpy(&spans[nspans], s, n * sizeof(*s));
+	nspans += n;
+}
+
+/* Drain the span rings of all the cores of @service */
+static void collect_spans(struct service_desc *service)
+{
+	struct unimsg_sock *s;
+	uint64_t lost = 0;
+	unsigned collected = 0;
+	int ncores = 1;
+
+	int rc = unimsg_socket(&s);
+	if (rc) {
+		fprintf(stderr, "Error creating unimsg socket: %s\n",
+			strerror(-rc));
+		exit(1);
+	}
+
+	rc = unimsg_connect(s, service->addr, service->port);
+	if (rc) {
+		fprintf(stderr, "Error connecting to %s service: %s\n",
+			service->name, strerror(-rc));
+		exit(1);
+	}
+
+	for (int core = 0; core < ncores; core++) {
+		uint64_t cursor = 0;
+
+		for (;;) {
+			struct unimsg_shm_desc desc;
+			rc = unimsg_buffer_get(&desc, 1);
+			if (rc) {
+				fprintf(stderr, "Error getting shm buffer: "
+					"%s\n", strerror(-rc));
+				exit(1);
+			}
+
+			struct rpc *rpc = desc.addr;
+			rpc->id = 0;
+			rpc->trace = (struct rpc_trace){ 0 };
+			rpc->deadline = 0;
+			GetSpansRR *rr = rpc_trace_get_spans(&desc);
+			rr->req.Core = core;
+			rr->req.Cursor = cursor;
+
+			query(s, &desc);
+
+			rpc = desc.addr;
+			rr = (GetSpansRR *)rpc->rr;
+			int32_t n = MIN(rr->res.num_spans, TRACE_MAX_SPANS);
+			ncores = rr->res.Cores;
+			cursor = rr->res.Cursor;
+			lost += rr->res.Lost;
+			if (n > 0)
+				add_spans(rr->res.Spans, n);
+			unimsg_buffer_put(&desc, 1);
+
+			if (n <= 0)
+				break;
+			collected += n;
+		}
+	}
+
+	printf("%s service: %d cores, %u spans, %lu lost\n", service->name,
+	       ncores, collected, (unsigned long)lost);
+
+	unimsg_close(s);
+}
+
+static int cmp_spans(const void *a, const void *b)
+{
+	const Span *x = a, *y = b;
+
+	if (x->TraceId != y->TraceId)
+		return (uint64_t)x->TraceId < (uint64_t)y->TraceId ? -1 : 1;
+
+	return x->StartNs < y->StartNs ? -1 : x->StartNs > y->StartNs;
+}
+
+static void print_span(Span *trace, unsigned n, unsigned i, int64_t start,
+		       unsigned depth)
+{
+	Span *s = &trace[i];
+
+	printf("  %*s%-*s %-36s %10.1f us  +%.1f us\n", 2 * depth, "",
+	       16 - 2 * (int)MIN(depth, 8), service_name(s->Service),
+	       command_name(s->Command), (s->EndNs - s->StartNs) / 1000.0,
+	       (s->StartNs - start) / 1000.0);
+
+	for (unsigned j = 0; j < n; j++) {
+		if (j != i && trace[j].ParentSpanId == s->SpanId)
+			print_span(trace, n, j, start, depth + 1);
+	}
+}
+
+static int has_parent(Span *trace, unsigned n, unsigned i)
+{
+	for (unsigned j = 0; j < n; j++) {
+		if (j != i && trace[j].SpanId == trace[i].ParentSpanId)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Print the @n spans of a trace, sorted by start time */
+static void print_trace(Span *trace, unsigned n)
+{
+	int64_t start = trace[0].StartNs;
+	int64_t end = trace[0].EndNs;
+
+	for (unsigned i = 1; i < n; i++)
+		end = MAX(end, trace[i].EndNs);
+	if ((uint64_t)(end - start) < opt_min_us * 1000ULL)
+		return;
+
+	printf("trace %016lx: %u spans, %.1f us\n",
+	       (unsigned long)trace[0].TraceId, n, (end - start) / 1000.0);
+
+	/* Spans whose caller is missing are roots. Callers in the frontend
+	 * are shown once, before the first of their callees.
+	 */
+	for (unsigned i = 0; i < n; i++) {
+		if (trace[i].ParentSpanId && has_parent(trace, n, i))
+			continue;
+
+		uint32_t parent = trace[i].ParentSpanId;
+		if (parent && TRACE_SPAN_SERVICE(parent) == FRONTEND) {
+			int first = 1;
+			for (unsigned j = 0; j < i; j++) {
+				if (trace[j].ParentSpanId == parent)
+					first = 0;
+			}
+			if (!first)
+				continue;
+
+			printf("  %-16s span %08x\n", services[FRONTEND].name,
+			       parent);
+			for (unsigned j = i; j < n; j++) {
+				if (trace[j].ParentSpanId == parent)
+					print_span(trace, n, j, start, 1);
+			}
+		} else {
+			print_span(trace, n, i, start, 0);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int found = 0;
+
+	parse_command_line(argc, argv);
+
+	for (unsigned i = 0; i < NUM_SERVICES; i++) {
+		if (services[i].id == FRONTEND)
+			continue;
+		if (opt_service && strcmp(opt_service, services[i].name))
+			continue;
+
+		collect_spans(&services[i]);
+		found = 1;
+	}
+
+	if (!found) {
+		fprintf(stderr, "Unknown service %s\n", opt_service);
+		usage(argv[0]);
+	}
+
+	qsort(spans, nspans, sizeof(*spans), cmp_spans);
+
+	for (unsigned i = 0, n; i < nspans; i += n) {
+		for (n = 1; i + n < nspans; n++) {
+			if (spans[i + n].TraceId != spans[i].TraceId)
+				break;
+		}
+		print_trace(&spans[i], n);
+	}
+
+	free(spans);
+
+	return 0;
+}
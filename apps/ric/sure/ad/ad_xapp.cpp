@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <getopt.h>
 #include <iostream>
 #include <string.h>
@@ -5,6 +6,7 @@
 #include <unimsg/net.h>
 #include <unistd.h>
 #include <uk/plat/time.h>
+#include <vector>
 
 #define UNIMSG_BUFFER_AVAILABLE (UNIMSG_BUFFER_SIZE - UNIMSG_BUFFER_HEADROOM)
 #define TS_ADDR 0x0100000a /* 10.0.0.1 */
@@ -97,6 +99,7 @@ int main(int argc, char *argv[])
 	int rc;
 	unsigned long start;
 	unsigned long total = 0, latency;
+	vector<unsigned long> latencies;
 
 	parse_command_line(argc, argv);
 
@@ -182,8 +185,10 @@ int main(int argc, char *argv[])
 		cout << "[AD] Control loop " << i << " took " << latency
 		     << " ns\n";
 
-		if (i > 0)
+		if (i > 0) {
 			total += latency;
+			latencies.push_back(latency);
+		}
 	}
 
 	unimsg_close(sock);
@@ -191,5 +196,17 @@ int main(int argc, char *argv[])
 	cout << "[AD] Average latency (excluding 1st loop) "
 	     << (total / (opt_iterations - 1)) << " ns\n";
 
+	/* The 1st loop pays the setup of the connections along the control
+	 * path, the following ones only do so if connections are not reused
+	 */
+	if (!latencies.empty()) {
+		sort(latencies.begin(), latencies.end());
+		unsigned long n = latencies.size();
+		cout << "[AD] Latency percentiles (excluding 1st loop) p50 "
+		     << latencies[n / 2] << " ns, p99 "
+		     << latencies[min(n - 1, n * 99 / 100)] << " ns, max "
+		     << latencies[n - 1] << " ns\n";
+	}
+
 	return 0;
 }
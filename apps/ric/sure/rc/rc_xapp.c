@@ -18,8 +18,7 @@ static char resp_template[] = "HTTP/1.1 200 OK\r\n"
 			      "Server: Custom/1.0.0 Custom/1.0.0\r\n"
 			      "Date: %s\r\n" /* current datetime */
 			      "Content-Length: %lu\r\n" /* body length */
-			      /* TODO:  what to put here? */
-			      "Connection: close\r\n"
+			      "Connection: %s\r\n" /* keep-alive or close */
 			      "\r\n"
 			      "%s"; /* body */
 
@@ -59,10 +58,18 @@ static void parse_command_line(int argc, char **argv)
 	}
 }
 
+/* HTTP/1.1 connections are persistent unless the client asks otherwise */
+static int wants_close(char *req, char *body)
+{
+	char *hdr = strstr(req, "\r\nConnection: close\r\n");
+
+	return hdr && hdr < body;
+}
+
 int main(int argc, char *argv[])
 {
 	int rc;
-	struct unimsg_sock *lsock, *sock;
+	struct unimsg_sock *lsock, *sock = NULL;
 
 	parse_command_line(argc, argv);
 
@@ -87,18 +94,29 @@ int main(int argc, char *argv[])
 
 	printf("[RC] Waiting for TS connections\n");
 
+	/* Serve one request per iteration, a connection is kept open across
+	 * iterations until the client closes it or asks to close it
+	 */
 	for (unsigned i = 0; i < opt_iterations; i++) {
-		rc = unimsg_accept(lsock, &sock, 0);
-		if (rc) {
-			fprintf(stderr, "Error accepting connection: %s\n",
-				strerror(-rc));
-			exit(1);
+		if (!sock) {
+			rc = unimsg_accept(lsock, &sock, 0);
+			if (rc) {
+				fprintf(stderr, "Error accepting connection: "
+					"%s\n", strerror(-rc));
+				exit(1);
+			}
 		}
 
 		struct unimsg_shm_desc desc;
 		unsigned ndescs = 1;
 		rc = unimsg_recv(sock, &desc, &ndescs, 0);
-		if (rc) {
+		if (rc == -ECONNRESET) {
+			/* Closed by the client between two requests */
+			unimsg_close(sock);
+			sock = NULL;
+			i--;
+			continue;
+		} else if (rc) {
 			fprintf(stderr, "Error receiving desc: %s\n",
 				strerror(-rc));
 			exit(1);
@@ -139,9 +157,10 @@ int main(int argc, char *argv[])
 			exit(1);
 		}
 
+		int keep_alive = !wants_close(desc.addr, body);
 		sprintf((char *)resp.addr, resp_template, timestr, strlen(body),
-			body);
-		resp.size = strlen((char *)desc.addr);
+			keep_alive ? "keep-alive" : "close", body);
+		resp.size = strlen((char *)resp.addr);
 
 		unimsg_buffer_put(&desc , 1);
 
@@ -152,9 +171,14 @@ int main(int argc, char *argv[])
 			exit(1);
 		}
 
-		unimsg_close(sock);
+		if (!keep_alive) {
+			unimsg_close(sock);
+			sock = NULL;
+		}
 	}
 
+	if (sock)
+		unimsg_close(sock);
 	unimsg_close(lsock);
 
 	return 0;
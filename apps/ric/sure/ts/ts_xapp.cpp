@@ -22,8 +22,10 @@
 #define QP_PORT 4580
 #define RC_ADDR 0x0300000a /* 10.0.0.3 */
 #define RC_PORT 5000
+#define REST_POOL_SIZE 4
 
 static unsigned opt_iterations = 0;
+static int opt_keep_alive = 1;
 static int downlink_threshold = 0;  // A1 policy type 20008 (in percentage)
 static struct unimsg_sock *ad_sock;
 static struct unimsg_sock *qp_sock;
@@ -31,6 +33,7 @@ static unsigned it = 0;
 static unsigned long total_latency = 0;
 static struct option long_options[] = {
 	{"iterations", required_argument, 0, 'i'},
+	{"no-keep-alive", no_argument, 0, 'n'},
 	{0, 0, 0, 0}
 };
 
@@ -131,7 +134,8 @@ static void usage(const char *prog)
 	fprintf(stderr,
 		"  Usage: %s [OPTIONS]\n"
 		"  Options:\n"
-		"  -i, --iterations	Number of control loop iterations\n",
+		"  -i, --iterations	Number of control loop iterations\n"
+		"  -n, --no-keep-alive	Open a new REST connection for every request\n",
 		prog);
 
 	exit(1);
@@ -142,7 +146,7 @@ static void parse_command_line(int argc, char **argv)
 	int option_index, c;
 
 	for (;;) {
-		c = getopt_long(argc, argv, "i:", long_options, &option_index);
+		c = getopt_long(argc, argv, "i:n", long_options, &option_index);
 		if (c == -1)
 			break;
 
@@ -150,6 +154,9 @@ static void parse_command_line(int argc, char **argv)
 		case 'i':
 			opt_iterations = atoi(optarg);
 			break;
+		case 'n':
+			opt_keep_alive = 0;
+			break;
 		default:
 			usage(argv[0]);
 		}
@@ -172,51 +179,123 @@ static char post_template[] = "POST %s HTTP/1.1\r\n" /* url */
 			      "Accept: application/json\r\n"
 			      "Content-Type: application/json\r\n"
 			      "Content-Length: %u\r\n" /* body length */
+			      "Connection: %s\r\n" /* keep-alive or close */
 			      "\r\n"
 			      "%s"; /* body */
 
-static struct rest_resp do_post(__u32 addr, __u16 port, string url, string body)
+/* Idle keep-alive connections to REST servers, reused by do_post() to avoid
+ * paying the connection setup on every request
+ */
+struct rest_conn {
+	__u32 addr;
+	__u16 port;
+	struct unimsg_sock *sock;
+};
+
+static struct rest_conn rest_pool[REST_POOL_SIZE];
+static unsigned rest_pool_len = 0;
+
+/* Returns an idle connection to addr:port from the pool, or a new one */
+static struct unimsg_sock *rest_conn_get(__u32 addr, __u16 port, int *reused)
 {
-	struct unimsg_sock *rc_sock;
-	struct unimsg_shm_desc desc;
+	struct unimsg_sock *sock;
 	int rc;
 
-	rc = unimsg_socket(&rc_sock);
+	for (unsigned i = 0; i < rest_pool_len; i++) {
+		if (rest_pool[i].addr == addr && rest_pool[i].port == port) {
+			sock = rest_pool[i].sock;
+			rest_pool[i] = rest_pool[--rest_pool_len];
+			*reused = 1;
+			return sock;
+		}
+	}
+
+	rc = unimsg_socket(&sock);
 	if (rc) {
 		fprintf(stderr, "Error creating socket: %s\n", strerror(-rc));
 		exit(1);
 	}
 
-	rc = unimsg_connect(rc_sock, addr, port);
+	rc = unimsg_connect(sock, addr, port);
 	if (rc) {
 		fprintf(stderr, "Error connecting to RC: %s\n", strerror(-rc));
 		exit(1);
 	}
 
-	rc = unimsg_buffer_get(&desc, 1);
-	if (rc) {
-		fprintf(stderr, "Error getting buffer: %s\n", strerror(-rc));
-		exit(1);
+	*reused = 0;
+	return sock;
+}
+
+/* Returns a connection to the pool, closing it if it can't be reused */
+static void rest_conn_put(__u32 addr, __u16 port, struct unimsg_sock *sock,
+			  int keep_alive)
+{
+	if (!keep_alive || rest_pool_len == REST_POOL_SIZE) {
+		unimsg_close(sock);
+		return;
 	}
 
-	sprintf((char *)desc.addr, post_template, url.c_str(), addr, port,
-		body.size(), body.c_str());
-	desc.size = strlen((char *)desc.addr);
+	rest_pool[rest_pool_len].addr = addr;
+	rest_pool[rest_pool_len].port = port;
+	rest_pool[rest_pool_len].sock = sock;
+	rest_pool_len++;
+}
 
-	rc = unimsg_send(rc_sock, &desc, 1, 0);
-	if (rc) {
-		fprintf(stderr, "Error sending desc: %s\n", strerror(-rc));
-		exit(1);
-	}
+static void rest_pool_close()
+{
+	for (unsigned i = 0; i < rest_pool_len; i++)
+		unimsg_close(rest_pool[i].sock);
+	rest_pool_len = 0;
+}
 
-	unsigned ndescs = 1;
-	rc = unimsg_recv(rc_sock, &desc, &ndescs, 0);
-	if (rc) {
-		fprintf(stderr, "Error receiving desc: %s\n", strerror(-rc));
-		exit(1);
-	}
+static struct rest_resp do_post(__u32 addr, __u16 port, string url, string body)
+{
+	struct unimsg_sock *rc_sock;
+	struct unimsg_shm_desc desc;
+	int reused;
+	int rc;
+
+	/* A pooled connection might have been closed by the server while idle,
+	 * in that case the send fails, the request never reached it and is
+	 * retried on a new connection. A reset after the send is an error:
+	 * the request might have been applied already.
+	 */
+	for (;;) {
+		rc_sock = rest_conn_get(addr, port, &reused);
+
+		rc = unimsg_buffer_get(&desc, 1);
+		if (rc) {
+			fprintf(stderr, "Error getting buffer: %s\n",
+				strerror(-rc));
+			exit(1);
+		}
 
-	unimsg_close(rc_sock);
+		sprintf((char *)desc.addr, post_template, url.c_str(), addr,
+			port, body.size(),
+			opt_keep_alive ? "keep-alive" : "close", body.c_str());
+		desc.size = strlen((char *)desc.addr);
+
+		rc = unimsg_send(rc_sock, &desc, 1, 0);
+		if (rc == -ECONNRESET && reused) {
+			unimsg_buffer_put(&desc, 1);
+			unimsg_close(rc_sock);
+			continue;
+		} else if (rc) {
+			fprintf(stderr, "Error sending desc: %s\n",
+				strerror(-rc));
+			exit(1);
+		}
+
+		unsigned ndescs = 1;
+		rc = unimsg_recv(rc_sock, &desc, &ndescs, 0);
+		if (rc) {
+			fprintf(stderr, "Error receiving desc: %s\n",
+				strerror(-rc));
+			exit(1);
+		}
+
+		break;
+	}
 
 	struct rest_resp resp;
 	if (sscanf((char *)desc.addr, "HTTP/1.1 %u OK", &resp.status_code)
@@ -233,6 +312,12 @@ static struct rest_resp do_post(__u32 addr, __u16 port, string url, string body)
 			(char *)desc.addr);
 		exit(1);
 	}
+
+	/* The server can refuse to keep the connection open */
+	char *hdr = strstr((char *)desc.addr, "\r\nConnection: close\r\n");
+	rest_conn_put(addr, port, rc_sock,
+		      opt_keep_alive && !(hdr && hdr < resp.body));
+
 	resp.body += 4; /* Skip newlines */
 	resp.desc = desc;
 
@@ -543,6 +628,7 @@ int main(int argc, char *argv[])
 		ad_callback(descs, ndescs);
 	}
 
+	rest_pool_close();
 	unimsg_close(qp_sock);
 	unimsg_close(ad_sock);
 